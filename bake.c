@@ -0,0 +1,50 @@
+///
+// Asset bake tool
+//
+// Packs every png in assets/aseprite-simplified into assets/sprites.pack, which the game loads
+// instead of the pngs if it exists (see sprite_pack.c in oogabooga).
+//
+// Build with bake.bat or bake.sh and run it from the project root:
+//
+//     build\bake.exe
+//
+// Rerun it whenever you add or change a sprite.
+
+#define OOGABOOGA_HEADLESS 1
+
+#define ENTRY_PROC entry
+
+#include "oogabooga/oogabooga.c"
+
+#define BAKE_SPRITE_DIRECTORY "assets/aseprite-simplified"
+#define BAKE_SPRITE_PACK_PATH "assets/sprites.pack"
+
+int entry(int argc, char **argv) {
+	
+	string *file_names;
+	growing_array_init((void**)&file_names, sizeof(string), get_heap_allocator());
+	
+	if (!os_read_directory_file_names(STR(BAKE_SPRITE_DIRECTORY), &file_names, get_heap_allocator())) {
+		log_error("Could not read directory '%cs'. Are you running from the project root?", BAKE_SPRITE_DIRECTORY);
+		return 1;
+	}
+	
+	string *png_paths;
+	growing_array_init((void**)&png_paths, sizeof(string), get_heap_allocator());
+	
+	for (u64 i = 0; i < growing_array_get_valid_count(file_names); i++) {
+		if (!strings_match(get_file_extension(file_names[i]), STR(".png"))) continue;
+		
+		string path = sprint(get_heap_allocator(), "%cs/%s", BAKE_SPRITE_DIRECTORY, file_names[i]);
+		growing_array_add((void**)&png_paths, &path);
+	}
+	
+	float64 start_time = os_get_elapsed_seconds();
+	bool ok = sprite_pack_bake(png_paths, growing_array_get_valid_count(png_paths), STR(BAKE_SPRITE_PACK_PATH));
+	
+	if (!ok) return 1;
+	
+	log_info("Done in %.2f ms", (os_get_elapsed_seconds()-start_time)*1000.0);
+	
+	return 0;
+}
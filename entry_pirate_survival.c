@@ -57,10 +57,11 @@ Vector2 get_mouse_world_pos()
 	return screen_to_world(v2(input_frame.mouse_x, input_frame.mouse_y));
 }
 
-Vector2 get_area_allowed(int size_allowed)
+// Random position for the n-th entity placed in the world, the same every time for the same seed
+Vector2 get_area_allowed(int size_allowed, u64 seed, u64 n)
 {
 	int half_of_size = size_allowed * 0.5;
-	return v2(get_random_float32_in_range(-half_of_size, half_of_size), get_random_float32_in_range(-half_of_size, half_of_size));
+	return v2(get_random_float32_in_range_at(seed, n*2, -half_of_size, half_of_size), get_random_float32_in_range_at(seed, n*2+1, -half_of_size, half_of_size));
 }
 
 // :game things
@@ -117,6 +118,40 @@ typedef enum SpriteID
 	SPRITE_MAX,
 } SpriteID;
 Sprite sprites[SPRITE_MAX];
+
+#define SPRITE_DIRECTORY "assets/aseprite-simplified"
+#define SPRITE_PACK_PATH "assets/sprites.pack"
+
+Image_Load_Request *pending_sprite_loads[SPRITE_MAX];
+
+// Sprites are named by their file name in SPRITE_DIRECTORY, without extension.
+// Sprites that aren't in the pack start decoding in the background, call finish_sprite_loads
+// once everything is requested.
+void load_sprite(Sprite_Pack *pack, SpriteID id, string name)
+{
+	if (pack)
+	{
+		Gfx_Image *image = sprite_pack_get(pack, name);
+		if (image)
+		{
+			sprites[id] = (Sprite){.image = image};
+			return;
+		}
+		log_warning("Sprite '%s' is not in the sprite pack, is it out of date?", name);
+	}
+	pending_sprite_loads[id] = load_image_from_disk_async(tprint("%s/%s.png", STR(SPRITE_DIRECTORY), name), get_heap_allocator());
+}
+void finish_sprite_loads()
+{
+	for (int id = 0; id < SPRITE_MAX; id++)
+	{
+		if (pending_sprite_loads[id])
+		{
+			sprites[id] = (Sprite){.image = wait_image_load(pending_sprite_loads[id])};
+			pending_sprite_loads[id] = 0;
+		}
+	}
+}
 Sprite *get_sprite(SpriteID id)
 {
 	if (id >= 0 && id < SPRITE_MAX)
@@ -222,6 +257,8 @@ typedef struct World
 {
 	Entity entities[MAX_ENTITY_COUNT];
 	ItemData inventory_items[ARCH_MAX];
+	u64 seed;
+	u64 placed_count;
 } World;
 World *world = 0;
 typedef struct WorldFrame
@@ -341,8 +378,11 @@ void setup_item_rock1(Entity *en)
 
 int entry(int argc, char **argv)
 {
-	font = load_font_from_disk(STR("C:/windows/fonts/arial.ttf"), get_heap_allocator());
+	// Text is drawn at tiny scales in world space, which distance fields hold up better under
+	font = load_font_from_disk_sdf(STR("C:/windows/fonts/arial.ttf"), get_heap_allocator());
 	assert(font, "Failed loading arial.ttf, %d", GetLastError());
+	// Rasterize the printable ascii glyphs in the background while the rest loads
+	Font_Prewarm *font_prewarm = font_prewarm_async(font, FONT_HEIGHT, 32, 126);
 
 	window.title = STR("Pirate Game");
 	window.scaled_width = 1280; // We need to set the scaled size if we want to handle system scaling (DPI)
@@ -353,19 +393,30 @@ int entry(int argc, char **argv)
 
 	world = alloc(get_heap_allocator(), sizeof(World));
 	memset(world, 0, sizeof(World));
+	world->seed = get_random();
 
 	// :load image
-	sprites[SPRITE_player] = (Sprite){.image = load_image_from_disk(STR("assets/aseprite-simplified/player.png"), get_heap_allocator())};
-	sprites[SPRITE_tree0] = (Sprite){.image = load_image_from_disk(STR("assets/aseprite-simplified/tree1.png"), get_heap_allocator())};
-	sprites[SPRITE_rock0] = (Sprite){.image = load_image_from_disk(STR("assets/aseprite-simplified/rock0.png"), get_heap_allocator())};
-	sprites[SPRITE_rock1] = (Sprite){.image = load_image_from_disk(STR("assets/aseprite-simplified/rock1.png"), get_heap_allocator())};
-	sprites[SPRITE_item_pine_wood] = (Sprite){.image = load_image_from_disk(STR("assets/aseprite-simplified/item_tree0.png"), get_heap_allocator())};
-	sprites[SPRITE_item_rock0] = (Sprite){.image = load_image_from_disk(STR("assets/aseprite-simplified/item_rock0.png"), get_heap_allocator())};
-	sprites[SPRITE_item_rock1] = (Sprite){.image = load_image_from_disk(STR("assets/aseprite-simplified/item_rock1.png"), get_heap_allocator())};
-	sprites[SPRITE_bush0] = (Sprite){.image = load_image_from_disk(STR("assets/aseprite-simplified/bush0.png"), get_heap_allocator())};
-	sprites[SPRITE_bush1] = (Sprite){.image = load_image_from_disk(STR("assets/aseprite-simplified/bush1.png"), get_heap_allocator())};
-	sprites[SPRITE_bush0_item0] = (Sprite){.image = load_image_from_disk(STR("assets/aseprite-simplified/item_bush0.png"), get_heap_allocator())};
-	sprites[SPRITE_bush1_item0] = (Sprite){.image = load_image_from_disk(STR("assets/aseprite-simplified/item_bush1.png"), get_heap_allocator())};
+	// Use the baked sprite pack if there is one (build & run bake.c), otherwise decode the pngs
+	float64 load_start_time = os_get_elapsed_seconds();
+	Sprite_Pack *sprite_pack = 0;
+	if (os_is_file(STR(SPRITE_PACK_PATH)))
+	{
+		sprite_pack = load_sprite_pack(STR(SPRITE_PACK_PATH), get_heap_allocator());
+	}
+	load_sprite(sprite_pack, SPRITE_player, STR("player"));
+	load_sprite(sprite_pack, SPRITE_tree0, STR("tree1"));
+	load_sprite(sprite_pack, SPRITE_rock0, STR("rock0"));
+	load_sprite(sprite_pack, SPRITE_rock1, STR("rock1"));
+	load_sprite(sprite_pack, SPRITE_item_pine_wood, STR("item_tree0"));
+	load_sprite(sprite_pack, SPRITE_item_rock0, STR("item_rock0"));
+	load_sprite(sprite_pack, SPRITE_item_rock1, STR("item_rock1"));
+	load_sprite(sprite_pack, SPRITE_bush0, STR("bush0"));
+	load_sprite(sprite_pack, SPRITE_bush1, STR("bush1"));
+	load_sprite(sprite_pack, SPRITE_bush0_item0, STR("item_bush0"));
+	load_sprite(sprite_pack, SPRITE_bush1_item0, STR("item_bush1"));
+	finish_sprite_loads();
+	log_info("Loaded sprites in %.2f ms (%s)", (os_get_elapsed_seconds() - load_start_time) * 1000.0, sprite_pack ? STR("sprite pack") : STR("png"));
+	wait_font_prewarm(font_prewarm);
 
 	// Player entity
 	Entity *player_en = entity_create();
@@ -378,7 +429,7 @@ int entry(int argc, char **argv)
 	{
 		Entity *en = entity_create();
 		setup_rock0(en);
-		en->pos = get_area_allowed(the_world_size);
+		en->pos = get_area_allowed(the_world_size, world->seed, world->placed_count++);
 	}
 
 	// rock 1 entities
@@ -386,7 +437,7 @@ int entry(int argc, char **argv)
 	{
 		Entity *en = entity_create();
 		setup_rock1(en);
-		en->pos = get_area_allowed(the_world_size);
+		en->pos = get_area_allowed(the_world_size, world->seed, world->placed_count++);
 	}
 
 	// Tree entities
@@ -394,7 +445,7 @@ int entry(int argc, char **argv)
 	{
 		Entity *en = entity_create();
 		setup_tree(en);
-		en->pos = get_area_allowed(the_world_size);
+		en->pos = get_area_allowed(the_world_size, world->seed, world->placed_count++);
 	}
 
 	// :create bush0 entities
@@ -402,7 +453,7 @@ int entry(int argc, char **argv)
 	{
 		Entity *en = entity_create();
 		setup_bush0(en);
-		en->pos = get_area_allowed(the_world_size);
+		en->pos = get_area_allowed(the_world_size, world->seed, world->placed_count++);
 	}
 
 	// :create bush1 entities
@@ -410,7 +461,7 @@ int entry(int argc, char **argv)
 	{
 		Entity *en = entity_create();
 		setup_bush1(en);
-		en->pos = get_area_allowed(the_world_size);
+		en->pos = get_area_allowed(the_world_size, world->seed, world->placed_count++);
 	}
 
 	// vars to debug frames
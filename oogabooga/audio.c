@@ -3,9 +3,13 @@
 
 		Loading audio:
 		
-	bool audio_open_source_stream(Audio_Source *src, string path, Allocator allocator);
+	bool audio_open_source_stream(Audio_Source *src, string path, Allocator allocator); // Decoded ahead on a background thread, see audio_stream_decode_ahead_ms
 	bool audio_open_source_load(Audio_Source *src, string path, Allocator allocator);
 	void audio_source_destroy(Audio_Source *src);
+	
+	audio_ogg_stream_mode = AUDIO_OGG_STREAM_FILE/AUDIO_OGG_STREAM_MAPPED/AUDIO_OGG_STREAM_MEMORY; // How streamed OGG files are read, read when a stream is opened
+	audio_prepare_max_seconds = ...; // (30 by default) Loaded sources up to this long are prepared for the mixer
+	bool audio_source_prepare(Audio_Source *src, Audio_Format format); // Resample & convert a loaded source once, so the mixer doesn't every buffer
 
 		Playing audio (the simple way):
 		
@@ -14,12 +18,19 @@
 	void play_one_audio_clip_source_config(Audio_Source source, Audio_Playback_Config config);
 	void play_one_audio_clip_config(string path, Audio_Playback_Config config);
 	
+	Clips played by path are decoded once into memory and kept in the sound bank:
+	
+	audio_sound_bank_budget_bytes = ...; // Clips that aren't playing are evicted (least recently played first) past this
+	void audio_sound_bank_trim(u64 budget_bytes); // Evict clips that aren't playing until the bank fits in budget_bytes
+	
 		Playing audio (with players):
 	
 	Audio_Player * audio_player_get_one();
 	void           audio_player_release(Audio_Player *p);
 
-		BEWARE! Most of these operations are potentially slow because they may need to synchronize with audio thread.
+		These are sent to the audio thread as commands and never wait for it, which also means the getters
+		report where the audio thread is and may be a buffer behind what you just set.
+		audio_source_destroy() waits until nothing plays the source anymore.
 		
 	void    audio_player_set_state(Audio_Player *p, Audio_Player_State state);
 	void    audio_player_set_time_stamp(Audio_Player *p, float64 time_in_seconds);
@@ -37,6 +48,38 @@
 	player->config.position_ndc          = v3(...);
 	player->config.volume                = ...; // (1.0 by default)
 	player->config.playback_speed        = ...; // (1.0 by default)
+	player->config.resample_quality      = AUDIO_RESAMPLE_LINEAR/AUDIO_RESAMPLE_SINC; // (linear by default)
+	player->config.priority              = ...; // (0 by default)
+	player->config.bus                   = AUDIO_BUS_SFX/AUDIO_BUS_MUSIC/AUDIO_BUS_AMBIENCE/...; // (SFX by default)
+	
+	audio_max_voices = ...; // (256 by default, 0 for no limit) Past this, the voices with the lowest priority,
+	                        // then volume, then the oldest are skipped. They keep their place in time and
+	                        // come back when there's room.
+	
+		Buses:
+		
+	Players mix into buses, which mix into other buses and in the end the master bus. Effects run
+	once per bus, not per voice. The master bus has a limiter on by default.
+	
+	Audio_Bus *  audio_bus_get(Audio_Bus_Id id);
+	Audio_Bus_Id audio_bus_create(Audio_Bus_Id output); // AUDIO_BUS_INVALID if there are AUDIO_MAX_BUSES already
+	bool         audio_bus_set_output(Audio_Bus_Id id, Audio_Bus_Id output); // False if it would make a loop
+	void         audio_bus_destroy(Audio_Bus_Id id);
+	
+	bus->config.volume             = ...; // (1.0 by default)
+	bus->config.lowpass_cutoff_hz  = ...; // (0 by default, off)
+	bus->config.lowpass_q          = ...; // (0.707 by default)
+	bus->config.reverb_mix         = ...; // (0 by default, off) 1 is only reverb
+	bus->config.reverb_decay       = ...; // (0.5 by default) 0 - 1
+	bus->config.reverb_damping     = ...; // (0.5 by default) 0 - 1
+	bus->config.enable_limiter     = true/false;
+	bus->config.limiter_threshold  = ...; // (0.98 by default)
+	bus->config.limiter_release_ms = ...; // (100 by default)
+	
+		Mixing without an audio device (benchmarks, tests, headless):
+		
+	bool audio_null_device_run(Audio_Null_Device_Config config, Audio_Null_Device_Stats *stats);
+	void audio_null_device_log_stats(Audio_Null_Device_Stats stats);
 	
 */
 
@@ -87,6 +130,35 @@ typedef enum Audio_Decoder_Kind {
 	AUDIO_DECODER_OGG
 } Audio_Decoder_Kind;
 
+// How a streamed OGG source gets at the compressed data
+typedef enum Audio_Ogg_Stream_Mode {
+	// Pages are read from the file on demand through a STB_VORBIS_FILE_BUFFER_SIZE buffer per
+	// decoder, so memory doesn't grow with the length of the file
+	AUDIO_OGG_STREAM_FILE,
+	// The file is memory mapped and the OS pages it in and out. Costs address space but no heap,
+	// and all decoders of the source share it.
+	AUDIO_OGG_STREAM_MAPPED,
+	// The whole file is read into memory up front
+	AUDIO_OGG_STREAM_MEMORY,
+} Audio_Ogg_Stream_Mode;
+
+// #Global
+ogb_instance Audio_Ogg_Stream_Mode audio_ogg_stream_mode;
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+// Read when a stream is opened
+Audio_Ogg_Stream_Mode audio_ogg_stream_mode = AUDIO_OGG_STREAM_FILE;
+#endif
+
+// #Global
+ogb_instance float64 audio_prepare_max_seconds;
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+// Sources loaded with audio_open_source_load() up to this long are prepared for the mixer, see
+// audio_source_prepare(). 0 to load everything straight into the output format.
+float64 audio_prepare_max_seconds = 30.0;
+#endif
+
 typedef enum Audio_Source_Kind {
 	AUDIO_SOURCE_FILE_STREAM,
 	AUDIO_SOURCE_MEMORY, // Raw pcm frames
@@ -122,6 +194,8 @@ typedef struct Wav_Stream {
 	Wav_Subformat_Guid sub_format;
 } Wav_Stream;
 
+typedef struct Audio_Stream Audio_Stream;
+
 typedef struct Audio_Source {
 
 	Audio_Source_Kind kind;
@@ -137,19 +211,20 @@ typedef struct Audio_Source {
 		stb_vorbis *ogg;
 	};
 	
-	// #Memory #Incomplete #StbVorbisFileStream
-	// I tried replacing the stdio stuff in stb_vorbis with oogabooga file api, but now
-	// stb_vorbis is shitting itself.
-	// So, for now, we're just reading the file into memory and then streaming from that
-	// memory.
-	// Luckily, ogg compression is pretty good so it's not going to completely butcher
-	// memory usage, but it's definitely suboptimal.
+	// See Audio_Ogg_Stream_Mode. ogg_raw is the whole compressed file when it's mapped or in
+	// memory, and empty when it's read from the file.
+	Audio_Ogg_Stream_Mode ogg_mode;
 	string ogg_raw;
+	File_Mapping ogg_mapping;
+	u64 ogg_next_frame; // Where the ogg decoder is, so reading on from there doesn't seek
+	
+	// Decoded ahead on the stream thread, so the mixer doesn't decode
+	Audio_Stream *stream;
 	
 	// For memory source
 	void *pcm_frames;
-	
-	Mutex mutex_for_destroy; // This should ONLY be used so a source isnt sampled on audio thread while it's being destroyed
+	// pcm_frames is f32, one channel after another, see audio_source_prepare()
+	bool planar;
 	
 } Audio_Source;
 
@@ -541,11 +616,410 @@ wav_load_file(string path, void **frames, Audio_Format format, u64 *number_of_fr
 	return true;
 }
 
+// Opens a vorbis decoder on the source's compressed data. For AUDIO_OGG_STREAM_FILE every
+// decoder opens the file on its own, otherwise they share ogg_raw.
+stb_vorbis *
+audio_source_open_ogg_decoder(Audio_Source *src, string path) {
+	stb_vorbis *ogg = 0;
+	int err = 0;
+	
+	third_party_allocator = src->allocator;
+	if (src->ogg_mode == AUDIO_OGG_STREAM_FILE) {
+		File file = os_file_open(path, O_READ);
+		if (file != OS_INVALID_FILE) {
+			// The decoder closes the file
+			ogg = stb_vorbis_open_file(file, true, &err, 0);
+		}
+	} else {
+		ogg = stb_vorbis_open_memory(src->ogg_raw.data, src->ogg_raw.count, &err, 0);
+	}
+	third_party_allocator = ZERO(Allocator);
+	
+	if (err != 0 && ogg) {
+		third_party_allocator = src->allocator;
+		stb_vorbis_close(ogg);
+		third_party_allocator = ZERO(Allocator);
+		ogg = 0;
+	}
+	
+	return ogg;
+}
+void
+audio_source_close_ogg(Audio_Source *src) {
+	if (src->ogg) {
+		third_party_allocator = src->allocator;
+		stb_vorbis_close(src->ogg);
+		third_party_allocator = ZERO(Allocator);
+		src->ogg = 0;
+	}
+	
+	switch (src->ogg_mode) {
+		case AUDIO_OGG_STREAM_FILE: break;
+		case AUDIO_OGG_STREAM_MAPPED: {
+			if (src->ogg_raw.data) os_file_unmap(&src->ogg_mapping);
+			break;
+		}
+		case AUDIO_OGG_STREAM_MEMORY: {
+			if (src->ogg_raw.data) dealloc_string(src->allocator, src->ogg_raw);
+			break;
+		}
+	}
+	src->ogg_raw = ZERO(string);
+}
+bool
+audio_source_open_ogg(Audio_Source *src, string path, Audio_Ogg_Stream_Mode mode) {
+	src->ogg_mode = mode;
+	src->ogg_raw = ZERO(string);
+	
+	switch (mode) {
+		case AUDIO_OGG_STREAM_FILE: break;
+		case AUDIO_OGG_STREAM_MAPPED: {
+			if (!os_file_map_s(path, &src->ogg_mapping)) return false;
+			src->ogg_raw = (string){src->ogg_mapping.size, (u8*)src->ogg_mapping.data};
+			break;
+		}
+		case AUDIO_OGG_STREAM_MEMORY: {
+			if (!os_read_entire_file(path, &src->ogg_raw, src->allocator)) return false;
+			break;
+		}
+	}
+	
+	src->ogg = audio_source_open_ogg_decoder(src, path);
+	src->ogg_next_frame = 0;
+	if (!src->ogg) {
+		audio_source_close_ogg(src);
+		return false;
+	}
+	
+	third_party_allocator = src->allocator;
+	src->number_of_frames = stb_vorbis_stream_length_in_samples(src->ogg);
+	third_party_allocator = ZERO(Allocator);
+	
+	// Frames are counted in the source format, like for wav
+	if (src->ogg->sample_rate != src->format.sample_rate) {
+		f64 ratio = (f64)src->format.sample_rate/(f64)src->ogg->sample_rate;
+		src->number_of_frames = (u64)round((f64)src->number_of_frames*ratio);
+	}
+	
+	return true;
+}
+
 
 int
 audio_source_get_frames(Audio_Source *src, u64 first_frame_index, 
 					             u64 number_of_frames, void *output_buffer);
 
+///
+// Decode-ahead for file streams
+//
+// Decoding (stb_vorbis_seek in particular) is too slow and too unpredictable to do on the audio
+// thread. A streamed source has a few cursors, each with its own decoder and a ring of frames
+// already decoded to the source format. One decode thread, shared by all streams, keeps every
+// ring audio_stream_decode_ahead_ms ahead, and the audio thread only copies out of them.
+//
+// Each ring has a single producer (the decode thread) and a single consumer. Mixing normally
+// happens on one thread, but consumer_lock makes it safe if there are more (e.g. the null device
+// running next to the OS audio thread).
+// A cursor follows one reader. When a player asks for a frame no cursor is at (a seek, or a second
+// player on the same source), the least recently used cursor is retargeted and the player gets
+// silence, without advancing, until the decode thread has caught up.
+// Cursors keep decoding from frame 0 after the end, so looping doesn't need a seek.
+
+#define AUDIO_STREAM_MAX_CURSORS 4
+#define AUDIO_STREAM_DECODE_CHUNK_FRAMES 1024
+
+typedef struct Audio_Stream_Cursor {
+
+	// Written by the consumer
+	volatile u64 read_count;
+	volatile u64 seek_frame;
+	volatile u64 seek_generation; // 0 means the cursor was never used
+	u64 next_frame; // Source frame at read_count
+	u64 last_used;
+	
+	// Written by the decode thread
+	volatile u64 write_count;
+	volatile u64 ready_generation; // Ring can be read when this matches seek_generation
+	
+	// Only touched by the decode thread
+	u64 decode_frame; // Source frame at write_count
+	Audio_Source decoder;
+	bool decoder_open;
+	bool decoder_failed;
+	u8 *frames;
+	
+} Audio_Stream_Cursor;
+
+typedef struct Audio_Stream {
+	string path;
+	Audio_Source source; // Copy of the streamed source, to open decoders like it
+	u64 frame_size;
+	u64 capacity; // Frames per ring
+	
+	Spinlock consumer_lock;
+	u64 use_counter;
+	// Frames that were asked for but not decoded in time
+	u64 underrun_frames;
+	
+	Audio_Stream_Cursor cursors[AUDIO_STREAM_MAX_CURSORS];
+} Audio_Stream;
+
+// #Global
+ogb_instance u64 audio_stream_decode_ahead_ms;
+ogb_instance Audio_Stream **audio_streams;
+ogb_instance Mutex audio_streams_mutex;
+ogb_instance bool audio_streams_initted;
+ogb_instance Spinlock audio_streams_init_lock;
+ogb_instance Thread audio_stream_decode_thread;
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+// Read when a stream is opened
+u64 audio_stream_decode_ahead_ms = 250;
+Audio_Stream **audio_streams = 0;
+Mutex audio_streams_mutex;
+bool audio_streams_initted = false;
+Spinlock audio_streams_init_lock = {0};
+Thread audio_stream_decode_thread;
+#endif
+
+bool
+audio_stream_open_decoder(Audio_Stream *stream, Audio_Stream_Cursor *cursor) {
+	Audio_Source *decoder = &cursor->decoder;
+	*decoder = stream->source;
+	decoder->stream = 0;
+	
+	third_party_allocator = decoder->allocator;
+	bool ok = false;
+	switch (decoder->decoder) {
+		case AUDIO_DECODER_WAV: {
+			u64 number_of_frames;
+			ok = wav_open_file(stream->path, &decoder->wav, decoder->format.sample_rate, &number_of_frames);
+			break;
+		}
+		case AUDIO_DECODER_OGG: {
+			// Every cursor has its own vorbis state, and its own file unless it's mapped or in memory
+			decoder->ogg = audio_source_open_ogg_decoder(decoder, stream->path);
+			decoder->ogg_next_frame = 0;
+			ok = decoder->ogg != 0;
+			break;
+		}
+	}
+	third_party_allocator = ZERO(Allocator);
+	
+	return ok;
+}
+void
+audio_stream_close_decoder(Audio_Stream_Cursor *cursor) {
+	third_party_allocator = cursor->decoder.allocator;
+	switch (cursor->decoder.decoder) {
+		case AUDIO_DECODER_WAV: wav_close(&cursor->decoder.wav); break;
+		case AUDIO_DECODER_OGG: stb_vorbis_close(cursor->decoder.ogg); break;
+	}
+	third_party_allocator = ZERO(Allocator);
+	cursor->decoder_open = false;
+}
+
+// Handles seek requests and decodes at most one chunk per cursor. Returns false if there was
+// nothing to do.
+bool
+audio_stream_decode_some(Audio_Stream *stream) {
+	bool did_work = false;
+	
+	u64 number_of_frames = stream->source.number_of_frames;
+	
+	for (u64 i = 0; i < AUDIO_STREAM_MAX_CURSORS; i++) {
+		Audio_Stream_Cursor *cursor = &stream->cursors[i];
+		
+		u64 generation = cursor->seek_generation;
+		if (generation == 0) continue;
+		MEMORY_BARRIER;
+		
+		if (cursor->ready_generation != generation) {
+			if (!cursor->frames) {
+				cursor->frames = alloc(stream->source.allocator, stream->capacity*stream->frame_size);
+			}
+			if (!cursor->decoder_open && !cursor->decoder_failed) {
+				cursor->decoder_open = audio_stream_open_decoder(stream, cursor);
+				if (!cursor->decoder_open) {
+					log_error("Could not open a decoder for audio stream '%s', it will play as silence", stream->path);
+					cursor->decoder_failed = true;
+				}
+			}
+			
+			// The consumer doesn't touch the ring until we're ready
+			cursor->write_count = cursor->read_count;
+			cursor->decode_frame = cursor->seek_frame;
+			MEMORY_BARRIER;
+			cursor->ready_generation = generation;
+			did_work = true;
+		}
+		
+		u64 used = cursor->write_count-cursor->read_count;
+		u64 free = stream->capacity-used;
+		if (free < AUDIO_STREAM_DECODE_CHUNK_FRAMES/4) continue;
+		
+		u64 ring_index = cursor->write_count % stream->capacity;
+		u64 frame_count = min(free, AUDIO_STREAM_DECODE_CHUNK_FRAMES);
+		frame_count = min(frame_count, stream->capacity-ring_index);
+		frame_count = min(frame_count, number_of_frames-cursor->decode_frame);
+		// Empty source, there's never anything to decode and that's not work
+		if (frame_count == 0) continue;
+		
+		u8 *dst = cursor->frames + ring_index*stream->frame_size;
+		int decoded = 0;
+		if (cursor->decoder_open) {
+			decoded = audio_source_get_frames(&cursor->decoder, cursor->decode_frame, frame_count, dst);
+			decoded = max(decoded, 0);
+		}
+		if ((u64)decoded < frame_count) {
+			memset(dst + decoded*stream->frame_size, 0, (frame_count-decoded)*stream->frame_size);
+		}
+		
+		MEMORY_BARRIER;
+		cursor->write_count += frame_count;
+		
+		cursor->decode_frame += frame_count;
+		if (cursor->decode_frame >= number_of_frames) cursor->decode_frame = 0;
+		
+		did_work = true;
+	}
+	
+	return did_work;
+}
+
+void
+audio_stream_decode_thread_proc(Thread *t) {
+	while (true) {
+		mutex_acquire_or_wait(&audio_streams_mutex);
+		bool did_work = false;
+		u64 count = growing_array_get_valid_count(audio_streams);
+		for (u64 i = 0; i < count; i++) {
+			did_work |= audio_stream_decode_some(audio_streams[i]);
+		}
+		mutex_release(&audio_streams_mutex);
+		
+		if (!did_work) os_sleep(1);
+	}
+}
+
+Audio_Stream *
+audio_stream_create(Audio_Source *src, string path) {
+	spinlock_acquire_or_wait(&audio_streams_init_lock);
+	if (!audio_streams_initted) {
+		mutex_init(&audio_streams_mutex);
+		growing_array_init((void**)&audio_streams, sizeof(Audio_Stream*), get_heap_allocator());
+		os_thread_init(&audio_stream_decode_thread, audio_stream_decode_thread_proc);
+		os_thread_start(&audio_stream_decode_thread);
+		audio_streams_initted = true;
+	}
+	spinlock_release(&audio_streams_init_lock);
+
+	Audio_Stream *stream = alloc(src->allocator, sizeof(Audio_Stream));
+	*stream = ZERO(Audio_Stream);
+	stream->path = alloc_string(src->allocator, path.count);
+	memcpy(stream->path.data, path.data, path.count);
+	stream->source = *src;
+	stream->frame_size = get_audio_bit_width_byte_size(src->format.bit_width)*src->format.channels;
+	stream->capacity = max((audio_stream_decode_ahead_ms*(u64)src->format.sample_rate)/1000, AUDIO_STREAM_DECODE_CHUNK_FRAMES*2);
+	
+	// Start decoding the beginning right away, that's what gets played first
+	stream->cursors[0].seek_frame = 0;
+	stream->cursors[0].next_frame = 0;
+	MEMORY_BARRIER;
+	stream->cursors[0].seek_generation = 1;
+	
+	mutex_acquire_or_wait(&audio_streams_mutex);
+	growing_array_add((void**)&audio_streams, &stream);
+	mutex_release(&audio_streams_mutex);
+	
+	return stream;
+}
+void
+audio_stream_destroy(Audio_Stream *stream) {
+	// Once it's out of the list, the decode thread is done with it
+	mutex_acquire_or_wait(&audio_streams_mutex);
+	growing_array_unordered_remove_one_by_value((void**)&audio_streams, &stream);
+	mutex_release(&audio_streams_mutex);
+	
+	Allocator allocator = stream->source.allocator;
+	for (u64 i = 0; i < AUDIO_STREAM_MAX_CURSORS; i++) {
+		Audio_Stream_Cursor *cursor = &stream->cursors[i];
+		if (cursor->decoder_open) audio_stream_close_decoder(cursor);
+		if (cursor->frames) dealloc(allocator, cursor->frames);
+	}
+	dealloc_string(allocator, stream->path);
+	dealloc(allocator, stream);
+}
+
+// Called from the mixer instead of decoding. Works like audio_source_sample_next_frames.
+u64 // New frame index
+audio_stream_read(Audio_Stream *stream, u64 first_frame_index, u64 number_of_frames, 
+                  void *output_buffer, bool looping) {
+	u64 source_frames = stream->source.number_of_frames;
+	u64 frame_size = stream->frame_size;
+	
+	spinlock_acquire_or_wait(&stream->consumer_lock);
+	
+	stream->use_counter += 1;
+	
+	Audio_Stream_Cursor *cursor = 0;
+	for (u64 i = 0; i < AUDIO_STREAM_MAX_CURSORS; i++) {
+		Audio_Stream_Cursor *c = &stream->cursors[i];
+		if (c->seek_generation != 0 && c->next_frame == first_frame_index) {
+			cursor = c;
+			break;
+		}
+	}
+	
+	if (!cursor) {
+		// Nothing is here, retarget an unused cursor or the least recently used one
+		for (u64 i = 0; i < AUDIO_STREAM_MAX_CURSORS; i++) {
+			Audio_Stream_Cursor *c = &stream->cursors[i];
+			if (c->seek_generation == 0) {
+				cursor = c;
+				break;
+			}
+			if (!cursor || c->last_used < cursor->last_used) cursor = c;
+		}
+		cursor->seek_frame = first_frame_index;
+		cursor->next_frame = first_frame_index;
+		MEMORY_BARRIER;
+		cursor->seek_generation += 1;
+	}
+	cursor->last_used = stream->use_counter;
+	
+	u64 wanted = number_of_frames;
+	if (!looping) wanted = min(wanted, source_frames-first_frame_index);
+	
+	u64 copied = 0;
+	if (cursor->ready_generation == cursor->seek_generation) {
+		MEMORY_BARRIER;
+		u64 available = cursor->write_count-cursor->read_count;
+		copied = min(available, wanted);
+		
+		u64 ring_index = cursor->read_count % stream->capacity;
+		u64 first_part = min(copied, stream->capacity-ring_index);
+		memcpy(output_buffer, cursor->frames + ring_index*frame_size, first_part*frame_size);
+		memcpy((u8*)output_buffer + first_part*frame_size, cursor->frames, (copied-first_part)*frame_size);
+		
+		MEMORY_BARRIER;
+		cursor->read_count += copied;
+		cursor->next_frame = (first_frame_index+copied) % source_frames;
+	}
+	
+	stream->underrun_frames += wanted-copied;
+	
+	spinlock_release(&stream->consumer_lock);
+	
+	if (copied < number_of_frames) {
+		memset((u8*)output_buffer + copied*frame_size, 0, (number_of_frames-copied)*frame_size);
+	}
+	
+	u64 new_index = first_frame_index+copied;
+	if (looping) new_index %= source_frames;
+	return new_index;
+}
+
 
 bool
 audio_open_source_stream_format(Audio_Source *src, string path, Audio_Format format, 
@@ -554,8 +1028,6 @@ audio_open_source_stream_format(Audio_Source *src, string path, Audio_Format for
 	src->uid = next_audio_source_uid;
 	next_audio_source_uid += 1;
 	
-	mutex_init(&src->mutex_for_destroy);
-	
 	src->allocator = allocator;
 	src->kind = AUDIO_SOURCE_FILE_STREAM;
 	
@@ -577,24 +1049,15 @@ audio_open_source_stream_format(Audio_Source *src, string path, Audio_Format for
 	} else if (check_ogg_header(header)) {
 		src->decoder = AUDIO_DECODER_OGG;
 		
-		ok = os_read_entire_file(path, &src->ogg_raw, src->allocator);
+		ok = audio_source_open_ogg(src, path, audio_ogg_stream_mode);
 		if (!ok) return false;
-		
-		third_party_allocator = src->allocator;
-		int err = 0;
-		src->ogg = stb_vorbis_open_memory(src->ogg_raw.data, src->ogg_raw.count, &err, 0);
-		third_party_allocator = ZERO(Allocator);
-		
-		if (err != 0 || src->ogg == 0) return false;
-		
-		third_party_allocator = src->allocator;
-		src->number_of_frames = stb_vorbis_stream_length_in_samples(src->ogg);
-		third_party_allocator = ZERO(Allocator);
 	} else {
 		log_error("Error in audio_open_source_stream(): Unrecognized audio format in file '%s'. We currently support WAV and OGG (Vorbis).", path);
 		return false;
 	}
 	
+	src->stream = audio_stream_create(src, path);
+	
 	return true;
 }
 bool
@@ -612,8 +1075,6 @@ audio_open_source_load_format(Audio_Source *src, string path, Audio_Format forma
 	src->uid = next_audio_source_uid;
 	next_audio_source_uid += 1;
 	
-	mutex_init(&src->mutex_for_destroy);
-	
 	src->allocator = allocator;
 	src->kind = AUDIO_SOURCE_MEMORY;
 	src->format = format;
@@ -636,20 +1097,10 @@ audio_open_source_load_format(Audio_Source *src, string path, Audio_Format forma
 	} else if (check_ogg_header(header)) {
 		src->decoder = AUDIO_DECODER_OGG;
 		
-		ok = os_read_entire_file(path, &src->ogg_raw, src->allocator);
+		// Decoded once front to back, so there's no need to hold the compressed file
+		ok = audio_source_open_ogg(src, path, AUDIO_OGG_STREAM_FILE);
 		if (!ok) return false;
 		
-		third_party_allocator = src->allocator;
-		int err = 0;
-		src->ogg = stb_vorbis_open_memory(src->ogg_raw.data, src->ogg_raw.count, &err, 0);
-		third_party_allocator = ZERO(Allocator);
-		
-		if (err != 0 || src->ogg == 0) return false;
-		
-		third_party_allocator = src->allocator;
-		src->number_of_frames = stb_vorbis_stream_length_in_samples(src->ogg);
-		third_party_allocator = ZERO(Allocator);
-		
 		src->pcm_frames = alloc(src->allocator, src->number_of_frames*frame_size);
 		int retrieved = audio_source_get_frames(
 			src, 
@@ -659,9 +1110,7 @@ audio_open_source_load_format(Audio_Source *src, string path, Audio_Format forma
 		);
 		
 		
-		third_party_allocator = src->allocator;
-		stb_vorbis_close(src->ogg);
-		third_party_allocator = ZERO(Allocator);
+		audio_source_close_ogg(src);
 		
 		if (retrieved != src->number_of_frames) {
 			dealloc(src->allocator, src->pcm_frames);
@@ -674,21 +1123,76 @@ audio_open_source_load_format(Audio_Source *src, string path, Audio_Format forma
 	
 	return true;
 }
+// Sample rate and channels as they are in the file, without decoding it
+bool
+audio_probe_file(string path, Audio_Format *format, u64 *number_of_frames) {
+	File file = os_file_open(path, O_READ);
+	if (file == OS_INVALID_FILE) return false;
+	string header = talloc_string(4);
+	memset(header.data, 0, 4);
+	u64 read;
+	bool ok = os_file_read(file, header.data, 4, &read);
+	os_file_close(file);
+	if (!ok || read != 4) return false;
+	
+	if (check_wav_header(header)) {
+		Wav_Stream wav;
+		u64 ignored;
+		if (!wav_open_file(path, &wav, 0, &ignored)) return false;
+		wav_close(&wav);
+		*format = (Audio_Format){ AUDIO_BITS_32, wav.channels, wav.sample_rate };
+		*number_of_frames = wav.number_of_frames;
+		return true;
+	} else if (check_ogg_header(header)) {
+		file = os_file_open(path, O_READ);
+		if (file == OS_INVALID_FILE) return false;
+		int err = 0;
+		third_party_allocator = get_heap_allocator();
+		// The decoder closes the file
+		stb_vorbis *ogg = stb_vorbis_open_file(file, true, &err, 0);
+		if (ogg) {
+			*format = (Audio_Format){ AUDIO_BITS_32, ogg->channels, ogg->sample_rate };
+			*number_of_frames = stb_vorbis_stream_length_in_samples(ogg);
+			stb_vorbis_close(ogg);
+		}
+		third_party_allocator = ZERO(Allocator);
+		return ogg && err == 0;
+	}
+	
+	return false;
+}
+
+bool audio_source_prepare(Audio_Source *src, Audio_Format format);
+
 bool
 audio_open_source_load(Audio_Source *src, string path, Allocator allocator) {
 	mutex_acquire_or_wait(&audio_init_mutex);
 	Audio_Format format = audio_output_format;
 	mutex_release(&audio_init_mutex);
+	
+	// Short clips are decoded as they are in the file and converted once, with the good
+	// resampler, to exactly what the mixer wants.
+	Audio_Format native;
+	u64 native_frames;
+	if (audio_prepare_max_seconds > 0 && audio_probe_file(path, &native, &native_frames)
+	    && (f64)native_frames/(f64)native.sample_rate <= audio_prepare_max_seconds) {
+	    
+		if (!audio_open_source_load_format(src, path, native, allocator)) return false;
+		return audio_source_prepare(src, format);
+	}
+	
 	return audio_open_source_load_format(src, path, format, allocator);
 }
 
-void 
-audio_source_destroy(Audio_Source *src) {
-
-	mutex_acquire_or_wait(&src->mutex_for_destroy);
+void audio_commands_detach_source(u64 source_uid);
 
+// Frees the source without checking if something is playing it
+void
+audio_source_free(Audio_Source *src) {
 	switch (src->kind) {
 		case AUDIO_SOURCE_FILE_STREAM: {
+			if (src->stream) audio_stream_destroy(src->stream);
+			
 			third_party_allocator = src->allocator;
 			switch (src->decoder) {
 				case AUDIO_DECODER_WAV: {
@@ -696,8 +1200,7 @@ audio_source_destroy(Audio_Source *src) {
 					break;
 				}
 				case AUDIO_DECODER_OGG: {
-					stb_vorbis_close(src->ogg);
-					dealloc_string(src->allocator, src->ogg_raw);
+					audio_source_close_ogg(src);
 					break;
 				}
 			}
@@ -709,8 +1212,13 @@ audio_source_destroy(Audio_Source *src) {
 			break;
 		}
 	}
-	
-	mutex_release(&src->mutex_for_destroy);
+}
+void 
+audio_source_destroy(Audio_Source *src) {
+	// Players playing it are stopped, and we wait until the audio thread has applied that so
+	// nothing reads the source while it's freed.
+	audio_commands_detach_source(src->uid);
+	audio_source_free(src);
 }
 
 int
@@ -733,10 +1241,14 @@ audio_source_get_frames(Audio_Source *src, u64 first_frame_index,
 	case AUDIO_DECODER_OGG:  {
 		f64 ratio = (f64)src->ogg->sample_rate/(f64)src->format.sample_rate;
 		
-		third_party_allocator = src->allocator;
-		bool seek_ok = stb_vorbis_seek(src->ogg, round(first_frame_index*ratio));
-		third_party_allocator = ZERO(Allocator);
-		assert(seek_ok);
+		// Seeking is slow even when we're already there, and streams mostly read on from
+		// where they were
+		if (first_frame_index != src->ogg_next_frame) {
+			third_party_allocator = src->allocator;
+			bool seek_ok = stb_vorbis_seek(src->ogg, round(first_frame_index*ratio));
+			third_party_allocator = ZERO(Allocator);
+			assert(seek_ok);
+		}
 		
 		// We need to convert sample rate & channels for vorbis
 		
@@ -808,6 +1320,8 @@ audio_source_get_frames(Audio_Source *src, u64 first_frame_index,
 			);
 		}
 		
+		src->ogg_next_frame = first_frame_index + max(retrieved, 0);
+		
 	} break; // case AUDIO_DECODER_OGG:
 	default: panic("Invalid decoder value");
 	}
@@ -815,6 +1329,28 @@ audio_source_get_frames(Audio_Source *src, u64 first_frame_index,
 	return retrieved;
 }
 
+// Interleaves frames from a planar source, for whoever doesn't mix them straight from the channels
+u64 // New frame index
+audio_source_sample_planar_interleaved(Audio_Source *src, u64 first_frame_index, u64 number_of_frames, 
+                                       float32 *output, bool looping) {
+	int channels = src->format.channels;
+	u64 index = first_frame_index;
+	for (u64 f = 0; f < number_of_frames; f++) {
+		if (index == src->number_of_frames) {
+			if (!looping) {
+				memset(output + f*channels, 0, (number_of_frames-f)*channels*sizeof(float32));
+				break;
+			}
+			index = 0;
+		}
+		for (int c = 0; c < channels; c++) {
+			output[f*channels+c] = ((float32*)src->pcm_frames)[(u64)c*src->number_of_frames + index];
+		}
+		index += 1;
+	}
+	return index;
+}
+
 u64 // New frame index 
 audio_source_sample_next_frames(Audio_Source *src, u64 first_frame_index, u64 number_of_frames, 
 						   void *output_buffer, bool looping) {
@@ -835,6 +1371,11 @@ audio_source_sample_next_frames(Audio_Source *src, u64 first_frame_index, u64 nu
 	switch (src->kind) {
 	case AUDIO_SOURCE_FILE_STREAM: {
 	
+		if (src->stream) {
+			new_index = audio_stream_read(src->stream, first_frame_index, number_of_frames, output_buffer, looping);
+			break;
+		}
+	
 		num_retrieved = audio_source_get_frames(
 			src, 
 			first_frame_index, 
@@ -854,7 +1395,7 @@ audio_source_sample_next_frames(Audio_Source *src, u64 first_frame_index, u64 nu
 					number_of_frames-num_retrieved, 
 					dst_remain
 				);
-				new_index = number_of_frames-num_retrieved;
+				new_index = num_retrieved;
 			} else {
 				memset(dst_remain, 0, frame_size * (number_of_frames - num_retrieved));
 			}	
@@ -863,6 +1404,11 @@ audio_source_sample_next_frames(Audio_Source *src, u64 first_frame_index, u64 nu
 		break; // case AUDIO_SOURCE_FILE_STREAM
 	}
 	case AUDIO_SOURCE_MEMORY: {
+		if (src->planar) {
+			new_index = audio_source_sample_planar_interleaved(src, first_frame_index, number_of_frames, output_buffer, looping);
+			break;
+		}
+		
 		s64 first_number_of_frames = min(number_of_frames, src->number_of_frames-first_frame_index);
 		void *src_pcm_start = (u8*)src->pcm_frames + first_frame_index*frame_size;
 		
@@ -914,6 +1460,7 @@ mix_frames(void *dst, void *src, u64 frame_count, Audio_Format format) {
             switch (format.bit_width) {
                 case AUDIO_BITS_32: {
                 	*((f32*)dst_sample) += *((f32*)src_sample);
+                	break;
             	}
                 case AUDIO_BITS_16: {
                     s16 dst_int = *((s16*)dst_sample);
@@ -1136,7 +1683,54 @@ convert_frames(void *dst, Audio_Format dst_format,
     return output_frame_count;
 }
 
+#define AUDIO_MAX_CHANNELS 16
+
+///
+// Streaming resampler
+//
+// Each player owns one, so the fractional read position and the last input frames carry over
+// from one mixer call to the next. Without that, every buffer boundary and every change of
+// playback_speed restarts interpolation on a whole frame, which clicks.
+//
+// Positions are 32.32 fixed point, in input frames relative to the first history frame.
+// The resampler reads ahead of the output by up to half the kernel, so the player's frame_index
+// runs that many frames (less than a millisecond) ahead of what is heard.
+
+typedef enum Audio_Resample_Quality {
+	AUDIO_RESAMPLE_LINEAR, // Cheap. Some high frequency roll-off and aliasing.
+	AUDIO_RESAMPLE_SINC,   // Polyphase windowed sinc. For music, or anything pitched a lot.
+} Audio_Resample_Quality;
+
+#define AUDIO_RESAMPLER_SINC_TAPS 32
+#define AUDIO_RESAMPLER_SINC_PHASES 128
+// Sinc kernels are made for pitch ratios 2^(band/4) so we can low-pass below the new nyquist
+// when pitching up. Ratios above the last band alias a bit.
+#define AUDIO_RESAMPLER_SINC_BANDS 9
+// Enough for the left half of the kernel, plus the right half already read ahead last time
+#define AUDIO_RESAMPLER_HISTORY AUDIO_RESAMPLER_SINC_TAPS
 
+typedef struct Audio_Resampler {
+	u64 position;
+	int channels;
+	bool active;
+	float32 history[AUDIO_MAX_CHANNELS][AUDIO_RESAMPLER_HISTORY];
+} Audio_Resampler;
+
+void
+audio_resampler_reset(Audio_Resampler *r, int channels) {
+	assert(channels > 0 && channels <= AUDIO_MAX_CHANNELS, "Unsupported channel count %d", channels);
+	memset(r->history, 0, sizeof(r->history));
+	r->channels = channels;
+	r->position = (u64)AUDIO_RESAMPLER_HISTORY << 32;
+	r->active = false;
+}
+
+// For when playback jumps (seeking, new source), so we don't interpolate across the jump
+inline void
+audio_resampler_forget(Audio_Resampler *r) {
+	r->channels = 0;
+	r->active = false;
+}
 
 #define AUDIO_SMOOTH_TRANSITION_TIME_MS 40
 
@@ -1145,29 +1739,63 @@ typedef enum Audio_Player_State {
 	AUDIO_PLAYER_STATE_PLAYING
 } Audio_Player_State;
 
+#define AUDIO_MAX_BUSES 32
+
+typedef enum Audio_Bus_Id {
+	AUDIO_BUS_SFX, // Where players go unless told otherwise
+	AUDIO_BUS_MUSIC,
+	AUDIO_BUS_AMBIENCE,
+	AUDIO_BUS_MASTER, // Every other bus ends up here, and this goes to the device
+	
+	AUDIO_BUS_BUILTIN_COUNT,
+	AUDIO_BUS_INVALID = AUDIO_MAX_BUSES,
+} Audio_Bus_Id;
+
 typedef struct Audio_Playback_Config {
 	Vector3 position_ndc;
 	bool enable_spacialization;
 	float32 volume;
 	float32 playback_speed;
+	Audio_Resample_Quality resample_quality; // Used when playback_speed or sample rates differ
+	s32 priority; // When more than audio_max_voices play, the lowest priority ones are skipped
+	Audio_Bus_Id bus; // Mixed into this bus, the master bus if it doesn't exist anymore
 } Audio_Playback_Config;
 
-typedef struct Audio_Player {
-	// You shouldn't set these directly.
-	// Set playback state with the player_xxxxx procedures
+typedef struct Audio_Sound_Bank_Clip Audio_Sound_Bank_Clip;
+
+// What a player is actually doing. Only the thread mixing touches this (see Audio_Command),
+// except that frame_index may be read to see how far playback has come.
+typedef struct Audio_Voice {
 	Audio_Source source;
 	bool has_source;
-	bool allocated;
-	bool marked_for_release; // We release on audio thread
 	Audio_Player_State state;
-	u64 frame_index;
+	volatile u64 frame_index;
 	bool looping;
 	u64 fade_frames;
 	u64 fade_frames_total;
 	bool release_when_done;
-	// I think we only need to sync when audio thread samples the source, which should be
-	// fairly quick and low contention, hence a spinlock.
-	Spinlock sample_lock; 
+	Audio_Sound_Bank_Clip *sound_bank_clip; // Kept loaded while this plays it, see play_one_audio_clip
+	Audio_Resampler resampler;
+	
+	// In audio_player_pool.active
+	bool active;
+	u64 active_index;
+	u64 start_order; // When it last started playing, newer voices are kept over older ones
+} Audio_Voice;
+
+typedef struct Audio_Player {
+	// You shouldn't set these directly.
+	// Set playback state with the player_xxxxx procedures. These are what was last asked for,
+	// the audio thread gets it as commands and may be a buffer behind.
+	Audio_Source source;
+	bool has_source;
+	bool allocated;
+	Audio_Player_State state;
+	bool looping;
+	struct Audio_Player *next_free; // In audio_player_pool.free_list or .released
+	
+	// Owned by the audio thread
+	Audio_Voice voice;
 	
 	// #Cleanup
 	DEPRECATED(Vector3 position, "Use player->config.position_ndc instead"); // ndc space -1 to 1
@@ -1186,205 +1814,689 @@ typedef struct Audio_Player_Block {
 	struct Audio_Player_Block *next;
 } Audio_Player_Block;
 
-// #Global
+// Players are handed out from a free list, and the mixer only looks at the players in
+// 'active', so neither costs anything for players that are allocated but idle.
+// Released players are freed on the audio thread, which pushes them to 'released' without
+// waiting on anything. audio_player_get_one takes that whole list at once when it runs out, so
+// there's only ever one thread popping and a plain compare and swap is enough.
+typedef struct Audio_Player_Pool {
+	Spinlock lock; // Game threads getting players
+	bool initted;
+	Audio_Player *free_list;
+	Audio_Player *volatile released;
+	Audio_Player_Block *last_block;
+	u64 player_count;
+	
+	// Owned by the audio thread
+	Audio_Player **active; // Growing array of players that may need mixing
+	u64 start_counter;
+	u64 voices_stolen; // Buffers voices were skipped for, because of audio_max_voices
+} Audio_Player_Pool;
+
+// #Global
 ogb_instance Audio_Player_Block audio_player_block;
+ogb_instance Audio_Player_Pool audio_player_pool;
+ogb_instance u64 audio_max_voices;
 
 #if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
 Audio_Player_Block audio_player_block = {0};
+Audio_Player_Pool audio_player_pool = {0};
+u64 audio_max_voices = 256; // 0 for no limit
 #endif
 
-Audio_Player *
-audio_player_get_one() {
+void audio_voice_drop_sound_bank_clip(Audio_Voice *v);
+
+///
+// Commands to the audio thread
+//
+// Player changes are pushed to a single producer single consumer ring, and applied by whoever
+// mixes next, before mixing. Whoever mixes holds audio_mixer_lock.
+// While a device is running (audio_mixer_thread_count > 0) only its thread applies commands, so
+// game threads never take the mixer lock and the device never waits on them. A full queue or a
+// sync waits for the audio thread to catch up. With no device running, the waiting game thread
+// applies the commands itself.
+// Producers are serialized with producer_lock, which the audio thread never touches.
+
+#define AUDIO_COMMAND_QUEUE_SIZE 1024 // Power of two
+
+typedef enum Audio_Command_Kind {
+	AUDIO_COMMAND_SET_SOURCE,
+	AUDIO_COMMAND_CLEAR_SOURCE,
+	AUDIO_COMMAND_SET_STATE,
+	AUDIO_COMMAND_SET_PROGRESSION,
+	AUDIO_COMMAND_SET_LOOPING,
+	AUDIO_COMMAND_RELEASE_WHEN_DONE,
+	AUDIO_COMMAND_RELEASE,
+	AUDIO_COMMAND_DETACH_SOURCE, // Stops every voice playing the source, before it's destroyed
+	AUDIO_COMMAND_BUS_CREATE,
+	AUDIO_COMMAND_BUS_SET_OUTPUT,
+	AUDIO_COMMAND_BUS_DESTROY,
+} Audio_Command_Kind;
+
+typedef struct Audio_Command {
+	Audio_Command_Kind kind;
+	Audio_Player *player;
+	union {
+		struct {
+			Audio_Source source;
+			Audio_Sound_Bank_Clip *sound_bank_clip; // Reference is handed over to the voice
+		} set_source;
+		Audio_Player_State state;
+		float64 progression;
+		bool looping;
+		u64 source_uid;
+		struct {
+			Audio_Bus_Id bus;
+			Audio_Bus_Id output;
+		} bus;
+	};
+} Audio_Command;
+
+typedef struct Audio_Command_Queue {
+	Audio_Command commands[AUDIO_COMMAND_QUEUE_SIZE];
+	volatile u64 write_count;
+	volatile u64 read_count;
+	Spinlock producer_lock;
+} Audio_Command_Queue;
+
+// #Global
+ogb_instance Audio_Command_Queue audio_command_queue;
+ogb_instance Spinlock audio_mixer_lock;
+ogb_instance volatile u64 audio_mixer_thread_count; // Changed with audio_mixer_lock held
+// While > 0 the OS device outputs silence and leaves the players to the null device.
+// Changed with audio_mixer_lock held.
+ogb_instance volatile u64 audio_null_device_count;
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+Audio_Command_Queue audio_command_queue = {0};
+Spinlock audio_mixer_lock = {0};
+volatile u64 audio_mixer_thread_count = 0;
+volatile u64 audio_null_device_count = 0;
+#endif
+
+void audio_bus_apply_command(Audio_Command_Kind kind, Audio_Bus_Id bus, Audio_Bus_Id output);
+
+void
+audio_voice_set_source(Audio_Voice *v, Audio_Source src, Audio_Sound_Bank_Clip *sound_bank_clip) {
+	audio_voice_drop_sound_bank_clip(v);
+	v->source = src;
+	v->has_source = true;
+	v->sound_bank_clip = sound_bank_clip;
+	
+	v->frame_index = 0;
+	audio_resampler_forget(&v->resampler);
+	
+	audio_player_pool.start_counter += 1;
+	v->start_order = audio_player_pool.start_counter;
+}
+void
+audio_voice_clear_source(Audio_Voice *v) {
+	audio_voice_drop_sound_bank_clip(v);
+	v->has_source = false;
+	v->state = AUDIO_PLAYER_STATE_PAUSED;
+	v->source = ZERO(Audio_Source);
+	v->frame_index = 0;
+	v->fade_frames = 0;
+}
+void
+audio_voice_set_state(Audio_Voice *v, Audio_Player_State state) {
+	if (v->state == state) return;
+	
+	v->state = state;
+	if (state == AUDIO_PLAYER_STATE_PLAYING) {
+		audio_player_pool.start_counter += 1;
+		v->start_order = audio_player_pool.start_counter;
+	}
+	if (!v->has_source || v->source.number_of_frames == 0) return;
+	
+	assert(v->frame_index <= v->source.number_of_frames);
+	
+	float64 full_duration 
+		= (float64)v->source.number_of_frames/(float64)v->source.format.sample_rate;
+	float64 progression = (float64)v->frame_index / (float64)v->source.number_of_frames;
+	float64 remaining = (1.0-progression)*full_duration;
+	
+	float64 fade_seconds = min(AUDIO_SMOOTH_TRANSITION_TIME_MS/1000.0, remaining);
+	
+	float64 fade_factor = fade_seconds/full_duration;
+	
+	v->fade_frames = (u64)round(fade_factor*(float64)v->source.number_of_frames);
+	v->fade_frames_total = v->fade_frames;
+}
+void // 0 - 1
+audio_voice_set_progression_factor(Audio_Voice *v, float64 factor) {
+	v->frame_index = (u64)round((float64)v->source.number_of_frames*clamp(factor, 0.0, 1.0));
+	audio_resampler_forget(&v->resampler);
+}
+void
+audio_voice_set_looping(Audio_Voice *v, bool looping) {
+	if (v->has_source && looping && !v->looping && v->frame_index == v->source.number_of_frames) {
+		v->frame_index = 0;
+	}
+	
+	v->looping = looping;
+}
+
+// The mixer looks at active players only. Anything that may make a voice audible activates it,
+// and the mixer deactivates voices it finds have nothing to play.
+void
+audio_player_activate(Audio_Player *p) {
+	Audio_Player_Pool *pool = &audio_player_pool;
+	if (p->voice.active) return;
+	
+	if (!pool->active) {
+		growing_array_init_reserve((void**)&pool->active, sizeof(Audio_Player*), AUDIO_PLAYERS_PER_BLOCK, get_heap_allocator());
+	}
+	
+	p->voice.active = true;
+	p->voice.active_index = growing_array_get_valid_count(pool->active);
+	growing_array_add((void**)&pool->active, &p);
+}
+void
+audio_player_deactivate(Audio_Player *p) {
+	Audio_Player_Pool *pool = &audio_player_pool;
+	if (!p->voice.active) return;
+	
+	u64 last_index = growing_array_get_valid_count(pool->active)-1;
+	Audio_Player *last = pool->active[last_index];
+	pool->active[p->voice.active_index] = last;
+	last->voice.active_index = p->voice.active_index;
+	growing_array_pop((void**)&pool->active);
+	
+	p->voice.active = false;
+}
+
+void
+audio_player_free(Audio_Player *p) {
+	audio_player_deactivate(p);
+	audio_voice_clear_source(&p->voice);
+	// The game thread may hand it out again as soon as this is false
+	MEMORY_BARRIER;
+	p->allocated = false;
+	
+	Audio_Player *head;
+	do {
+		head = audio_player_pool.released;
+		p->next_free = head;
+	} while (!compare_and_swap_64((volatile u64*)&audio_player_pool.released, (u64)p, (u64)head));
+}
 
-	Audio_Player_Block *block = &audio_player_block;
-	Audio_Player_Block *last = 0;
+// Caller must hold audio_mixer_lock
+void
+audio_commands_apply() {
+	Audio_Command_Queue *q = &audio_command_queue;
+	
+	u64 write_count = q->write_count;
+	MEMORY_BARRIER;
 	
-	while (block) {
+	while (q->read_count < write_count) {
+		Audio_Command *c = &q->commands[q->read_count & (AUDIO_COMMAND_QUEUE_SIZE-1)];
+		Audio_Voice *v = c->player ? &c->player->voice : 0;
 		
-		for (u64 i = 0; i < AUDIO_PLAYERS_PER_BLOCK; i++) {
-			if (!block->players[i].allocated) {
-			
-				memset(&block->players[i], 0, sizeof(block->players[i]));
-				block->players[i].allocated = true;
-				block->players[i].config.volume = 1.0;
-				block->players[i].config.playback_speed = 1.0;
-				
-				return &block->players[i];
+		switch (c->kind) {
+			case AUDIO_COMMAND_SET_SOURCE: {
+				audio_voice_set_source(v, c->set_source.source, c->set_source.sound_bank_clip);
+				break;
+			}
+			case AUDIO_COMMAND_CLEAR_SOURCE:      audio_voice_clear_source(v); break;
+			case AUDIO_COMMAND_SET_STATE:         audio_voice_set_state(v, c->state); break;
+			case AUDIO_COMMAND_SET_PROGRESSION:   audio_voice_set_progression_factor(v, c->progression); break;
+			case AUDIO_COMMAND_SET_LOOPING:       audio_voice_set_looping(v, c->looping); break;
+			case AUDIO_COMMAND_RELEASE_WHEN_DONE: v->release_when_done = true; break;
+			case AUDIO_COMMAND_RELEASE:           audio_player_free(c->player); break;
+			case AUDIO_COMMAND_DETACH_SOURCE: {
+				// Rare enough that looking at every player is fine, idle ones can play the source too
+				for (Audio_Player_Block *block = &audio_player_block; block; block = block->next) {
+					for (u64 i = 0; i < AUDIO_PLAYERS_PER_BLOCK; i++) {
+						Audio_Voice *voice = &block->players[i].voice;
+						if (voice->has_source && voice->source.uid == c->source_uid) {
+							audio_voice_clear_source(voice);
+						}
+					}
+				}
+				break;
+			}
+			case AUDIO_COMMAND_BUS_CREATE:
+			case AUDIO_COMMAND_BUS_SET_OUTPUT:
+			case AUDIO_COMMAND_BUS_DESTROY: {
+				audio_bus_apply_command(c->kind, c->bus.bus, c->bus.output);
+				break;
 			}
 		}
 		
-		last = block;
-		block = block->next;
+		if (c->kind != AUDIO_COMMAND_RELEASE && c->player) audio_player_activate(c->player);
+		
+		MEMORY_BARRIER;
+		q->read_count += 1;
+	}
+}
+
+// Applies pending commands on the calling thread, but only if no device is running.
+// Otherwise the commands belong to the audio thread and we don't touch the mixer lock.
+bool
+audio_commands_apply_if_no_mixer() {
+	if (audio_mixer_thread_count > 0) return false;
+	if (!spinlock_acquire_or_wait_timeout(&audio_mixer_lock, 0)) return false;
+	bool apply = audio_mixer_thread_count == 0;
+	if (apply) audio_commands_apply();
+	spinlock_release(&audio_mixer_lock);
+	return apply;
+}
+
+// Called by a device thread when it starts and stops pulling buffers from the mixer
+void
+audio_mixer_thread_begin() {
+	spinlock_acquire_or_wait(&audio_mixer_lock);
+	audio_mixer_thread_count += 1;
+	spinlock_release(&audio_mixer_lock);
+}
+void
+audio_mixer_thread_end() {
+	spinlock_acquire_or_wait(&audio_mixer_lock);
+	assert(audio_mixer_thread_count > 0, "audio_mixer_thread_end without audio_mixer_thread_begin");
+	audio_mixer_thread_count -= 1;
+	spinlock_release(&audio_mixer_lock);
+}
+
+// For device threads while they wait for the next buffer, so syncs and a full queue
+// don't wait for a whole buffer period. Never waits, if someone else is mixing they apply them.
+void
+audio_mixer_thread_apply_commands() {
+	if (audio_command_queue.read_count == audio_command_queue.write_count) return;
+	if (!spinlock_acquire_or_wait_timeout(&audio_mixer_lock, 0)) return;
+	audio_commands_apply();
+	spinlock_release(&audio_mixer_lock);
+}
+
+void
+audio_command_push(Audio_Command *command) {
+	Audio_Command_Queue *q = &audio_command_queue;
+	
+	spinlock_acquire_or_wait(&q->producer_lock);
+	
+	while (q->write_count - q->read_count >= AUDIO_COMMAND_QUEUE_SIZE) {
+		if (!audio_commands_apply_if_no_mixer()) os_yield_thread();
 	}
 	
-	// No free player found, make another block
-	// #Volatile can't assign to last->next before this is zero initialized
-	Audio_Player_Block *new_block = alloc(get_heap_allocator(), sizeof(Audio_Player_Block));
+	q->commands[q->write_count & (AUDIO_COMMAND_QUEUE_SIZE-1)] = *command;
+	MEMORY_BARRIER;
+	q->write_count += 1;
 	
-#if !DO_ZERO_INITIALIATION
-	memset(new_block, 0, sizeof(*new_block));
-#endif
+	spinlock_release(&q->producer_lock);
+}
+
+// Blocks until every command pushed so far has been applied
+void
+audio_commands_sync() {
+	u64 target = audio_command_queue.write_count;
+	while (audio_command_queue.read_count < target) {
+		if (!audio_commands_apply_if_no_mixer()) os_yield_thread();
+	}
+}
+
+void
+audio_commands_detach_source(u64 source_uid) {
+	Audio_Command c = ZERO(Audio_Command);
+	c.kind = AUDIO_COMMAND_DETACH_SOURCE;
+	c.source_uid = source_uid;
+	audio_command_push(&c);
+	audio_commands_sync();
+}
 
-	last->next = new_block;
+void
+audio_player_pool_add_block(Audio_Player_Block *block) {
+	Audio_Player_Pool *pool = &audio_player_pool;
+	// Backwards so players are handed out in order
+	for (s64 i = AUDIO_PLAYERS_PER_BLOCK-1; i >= 0; i--) {
+		block->players[i].next_free = pool->free_list;
+		pool->free_list = &block->players[i];
+	}
+	pool->player_count += AUDIO_PLAYERS_PER_BLOCK;
+}
 
-	new_block->players[0].allocated = true;
-	new_block->players[0].config.volume = 1.0;
-	block->players[0].config.playback_speed = 1.0;
-	return &new_block->players[0];
+Audio_Player *
+audio_player_get_one() {
+	Audio_Player_Pool *pool = &audio_player_pool;
+	
+	spinlock_acquire_or_wait(&pool->lock);
+	
+	if (!pool->initted) {
+		pool->initted = true;
+		pool->last_block = &audio_player_block;
+		audio_player_pool_add_block(&audio_player_block);
+	}
+	
+	if (!pool->free_list) {
+		// Take everything the audio thread released since last time
+		Audio_Player *released;
+		do {
+			released = pool->released;
+		} while (released && !compare_and_swap_64((volatile u64*)&pool->released, 0, (u64)released));
+		pool->free_list = released;
+	}
+	
+	if (!pool->free_list) {
+		// #Volatile can't assign to last->next before this is zero initialized
+		Audio_Player_Block *new_block = alloc(get_heap_allocator(), sizeof(Audio_Player_Block));
+		
+#if !DO_ZERO_INITIALIATION
+		memset(new_block, 0, sizeof(*new_block));
+#endif
+		MEMORY_BARRIER;
+		
+		pool->last_block->next = new_block;
+		pool->last_block = new_block;
+		audio_player_pool_add_block(new_block);
+	}
+	
+	Audio_Player *p = pool->free_list;
+	pool->free_list = p->next_free;
+	
+	spinlock_release(&pool->lock);
+	
+	memset(p, 0, sizeof(*p));
+	p->config.volume = 1.0;
+	p->config.playback_speed = 1.0;
+	MEMORY_BARRIER;
+	p->allocated = true;
+	
+	return p;
 }
 
 void 
 audio_player_release(Audio_Player *p) {
-	p->marked_for_release = true;
+	// We release on audio thread
+	Audio_Command c = ZERO(Audio_Command);
+	c.kind = AUDIO_COMMAND_RELEASE;
+	c.player = p;
+	audio_command_push(&c);
 }
 void
 audio_player_set_state(Audio_Player *p, Audio_Player_State state) {
 
 	if (p->state == state) return;
-
-	spinlock_acquire_or_wait(&p->sample_lock);
-	assert(p->frame_index <= p->source.number_of_frames);
 	p->state = state;
-	
-	float64 full_duration 
-		= (float64)p->source.number_of_frames/(float64)p->source.format.sample_rate;
-	float64 progression = (float64)p->frame_index / (float64)p->source.number_of_frames;
-	float64 remaining = (1.0-progression)*full_duration;
-	
-	float64 fade_seconds = min(AUDIO_SMOOTH_TRANSITION_TIME_MS/1000.0, remaining);
-	
-	float64 fade_factor = fade_seconds/full_duration;
-	
-	p->fade_frames = (u64)round(fade_factor*(float64)p->source.number_of_frames);
-	p->fade_frames_total = p->fade_frames;
-	
-	spinlock_release(&p->sample_lock);
+
+	Audio_Command c = ZERO(Audio_Command);
+	c.kind = AUDIO_COMMAND_SET_STATE;
+	c.player = p;
+	c.state = state;
+	audio_command_push(&c);
+}
+void // 0 - 1
+audio_player_set_progression_factor(Audio_Player *p, float64 factor) {
+	Audio_Command c = ZERO(Audio_Command);
+	c.kind = AUDIO_COMMAND_SET_PROGRESSION;
+	c.player = p;
+	c.progression = factor;
+	audio_command_push(&c);
 }
 void
 audio_player_set_time_stamp(Audio_Player *p, float64 time_in_seconds) {
-	spinlock_acquire_or_wait(&p->sample_lock);
-	assert(p->frame_index <= p->source.number_of_frames);
-	
 	float64 full_duration 
 		= (float64)p->source.number_of_frames/(float64)p->source.format.sample_rate;
 	time_in_seconds = clamp(time_in_seconds, 0, full_duration);
-	float64 progression = time_in_seconds/full_duration;
-	
-	p->frame_index = (u64)round((float64)p->source.number_of_frames*progression);
-	
-	spinlock_release(&p->sample_lock);
+	audio_player_set_progression_factor(p, time_in_seconds/full_duration);
 }
 
+// These report how far the audio thread has come
 bool 
 audio_player_at_source_end(Audio_Player *p) {
-	spinlock_acquire_or_wait(&p->sample_lock);
-	assert(p->frame_index <= p->source.number_of_frames);
-	
-    bool finished = p->frame_index == p->source.number_of_frames;
-	
-	spinlock_release(&p->sample_lock);
-
-    return finished;
+    return p->voice.frame_index >= p->source.number_of_frames;
 }
-
-void // 0 - 1
-audio_player_set_progression_factor(Audio_Player *p, float64 factor) {
-	spinlock_acquire_or_wait(&p->sample_lock);
-	assert(p->frame_index <= p->source.number_of_frames);
+float64
+audio_player_get_current_progression_factor(Audio_Player *p) {
+	if (!p->has_source || p->source.number_of_frames == 0) return 0;
 	
-	p->frame_index = (u64)round((float64)p->source.number_of_frames*factor);
+	// The voice may not have switched to this source yet
+	u64 frame_index = min(p->voice.frame_index, p->source.number_of_frames);
 	
-	spinlock_release(&p->sample_lock);
+	return (float64)frame_index / (float64)p->source.number_of_frames;
 }
 float64 // seconds
 audio_player_get_time_stamp(Audio_Player *p) {
-	spinlock_acquire_or_wait(&p->sample_lock);
-	assert(p->frame_index <= p->source.number_of_frames);
-	
 	float64 full_duration 
 		= (float64)p->source.number_of_frames/(float64)p->source.format.sample_rate;
-	float64 progression = (float64)p->frame_index / (float64)p->source.number_of_frames;
 	
-	spinlock_release(&p->sample_lock);
-	
-	return progression*full_duration;
+	return audio_player_get_current_progression_factor(p)*full_duration;
 }
-float64
-audio_player_get_current_progression_factor(Audio_Player *p) {
-	if (!p->has_source) return 0;
-	spinlock_acquire_or_wait(&p->sample_lock);
-	assert(p->frame_index <= p->source.number_of_frames);
-	
-	float64 progression = (float64)p->frame_index / (float64)p->source.number_of_frames;
-	
-	spinlock_release(&p->sample_lock);
+void
+audio_player_set_source_internal(Audio_Player *p, Audio_Source src, Audio_Sound_Bank_Clip *sound_bank_clip) {
+	p->source = src;
+	p->has_source = true;
 	
-	return progression;
+	Audio_Command c = ZERO(Audio_Command);
+	c.kind = AUDIO_COMMAND_SET_SOURCE;
+	c.player = p;
+	c.set_source.source = src;
+	c.set_source.sound_bank_clip = sound_bank_clip;
+	audio_command_push(&c);
 }
 void 
 audio_player_set_source(Audio_Player *p, Audio_Source src) {
-
-	float64 last_progression = audio_player_get_current_progression_factor(p);
-	
-	spinlock_acquire_or_wait(&p->sample_lock);
-
-	p->source = src;
-	p->has_source = true;
-	
-	p->frame_index = 0;
-	
-	spinlock_release(&p->sample_lock);
+	audio_player_set_source_internal(p, src, 0);
 }
 void 
 audio_player_clear_source(Audio_Player *p) {
-	spinlock_acquire_or_wait(&p->sample_lock);
-	assert(p->frame_index <= p->source.number_of_frames);
-	
 	p->has_source = false;
 	p->state = AUDIO_PLAYER_STATE_PAUSED;
 	p->source = ZERO(Audio_Source);
 	
-	spinlock_release(&p->sample_lock);
+	Audio_Command c = ZERO(Audio_Command);
+	c.kind = AUDIO_COMMAND_CLEAR_SOURCE;
+	c.player = p;
+	audio_command_push(&c);
 }
 void
 audio_player_set_looping(Audio_Player *p, bool looping) {
-	spinlock_acquire_or_wait(&p->sample_lock);
-	
-	if (p->has_source && looping && !p->looping && p->frame_index == p->source.number_of_frames) {
-		p->frame_index = 0;
-	}
-	
 	p->looping = looping;
 	
-	spinlock_release(&p->sample_lock);
+	Audio_Command c = ZERO(Audio_Command);
+	c.kind = AUDIO_COMMAND_SET_LOOPING;
+	c.player = p;
+	c.looping = looping;
+	audio_command_push(&c);
 }
 
+///
+// Sound bank
+//
+// play_one_audio_clip(path) used to open a source per path and stream it, so the same short
+// clip was decoded again every time it was played. The sound bank decodes every clip once, into
+// memory in audio_output_format, and all players playing it share that.
+// A player playing a clip holds a reference, which is let go on the audio thread when the player
+// is released. Only clips nobody is playing are evicted, so eviction never races with the mixer:
+// references are only taken under the bank lock and the audio thread only ever lets go of them.
+
+typedef struct Audio_Sound_Bank_Clip {
+	string path;
+	Audio_Source source;
+	bool loaded;
+	bool loading; // By a thread that let go of the bank lock meanwhile
+	bool failed; // So we don't hit the disk every time a missing clip is played
+	u64 size; // Bytes of pcm
+	volatile u64 ref_count;
+	u64 last_used;
+} Audio_Sound_Bank_Clip;
+
+typedef struct Audio_Sound_Bank {
+	Hash_Table clips; // path -> Audio_Sound_Bank_Clip*, evicted clips stay in here unloaded
+	bool initted;
+	Spinlock lock;
+	
+	u64 loaded_bytes;
+	u64 use_counter;
+	
+	u64 hits;
+	u64 loads;
+	u64 evictions;
+} Audio_Sound_Bank;
+
 // #Global
-ogb_instance Hash_Table just_audio_clips;
-ogb_instance bool just_audio_clips_initted;
+ogb_instance Audio_Sound_Bank audio_sound_bank;
+ogb_instance u64 audio_sound_bank_budget_bytes;
 
 #if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
-Hash_Table just_audio_clips;
-bool just_audio_clips_initted = false;
+Audio_Sound_Bank audio_sound_bank = {0};
+u64 audio_sound_bank_budget_bytes = 64*1024*1024;
 #endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
 
 void
-DEPRECATED(play_one_audio_clip_source_at_position(Audio_Source source, Vector3 pos), "Use play_one_audio_clip_source_with_config() instead") {
+audio_sound_bank_clip_release(Audio_Sound_Bank_Clip *clip) {
+	u64 count;
+	do {
+		count = clip->ref_count;
+		assert(count > 0, "Sound bank clip released more times than it was retained");
+	} while (!compare_and_swap_64(&clip->ref_count, count-1, count));
+}
+void
+audio_sound_bank_clip_retain(Audio_Sound_Bank_Clip *clip) {
+	u64 count;
+	do {
+		count = clip->ref_count;
+	} while (!compare_and_swap_64(&clip->ref_count, count+1, count));
+}
+
+void
+audio_voice_drop_sound_bank_clip(Audio_Voice *v) {
+	if (v->sound_bank_clip) {
+		audio_sound_bank_clip_release(v->sound_bank_clip);
+		v->sound_bank_clip = 0;
+	}
+}
+
+// Expects audio_sound_bank.lock to be held
+void
+audio_sound_bank_trim_locked(u64 budget_bytes) {
+	Hash_Table *clips = &audio_sound_bank.clips;
+	while (audio_sound_bank.loaded_bytes > budget_bytes) {
+		Audio_Sound_Bank_Clip *oldest = 0;
+		for (u64 i = 0; i < clips->count; i++) {
+			Audio_Sound_Bank_Clip *clip = *(Audio_Sound_Bank_Clip**)hash_table_get_nth_value(clips, i);
+			if (!clip->loaded || clip->ref_count > 0) continue;
+			if (!oldest || clip->last_used < oldest->last_used) oldest = clip;
+		}
+		
+		// Everything left is playing
+		if (!oldest) break;
+		
+		// Nothing is playing it, so there's no need to go through the audio thread
+		audio_source_free(&oldest->source);
+		oldest->loaded = false;
+		audio_sound_bank.loaded_bytes -= oldest->size;
+		audio_sound_bank.evictions += 1;
+	}
+}
+void
+audio_sound_bank_trim(u64 budget_bytes) {
+	spinlock_acquire_or_wait(&audio_sound_bank.lock);
+	if (audio_sound_bank.initted) audio_sound_bank_trim_locked(budget_bytes);
+	spinlock_release(&audio_sound_bank.lock);
+}
+
+// Returns the clip retained, or 0 if it could not be loaded. Release it with
+// audio_sound_bank_clip_release().
+// Loading happens outside the lock, so clips that are already loaded can be played from other
+// threads meanwhile.
+Audio_Sound_Bank_Clip *
+audio_sound_bank_get(string path) {
+	Audio_Sound_Bank_Clip *clip = 0;
+	while (true) {
+		spinlock_acquire_or_wait(&audio_sound_bank.lock);
+		
+		if (!audio_sound_bank.initted) {
+			audio_sound_bank.clips = make_hash_table(string, Audio_Sound_Bank_Clip*, get_heap_allocator());
+			audio_sound_bank.initted = true;
+		}
+		
+		Audio_Sound_Bank_Clip **found = hash_table_find(&audio_sound_bank.clips, path);
+		if (found) {
+			clip = *found;
+		} else {
+			clip = alloc(get_heap_allocator(), sizeof(Audio_Sound_Bank_Clip));
+			*clip = ZERO(Audio_Sound_Bank_Clip);
+			clip->path = alloc_string(get_heap_allocator(), path.count);
+			memcpy(clip->path.data, path.data, path.count);
+			hash_table_add(&audio_sound_bank.clips, clip->path, clip);
+		}
+		
+		if (!clip->loading) break;
+		
+		// Another thread is loading this one, wait for it without holding the bank
+		spinlock_release(&audio_sound_bank.lock);
+		os_sleep(1);
+	}
+	
+	if (!clip->loaded && !clip->failed) {
+		// Clips are never freed, only unloaded, so the pointer stays good while we don't hold the lock
+		clip->loading = true;
+		spinlock_release(&audio_sound_bank.lock);
+		
+		Audio_Source source;
+		bool ok = audio_open_source_load(&source, path, get_heap_allocator());
+		
+		spinlock_acquire_or_wait(&audio_sound_bank.lock);
+		clip->loading = false;
+		
+		if (ok) {
+			clip->source = source;
+			clip->loaded = true;
+			clip->size = clip->source.number_of_frames
+			           * get_audio_bit_width_byte_size(clip->source.format.bit_width)
+			           * clip->source.format.channels;
+			audio_sound_bank.loaded_bytes += clip->size;
+			audio_sound_bank.loads += 1;
+		} else {
+			log_error("Could not load audio to play from %s", path);
+			clip->failed = true;
+		}
+	} else if (clip->loaded) {
+		audio_sound_bank.hits += 1;
+	}
+	
+	if (!clip->loaded) {
+		spinlock_release(&audio_sound_bank.lock);
+		return 0;
+	}
+	
+	audio_sound_bank.use_counter += 1;
+	clip->last_used = audio_sound_bank.use_counter;
+	audio_sound_bank_clip_retain(clip);
+	
+	// The clip we just got is retained, so it stays
+	audio_sound_bank_trim_locked(audio_sound_bank_budget_bytes);
+	
+	spinlock_release(&audio_sound_bank.lock);
+	
+	return clip;
+}
+
+void
+audio_player_play_one(Audio_Source source, Audio_Playback_Config config, Audio_Sound_Bank_Clip *clip) {
 	Audio_Player *p = audio_player_get_one();
-	audio_player_set_source(p, source);
+	p->config = config;
+	audio_player_set_source_internal(p, source, clip);
 	audio_player_set_state(p, AUDIO_PLAYER_STATE_PLAYING);
-	p->config.position_ndc = pos;
-	p->config.enable_spacialization = true;
-	p->release_when_done = true;
+	
+	Audio_Command c = ZERO(Audio_Command);
+	c.kind = AUDIO_COMMAND_RELEASE_WHEN_DONE;
+	c.player = p;
+	audio_command_push(&c);
+}
+
+void
+DEPRECATED(play_one_audio_clip_source_at_position(Audio_Source source, Vector3 pos), "Use play_one_audio_clip_source_with_config() instead") {
+	Audio_Playback_Config config = {0};
+	config.volume = 1.0;
+	config.playback_speed = 1.0;
+	config.position_ndc = pos;
+	config.enable_spacialization = true;
+	audio_player_play_one(source, config, 0);
 }
 
 void
 play_one_audio_clip_source_with_config(Audio_Source source, Audio_Playback_Config config) {
-	Audio_Player *p = audio_player_get_one();
-	audio_player_set_source(p, source);
-	audio_player_set_state(p, AUDIO_PLAYER_STATE_PLAYING);
-	p->config = config;
-	p->release_when_done = true;
+	audio_player_play_one(source, config, 0);
 }
 
 void inline 
@@ -1395,47 +2507,19 @@ play_one_audio_clip_source(Audio_Source source) {
 	play_one_audio_clip_source_with_config(source, config);
 }
 void
-DEPRECATED(play_one_audio_clip_at_position(string path, Vector3 pos), "Use play_one_audio_clip_with_config() instead") {
-	if (!just_audio_clips_initted) {
-		just_audio_clips_initted = true;
-		just_audio_clips = make_hash_table(string, Audio_Source, get_heap_allocator());
-	}
-	
-	Audio_Source *src_ptr = hash_table_find(&just_audio_clips, path);
-	if (src_ptr) {
-		play_one_audio_clip_source_at_position(*src_ptr, pos);
-	} else {
-		Audio_Source new_src;
-		bool ok = audio_open_source_stream(&new_src, path, get_heap_allocator());
-		if (!ok) {
-			log_error("Could not load audio to play from %s", path);
-			return;
-		}
-		hash_table_add(&just_audio_clips, path, new_src);
-		play_one_audio_clip_source_at_position(new_src, pos);
-	}
-	
+play_one_audio_clip_with_config(string path, Audio_Playback_Config config) {
+	Audio_Sound_Bank_Clip *clip = audio_sound_bank_get(path);
+	if (!clip) return;
+	audio_player_play_one(clip->source, config, clip);
 }
 void
-play_one_audio_clip_with_config(string path, Audio_Playback_Config config) {
-	if (!just_audio_clips_initted) {
-		just_audio_clips_initted = true;
-		just_audio_clips = make_hash_table(string, Audio_Source, get_heap_allocator());
-	}
-	
-	Audio_Source *src_ptr = hash_table_find(&just_audio_clips, path);
-	if (src_ptr) {
-		play_one_audio_clip_source_with_config(*src_ptr, config);
-	} else {
-		Audio_Source new_src;
-		bool ok = audio_open_source_stream(&new_src, path, get_heap_allocator());
-		if (!ok) {
-			log_error("Could not load audio to play from %s", path);
-			return;
-		}
-		hash_table_add(&just_audio_clips, path, new_src);
-		play_one_audio_clip_source_with_config(new_src, config);
-	}
+DEPRECATED(play_one_audio_clip_at_position(string path, Vector3 pos), "Use play_one_audio_clip_with_config() instead") {
+	Audio_Playback_Config config = {0};
+	config.volume = 1.0;
+	config.playback_speed = 1.0;
+	config.position_ndc = pos;
+	config.enable_spacialization = true;
+	play_one_audio_clip_with_config(path, config);
 }
 void inline
 play_one_audio_clip(string path) {
@@ -1655,235 +2739,1742 @@ void apply_audio_volume(void* frames, Audio_Format format, u64 number_of_frames,
     }
 }
 
-// This is supposed to be called by OS layer audio thread whenever it wants more audio samples
+///
+// Mixing
+//
+// Voices are mixed in planar f32, one array per channel. Arrays are padded to a multiple of 4
+// frames (with zeros) so the SSE loops don't need a scalar tail.
+// Each voice is converted from its source format in one pass, resampled if it needs to be, and
+// then added to the bus with volume, spacialization and fade as one multiply-add per sample.
+// The bus is converted to the device format once, after all voices are mixed.
+
+typedef struct Audio_Planar_Buffer {
+	float32 *data;
+	u64 stride; // Frames per channel, a multiple of 4
+	u64 frame_count;
+	int channels;
+	u64 capacity; // In floats
+} Audio_Planar_Buffer;
+
 void 
-do_program_audio_sample(u64 number_of_output_frames, Audio_Format out_format, 
-							 void *output) {
-							 
-	reset_temporary_storage();
-							 
-	u64 out_comp_size  = get_audio_bit_width_byte_size(out_format.bit_width);
-    u64 out_frame_size = out_comp_size * out_format.channels;
-    u64 output_size    = number_of_output_frames * out_frame_size;
-    
-	memset(output, 0, output_size);
+audio_planar_buffer_reserve(Audio_Planar_Buffer *b, int channels, u64 frame_count) {
+	assert(channels > 0 && channels <= AUDIO_MAX_CHANNELS, "Unsupported channel count %d", channels);
+	u64 stride = (frame_count+3) & ~3ull;
+	u64 needed = stride*(u64)channels;
+	if (needed > b->capacity) {
+		if (b->data) dealloc(get_heap_allocator(), b->data);
+		b->capacity = get_next_power_of_two(needed);
+		// Heap allocations are 16 byte aligned, and so is every channel since stride is a multiple of 4
+		b->data = alloc(get_heap_allocator(), b->capacity*sizeof(float32));
+	}
+	b->stride = stride;
+	b->frame_count = frame_count;
+	b->channels = channels;
+}
+void 
+audio_planar_buffer_destroy(Audio_Planar_Buffer *b) {
+	if (b->data) dealloc(get_heap_allocator(), b->data);
+	*b = ZERO(Audio_Planar_Buffer);
+}
+inline float32 *
+audio_planar_channel(Audio_Planar_Buffer *b, int c) {
+	return b->data + (u64)c*b->stride;
+}
+void 
+audio_planar_buffer_clear(Audio_Planar_Buffer *b) {
+	memset(b->data, 0, b->stride*(u64)b->channels*sizeof(float32));
+}
+
+// Converts interleaved frames in any format to dst->channels planar f32 channels.
+// Channels are mapped like convert_frames does it: mono goes to every channel, and channels that
+// don't exist on one side get the average of the other side.
+void 
+audio_frames_to_planar(Audio_Planar_Buffer *dst, void *src, Audio_Format src_format, u64 frame_count) {
+	assert(frame_count <= dst->stride, "Planar buffer too small");
 	
-	Audio_Player_Block *block = &audio_player_block;
+	int src_channels = src_format.channels;
+	int dst_channels = dst->channels;
+	bool is_s16 = src_format.bit_width == AUDIO_BITS_16;
+	const float32 s16_scale = 1.0f/32768.0f;
 	
-	// #Cleanup #Memory refactor intermediate buffers
-	local_persist thread_local void *mix_buffer = 0;
-	local_persist thread_local u64 mix_buffer_size;
-	local_persist thread_local void *convert_buffer = 0;
-	local_persist thread_local u64 convert_buffer_size;
+	u64 f = 0;
 	
-	memset(mix_buffer, 0, mix_buffer_size);
+	if (src_channels == 1) {
+		// Convert into the first channel and copy that to the rest
+		float32 *out = audio_planar_channel(dst, 0);
+#if ENABLE_SIMD
+		if (is_s16) {
+			__m128 scale = _mm_set1_ps(s16_scale);
+			for (; f+8 <= frame_count; f += 8) {
+				__m128i x = _mm_loadu_si128((__m128i*)((s16*)src + f));
+				// Sign extend by putting each s16 in the top half and shifting it down
+				__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+				__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+				_mm_store_ps(out+f,   _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+				_mm_store_ps(out+f+4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+			}
+		} else {
+			memcpy(out, src, frame_count*sizeof(float32));
+			f = frame_count;
+		}
+#endif
+		for (; f < frame_count; f++) {
+			out[f] = is_s16 ? (float32)((s16*)src)[f]*s16_scale : ((float32*)src)[f];
+		}
+		for (u64 pad = frame_count; pad < dst->stride; pad++) out[pad] = 0;
+		for (int c = 1; c < dst_channels; c++) {
+			memcpy(audio_planar_channel(dst, c), out, dst->stride*sizeof(float32));
+		}
+		return;
+	}
 	
-	u64 *started_this_frame;
-	growing_array_init((void**)&started_this_frame, sizeof(u64), get_temporary_allocator());
+#if ENABLE_SIMD
+	if (src_channels == 2 && dst_channels == 2) {
+		float32 *left  = audio_planar_channel(dst, 0);
+		float32 *right = audio_planar_channel(dst, 1);
+		if (is_s16) {
+			__m128 scale = _mm_set1_ps(s16_scale);
+			for (; f+4 <= frame_count; f += 4) {
+				__m128i x = _mm_loadu_si128((__m128i*)((s16*)src + f*2));
+				__m128 a = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16)), scale);
+				__m128 b = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16)), scale);
+				_mm_store_ps(left+f,  _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+				_mm_store_ps(right+f, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+			}
+		} else {
+			for (; f+4 <= frame_count; f += 4) {
+				__m128 a = _mm_loadu_ps((float32*)src + f*2);
+				__m128 b = _mm_loadu_ps((float32*)src + f*2 + 4);
+				_mm_store_ps(left+f,  _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+				_mm_store_ps(right+f, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+			}
+		}
+	}
+#endif
+	
+	for (; f < frame_count; f++) {
+		float32 in[AUDIO_MAX_CHANNELS];
+		float32 sum = 0;
+		for (int c = 0; c < src_channels && c < AUDIO_MAX_CHANNELS; c++) {
+			in[c] = is_s16 ? (float32)((s16*)src)[f*src_channels+c]*s16_scale : ((float32*)src)[f*src_channels+c];
+			sum += in[c];
+		}
+		float32 avg = sum/(float32)src_channels;
+		for (int c = 0; c < dst_channels; c++) {
+			float32 s = avg;
+			if (src_channels == dst_channels || (src_channels < dst_channels && c < src_channels)) s = in[c];
+			audio_planar_channel(dst, c)[f] = s;
+		}
+	}
+	
+	for (int c = 0; c < dst_channels; c++) {
+		float32 *out = audio_planar_channel(dst, c);
+		for (u64 pad = frame_count; pad < dst->stride; pad++) out[pad] = 0;
+	}
+}
+
+// #Global
+ogb_instance float32 audio_sinc_table[AUDIO_RESAMPLER_SINC_BANDS][AUDIO_RESAMPLER_SINC_PHASES+1][AUDIO_RESAMPLER_SINC_TAPS];
+ogb_instance volatile bool audio_sinc_table_initted;
+ogb_instance Spinlock audio_sinc_table_lock;
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+float32 audio_sinc_table[AUDIO_RESAMPLER_SINC_BANDS][AUDIO_RESAMPLER_SINC_PHASES+1][AUDIO_RESAMPLER_SINC_TAPS];
+volatile bool audio_sinc_table_initted = false;
+Spinlock audio_sinc_table_lock = {0};
+#endif
+
+f64
+audio_bessel_i0(f64 x) {
+	f64 sum = 1.0;
+	f64 term = 1.0;
+	for (int k = 1; k < 32; k++) {
+		term *= (x/(2.0*k))*(x/(2.0*k));
+		sum += term;
+	}
+	return sum;
+}
+
+void
+audio_init_sinc_table() {
+	if (audio_sinc_table_initted) return;
+	spinlock_acquire_or_wait(&audio_sinc_table_lock);
+	if (!audio_sinc_table_initted) {
+		const int half = AUDIO_RESAMPLER_SINC_TAPS/2;
+		const f64 beta = 8.0;
+		f64 i0_beta = audio_bessel_i0(beta);
+		for (int band = 0; band < AUDIO_RESAMPLER_SINC_BANDS; band++) {
+			// Slightly below nyquist so the transition band doesn't fold back
+			f64 cutoff = 0.92/pow(2.0, (f64)band/4.0);
+			for (int phase = 0; phase <= AUDIO_RESAMPLER_SINC_PHASES; phase++) {
+				f64 frac = (f64)phase/(f64)AUDIO_RESAMPLER_SINC_PHASES;
+				f64 sum = 0;
+				f64 coefficients[AUDIO_RESAMPLER_SINC_TAPS];
+				for (int j = 0; j < AUDIO_RESAMPLER_SINC_TAPS; j++) {
+					// Distance from the sample this tap reads to the output position
+					f64 x = (f64)(j-(half-1))-frac;
+					f64 r = x/(f64)half;
+					f64 window = r*r < 1.0 ? audio_bessel_i0(beta*sqrt(1.0-r*r))/i0_beta : 0.0;
+					f64 y = PI64*cutoff*x;
+					f64 sinc = fabs(y) < 1e-9 ? 1.0 : sin(y)/y;
+					coefficients[j] = cutoff*sinc*window;
+					sum += coefficients[j];
+				}
+				// Unity gain at DC for every phase
+				for (int j = 0; j < AUDIO_RESAMPLER_SINC_TAPS; j++) {
+					audio_sinc_table[band][phase][j] = (float32)(coefficients[j]/sum);
+				}
+			}
+		}
+		audio_sinc_table_initted = true;
+	}
+	spinlock_release(&audio_sinc_table_lock);
+}
+
+// Input frames advanced per output frame, 32.32 fixed point
+inline u64
+audio_resampler_step(f64 ratio) {
+	return (u64)(ratio*4294967296.0 + 0.5);
+}
+
+// How many new input frames audio_resampler_process() needs to make output_frames frames.
+u64
+audio_resampler_frames_needed(Audio_Resampler *r, Audio_Resample_Quality quality, f64 ratio, u64 output_frames) {
+	if (output_frames == 0) return 0;
+	u64 step = audio_resampler_step(ratio);
+	u64 last = (r->position + (output_frames-1)*step) >> 32;
+	u64 lookahead = quality == AUDIO_RESAMPLE_SINC ? AUDIO_RESAMPLER_SINC_TAPS/2 : 1;
+	u64 end = last + lookahead + 1;
+	return end > AUDIO_RESAMPLER_HISTORY ? end - AUDIO_RESAMPLER_HISTORY : 0;
+}
+
+// Keeps the end of frames that were played without resampling, so that switching to the
+// resampler (playback_speed changed) continues from them instead of from silence.
+void
+audio_resampler_push_history(Audio_Resampler *r, Audio_Planar_Buffer *in) {
+	assert(r->channels == in->channels && !r->active, "Resampler history doesn't match the frames played");
+	u64 n = in->frame_count;
+	for (int c = 0; c < r->channels; c++) {
+		float32 *h = r->history[c];
+		float32 *src = audio_planar_channel(in, c);
+		if (n >= AUDIO_RESAMPLER_HISTORY) {
+			memcpy(h, src + n - AUDIO_RESAMPLER_HISTORY, AUDIO_RESAMPLER_HISTORY*sizeof(float32));
+		} else {
+			memmove(h, h + n, (AUDIO_RESAMPLER_HISTORY-n)*sizeof(float32));
+			memcpy(h + AUDIO_RESAMPLER_HISTORY - n, src, n*sizeof(float32));
+		}
+	}
+}
+
+// Resamples the next in->frame_count input frames into out->frame_count output frames.
+// in->frame_count must be what audio_resampler_frames_needed() asked for.
+void
+audio_resampler_process(Audio_Resampler *r, Audio_Resample_Quality quality, f64 ratio, 
+                        Audio_Planar_Buffer *in, Audio_Planar_Buffer *out) {
+	assert(r->channels == out->channels, "Resampler was reset for %d channels, output has %d", r->channels, out->channels);
+	assert(in->frame_count == 0 || in->channels == out->channels, "Channel count must be the same for sample rate conversion");
+	assert(in->frame_count == audio_resampler_frames_needed(r, quality, ratio, out->frame_count), "Wrong number of input frames for resampler");
+	
+	if (quality == AUDIO_RESAMPLE_SINC) audio_init_sinc_table();
 	
-	while (block) {
+	// History followed by the new input, so kernels can read across the boundary
+	local_persist thread_local Audio_Planar_Buffer work = {0};
+	u64 work_frames = AUDIO_RESAMPLER_HISTORY + in->frame_count;
+	// Linear reads one frame past the last index it uses when the fraction is 0
+	audio_planar_buffer_reserve(&work, out->channels, work_frames+1);
+	for (int c = 0; c < out->channels; c++) {
+		float32 *w = audio_planar_channel(&work, c);
+		memcpy(w, r->history[c], AUDIO_RESAMPLER_HISTORY*sizeof(float32));
+		if (in->frame_count) memcpy(w+AUDIO_RESAMPLER_HISTORY, audio_planar_channel(in, c), in->frame_count*sizeof(float32));
+		w[work_frames] = 0;
+	}
+	
+	u64 step = audio_resampler_step(ratio);
+	u64 frame_count = out->frame_count;
+	u64 position = r->position;
+	
+	if (quality == AUDIO_RESAMPLE_LINEAR && step == (1ull << 32) && (u32)position == 0) {
+	
+		// Same rate and on a whole frame, nothing to interpolate
+		for (int c = 0; c < out->channels; c++) {
+			memcpy(audio_planar_channel(out, c), audio_planar_channel(&work, c) + (position >> 32), frame_count*sizeof(float32));
+		}
+		position += frame_count*step;
+		
+	} else if (quality == AUDIO_RESAMPLE_LINEAR) {
 		
-		for (u64 i = 0; i < AUDIO_PLAYERS_PER_BLOCK; i++) {
-			Audio_Player *p = &block->players[i];
-			if (p->release_when_done && (p->frame_index >= p->source.number_of_frames
-										  || !p->has_source)) {
-				p->allocated = false;
+		const float32 frac_scale = 1.0f/16777216.0f;
+		u64 f = 0;
+#if ENABLE_SIMD
+		__m128 scale = _mm_set1_ps(frac_scale);
+		for (; f+4 <= frame_count; f += 4) {
+			u64 p0 = position, p1 = position+step, p2 = position+step*2, p3 = position+step*3;
+			u64 i0 = p0 >> 32, i1 = p1 >> 32, i2 = p2 >> 32, i3 = p3 >> 32;
+			// Top 24 bits of the fraction, so the int to float conversion is exact
+			__m128i frac = _mm_srli_epi32(_mm_set_epi32((s32)(u32)p3, (s32)(u32)p2, (s32)(u32)p1, (s32)(u32)p0), 8);
+			__m128 t = _mm_mul_ps(_mm_cvtepi32_ps(frac), scale);
+			for (int c = 0; c < out->channels; c++) {
+				float32 *w = audio_planar_channel(&work, c);
+				__m128 a = _mm_set_ps(w[i3],   w[i2],   w[i1],   w[i0]);
+				__m128 b = _mm_set_ps(w[i3+1], w[i2+1], w[i1+1], w[i0+1]);
+				_mm_store_ps(audio_planar_channel(out, c)+f, _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a))));
 			}
-			if (!p->allocated) {
-				continue;
+			position += step*4;
+		}
+#endif
+		for (; f < frame_count; f++) {
+			u64 i = position >> 32;
+			float32 t = (float32)((u32)position >> 8)*frac_scale;
+			for (int c = 0; c < out->channels; c++) {
+				float32 *w = audio_planar_channel(&work, c);
+				audio_planar_channel(out, c)[f] = w[i] + t*(w[i+1]-w[i]);
 			}
+			position += step;
+		}
+		
+	} else {
+	
+		int band = 0;
+		while (band < AUDIO_RESAMPLER_SINC_BANDS-1 && ratio > pow(2.0, (f64)band/4.0)+1e-9) band += 1;
+		
+		const int phase_bits = 7; // log2(AUDIO_RESAMPLER_SINC_PHASES)
+		const u32 blend_mask = (1u << (32-phase_bits))-1;
+		const float32 blend_scale = 1.0f/(float32)(1u << (32-phase_bits));
+		
+		for (u64 f = 0; f < frame_count; f++) {
+			u64 first = (position >> 32) - (AUDIO_RESAMPLER_SINC_TAPS/2-1);
+			u32 frac = (u32)position;
+			float32 *row0 = audio_sinc_table[band][frac >> (32-phase_bits)];
+			float32 *row1 = row0 + AUDIO_RESAMPLER_SINC_TAPS;
+			float32 blend = (float32)(frac & blend_mask)*blend_scale;
 			
-			if (p->marked_for_release) {
-				p->marked_for_release = false;
-				p->allocated = false;
-				continue;
+#if ENABLE_SIMD
+			// Interpolate between the two nearest phases once, then use it for every channel
+			__m128 coefficients[AUDIO_RESAMPLER_SINC_TAPS/4];
+			__m128 b = _mm_set1_ps(blend);
+			for (int k = 0; k < AUDIO_RESAMPLER_SINC_TAPS/4; k++) {
+				__m128 c0 = _mm_loadu_ps(row0+k*4);
+				__m128 c1 = _mm_loadu_ps(row1+k*4);
+				coefficients[k] = _mm_add_ps(c0, _mm_mul_ps(b, _mm_sub_ps(c1, c0)));
 			}
-			
-			if (p->state != AUDIO_PLAYER_STATE_PLAYING) {
-				if (p->fade_frames == 0) continue;
+			for (int c = 0; c < out->channels; c++) {
+				float32 *w = audio_planar_channel(&work, c) + first;
+				__m128 acc0 = _mm_mul_ps(coefficients[0], _mm_loadu_ps(w));
+				__m128 acc1 = _mm_mul_ps(coefficients[1], _mm_loadu_ps(w+4));
+				for (int k = 2; k < AUDIO_RESAMPLER_SINC_TAPS/4; k += 2) {
+					acc0 = _mm_add_ps(acc0, _mm_mul_ps(coefficients[k],   _mm_loadu_ps(w+k*4)));
+					acc1 = _mm_add_ps(acc1, _mm_mul_ps(coefficients[k+1], _mm_loadu_ps(w+k*4+4)));
+				}
+				__m128 acc = _mm_add_ps(acc0, acc1);
+				acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+				acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+				audio_planar_channel(out, c)[f] = _mm_cvtss_f32(acc);
 			}
-			
-			// #Incomplete Reverse playback ?
-			if (p->config.playback_speed <= 0.0) continue;
-			
-			if (p->frame_index >= p->source.number_of_frames && !p->looping) continue;
-			
-			spinlock_acquire_or_wait(&p->sample_lock);
-			
-			Audio_Source src = p->source;
-			
-			mutex_acquire_or_wait(&src.mutex_for_destroy);
+#else
+			float32 coefficients[AUDIO_RESAMPLER_SINC_TAPS];
+			for (int k = 0; k < AUDIO_RESAMPLER_SINC_TAPS; k++) {
+				coefficients[k] = row0[k] + blend*(row1[k]-row0[k]);
+			}
+			for (int c = 0; c < out->channels; c++) {
+				float32 *w = audio_planar_channel(&work, c) + first;
+				float32 acc = 0;
+				for (int k = 0; k < AUDIO_RESAMPLER_SINC_TAPS; k++) acc += coefficients[k]*w[k];
+				audio_planar_channel(out, c)[f] = acc;
+			}
+#endif
+			position += step;
+		}
+	}
+	
+	for (int c = 0; c < out->channels; c++) {
+		float32 *o = audio_planar_channel(out, c);
+		for (u64 pad = frame_count; pad < out->stride; pad++) o[pad] = 0;
+	}
+	
+	// Keep the last frames as history and move the position back by what we dropped
+	for (int c = 0; c < out->channels; c++) {
+		memcpy(r->history[c], audio_planar_channel(&work, c) + in->frame_count, AUDIO_RESAMPLER_HISTORY*sizeof(float32));
+	}
+	r->position = position - (in->frame_count << 32);
+	r->active = true;
+}
 
-			Audio_Format sample_format = src.format;
-			sample_format.sample_rate = sample_format.sample_rate*p->config.playback_speed;
-			
-			bool need_convert = !bytes_match(
-				&out_format, 
-				&sample_format, 
-				sizeof(Audio_Format)
-			);
-			
-			u64 in_comp_size 
-				= get_audio_bit_width_byte_size(sample_format.bit_width);
-			
-			u64 in_frame_size = in_comp_size * sample_format.channels;
-			u64 input_size = number_of_output_frames * in_frame_size;
-			
-			// #Copypaste #Cleanup
-			u64 biggest_size = max(input_size, output_size);
-			if (!mix_buffer || mix_buffer_size < biggest_size) {
-				u64 new_size = get_next_power_of_two(biggest_size);
-				if (mix_buffer) dealloc(get_heap_allocator(), mix_buffer);
-				mix_buffer = alloc(get_heap_allocator(), new_size);
-				mix_buffer_size = new_size;
-				memset(mix_buffer, 0, new_size);
+// Converts a memory source to planar f32 in format's sample rate and channel count, resampled
+// with the sinc resampler. Playing it at normal speed then costs the mixer a copy per channel
+// and the multiply-add, instead of converting and resampling every buffer.
+// Takes the same memory as f32 interleaved.
+bool
+audio_source_prepare(Audio_Source *src, Audio_Format format) {
+	if (src->kind != AUDIO_SOURCE_MEMORY) return false;
+	if (src->planar) return true;
+	
+	bool resample = src->format.sample_rate != format.sample_rate;
+	f64 ratio = (f64)src->format.sample_rate/(f64)format.sample_rate;
+	u64 in_frames = src->number_of_frames;
+	u64 out_frames = resample ? (u64)round((f64)in_frames/ratio) : in_frames;
+	u64 in_frame_size = get_audio_bit_width_byte_size(src->format.bit_width)*src->format.channels;
+	
+	float32 *planar = alloc(src->allocator, max(out_frames, 1)*format.channels*sizeof(float32));
+	
+	Audio_Resampler resampler;
+	audio_resampler_reset(&resampler, format.channels);
+	Audio_Planar_Buffer in = ZERO(Audio_Planar_Buffer);
+	Audio_Planar_Buffer out = ZERO(Audio_Planar_Buffer);
+	
+	const u64 block_frames = 4096;
+	u64 read = 0;
+	u64 written = 0;
+	while (written < out_frames) {
+		u64 frames = min(block_frames, out_frames-written);
+		u64 needed = resample ? audio_resampler_frames_needed(&resampler, AUDIO_RESAMPLE_SINC, ratio, frames) : frames;
+		
+		// The resampler reads a little past the end, which is silence
+		u64 available = read < in_frames ? min(needed, in_frames-read) : 0;
+		audio_planar_buffer_reserve(&in, format.channels, max(needed, 1));
+		audio_frames_to_planar(&in, (u8*)src->pcm_frames + read*in_frame_size, src->format, available);
+		in.frame_count = needed;
+		read += needed;
+		
+		Audio_Planar_Buffer *result = &in;
+		if (resample) {
+			audio_planar_buffer_reserve(&out, format.channels, frames);
+			audio_resampler_process(&resampler, AUDIO_RESAMPLE_SINC, ratio, &in, &out);
+			result = &out;
+		}
+		
+		for (int c = 0; c < format.channels; c++) {
+			memcpy(planar + (u64)c*out_frames + written, audio_planar_channel(result, c), frames*sizeof(float32));
+		}
+		written += frames;
+	}
+	
+	audio_planar_buffer_destroy(&in);
+	audio_planar_buffer_destroy(&out);
+	
+	dealloc(src->allocator, src->pcm_frames);
+	src->pcm_frames = planar;
+	src->planar = true;
+	src->format = (Audio_Format){ AUDIO_BITS_32, format.channels, format.sample_rate };
+	src->number_of_frames = out_frames;
+	
+	return true;
+}
+
+// Copies frames of a prepared source into dst, which has the same channel count
+u64 // New frame index
+audio_source_sample_planar(Audio_Source *src, u64 first_frame_index, Audio_Planar_Buffer *dst, bool looping) {
+	u64 index = first_frame_index;
+	u64 f = 0;
+	while (f < dst->frame_count && src->number_of_frames > 0) {
+		if (index == src->number_of_frames) {
+			if (!looping) break;
+			index = 0;
+		}
+		u64 count = min(dst->frame_count-f, src->number_of_frames-index);
+		for (int c = 0; c < dst->channels; c++) {
+			float32 *channel = (float32*)src->pcm_frames + (u64)c*src->number_of_frames;
+			memcpy(audio_planar_channel(dst, c) + f, channel + index, count*sizeof(float32));
+		}
+		f += count;
+		index += count;
+	}
+	for (int c = 0; c < dst->channels; c++) {
+		float32 *out = audio_planar_channel(dst, c);
+		for (u64 pad = f; pad < dst->stride; pad++) out[pad] = 0;
+	}
+	if (looping && index == src->number_of_frames) index = 0;
+	return index;
+}
+
+// dst += src*gain, or dst += src*gain*envelope[i] if there's an envelope.
+// frame_count is rounded up to 4, which is fine since planar buffers are padded.
+void 
+audio_mix_planar(float32 *dst, float32 *src, u64 frame_count, float32 gain, float32 *envelope) {
+	u64 count = (frame_count+3) & ~3ull;
+	u64 i = 0;
+#if ENABLE_SIMD
+	__m128 g = _mm_set1_ps(gain);
+	if (envelope) {
+		for (; i < count; i += 4) {
+			__m128 s = _mm_mul_ps(_mm_load_ps(src+i), _mm_mul_ps(g, _mm_load_ps(envelope+i)));
+			_mm_store_ps(dst+i, _mm_add_ps(_mm_load_ps(dst+i), s));
+		}
+	} else {
+		for (; i < count; i += 4) {
+			_mm_store_ps(dst+i, _mm_add_ps(_mm_load_ps(dst+i), _mm_mul_ps(_mm_load_ps(src+i), g)));
+		}
+	}
+#endif
+	for (; i < count; i++) {
+		dst[i] += src[i]*gain*(envelope ? envelope[i] : 1.0f);
+	}
+}
+
+// Interleaves and converts planar f32 to the output format, clamped to -1 to 1.
+// The master bus limiter keeps the mix under that, so this only clips if it's turned off.
+void 
+audio_planar_to_frames(void *dst, Audio_Format format, Audio_Planar_Buffer *src) {
+	assert(format.channels == src->channels, "Channel count must match");
+	
+	u64 frame_count = src->frame_count;
+	int channels = format.channels;
+	u64 f = 0;
+	
+#if ENABLE_SIMD
+	if (channels == 2) {
+		float32 *left  = audio_planar_channel(src, 0);
+		float32 *right = audio_planar_channel(src, 1);
+		__m128 one = _mm_set1_ps(1.0f);
+		__m128 minus_one = _mm_set1_ps(-1.0f);
+		if (format.bit_width == AUDIO_BITS_32) {
+			for (; f+4 <= frame_count; f += 4) {
+				__m128 l = _mm_max_ps(_mm_min_ps(_mm_load_ps(left+f), one), minus_one);
+				__m128 r = _mm_max_ps(_mm_min_ps(_mm_load_ps(right+f), one), minus_one);
+				_mm_storeu_ps((float32*)dst + f*2,     _mm_unpacklo_ps(l, r));
+				_mm_storeu_ps((float32*)dst + f*2 + 4, _mm_unpackhi_ps(l, r));
 			}
-			
-			void *target_buffer = mix_buffer;
-			u64 number_of_sample_frames = number_of_output_frames;
-			
-			if (need_convert) {
-				if (sample_format.sample_rate != out_format.sample_rate) {
-					f64 src_ratio 
-						= (f64)sample_format.sample_rate 
-						  / (f64)out_format.sample_rate;
-						
-					number_of_sample_frames = round(number_of_output_frames * src_ratio);
-					input_size = number_of_sample_frames * in_frame_size;
-
-					// #Copypaste #Cleanup  we need to potentially grow the mix buffer again after we change input_size
-					u64 biggest_size = max(input_size, output_size);
-					if (!mix_buffer || mix_buffer_size < biggest_size) {
-						u64 new_size = get_next_power_of_two(biggest_size);
-						if (mix_buffer) dealloc(get_heap_allocator(), mix_buffer);
-						mix_buffer = alloc(get_heap_allocator(), new_size);
-						mix_buffer_size = new_size;
-						memset(mix_buffer, 0, new_size);
-					}
-				}
-				
-				u64 biggest_size = max(input_size, output_size);
-				if (!convert_buffer || convert_buffer_size < biggest_size) {
-					u64 new_size = get_next_power_of_two(biggest_size);
-					if (convert_buffer) dealloc(get_heap_allocator(), convert_buffer);
-					convert_buffer = alloc(get_heap_allocator(), new_size);
-					convert_buffer_size = new_size;
-					memset(convert_buffer, 0, new_size);
-				}
-				target_buffer = convert_buffer;
-				
+		} else {
+			__m128 scale = _mm_set1_ps(32767.0f);
+			for (; f+4 <= frame_count; f += 4) {
+				__m128 l = _mm_max_ps(_mm_min_ps(_mm_load_ps(left+f), one), minus_one);
+				__m128 r = _mm_max_ps(_mm_min_ps(_mm_load_ps(right+f), one), minus_one);
+				__m128i li = _mm_cvtps_epi32(_mm_mul_ps(l, scale));
+				__m128i ri = _mm_cvtps_epi32(_mm_mul_ps(r, scale));
+				__m128i packed = _mm_packs_epi32(_mm_unpacklo_epi32(li, ri), _mm_unpackhi_epi32(li, ri));
+				_mm_storeu_si128((__m128i*)((s16*)dst + f*2), packed);
 			}
+		}
+	}
+#endif
 	
-			// :PhaseCancellation
-			if (p->frame_index == 0) { // The players' source just started playing
-			
-				s64 existing_index = growing_array_find_index_from_left_by_value((void**)&started_this_frame, &src.uid);
-				
-				if (existing_index != -1) {
-					// If this source already started playing this round from another player, then we pretend that
-					// we're already done playing by skipping to the last frame.
-					// For non-looping players, this means we don't play this instance at all.
-					// For looping players, this means we have a slight offset between the players that start
-					// playing at the exact same time. I'm not sure how else to deal with phase cancellation
-					// in looping players.
-					// #Incomplete player->is_muted_for_phase_cancellation ? 
-					p->frame_index = src.number_of_frames;
-					continue;
-				}
-				growing_array_add((void**)&started_this_frame, &src.uid);
+	for (; f < frame_count; f++) {
+		for (int c = 0; c < channels; c++) {
+			float32 s = clamp(audio_planar_channel(src, c)[f], -1.0f, 1.0f);
+			if (format.bit_width == AUDIO_BITS_32) {
+				((float32*)dst)[f*channels+c] = s;
+			} else {
+				((s16*)dst)[f*channels+c] = (s16)roundf(s*32767.0f);
 			}
+		}
+	}
+}
+
+// Same gains as apply_audio_spacialization, one per output channel
+void 
+audio_get_spacialization_gains(Vector3 pos, int channels, float32 *gains) {
+	float32 distance = sqrtf(pos.x * pos.x + pos.y * pos.y + pos.z * pos.z);
+	float32 attenuation = 1.0f / (1.0f + distance);
 	
-			u64 last_frame_index = p->frame_index;
-			p->frame_index = audio_source_sample_next_frames(
-				&src,
-				p->frame_index, 
+	float32 left_right_pan = (pos.x + 1.0f) * 0.5f;
+	float32 up_down_pan = (pos.y + 1.0f) * 0.5f;
+	float32 front_back_pan = (pos.z + 1.0f) * 0.5f;
+	
+	if (channels == 1) {
+		gains[0] = attenuation;
+	} else if (channels == 2) {
+		// The phase shift for vertical position is the same factor for every sample
+		float32 phase_shift = (up_down_pan - 0.5f) * 0.5f;
+		gains[0] = (1.0f - left_right_pan) * attenuation * (cosf(phase_shift) - sinf(phase_shift));
+		gains[1] = left_right_pan * attenuation * (cosf(phase_shift) + sinf(phase_shift));
+	} else if (channels == 4) {
+		gains[0] = (1.0f - left_right_pan) * (1.0f - front_back_pan) * attenuation;
+		gains[1] = left_right_pan * (1.0f - front_back_pan) * attenuation;
+		gains[2] = (1.0f - left_right_pan) * front_back_pan * attenuation;
+		gains[3] = left_right_pan * front_back_pan * attenuation;
+	} else if (channels == 6) {
+		gains[0] = (1.0f - left_right_pan) * attenuation;
+		gains[1] = left_right_pan * attenuation;
+		gains[2] = (1.0f - front_back_pan) * attenuation;
+		gains[3] = 0.5f * attenuation;
+		gains[4] = (1.0f - left_right_pan) * front_back_pan * attenuation;
+		gains[5] = left_right_pan * front_back_pan * attenuation;
+	} else {
+		for (int c = 0; c < channels; c++) gains[c] = attenuation / channels;
+	}
+}
+
+// Mixes the next bus->frame_count frames of a player into bus and advances the player.
+// Caller has checked that the voice should play, and holds audio_mixer_lock.
+void 
+audio_player_mix(Audio_Player *p, Audio_Format out_format, Audio_Planar_Buffer *bus) {
+	
+	// #Cleanup #Memory refactor intermediate buffers
+	local_persist thread_local void *raw_buffer = 0;
+	local_persist thread_local u64 raw_buffer_size = 0;
+	local_persist thread_local Audio_Planar_Buffer voice = {0};
+	local_persist thread_local Audio_Planar_Buffer resampled = {0};
+	local_persist thread_local float32 *envelope = 0;
+	local_persist thread_local u64 envelope_capacity = 0;
+	
+	Audio_Voice *v = &p->voice;
+	Audio_Source *src = &v->source;
+	u64 number_of_output_frames = bus->frame_count;
+	
+	f64 sample_rate = (f64)src->format.sample_rate*(f64)p->config.playback_speed;
+	f64 ratio = sample_rate/(f64)out_format.sample_rate;
+	Audio_Resample_Quality quality = p->config.resample_quality;
+	
+	if (v->resampler.channels != out_format.channels) {
+		audio_resampler_reset(&v->resampler, out_format.channels);
+	}
+	
+	// Once a player has been resampled it stays on the resampler until it's forgotten (seek, new
+	// source), because the resampler has read ahead of frame_index.
+	bool resample = audio_resampler_step(ratio) != (1ull << 32) || v->resampler.active;
+	
+	u64 number_of_sample_frames = number_of_output_frames;
+	if (resample) {
+		number_of_sample_frames = audio_resampler_frames_needed(&v->resampler, quality, ratio, number_of_output_frames);
+	}
+	
+	audio_planar_buffer_reserve(&voice, out_format.channels, max(number_of_sample_frames, 1));
+	voice.frame_count = number_of_sample_frames;
+	
+	if (src->planar && src->format.channels == out_format.channels) {
+		// Prepared at load, nothing to convert
+		if (number_of_sample_frames > 0) {
+			v->frame_index = audio_source_sample_planar(src, v->frame_index, &voice, v->looping);
+		}
+	} else {
+		u64 in_frame_size = get_audio_bit_width_byte_size(src->format.bit_width)*src->format.channels;
+		u64 input_size = max(number_of_sample_frames, 1)*in_frame_size;
+		if (!raw_buffer || raw_buffer_size < input_size) {
+			if (raw_buffer) dealloc(get_heap_allocator(), raw_buffer);
+			raw_buffer_size = get_next_power_of_two(input_size);
+			raw_buffer = alloc(get_heap_allocator(), raw_buffer_size);
+		}
+		
+		// The resampler may already have read far enough ahead
+		if (number_of_sample_frames > 0) {
+			v->frame_index = audio_source_sample_next_frames(
+				src,
+				v->frame_index, 
 				number_of_sample_frames,
-				target_buffer,
-				p->looping
+				raw_buffer,
+				v->looping
 			);
-			if (p->frame_index > last_frame_index && (p->looping || p->frame_index != src.number_of_frames)) {
-				assert(p->frame_index - last_frame_index == number_of_sample_frames);
+			audio_frames_to_planar(&voice, raw_buffer, src->format, number_of_sample_frames);
+		}
+	}
+	
+	Audio_Planar_Buffer *mixed = &voice;
+	if (resample) {
+		audio_planar_buffer_reserve(&resampled, out_format.channels, number_of_output_frames);
+		audio_resampler_process(&v->resampler, quality, ratio, &voice, &resampled);
+		mixed = &resampled;
+	} else {
+		audio_resampler_push_history(&v->resampler, &voice);
+	}
+	
+	// Fade is counted in source frames, and spread over the output frames they became
+	float32 *fade = 0;
+	if (v->fade_frames > 0) {
+		u64 stride = (number_of_output_frames+3) & ~3ull;
+		if (envelope_capacity < stride) {
+			if (envelope) dealloc(get_heap_allocator(), envelope);
+			envelope_capacity = get_next_power_of_two(stride);
+			envelope = alloc(get_heap_allocator(), envelope_capacity*sizeof(float32));
+		}
+		
+		// Not number_of_sample_frames, the resampler reads ahead by a varying amount
+		u64 source_frames_played = max((u64)round((f64)number_of_output_frames*ratio), 1);
+		u64 frames_to_fade = min(v->fade_frames, source_frames_played);
+		u64 frames_faded_so_far = v->fade_frames_total-v->fade_frames;
+		u64 output_frames_to_fade = min((u64)round((f64)frames_to_fade*(f64)number_of_output_frames/(f64)source_frames_played), number_of_output_frames);
+		
+		f64 fade_from = (f64)frames_faded_so_far / (f64)v->fade_frames_total;
+		f64 fade_to   = (f64)(frames_faded_so_far + frames_to_fade) / (f64)v->fade_frames_total;
+		if (v->state != AUDIO_PLAYER_STATE_PLAYING) {
+			fade_from = 1.0-fade_from;
+			fade_to   = 1.0-fade_to;
+		}
+		
+		for (u64 f = 0; f < output_frames_to_fade; f++) {
+			f32 log_scale = log10f(1.0f + 9.0f*((f32)f/(f32)output_frames_to_fade));
+			envelope[f] = smerpf((f32)fade_from, (f32)fade_to, log_scale);
+		}
+		// Faded all the way in or out
+		for (u64 f = output_frames_to_fade; f < stride; f++) envelope[f] = (f32)fade_to;
+		
+		v->fade_frames -= frames_to_fade;
+		fade = envelope;
+	}
+	
+	float32 gains[AUDIO_MAX_CHANNELS];
+	if (p->config.enable_spacialization) {
+		audio_get_spacialization_gains(p->config.position_ndc, out_format.channels, gains);
+	} else {
+		for (int c = 0; c < out_format.channels; c++) gains[c] = 1.0f;
+	}
+	
+	for (int c = 0; c < out_format.channels; c++) {
+		audio_mix_planar(
+			audio_planar_channel(bus, c), 
+			audio_planar_channel(mixed, c), 
+			number_of_output_frames, 
+			gains[c]*p->config.volume, 
+			fade
+		);
+	}
+}
+
+// Over the voice cap the voice isn't mixed, but keeps moving so it comes back where it
+// would have been.
+void
+audio_player_skip(Audio_Player *p, u64 number_of_output_frames, Audio_Format out_format) {
+	Audio_Voice *v = &p->voice;
+	u64 number_of_frames = v->source.number_of_frames;
+	if (number_of_frames == 0) return;
+	
+	f64 ratio = (f64)v->source.format.sample_rate*(f64)p->config.playback_speed/(f64)out_format.sample_rate;
+	u64 frames = (u64)round((f64)number_of_output_frames*ratio);
+	
+	u64 frame_index = v->frame_index + frames;
+	if (frame_index >= number_of_frames) {
+		frame_index = v->looping ? frame_index % number_of_frames : number_of_frames;
+	}
+	v->frame_index = frame_index;
+	v->fade_frames = v->fade_frames > frames ? v->fade_frames-frames : 0;
+	
+	audio_resampler_forget(&v->resampler);
+}
+
+///
+// Buses
+//
+// Players are mixed into buses, and buses into other buses, ending in the master bus which goes
+// to the device. A bus can low-pass, reverb and limit whatever was mixed into it before it's
+// mixed on with its volume, so effects cost the same no matter how many voices go through them.
+// Like voices, the graph is owned by the audio thread and changed with commands. Bus configs are
+// read by the mixer every buffer and are safe to set whenever.
+// Everything runs on planar f32, once per buffer, deepest buses first.
+
+typedef struct Audio_Bus_Config {
+	float32 volume;             // (1.0 by default)
+	float32 lowpass_cutoff_hz;  // 0 is off
+	float32 lowpass_q;          // (0.707 by default)
+	float32 reverb_mix;         // 0 is off, 1 is only reverb
+	float32 reverb_decay;       // 0 - 1, how long the tail rings (0.5 by default)
+	float32 reverb_damping;     // 0 - 1, how much quicker the highs die out (0.5 by default)
+	bool enable_limiter;        // (on for the master bus)
+	float32 limiter_threshold;  // (0.98 by default)
+	float32 limiter_release_ms; // (100 by default)
+} Audio_Bus_Config;
+
+typedef struct Audio_Biquad {
+	// What the coefficients were made for
+	float32 cutoff_hz;
+	float32 q;
+	u32 sample_rate;
+	
+	float32 b0, b1, b2, a1, a2;
+	// y[n..n+3] for a 1 in each of x[n], x[n+1], x[n+2], x[n+3], x[n-1], x[n-2], y[n-1], y[n-2].
+	// Then 4 frames are 8 independent multiply-adds instead of a chain of 4 filter steps.
+	float32 block[8][4];
+	
+	float32 x1[AUDIO_MAX_CHANNELS];
+	float32 x2[AUDIO_MAX_CHANNELS];
+	float32 y1[AUDIO_MAX_CHANNELS];
+	float32 y2[AUDIO_MAX_CHANNELS];
+} Audio_Biquad;
+
+#define AUDIO_REVERB_LINES 4
+#define AUDIO_REVERB_CHUNK_FRAMES 256 // No line is shorter than this
+
+// Feedback delay network: damped delay lines that feed back into each other through a
+// Hadamard matrix. Lines are at least a chunk long, so a whole chunk is read from every line
+// before anything is written back and each step is SIMD over frames.
+typedef struct Audio_Reverb {
+	float32 *lines; // One after another
+	u32 sample_rate;
+	u32 lengths[AUDIO_REVERB_LINES];
+	u32 positions[AUDIO_REVERB_LINES];
+	float32 damped[AUDIO_REVERB_LINES];
+} Audio_Reverb;
+
+typedef struct Audio_Limiter {
+	float32 gain;
+} Audio_Limiter;
+
+// What the mixer does with a bus. Only the thread mixing touches this.
+typedef struct Audio_Bus_Mix {
+	bool in_use;
+	Audio_Bus_Id output;
+	u64 depth; // Buses between this one and the master bus
+	bool has_input; // Something was mixed into buffer this time
+	Audio_Planar_Buffer buffer;
+	Audio_Biquad lowpass;
+	Audio_Reverb reverb;
+	Audio_Limiter limiter;
+} Audio_Bus_Mix;
+
+typedef struct Audio_Bus {
+	// What was last asked for
+	bool allocated;
+	Audio_Bus_Id output;
+	
+	// Owned by the audio thread
+	Audio_Bus_Mix mix;
+	
+	// This is safe to set whenever
+	Audio_Bus_Config config;
+} Audio_Bus;
+
+// #Global
+ogb_instance Audio_Bus audio_buses[AUDIO_MAX_BUSES];
+ogb_instance volatile bool audio_buses_initted;
+ogb_instance Spinlock audio_bus_lock; // Game threads changing the graph
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+Audio_Bus audio_buses[AUDIO_MAX_BUSES] = {0};
+volatile bool audio_buses_initted = false;
+Spinlock audio_bus_lock = {0};
+#endif
+
+Audio_Bus_Config
+audio_bus_default_config() {
+	Audio_Bus_Config config = ZERO(Audio_Bus_Config);
+	config.volume = 1.0;
+	config.lowpass_q = 0.707f;
+	config.reverb_decay = 0.5f;
+	config.reverb_damping = 0.5f;
+	config.limiter_threshold = 0.98f;
+	config.limiter_release_ms = 100.0f;
+	return config;
+}
+
+void
+audio_buses_init() {
+	if (audio_buses_initted) return;
+	spinlock_acquire_or_wait(&audio_bus_lock);
+	if (!audio_buses_initted) {
+		for (u64 i = 0; i < AUDIO_BUS_BUILTIN_COUNT; i++) {
+			Audio_Bus *bus = &audio_buses[i];
+			bus->allocated = true;
+			bus->output = i == AUDIO_BUS_MASTER ? AUDIO_BUS_INVALID : AUDIO_BUS_MASTER;
+			bus->config = audio_bus_default_config();
+			// The mixer waits for this before it looks at any bus
+			bus->mix.in_use = true;
+			bus->mix.output = bus->output;
+			bus->mix.limiter.gain = 1.0;
+		}
+		audio_buses[AUDIO_BUS_MASTER].config.enable_limiter = true;
+		MEMORY_BARRIER;
+		audio_buses_initted = true;
+	}
+	spinlock_release(&audio_bus_lock);
+}
+
+Audio_Bus *
+audio_bus_get(Audio_Bus_Id id) {
+	audio_buses_init();
+	assert(id < AUDIO_MAX_BUSES && audio_buses[id].allocated, "Invalid audio bus %d", id);
+	return &audio_buses[id];
+}
+
+void
+audio_bus_push_command(Audio_Command_Kind kind, Audio_Bus_Id id, Audio_Bus_Id output) {
+	Audio_Command c = ZERO(Audio_Command);
+	c.kind = kind;
+	c.bus.bus = id;
+	c.bus.output = output;
+	audio_command_push(&c);
+}
+
+// Mixed into output, or the master bus if output is AUDIO_BUS_INVALID.
+// Returns AUDIO_BUS_INVALID if all AUDIO_MAX_BUSES buses are taken.
+Audio_Bus_Id
+audio_bus_create(Audio_Bus_Id output) {
+	audio_buses_init();
+	if (output >= AUDIO_MAX_BUSES) output = AUDIO_BUS_MASTER;
+	
+	spinlock_acquire_or_wait(&audio_bus_lock);
+	assert(audio_buses[output].allocated, "Invalid audio bus %d", output);
+	
+	Audio_Bus_Id id = AUDIO_BUS_INVALID;
+	for (u64 i = AUDIO_BUS_BUILTIN_COUNT; i < AUDIO_MAX_BUSES; i++) {
+		if (!audio_buses[i].allocated) {
+			id = (Audio_Bus_Id)i;
+			break;
+		}
+	}
+	if (id != AUDIO_BUS_INVALID) {
+		Audio_Bus *bus = &audio_buses[id];
+		bus->allocated = true;
+		bus->output = output;
+		bus->config = audio_bus_default_config();
+		audio_bus_push_command(AUDIO_COMMAND_BUS_CREATE, id, output);
+	}
+	
+	spinlock_release(&audio_bus_lock);
+	return id;
+}
+
+// Returns false if that would make a loop
+bool
+audio_bus_set_output(Audio_Bus_Id id, Audio_Bus_Id output) {
+	audio_buses_init();
+	if (output >= AUDIO_MAX_BUSES) output = AUDIO_BUS_MASTER;
+	
+	spinlock_acquire_or_wait(&audio_bus_lock);
+	assert(id < AUDIO_MAX_BUSES && id != AUDIO_BUS_MASTER && audio_buses[id].allocated, "Can't route audio bus %d", id);
+	assert(audio_buses[output].allocated, "Invalid audio bus %d", output);
+	
+	for (Audio_Bus_Id b = output; b != AUDIO_BUS_INVALID; b = audio_buses[b].output) {
+		if (b == id) {
+			spinlock_release(&audio_bus_lock);
+			return false;
+		}
+	}
+	
+	audio_buses[id].output = output;
+	audio_bus_push_command(AUDIO_COMMAND_BUS_SET_OUTPUT, id, output);
+	
+	spinlock_release(&audio_bus_lock);
+	return true;
+}
+
+// Buses mixed into this one go to the master bus. So do players, until the id is handed out again.
+void
+audio_bus_destroy(Audio_Bus_Id id) {
+	audio_buses_init();
+	
+	spinlock_acquire_or_wait(&audio_bus_lock);
+	assert(id >= AUDIO_BUS_BUILTIN_COUNT && id < AUDIO_MAX_BUSES && audio_buses[id].allocated, "Can't destroy audio bus %d", id);
+	
+	for (u64 i = 0; i < AUDIO_MAX_BUSES; i++) {
+		Audio_Bus *bus = &audio_buses[i];
+		if (bus->allocated && bus->output == id) {
+			bus->output = AUDIO_BUS_MASTER;
+			audio_bus_push_command(AUDIO_COMMAND_BUS_SET_OUTPUT, (Audio_Bus_Id)i, AUDIO_BUS_MASTER);
+		}
+	}
+	audio_bus_push_command(AUDIO_COMMAND_BUS_DESTROY, id, AUDIO_BUS_INVALID);
+	audio_buses[id].allocated = false;
+	
+	spinlock_release(&audio_bus_lock);
+}
+
+// Caller must hold audio_mixer_lock
+void
+audio_bus_apply_command(Audio_Command_Kind kind, Audio_Bus_Id id, Audio_Bus_Id output) {
+	Audio_Bus_Mix *mix = &audio_buses[id].mix;
+	switch (kind) {
+		case AUDIO_COMMAND_BUS_CREATE: {
+			mix->in_use = true;
+			mix->output = output;
+			mix->limiter.gain = 1.0;
+			break;
+		}
+		case AUDIO_COMMAND_BUS_SET_OUTPUT: mix->output = output; break;
+		case AUDIO_COMMAND_BUS_DESTROY: {
+			audio_planar_buffer_destroy(&mix->buffer);
+			if (mix->reverb.lines) dealloc(get_heap_allocator(), mix->reverb.lines);
+			*mix = ZERO(Audio_Bus_Mix);
+			break;
+		}
+		default: break;
+	}
+}
+
+// Where something mixed into id actually goes
+inline Audio_Bus_Id
+audio_bus_resolve(Audio_Bus_Id id) {
+	if (id >= AUDIO_MAX_BUSES || !audio_buses[id].mix.in_use) return AUDIO_BUS_MASTER;
+	return id;
+}
+
+// The bus buffer to mix into. Cleared the first time this buffer.
+Audio_Planar_Buffer *
+audio_bus_begin_input(Audio_Bus_Id id, int channels, u64 frame_count) {
+	Audio_Bus_Mix *mix = &audio_buses[id].mix;
+	if (!mix->has_input) {
+		audio_planar_buffer_reserve(&mix->buffer, channels, frame_count);
+		audio_planar_buffer_clear(&mix->buffer);
+		mix->has_input = true;
+	}
+	return &mix->buffer;
+}
+
+void
+audio_biquad_update_lowpass(Audio_Biquad *f, float32 cutoff_hz, float32 q, u32 sample_rate) {
+	if (f->cutoff_hz == cutoff_hz && f->q == q && f->sample_rate == sample_rate) return;
+	f->cutoff_hz = cutoff_hz;
+	f->q = q;
+	f->sample_rate = sample_rate;
+	
+	// From the Audio EQ Cookbook
+	f64 w0 = 2.0*PI64*min((f64)cutoff_hz, (f64)sample_rate*0.49)/(f64)sample_rate;
+	f64 alpha = sin(w0)/(2.0*max((f64)q, 0.1));
+	f64 cos_w0 = cos(w0);
+	f64 a0 = 1.0+alpha;
+	f->b0 = (float32)((1.0-cos_w0)*0.5/a0);
+	f->b1 = (float32)((1.0-cos_w0)/a0);
+	f->b2 = f->b0;
+	f->a1 = (float32)(-2.0*cos_w0/a0);
+	f->a2 = (float32)((1.0-alpha)/a0);
+	
+	for (int k = 0; k < 8; k++) {
+		// x[n-2..n+3] and y[n-2..n+3], with a 1 where this column reads from
+		float32 x[6] = {0};
+		float32 y[6] = {0};
+		if (k < 4)       x[k+2] = 1;
+		else if (k == 4) x[1] = 1;
+		else if (k == 5) x[0] = 1;
+		else if (k == 6) y[1] = 1;
+		else             y[0] = 1;
+		for (int n = 2; n < 6; n++) {
+			y[n] = f->b0*x[n] + f->b1*x[n-1] + f->b2*x[n-2] - f->a1*y[n-1] - f->a2*y[n-2];
+			f->block[k][n-2] = y[n];
+		}
+	}
+}
+
+void
+audio_biquad_process(Audio_Biquad *f, Audio_Planar_Buffer *b) {
+	u64 frame_count = b->frame_count;
+	for (int c = 0; c < b->channels; c++) {
+		float32 *data = audio_planar_channel(b, c);
+		float32 x1 = f->x1[c];
+		float32 x2 = f->x2[c];
+		float32 y1 = f->y1[c];
+		float32 y2 = f->y2[c];
+		u64 i = 0;
+		
+#if ENABLE_SIMD
+		__m128 k0 = _mm_loadu_ps(f->block[0]);
+		__m128 k1 = _mm_loadu_ps(f->block[1]);
+		__m128 k2 = _mm_loadu_ps(f->block[2]);
+		__m128 k3 = _mm_loadu_ps(f->block[3]);
+		__m128 k4 = _mm_loadu_ps(f->block[4]);
+		__m128 k5 = _mm_loadu_ps(f->block[5]);
+		__m128 k6 = _mm_loadu_ps(f->block[6]);
+		__m128 k7 = _mm_loadu_ps(f->block[7]);
+		__m128 xm1 = _mm_set1_ps(x1);
+		__m128 xm2 = _mm_set1_ps(x2);
+		__m128 ym1 = _mm_set1_ps(y1);
+		__m128 ym2 = _mm_set1_ps(y2);
+		for (; i+4 <= frame_count; i += 4) {
+			__m128 x = _mm_load_ps(data+i);
+			__m128 y = _mm_mul_ps(k0, _mm_shuffle_ps(x, x, _MM_SHUFFLE(0, 0, 0, 0)));
+			y = _mm_add_ps(y, _mm_mul_ps(k1, _mm_shuffle_ps(x, x, _MM_SHUFFLE(1, 1, 1, 1))));
+			y = _mm_add_ps(y, _mm_mul_ps(k2, _mm_shuffle_ps(x, x, _MM_SHUFFLE(2, 2, 2, 2))));
+			y = _mm_add_ps(y, _mm_mul_ps(k3, _mm_shuffle_ps(x, x, _MM_SHUFFLE(3, 3, 3, 3))));
+			y = _mm_add_ps(y, _mm_mul_ps(k4, xm1));
+			y = _mm_add_ps(y, _mm_mul_ps(k5, xm2));
+			// Only these depend on the last block
+			y = _mm_add_ps(y, _mm_add_ps(_mm_mul_ps(k6, ym1), _mm_mul_ps(k7, ym2)));
+			_mm_store_ps(data+i, y);
+			xm1 = _mm_shuffle_ps(x, x, _MM_SHUFFLE(3, 3, 3, 3));
+			xm2 = _mm_shuffle_ps(x, x, _MM_SHUFFLE(2, 2, 2, 2));
+			ym1 = _mm_shuffle_ps(y, y, _MM_SHUFFLE(3, 3, 3, 3));
+			ym2 = _mm_shuffle_ps(y, y, _MM_SHUFFLE(2, 2, 2, 2));
+		}
+		x1 = _mm_cvtss_f32(xm1);
+		x2 = _mm_cvtss_f32(xm2);
+		y1 = _mm_cvtss_f32(ym1);
+		y2 = _mm_cvtss_f32(ym2);
+#endif
+		
+		for (; i < frame_count; i++) {
+			float32 x = data[i];
+			float32 y = f->b0*x + f->b1*x1 + f->b2*x2 - f->a1*y1 - f->a2*y2;
+			x2 = x1;
+			x1 = x;
+			y2 = y1;
+			y1 = y;
+			data[i] = y;
+		}
+		
+		// Denormals would make every buffer slow once it goes quiet
+		if (fabsf(y1) < 1e-15f && fabsf(y2) < 1e-15f) {
+			y1 = 0;
+			y2 = 0;
+		}
+		f->x1[c] = x1;
+		f->x2[c] = x2;
+		f->y1[c] = y1;
+		f->y2[c] = y2;
+	}
+}
+
+// data[i] = a*data[i] + d*data[i-1], the low-pass inside each reverb line
+void
+audio_one_pole_process(float32 *data, u64 frame_count, float32 a, float32 d, float32 *state) {
+	float32 y = *state;
+	u64 i = 0;
+#if ENABLE_SIMD
+	// Same trick as audio_biquad_process, 4 frames at a time
+	float32 d2 = d*d;
+	float32 d3 = d2*d;
+	__m128 k0 = _mm_setr_ps(a, a*d, a*d2, a*d3);
+	__m128 k1 = _mm_setr_ps(0, a, a*d, a*d2);
+	__m128 k2 = _mm_setr_ps(0, 0, a, a*d);
+	__m128 k3 = _mm_setr_ps(0, 0, 0, a);
+	__m128 ky = _mm_setr_ps(d, d2, d3, d3*d);
+	__m128 ym1 = _mm_set1_ps(y);
+	for (; i+4 <= frame_count; i += 4) {
+		__m128 x = _mm_load_ps(data+i);
+		__m128 out = _mm_mul_ps(k0, _mm_shuffle_ps(x, x, _MM_SHUFFLE(0, 0, 0, 0)));
+		out = _mm_add_ps(out, _mm_mul_ps(k1, _mm_shuffle_ps(x, x, _MM_SHUFFLE(1, 1, 1, 1))));
+		out = _mm_add_ps(out, _mm_mul_ps(k2, _mm_shuffle_ps(x, x, _MM_SHUFFLE(2, 2, 2, 2))));
+		out = _mm_add_ps(out, _mm_mul_ps(k3, _mm_shuffle_ps(x, x, _MM_SHUFFLE(3, 3, 3, 3))));
+		out = _mm_add_ps(out, _mm_mul_ps(ky, ym1));
+		_mm_store_ps(data+i, out);
+		ym1 = _mm_shuffle_ps(out, out, _MM_SHUFFLE(3, 3, 3, 3));
+	}
+	y = _mm_cvtss_f32(ym1);
+#endif
+	for (; i < frame_count; i++) {
+		y = a*data[i] + d*y;
+		data[i] = y;
+	}
+	*state = y;
+}
+
+// Copies frames out of a delay line starting at position, or into it if write
+void
+audio_reverb_line_copy(float32 *line, u32 length, u32 position, float32 *frames, u64 frame_count, bool write) {
+	u64 first = min((u64)(length-position), frame_count);
+	if (write) {
+		memcpy(line+position, frames, first*sizeof(float32));
+		memcpy(line, frames+first, (frame_count-first)*sizeof(float32));
+	} else {
+		memcpy(frames, line+position, first*sizeof(float32));
+		memcpy(frames+first, line, (frame_count-first)*sizeof(float32));
+	}
+}
+
+// dst = dst*dry + (a+b)*wet. Rounded up to 4 frames like audio_mix_planar.
+void
+audio_reverb_mix_wet(float32 *dst, float32 *a, float32 *b, u64 frame_count, float32 dry, float32 wet) {
+	u64 count = (frame_count+3) & ~3ull;
+	u64 i = 0;
+#if ENABLE_SIMD
+	__m128 vdry = _mm_set1_ps(dry);
+	__m128 vwet = _mm_set1_ps(wet);
+	for (; i < count; i += 4) {
+		__m128 w = _mm_mul_ps(_mm_add_ps(_mm_load_ps(a+i), _mm_load_ps(b+i)), vwet);
+		_mm_store_ps(dst+i, _mm_add_ps(_mm_mul_ps(_mm_load_ps(dst+i), vdry), w));
+	}
+#endif
+	for (; i < count; i++) {
+		dst[i] = dst[i]*dry + (a[i]+b[i])*wet;
+	}
+}
+
+void
+audio_reverb_process(Audio_Reverb *r, Audio_Planar_Buffer *b, u32 sample_rate, float32 mix, float32 decay, float32 damping) {
+	// Freeverb's comb lengths at 44.1khz, far enough from multiples of each other that echoes don't pile up
+	const u32 lengths_44k[AUDIO_REVERB_LINES] = { 1116, 1277, 1422, 1617 };
+	
+	// #Cleanup #Memory refactor intermediate buffers
+	local_persist thread_local Audio_Planar_Buffer scratch = {0};
+	
+	if (r->sample_rate != sample_rate) {
+		if (r->lines) dealloc(get_heap_allocator(), r->lines);
+		u64 total = 0;
+		for (int k = 0; k < AUDIO_REVERB_LINES; k++) {
+			u32 length = (u32)round((f64)lengths_44k[k]*(f64)sample_rate/44100.0);
+			r->lengths[k] = max(length, AUDIO_REVERB_CHUNK_FRAMES);
+			r->positions[k] = 0;
+			r->damped[k] = 0;
+			total += r->lengths[k];
+		}
+		r->lines = alloc(get_heap_allocator(), total*sizeof(float32));
+		memset(r->lines, 0, total*sizeof(float32));
+		r->sample_rate = sample_rate;
+	}
+	
+	float32 *lines[AUDIO_REVERB_LINES];
+	lines[0] = r->lines;
+	for (int k = 1; k < AUDIO_REVERB_LINES; k++) lines[k] = lines[k-1] + r->lengths[k-1];
+	
+	mix = clamp(mix, 0.0f, 1.0f);
+	// The Hadamard matrix times 0.5 keeps the energy, so this alone decides how long it rings
+	float32 feedback = 0.5f*(0.7f + 0.28f*clamp(decay, 0.0f, 1.0f));
+	float32 damp = 0.7f*clamp(damping, 0.0f, 1.0f);
+	float32 input_gain = 1.0f/(float32)b->channels;
+	// Keeps the lines out of denormals when it goes quiet, -360dB of DC
+	const float32 tiny = 1e-18f;
+	
+	// Input, then the lines
+	audio_planar_buffer_reserve(&scratch, AUDIO_REVERB_LINES+1, AUDIO_REVERB_CHUNK_FRAMES);
+	float32 *in = audio_planar_channel(&scratch, 0);
+	float32 *out[AUDIO_REVERB_LINES];
+	for (int k = 0; k < AUDIO_REVERB_LINES; k++) out[k] = audio_planar_channel(&scratch, k+1);
+	
+	for (u64 first = 0; first < b->frame_count; first += AUDIO_REVERB_CHUNK_FRAMES) {
+		u64 n = min(AUDIO_REVERB_CHUNK_FRAMES, b->frame_count-first);
+		u64 count = (n+3) & ~3ull;
+		
+		memset(in, 0, count*sizeof(float32));
+		for (int c = 0; c < b->channels; c++) {
+			audio_mix_planar(in, audio_planar_channel(b, c)+first, n, input_gain, 0);
+		}
+		
+		// What comes out now went in lengths[k] frames ago
+		for (int k = 0; k < AUDIO_REVERB_LINES; k++) {
+			audio_reverb_line_copy(lines[k], r->lengths[k], r->positions[k], out[k], n, false);
+			for (u64 i = n; i < count; i++) out[k][i] = 0;
+			audio_one_pole_process(out[k], n, 1.0f-damp, damp, &r->damped[k]);
+		}
+		
+		// Two lines to the left, two to the right
+		if (b->channels == 1) {
+			float32 *dst = audio_planar_channel(b, 0)+first;
+			audio_reverb_mix_wet(dst, out[0], out[2], n, 1.0f-mix, mix*0.25f);
+			audio_reverb_mix_wet(dst, out[1], out[3], n, 1.0f, mix*0.25f);
+		} else {
+			for (int c = 0; c < b->channels; c++) {
+				float32 *dst = audio_planar_channel(b, c)+first;
+				if (c % 2 == 0) audio_reverb_mix_wet(dst, out[0], out[2], n, 1.0f-mix, mix*0.5f);
+				else            audio_reverb_mix_wet(dst, out[1], out[3], n, 1.0f-mix, mix*0.5f);
 			}
+		}
+		
+		// Mix the lines with each other and feed them back with the input
+		u64 i = 0;
+#if ENABLE_SIMD
+		__m128 vfeedback = _mm_set1_ps(feedback);
+		__m128 vtiny = _mm_set1_ps(tiny);
+		for (; i < count; i += 4) {
+			__m128 l0 = _mm_load_ps(out[0]+i);
+			__m128 l1 = _mm_load_ps(out[1]+i);
+			__m128 l2 = _mm_load_ps(out[2]+i);
+			__m128 l3 = _mm_load_ps(out[3]+i);
+			__m128 x = _mm_add_ps(_mm_load_ps(in+i), vtiny);
+			__m128 s = _mm_add_ps(l0, l1);
+			__m128 t = _mm_sub_ps(l0, l1);
+			__m128 u = _mm_add_ps(l2, l3);
+			__m128 v = _mm_sub_ps(l2, l3);
+			_mm_store_ps(out[0]+i, _mm_add_ps(_mm_mul_ps(_mm_add_ps(s, u), vfeedback), x));
+			_mm_store_ps(out[1]+i, _mm_add_ps(_mm_mul_ps(_mm_add_ps(t, v), vfeedback), x));
+			_mm_store_ps(out[2]+i, _mm_add_ps(_mm_mul_ps(_mm_sub_ps(s, u), vfeedback), x));
+			_mm_store_ps(out[3]+i, _mm_add_ps(_mm_mul_ps(_mm_sub_ps(t, v), vfeedback), x));
+		}
+#endif
+		for (; i < count; i++) {
+			float32 x = in[i] + tiny;
+			float32 s = out[0][i] + out[1][i];
+			float32 t = out[0][i] - out[1][i];
+			float32 u = out[2][i] + out[3][i];
+			float32 v = out[2][i] - out[3][i];
+			out[0][i] = (s+u)*feedback + x;
+			out[1][i] = (t+v)*feedback + x;
+			out[2][i] = (s-u)*feedback + x;
+			out[3][i] = (t-v)*feedback + x;
+		}
+		
+		for (int k = 0; k < AUDIO_REVERB_LINES; k++) {
+			audio_reverb_line_copy(lines[k], r->lengths[k], r->positions[k], out[k], n, true);
+			r->positions[k] = (u32)((r->positions[k] + n) % r->lengths[k]);
+		}
+	}
+}
+
+// Writes a gain per frame to envelope, so that no sample of b*volume*envelope goes over threshold.
+// Attack is instant so nothing gets past, and the gain comes back up over release_ms.
+void
+audio_limiter_process(Audio_Limiter *l, Audio_Planar_Buffer *b, float32 volume, float32 threshold, 
+                      float32 release_ms, u32 sample_rate, float32 *envelope) {
+	u64 frame_count = b->frame_count;
+	u64 stride = b->stride;
+	
+	// Loudest channel of every frame first
+	u64 f = 0;
+#if ENABLE_SIMD
+	__m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	for (; f < stride; f += 4) {
+		__m128 peak = _mm_setzero_ps();
+		for (int c = 0; c < b->channels; c++) {
+			peak = _mm_max_ps(peak, _mm_and_ps(_mm_load_ps(audio_planar_channel(b, c)+f), abs_mask));
+		}
+		_mm_store_ps(envelope+f, peak);
+	}
+#endif
+	for (; f < stride; f++) {
+		float32 peak = 0;
+		for (int c = 0; c < b->channels; c++) peak = max(peak, fabsf(audio_planar_channel(b, c)[f]));
+		envelope[f] = peak;
+	}
+	
+	float32 release = 1.0f - expf(-1000.0f/(max(release_ms, 1.0f)*(float32)sample_rate));
+	float32 gain = l->gain;
+	for (f = 0; f < frame_count; f++) {
+		float32 peak = envelope[f]*volume;
+		float32 target = peak > threshold ? threshold/peak : 1.0f;
+		gain += (1.0f-gain)*release;
+		if (gain > target) gain = target;
+		envelope[f] = gain;
+	}
+	for (; f < stride; f++) envelope[f] = gain;
+	l->gain = gain;
+}
+
+// Runs the effects of every bus and mixes it into its output, deepest buses first, and the
+// master bus into output. Caller holds audio_mixer_lock.
+void
+audio_buses_process(Audio_Format format, Audio_Planar_Buffer *output) {
+	
+	// #Cleanup #Memory refactor intermediate buffers
+	local_persist thread_local float32 *envelope = 0;
+	local_persist thread_local u64 envelope_capacity = 0;
+	
+	u64 frame_count = output->frame_count;
+	
+	u64 max_depth = 0;
+	for (u64 i = 0; i < AUDIO_MAX_BUSES; i++) {
+		Audio_Bus_Mix *mix = &audio_buses[i].mix;
+		if (!mix->in_use) continue;
+		mix->depth = 0;
+		// Commands never make a loop, but don't count on it here
+		Audio_Bus_Id b = (Audio_Bus_Id)i;
+		while (b != AUDIO_BUS_MASTER && mix->depth < AUDIO_MAX_BUSES) {
+			b = audio_bus_resolve(audio_buses[b].mix.output);
+			mix->depth += 1;
+		}
+		max_depth = max(max_depth, mix->depth);
+	}
+	
+	for (s64 depth = (s64)max_depth; depth >= 0; depth--) {
+		for (u64 i = 0; i < AUDIO_MAX_BUSES; i++) {
+			Audio_Bus *bus = &audio_buses[i];
+			Audio_Bus_Mix *mix = &bus->mix;
+			if (!mix->in_use || mix->depth != (u64)depth) continue;
 			
-			if (p->fade_frames > 0) {
-				u64 frames_to_fade = min(p->fade_frames, number_of_sample_frames);
-				
-				u64 frames_faded_so_far = (p->fade_frames_total-p->fade_frames);
-				
-				switch (p->state) {
-					case AUDIO_PLAYER_STATE_PLAYING: {
-						// We need to fade in
-						float64 fade_from 
-							= (f64)frames_faded_so_far / (f64)p->fade_frames_total;
-							
-						float64 fade_to 
-							= (f64)(frames_faded_so_far + frames_to_fade) / (f64)p->fade_frames_total;
-						audio_apply_fade_in(
-							target_buffer, 
-							frames_to_fade, 
-							p->source.format, 
-							fade_from,
-							fade_to
-						);
-						break;
-					}
-					case AUDIO_PLAYER_STATE_PAUSED: {
-						// We need to fade out
-						// #Bug #Incomplete
-						// I can't get this to fade out without noise.
-						// I tried dithering but that didn't help.
-						float64 fade_from 
-							= 1.0 - (f64)frames_faded_so_far / (f64)p->fade_frames_total;
-							
-						float64 fade_to 
-							= 1.0 - (f64)(frames_faded_so_far + frames_to_fade) / (f64)p->fade_frames_total;
-						audio_apply_fade_out(
-							target_buffer, 
-							frames_to_fade, 
-							p->source.format, 
-							fade_from,
-							fade_to
-						);
-						break;
-					}
-				}
-				
-				p->fade_frames -= frames_to_fade;
-				
-				if (frames_to_fade < number_of_sample_frames) {
-					memset(
-						(u8*)target_buffer+frames_to_fade, 
-						0, 
-						number_of_sample_frames-frames_to_fade
-					);
-				}
+			// Copy, the game may be changing it
+			Audio_Bus_Config config = bus->config;
+			bool reverb = config.reverb_mix > 0;
+			
+			// Nothing came in and nothing rings on
+			if (!mix->has_input && !reverb && i != AUDIO_BUS_MASTER) {
+				memset(mix->lowpass.x1, 0, sizeof(mix->lowpass.x1));
+				memset(mix->lowpass.x2, 0, sizeof(mix->lowpass.x2));
+				memset(mix->lowpass.y1, 0, sizeof(mix->lowpass.y1));
+				memset(mix->lowpass.y2, 0, sizeof(mix->lowpass.y2));
+				continue;
 			}
 			
-			spinlock_release(&p->sample_lock);
-						
-			if (need_convert) {
-				int converted = convert_frames(
-					mix_buffer, 
-					out_format, 
-					convert_buffer, 
-					sample_format,
-					number_of_output_frames
-				);
-				assert(converted == number_of_output_frames);
+			Audio_Planar_Buffer *buffer = audio_bus_begin_input((Audio_Bus_Id)i, format.channels, frame_count);
+			
+			if (config.lowpass_cutoff_hz > 0) {
+				audio_biquad_update_lowpass(&mix->lowpass, config.lowpass_cutoff_hz, config.lowpass_q, format.sample_rate);
+				audio_biquad_process(&mix->lowpass, buffer);
 			}
-
-			if (p->config.enable_spacialization) {
-				apply_audio_spacialization(mix_buffer, out_format, number_of_output_frames, p->config.position_ndc);
+			if (reverb) {
+				audio_reverb_process(&mix->reverb, buffer, format.sample_rate, config.reverb_mix, config.reverb_decay, config.reverb_damping);
 			}
-			if (p->config.volume != 0.0) {
-				apply_audio_volume(mix_buffer, out_format, number_of_output_frames, p->config.volume);
+			
+			float32 *gain = 0;
+			if (config.enable_limiter) {
+				if (envelope_capacity < buffer->stride) {
+					if (envelope) dealloc(get_heap_allocator(), envelope);
+					envelope_capacity = get_next_power_of_two(buffer->stride);
+					envelope = alloc(get_heap_allocator(), envelope_capacity*sizeof(float32));
+				}
+				audio_limiter_process(&mix->limiter, buffer, config.volume, config.limiter_threshold, 
+				                      config.limiter_release_ms, format.sample_rate, envelope);
+				gain = envelope;
+			}
+			
+			Audio_Planar_Buffer *dst = output;
+			if (i != AUDIO_BUS_MASTER) {
+				dst = audio_bus_begin_input(audio_bus_resolve(mix->output), format.channels, frame_count);
+			}
+			for (int c = 0; c < format.channels; c++) {
+				audio_mix_planar(audio_planar_channel(dst, c), audio_planar_channel(buffer, c), frame_count, config.volume, gain);
 			}
 			
-			mix_frames(output, mix_buffer, number_of_output_frames, out_format);
+			mix->has_input = false;
+		}
+	}
+}
+
+typedef struct Audio_Voice_Rank {
+	Audio_Player *player;
+	s32 priority;
+	float32 volume;
+	u64 start_order;
+} Audio_Voice_Rank;
+
+// The voices we keep first: highest priority, then loudest, then newest
+int
+audio_compare_voice_rank(const void *a, const void *b) {
+	const Audio_Voice_Rank *ra = (const Audio_Voice_Rank*)a;
+	const Audio_Voice_Rank *rb = (const Audio_Voice_Rank*)b;
+	if (ra->priority != rb->priority) return ra->priority > rb->priority ? -1 : 1;
+	if (ra->volume != rb->volume) return ra->volume > rb->volume ? -1 : 1;
+	if (ra->start_order != rb->start_order) return ra->start_order > rb->start_order ? -1 : 1;
+	return 0;
+}
+
+// Applies commands and mixes every playing voice into its bus, and the buses into output.
+// Caller must hold audio_mixer_lock.
+// Returns the number of voices that were mixed into the output.
+u64
+audio_mix_voices(u64 number_of_output_frames, Audio_Format out_format, void *output) {
+	
+	audio_buses_init();
+	audio_commands_apply();
+	
+	// #Cleanup #Memory refactor intermediate buffers
+	local_persist thread_local Audio_Planar_Buffer mixed = {0};
+	audio_planar_buffer_reserve(&mixed, out_format.channels, number_of_output_frames);
+	audio_planar_buffer_clear(&mixed);
+	
+	Audio_Player_Pool *pool = &audio_player_pool;
+	
+	u64 *started_this_frame;
+	growing_array_init((void**)&started_this_frame, sizeof(u64), get_temporary_allocator());
+	
+	Audio_Voice_Rank *audible;
+	growing_array_init((void**)&audible, sizeof(Audio_Voice_Rank), get_temporary_allocator());
+	
+	u64 i = 0;
+	while (pool->active && i < growing_array_get_valid_count(pool->active)) {
+		// Freeing or deactivating moves the last active player to i
+		Audio_Player *p = pool->active[i];
+		Audio_Voice *v = &p->voice;
+		
+		if (v->release_when_done && (v->frame_index >= v->source.number_of_frames
+									  || !v->has_source)) {
+			audio_player_free(p);
+			continue;
+		}
+		
+		// Only a command can make these audible again
+		if (!v->has_source
+		    || (v->state != AUDIO_PLAYER_STATE_PLAYING && v->fade_frames == 0)
+		    || (v->frame_index >= v->source.number_of_frames && !v->looping)) {
+			audio_player_deactivate(p);
+			continue;
+		}
+		
+		i += 1;
+		
+		// #Incomplete Reverse playback ?
+		if (p->config.playback_speed <= 0.0) continue;
+		
+		// :PhaseCancellation
+		if (v->frame_index == 0) { // The players' source just started playing
+		
+			s64 existing_index = growing_array_find_index_from_left_by_value((void**)&started_this_frame, &v->source.uid);
 			
-			mutex_release(&src.mutex_for_destroy);
+			if (existing_index != -1) {
+				// If this source already started playing this round from another player, then we pretend that
+				// we're already done playing by skipping to the last frame.
+				// For non-looping players, this means we don't play this instance at all.
+				// For looping players, this means we have a slight offset between the players that start
+				// playing at the exact same time. I'm not sure how else to deal with phase cancellation
+				// in looping players.
+				// #Incomplete player->is_muted_for_phase_cancellation ? 
+				v->frame_index = v->source.number_of_frames;
+				continue;
+			}
+			growing_array_add((void**)&started_this_frame, &v->source.uid);
 		}
 		
-		block = block->next;
+		Audio_Voice_Rank rank = { p, p->config.priority, p->config.volume, v->start_order };
+		growing_array_add((void**)&audible, &rank);
+	}
+	
+	u64 audible_count = growing_array_get_valid_count(audible);
+	u64 voice_limit = audible_count;
+	if (audio_max_voices > 0 && audible_count > audio_max_voices) {
+		Audio_Voice_Rank *help = alloc(get_temporary_allocator(), audible_count*sizeof(Audio_Voice_Rank));
+		merge_sort(audible, help, audible_count, sizeof(Audio_Voice_Rank), audio_compare_voice_rank);
+		voice_limit = audio_max_voices;
 	}
+	
+	for (i = 0; i < audible_count; i++) {
+		if (i >= voice_limit) {
+			audio_player_skip(audible[i].player, number_of_output_frames, out_format);
+			pool->voices_stolen += 1;
+			continue;
+		}
+		Audio_Player *p = audible[i].player;
+		Audio_Planar_Buffer *bus = audio_bus_begin_input(audio_bus_resolve(p->config.bus), out_format.channels, number_of_output_frames);
+		audio_player_mix(p, out_format, bus);
+	}
+	
+	audio_buses_process(out_format, &mixed);
+	audio_planar_to_frames(output, out_format, &mixed);
+	
+	return voice_limit;
+}
+
+// This is supposed to be called by OS layer audio thread whenever it wants more audio samples
+// Returns the number of voices that were mixed into the output.
+// The thread should be between audio_mixer_thread_begin/end, then game threads never take the
+// mixer lock. This never waits: if another mixer (a null device starting or stopping) holds the
+// lock, this buffer is silent.
+u64 
+do_program_audio_sample(u64 number_of_output_frames, Audio_Format out_format, 
+							 void *output) {
+							 
+	reset_temporary_storage();
+	
+	if (!spinlock_acquire_or_wait_timeout(&audio_mixer_lock, 0)) {
+		u64 frame_size = get_audio_bit_width_byte_size(out_format.bit_width)*out_format.channels;
+		memset(output, 0, number_of_output_frames*frame_size);
+		return 0;
+	}
+	
+	if (audio_null_device_count > 0) {
+		// A null device owns the players right now, if we mixed too they would advance twice
+		spinlock_release(&audio_mixer_lock);
+		u64 frame_size = get_audio_bit_width_byte_size(out_format.bit_width)*out_format.channels;
+		memset(output, 0, number_of_output_frames*frame_size);
+		return 0;
+	}
+	
+	u64 voices_mixed = audio_mix_voices(number_of_output_frames, out_format, output);
+	
+	spinlock_release(&audio_mixer_lock);
+	
+	return voices_mixed;
+}
+
+///
+// Null audio device
+//
+// Pulls from the mixer the same way an OS audio thread does, but without an audio device.
+// The output is either written to a WAV file or discarded, and the time spent mixing each
+// buffer is measured. This is what we use to benchmark and regression-test the mixer on
+// machines without audio (or in headless builds).
+//
+// The device mixes on its own thread, like a real device, and audio_null_device_run() blocks
+// until all buffers are done. While it runs, the OS audio device (if any) outputs silence so
+// the players only advance by what the null device mixes.
+
+typedef struct Audio_Null_Device Audio_Null_Device;
+
+// Called on the device thread before each buffer is mixed, to start/stop/move players.
+typedef void(*Audio_Null_Device_Buffer_Proc)(Audio_Null_Device *device, u64 buffer_index);
+
+typedef struct Audio_Null_Device_Config {
+	Audio_Format format;
+	u64 frames_per_buffer;
+	u64 number_of_buffers;
+	
+	// Sleep until the next buffer would be requested by a real device instead of mixing
+	// as fast as possible.
+	bool real_time;
+	
+	// Output is written here as a WAV file. Discarded if empty.
+	string wav_path;
+	
+	// Runs on the device thread, so it can push commands but must not wait for them
+	// (audio_commands_sync, audio_source_destroy).
+	Audio_Null_Device_Buffer_Proc before_buffer;
+	void *userdata;
+} Audio_Null_Device_Config;
+
+typedef struct Audio_Null_Device_Stats {
+	u64 buffers_mixed;
+	u64 frames_mixed;
+	
+	// How long one buffer lasts at the sample rate, i.e. the deadline for mixing it.
+	float64 buffer_seconds;
+	
+	float64 total_mix_seconds;
+	float64 average_mix_seconds;
+	float64 worst_mix_seconds;
+	float64 mix_jitter_seconds; // Standard deviation of the mix time
+	
+	u64 total_voices_mixed;
+	u64 max_voices_mixed;
+	float64 average_voices_mixed;
+	
+	// buffer_seconds minus the time spent mixing. Negative means a real device would have
+	// run dry, which is counted as an underrun.
+	float64 min_headroom_seconds;
+	float64 average_headroom_seconds;
+	u64 underruns;
+} Audio_Null_Device_Stats;
+
+typedef struct Audio_Null_Device {
+	Audio_Null_Device_Config config;
+	Audio_Null_Device_Stats stats;
+	File wav_file;
+	u64 wav_data_size;
+	bool ok;
+} Audio_Null_Device;
+
+#define AUDIO_WAV_HEADER_SIZE 44
+
+// Canonical 44 byte header, PCM for s16 and IEEE float for f32
+void
+audio_write_wav_header(u8 *header, Audio_Format format, u64 data_size) {
+	u16 comp_size = (u16)get_audio_bit_width_byte_size(format.bit_width);
+	u16 block_align = comp_size*(u16)format.channels;
+	u32 byte_rate = (u32)format.sample_rate*block_align;
+	
+	// 1 = PCM, 3 = IEEE float
+	u16 wav_format = format.bit_width == AUDIO_BITS_32 ? 3 : 1;
+	u16 channels = (u16)format.channels;
+	u32 sample_rate = (u32)format.sample_rate;
+	u16 bits = comp_size*8;
+	u32 fmt_size = 16;
+	u32 riff_size = (u32)(36 + data_size);
+	u32 data_size32 = (u32)data_size;
+	
+	memcpy(header+0,  "RIFF", 4);
+	memcpy(header+4,  &riff_size, 4);
+	memcpy(header+8,  "WAVE", 4);
+	memcpy(header+12, "fmt ", 4);
+	memcpy(header+16, &fmt_size, 4);
+	memcpy(header+20, &wav_format, 2);
+	memcpy(header+22, &channels, 2);
+	memcpy(header+24, &sample_rate, 4);
+	memcpy(header+28, &byte_rate, 4);
+	memcpy(header+32, &block_align, 2);
+	memcpy(header+34, &bits, 2);
+	memcpy(header+36, "data", 4);
+	memcpy(header+40, &data_size32, 4);
+}
+
+void
+audio_null_device_thread(Thread *t) {
+	Audio_Null_Device *device = (Audio_Null_Device*)t->data;
+	Audio_Null_Device_Config config = device->config;
+	Audio_Null_Device_Stats *stats = &device->stats;
+	
+	u64 frame_size = get_audio_bit_width_byte_size(config.format.bit_width)*config.format.channels;
+	u64 buffer_size = frame_size*config.frames_per_buffer;
+	void *buffer = alloc(get_heap_allocator(), buffer_size);
+	
+	stats->buffer_seconds = (float64)config.frames_per_buffer/(float64)config.format.sample_rate;
+	stats->min_headroom_seconds = stats->buffer_seconds;
+	
+	audio_mixer_thread_begin();
+	spinlock_acquire_or_wait(&audio_mixer_lock);
+	audio_null_device_count += 1;
+	spinlock_release(&audio_mixer_lock);
+	
+	float64 next_buffer_time = os_get_elapsed_seconds();
+	float64 total_mix_seconds_squared = 0;
+	
+	for (u64 i = 0; i < config.number_of_buffers; i++) {
+	
+		if (config.real_time) {
+			float64 now = os_get_elapsed_seconds();
+			if (now < next_buffer_time) {
+				os_high_precision_sleep((next_buffer_time-now)*1000.0);
+			} else {
+				// We're late, so a real device would have skipped ahead
+				next_buffer_time = now;
+			}
+			next_buffer_time += stats->buffer_seconds;
+		}
+		
+		if (config.before_buffer) config.before_buffer(device, i);
+	
+		float64 start = os_get_elapsed_seconds();
+		reset_temporary_storage();
+		spinlock_acquire_or_wait(&audio_mixer_lock);
+		u64 voices = audio_mix_voices(config.frames_per_buffer, config.format, buffer);
+		spinlock_release(&audio_mixer_lock);
+		float64 mix_seconds = os_get_elapsed_seconds()-start;
+		
+		float64 headroom = stats->buffer_seconds-mix_seconds;
+		
+		stats->buffers_mixed += 1;
+		stats->frames_mixed += config.frames_per_buffer;
+		stats->total_mix_seconds += mix_seconds;
+		total_mix_seconds_squared += mix_seconds*mix_seconds;
+		stats->worst_mix_seconds = max(stats->worst_mix_seconds, mix_seconds);
+		stats->total_voices_mixed += voices;
+		stats->max_voices_mixed = max(stats->max_voices_mixed, voices);
+		stats->min_headroom_seconds = min(stats->min_headroom_seconds, headroom);
+		if (headroom < 0) stats->underruns += 1;
+		
+		if (device->wav_file != OS_INVALID_FILE) {
+			if (!os_file_write_bytes(device->wav_file, buffer, buffer_size)) {
+				log_error("Null audio device failed writing to '%s'", config.wav_path);
+				device->ok = false;
+				break;
+			}
+			device->wav_data_size += buffer_size;
+		}
+	}
+	
+	if (stats->buffers_mixed > 0) {
+		stats->average_mix_seconds = stats->total_mix_seconds/(float64)stats->buffers_mixed;
+		stats->average_voices_mixed = (float64)stats->total_voices_mixed/(float64)stats->buffers_mixed;
+		stats->average_headroom_seconds = stats->buffer_seconds-stats->average_mix_seconds;
+		float64 variance = total_mix_seconds_squared/(float64)stats->buffers_mixed
+		                 - stats->average_mix_seconds*stats->average_mix_seconds;
+		stats->mix_jitter_seconds = sqrt(max(variance, 0.0));
+	}
+	
+	spinlock_acquire_or_wait(&audio_mixer_lock);
+	audio_null_device_count -= 1;
+	spinlock_release(&audio_mixer_lock);
+	audio_mixer_thread_end();
+	
+	dealloc(get_heap_allocator(), buffer);
+}
+
+// Blocks until config.number_of_buffers buffers have been mixed.
+// Returns false if the config is invalid or writing the WAV file failed.
+bool
+audio_null_device_run(Audio_Null_Device_Config config, Audio_Null_Device_Stats *stats) {
+	if (config.frames_per_buffer == 0 || config.format.sample_rate <= 0
+	    || config.format.channels <= 0 || config.format.channels > AUDIO_MAX_CHANNELS) {
+		log_error("Invalid null audio device config (%llu frames, %d channels, %dhz)", 
+			config.frames_per_buffer, config.format.channels, config.format.sample_rate);
+		return false;
+	}
+	
+	Audio_Null_Device device = ZERO(Audio_Null_Device);
+	device.config = config;
+	device.wav_file = OS_INVALID_FILE;
+	device.ok = true;
+	
+	if (config.wav_path.count > 0) {
+		device.wav_file = os_file_open(config.wav_path, O_WRITE | O_CREATE);
+		if (device.wav_file == OS_INVALID_FILE) {
+			log_error("Null audio device could not open '%s' for writing", config.wav_path);
+			return false;
+		}
+		// Sizes are patched when we're done
+		u8 header[AUDIO_WAV_HEADER_SIZE];
+		audio_write_wav_header(header, config.format, 0);
+		if (!os_file_write_bytes(device.wav_file, header, AUDIO_WAV_HEADER_SIZE)) {
+			os_file_close(device.wav_file);
+			return false;
+		}
+	}
+	
+	Thread thread;
+	os_thread_init(&thread, audio_null_device_thread);
+	thread.data = &device;
+	os_thread_start(&thread);
+	os_thread_join(&thread);
+	os_thread_destroy(&thread);
+	
+	if (device.wav_file != OS_INVALID_FILE) {
+		u8 header[AUDIO_WAV_HEADER_SIZE];
+		audio_write_wav_header(header, config.format, device.wav_data_size);
+		if (!os_file_set_pos(device.wav_file, 0) 
+		    || !os_file_write_bytes(device.wav_file, header, AUDIO_WAV_HEADER_SIZE)) {
+			device.ok = false;
+		}
+		os_file_close(device.wav_file);
+	}
+	
+	if (stats) *stats = device.stats;
+	
+	return device.ok;
+}
+
+void
+audio_null_device_log_stats(Audio_Null_Device_Stats stats) {
+	log_info("Null audio device: %llu buffers of %.2fms, mixing avg %.3fms, worst %.3fms, jitter %.3fms, voices avg %.1f, max %llu, min headroom %.3fms, %llu underruns",
+		stats.buffers_mixed, stats.buffer_seconds*1000.0, 
+		stats.average_mix_seconds*1000.0, stats.worst_mix_seconds*1000.0, stats.mix_jitter_seconds*1000.0,
+		stats.average_voices_mixed, stats.max_voices_mixed, 
+		stats.min_headroom_seconds*1000.0, stats.underruns);
 }
@@ -58,6 +58,53 @@ void ogb_instance
 mutex_release(Mutex *m);
 
 
+///
+// Worker pool
+// A fixed set of threads pulling jobs from a shared queue.
+// Each worker has its own temporary storage, so talloc is safe to use from jobs.
+// The thread calling worker_pool_wait helps out with queued jobs while it waits.
+typedef void(*Job_Proc)(void *data);
+typedef struct Job {
+	Job_Proc proc;
+	void *data;
+} Job;
+
+typedef struct Worker_Pool {
+	Thread *threads;
+	u64 thread_count;
+	
+	Job *jobs; // Ring buffer
+	u64 job_capacity;
+	u64 job_head;
+	volatile u64 job_count;
+	volatile u64 jobs_unfinished;
+	
+	Mutex queue_mutex;
+	Binary_Semaphore work_available;
+	volatile bool should_exit;
+	
+	Allocator allocator;
+} Worker_Pool;
+
+void ogb_instance
+worker_pool_init(Worker_Pool *pool, u64 thread_count, Allocator allocator);
+
+// Joins all worker threads. Jobs still in the queue are discarded.
+void ogb_instance
+worker_pool_destroy(Worker_Pool *pool);
+
+void ogb_instance
+worker_pool_push(Worker_Pool *pool, Job_Proc proc, void *data);
+
+// Pops and runs one job on the calling thread. Returns false if the queue was empty.
+bool ogb_instance
+worker_pool_run_one(Worker_Pool *pool);
+
+// Blocks until every pushed job has finished
+void ogb_instance
+worker_pool_wait(Worker_Pool *pool);
+
+
 #if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
 
 void spinlock_init(Spinlock *l) {
@@ -131,4 +178,127 @@ void mutex_release(Mutex *m) {
 	}
 }
 
+///
+// Worker pool
+
+void worker_pool_thread_proc(Thread *t) {
+	Worker_Pool *pool = (Worker_Pool*)t->data;
+	
+	while (!pool->should_exit) {
+		if (worker_pool_run_one(pool)) continue;
+		
+		// work_available is reset by whichever worker wakes, and it checks the queue and
+		// should_exit again after that. So the signal for anything pushed after this check
+		// is either still set when we wait, or taken by a worker that will see the job.
+		mutex_acquire_or_wait(&pool->queue_mutex);
+		bool idle = pool->job_count == 0 && !pool->should_exit;
+		mutex_release(&pool->queue_mutex);
+		
+		if (idle) os_binary_semaphore_wait(&pool->work_available);
+	}
+	
+	// Pass the exit signal on, another worker may have woken and reset it before we did
+	os_binary_semaphore_signal(&pool->work_available);
+}
+
+void worker_pool_init(Worker_Pool *pool, u64 thread_count, Allocator allocator) {
+	memset(pool, 0, sizeof(Worker_Pool));
+	
+	pool->allocator = allocator;
+	pool->job_capacity = 256;
+	pool->jobs = (Job*)alloc(allocator, pool->job_capacity*sizeof(Job));
+	
+	mutex_init(&pool->queue_mutex);
+	os_binary_semaphore_init(&pool->work_available, false);
+	
+	pool->thread_count = thread_count;
+	if (thread_count) {
+		pool->threads = (Thread*)alloc(allocator, thread_count*sizeof(Thread));
+	}
+	for (u64 i = 0; i < thread_count; i++) {
+		Thread *t = &pool->threads[i];
+		os_thread_init(t, worker_pool_thread_proc);
+		t->data = pool;
+		t->temporary_storage_size = KB(256);
+		os_thread_start(t);
+	}
+}
+
+void worker_pool_destroy(Worker_Pool *pool) {
+	mutex_acquire_or_wait(&pool->queue_mutex);
+	pool->should_exit = true;
+	mutex_release(&pool->queue_mutex);
+	
+	// Each exiting worker signals again, so this one wakes all of them
+	os_binary_semaphore_signal(&pool->work_available);
+	for (u64 i = 0; i < pool->thread_count; i++) {
+		os_thread_join(&pool->threads[i]);
+	}
+	for (u64 i = 0; i < pool->thread_count; i++) {
+		os_thread_destroy(&pool->threads[i]);
+	}
+	
+	os_binary_semaphore_destroy(&pool->work_available);
+	mutex_destroy(&pool->queue_mutex);
+	
+	if (pool->threads) dealloc(pool->allocator, pool->threads);
+	dealloc(pool->allocator, pool->jobs);
+	memset(pool, 0, sizeof(Worker_Pool));
+}
+
+void worker_pool_push(Worker_Pool *pool, Job_Proc proc, void *data) {
+	mutex_acquire_or_wait(&pool->queue_mutex);
+	
+	if (pool->job_count >= pool->job_capacity) {
+		u64 new_capacity = pool->job_capacity*2;
+		Job *new_jobs = (Job*)alloc(pool->allocator, new_capacity*sizeof(Job));
+		for (u64 i = 0; i < pool->job_count; i++) {
+			new_jobs[i] = pool->jobs[(pool->job_head+i) % pool->job_capacity];
+		}
+		dealloc(pool->allocator, pool->jobs);
+		pool->jobs = new_jobs;
+		pool->job_capacity = new_capacity;
+		pool->job_head = 0;
+	}
+	
+	Job *job = &pool->jobs[(pool->job_head+pool->job_count) % pool->job_capacity];
+	job->proc = proc;
+	job->data = data;
+	pool->job_count += 1;
+	pool->jobs_unfinished += 1;
+	
+	mutex_release(&pool->queue_mutex);
+	
+	os_binary_semaphore_signal(&pool->work_available);
+}
+
+bool worker_pool_run_one(Worker_Pool *pool) {
+	// Cheap early out so idle waiters don't hammer the mutex
+	if (pool->job_count == 0) return false;
+	
+	mutex_acquire_or_wait(&pool->queue_mutex);
+	if (pool->job_count == 0) {
+		mutex_release(&pool->queue_mutex);
+		return false;
+	}
+	Job job = pool->jobs[pool->job_head];
+	pool->job_head = (pool->job_head+1) % pool->job_capacity;
+	pool->job_count -= 1;
+	mutex_release(&pool->queue_mutex);
+	
+	job.proc(job.data);
+	
+	mutex_acquire_or_wait(&pool->queue_mutex);
+	pool->jobs_unfinished -= 1;
+	mutex_release(&pool->queue_mutex);
+	
+	return true;
+}
+
+void worker_pool_wait(Worker_Pool *pool) {
+	while (pool->jobs_unfinished > 0) {
+		if (!worker_pool_run_one(pool)) os_yield_thread();
+	}
+}
+
 #endif
\ No newline at end of file
@@ -404,27 +404,49 @@ typedef struct {
 	Vector4 color;
 	Draw_Frame *frame;
 } Draw_Text_Callback_Params;
+// quad_type is QUAD_TYPE_TEXT, or QUAD_TYPE_SDF for fonts loaded with load_font_from_disk_sdf
+Draw_Quad *draw_glyph_in_frame(Gfx_Image *atlas_image, Matrix4 xform, Vector2 glyph_position, Vector2 size, Vector4 uv, u8 quad_type, Vector4 color, Draw_Frame *frame) {
+	Matrix4 glyph_xform = m4_translate(xform, v3(glyph_position.x, glyph_position.y, 0));
+	
+	Draw_Quad *q = draw_image_xform_in_frame(atlas_image, glyph_xform, size, color, frame);
+	q->uv = uv;
+	q->type = quad_type;
+	q->image_min_filter = GFX_FILTER_MODE_LINEAR;
+	q->image_mag_filter = GFX_FILTER_MODE_LINEAR;
+	
+	return q;
+}
 bool draw_text_callback(Gfx_Glyph glyph, Gfx_Font_Atlas *atlas, float glyph_x, float glyph_y, void *ud) {
 
-	u32 codepoint = glyph.codepoint;
-
 	Draw_Text_Callback_Params *params = (Draw_Text_Callback_Params*)ud;
 	
-	Vector2 size = v2(glyph.width*params->scale.x, glyph.height*params->scale.y);
+	// Nothing to draw (e.g. space)
+	if (!atlas) return true;
 	
-	Matrix4 glyph_xform = m4_translate(params->xform, v3(glyph_x, glyph_y, 0));
+	Vector2 position, size;
+	font_glyph_quad(params->font, glyph, glyph_x, glyph_y, params->scale, &position, &size);
+	u8 quad_type = params->font->sdf ? QUAD_TYPE_SDF : QUAD_TYPE_TEXT;
 	
-	Draw_Quad *q = draw_image_xform_in_frame(atlas->image, glyph_xform, size, params->color, params->frame);
-	q->uv = glyph.uv;
-	q->type = QUAD_TYPE_TEXT;
-	q->image_min_filter = GFX_FILTER_MODE_LINEAR;
-	q->image_mag_filter = GFX_FILTER_MODE_LINEAR;
+	draw_glyph_in_frame(atlas->image, params->xform, position, size, glyph.uv, quad_type, params->color, params->frame);
 	
 	return true;
 }
 
 void draw_text_xform_in_frame(Gfx_Font *font, string text, u32 raster_height, Matrix4 xform, Vector2 scale, Vector4 color, Draw_Frame *frame) {
 	
+	if (enable_text_layout_cache) {
+		Text_Layout *layout = get_text_layout(font, text, raster_height, scale);
+		u8 quad_type = font->sdf ? QUAD_TYPE_SDF : QUAD_TYPE_TEXT;
+		for (u64 i = 0; i < layout->glyph_count; i++) {
+			Text_Layout_Glyph *g = &layout->glyphs[i];
+			draw_glyph_in_frame(font->atlases[g->atlas_index].image, xform, g->position, g->size, g->uv, quad_type, color, frame);
+		}
+		return;
+	}
+	
+	// Callback gets scale for the resolved height, see font_resolve_raster_height
+	raster_height = font_resolve_raster_height(font, raster_height, &scale);
+	
 	Draw_Text_Callback_Params p;
 	p.font = font;
 	p.text = text;
@@ -46,6 +46,16 @@
 			Emission instances will, by default,  be released and their handles invalidated after the last particle
 			in the emission has died. UNLESS: config.loop is true OR config.persist is true.
 			
+		By default, every particle is recomputed from its emission time each frame, which costs as much
+		as the number of particles emitted so far. For big emissions set config.simulate = true; particles are
+		then stored when emitted and moved each frame by particles_update(delta_time), and dead ones are removed.
+		Random properties are sampled once when a particle is emitted, and start_position, velocity and
+		acceleration always are. Interpolated properties other than those are still interpolated over the
+		particle's life time.
+		
+		particles_update and particles_draw spread the work over worker threads (see particle_worker_count).
+		Quads come out in the same order no matter how many threads there are. To draw particles into
+		another frame, call particles_draw_in_frame(frame, os_get_elapsed_seconds()) instead of particles_draw().
 			
 		
 */
@@ -125,6 +135,10 @@ typedef struct Emission_Config {
 	
 	bool loop;
 	
+	// Simulate particles in particles_update rather than recomputing them every frame.
+	// Velocity and acceleration are integrated, so acceleration behaves like regular physics.
+	bool simulate;
+	
 	u64 seed;
 	
 	// Vector2
@@ -154,12 +168,34 @@ typedef struct Emission_Config {
 
 
 
+// Particles of a simulated emission (Emission_Config.simulate), one array per component so
+// particles_update can move 4 of them at a time. Arrays are in emission order, and capacity is a
+// multiple of 4 so the last few can be updated together too.
+typedef struct Particle_Buffer {
+	float32 *position_x, *position_y;
+	float32 *velocity_x, *velocity_y;
+	float32 *acceleration_x, *acceleration_y;
+	float32 *rotation, *rotational_velocity;
+	float32 *age, *life_time;
+	float32 *color_r, *color_g, *color_b, *color_a;
+	float32 *size_x, *size_y;
+	float32 *pivot_x, *pivot_y;
+	u8 *kind;
+	u16 *image_index;
+	u64 count;
+	u64 capacity;
+	
+	float32 time; // Seconds simulated since the emission started or was reset
+	u64 emitted;
+} Particle_Buffer;
+
 typedef struct Emission_Instance {
 	Emission_Config config;
 	Vector2 pos;
 	float32 start_time;
 	bool allocated;
 	u32 generation;
+	Particle_Buffer particles; // Only for simulated emissions
 } Emission_Instance;
 
 typedef struct Emission_Handle {
@@ -174,6 +210,83 @@ ogb_instance Emission_Instance *emissions;
 Emission_Instance *emissions;
 #endif
 
+///
+// Threading
+//
+// particles_update and particles_draw_in_frame cut the work into jobs of PARTICLES_PER_JOB
+// particles which run on particle_workers. Particles take their random numbers from
+// particle_random_seed, so each can be computed on its own.
+// Each draw job writes quads to its own Draw_Frame, and those are appended to the target frame in
+// job order after all jobs are done, so the quads come out in the same order as they would
+// on a single thread.
+
+#ifndef PARTICLES_PER_JOB
+	// Must be a multiple of 4, particle_buffer_integrate does 4 at a time
+	#define PARTICLES_PER_JOB 16384
+#endif
+
+// Number of particle threads. -1 means one less than the number of logical processors.
+// Must be set before the first particles_update or particles_draw.
+// Set particles_multithreaded to false to run all jobs on the calling thread.
+// #Global
+#if OOGABOOGA_LINK_EXTERNAL_INSTANCE
+ogb_instance s64 particle_worker_count;
+ogb_instance bool particles_multithreaded;
+ogb_instance Worker_Pool particle_workers;
+ogb_instance bool particle_workers_initted;
+#else
+s64 particle_worker_count = -1;
+bool particles_multithreaded = true;
+Worker_Pool particle_workers;
+bool particle_workers_initted = false;
+#endif
+
+typedef struct Particle_Job {
+	Emission_Instance *e;
+	u64 first, last;
+	
+	// Update
+	float32 delta_time;
+	u64 first_dead;
+	
+	// Draw
+	bool recompute;
+	float32 passed;
+	Matrix4 world_to_clip;
+	Draw_Frame *frame;
+} Particle_Job;
+
+// #Global
+#if OOGABOOGA_LINK_EXTERNAL_INSTANCE
+ogb_instance Particle_Job *particle_jobs;
+ogb_instance Draw_Frame *particle_job_frames; // Kept between frames so quad buffers are reused
+#else
+Particle_Job *particle_jobs;
+Draw_Frame *particle_job_frames;
+#endif
+
+// Every particle gets its own random numbers for each of these, from particle_random_seed.
+// Numbers come from get_random_*_at so particles can be sampled in any order and on any thread.
+typedef enum Particle_Random_Slot {
+	PARTICLE_RANDOM_KIND,
+	PARTICLE_RANDOM_IMAGE,
+	PARTICLE_RANDOM_LIFE_TIME,
+	PARTICLE_RANDOM_START_POSITION,
+	PARTICLE_RANDOM_PIVOT,
+	PARTICLE_RANDOM_VELOCITY,
+	PARTICLE_RANDOM_ACCELERATION,
+	PARTICLE_RANDOM_ROTATION,
+	PARTICLE_RANDOM_ROTATIONAL_ACCELERATION,
+	PARTICLE_RANDOM_COLOR,
+	PARTICLE_RANDOM_SIZE,
+	
+	PARTICLE_RANDOM_SLOT_COUNT,
+} Particle_Random_Slot;
+
+u64 particle_random_seed(Emission_Instance *e, u64 particle_index, Particle_Random_Slot slot) {
+	return get_random_at(e->config.seed, particle_index*PARTICLE_RANDOM_SLOT_COUNT + slot);
+}
+
 float32 sample_interp_one(Emission_Interpolation_Kind interp, float32 min, float32 max, float t) {
 	switch (interp) {
 		case EMISSION_INTERPOLATION_LINEAR: {
@@ -194,7 +307,7 @@ float32 sample_emission_property_f32(Emission_Property p, u64 seed, float32 t) {
 		case EMISSION_PROPERTY_MODE_FLAT:
 			return p.flat_f32;
 		case EMISSION_PROPERTY_MODE_RANDOM:
-			float32 v = get_random_float32_in_range(p.min_f32, p.max_f32);
+			float32 v = get_random_float32_in_range_at(seed, 0, p.min_f32, p.max_f32);
 			return v;
 		case EMISSION_PROPERTY_MODE_INTERPOLATE:
 			return sample_interp_one(p.interp_kind, p.min_f32, p.max_f32, t);
@@ -208,8 +321,8 @@ Vector2 sample_emission_property_v2(Emission_Property p, u64 seed, float32 t) {
 			return p.flat_v2;
 		case EMISSION_PROPERTY_MODE_RANDOM:
 			Vector2 v;
-			v.x = get_random_float32_in_range(p.min_v2.x, p.max_v2.x);
-			v.y = get_random_float32_in_range(p.min_v2.y, p.max_v2.y);
+			v.x = get_random_float32_in_range_at(seed, 0, p.min_v2.x, p.max_v2.x);
+			v.y = get_random_float32_in_range_at(seed, 1, p.min_v2.y, p.max_v2.y);
 			return v;
 		case EMISSION_PROPERTY_MODE_INTERPOLATE:
 			return v2(
@@ -226,9 +339,9 @@ Vector3 sample_emission_property_v3(Emission_Property p, u64 seed, float32 t) {
 			return p.flat_v3;
 		case EMISSION_PROPERTY_MODE_RANDOM:
 			Vector3 v;
-			v.x = get_random_float32_in_range(p.min_v3.x, p.max_v3.x);
-			v.y = get_random_float32_in_range(p.min_v3.y, p.max_v3.y);
-			v.z = get_random_float32_in_range(p.min_v3.z, p.max_v3.z);
+			v.x = get_random_float32_in_range_at(seed, 0, p.min_v3.x, p.max_v3.x);
+			v.y = get_random_float32_in_range_at(seed, 1, p.min_v3.y, p.max_v3.y);
+			v.z = get_random_float32_in_range_at(seed, 2, p.min_v3.z, p.max_v3.z);
 			return v;
 		case EMISSION_PROPERTY_MODE_INTERPOLATE:
 			return v3(
@@ -246,10 +359,10 @@ Vector4 sample_emission_property_v4(Emission_Property p, u64 seed, float32 t) {
 			return p.flat_v4;
 		case EMISSION_PROPERTY_MODE_RANDOM:
 			Vector4 v;
-			v.x = get_random_float32_in_range(p.min_v4.x, p.max_v4.x);
-			v.y = get_random_float32_in_range(p.min_v4.y, p.max_v4.y);
-			v.z = get_random_float32_in_range(p.min_v4.z, p.max_v4.z);
-			v.w = get_random_float32_in_range(p.min_v4.w, p.max_v4.w);
+			v.x = get_random_float32_in_range_at(seed, 0, p.min_v4.x, p.max_v4.x);
+			v.y = get_random_float32_in_range_at(seed, 1, p.min_v4.y, p.max_v4.y);
+			v.z = get_random_float32_in_range_at(seed, 2, p.min_v4.z, p.max_v4.z);
+			v.w = get_random_float32_in_range_at(seed, 3, p.min_v4.w, p.max_v4.w);
 			return v;
 		case EMISSION_PROPERTY_MODE_INTERPOLATE:
 			return v4(
@@ -262,6 +375,54 @@ Vector4 sample_emission_property_v4(Emission_Property p, u64 seed, float32 t) {
 	return v4(0, 0, 0, 0);
 }
 
+void particle_buffer_reserve(Particle_Buffer *b, u64 capacity) {
+	if (capacity <= b->capacity) return;
+	
+	u64 new_capacity = max(b->capacity*2, 256);
+	while (new_capacity < capacity) new_capacity *= 2;
+	
+	float32 **floats[] = {
+		&b->position_x, &b->position_y, &b->velocity_x, &b->velocity_y, &b->acceleration_x, &b->acceleration_y,
+		&b->rotation, &b->rotational_velocity, &b->age, &b->life_time,
+		&b->color_r, &b->color_g, &b->color_b, &b->color_a, &b->size_x, &b->size_y, &b->pivot_x, &b->pivot_y,
+	};
+	for (u64 i = 0; i < sizeof(floats)/sizeof(floats[0]); i++) {
+		// Heap allocations are 16 byte aligned, which the SSE loads in particles_update rely on
+		float32 *new_array = alloc(get_heap_allocator(), new_capacity*sizeof(float32));
+		if (*floats[i]) {
+			memcpy(new_array, *floats[i], b->count*sizeof(float32));
+			dealloc(get_heap_allocator(), *floats[i]);
+		}
+		*floats[i] = new_array;
+	}
+	
+	u8 *new_kind = alloc(get_heap_allocator(), new_capacity*sizeof(u8));
+	u16 *new_image_index = alloc(get_heap_allocator(), new_capacity*sizeof(u16));
+	if (b->kind) {
+		memcpy(new_kind, b->kind, b->count*sizeof(u8));
+		memcpy(new_image_index, b->image_index, b->count*sizeof(u16));
+		dealloc(get_heap_allocator(), b->kind);
+		dealloc(get_heap_allocator(), b->image_index);
+	}
+	b->kind = new_kind;
+	b->image_index = new_image_index;
+	
+	b->capacity = new_capacity;
+}
+void particle_buffer_free(Particle_Buffer *b) {
+	if (b->capacity) {
+		float32 *floats[] = {
+			b->position_x, b->position_y, b->velocity_x, b->velocity_y, b->acceleration_x, b->acceleration_y,
+			b->rotation, b->rotational_velocity, b->age, b->life_time,
+			b->color_r, b->color_g, b->color_b, b->color_a, b->size_x, b->size_y, b->pivot_x, b->pivot_y,
+		};
+		for (u64 i = 0; i < sizeof(floats)/sizeof(floats[0]); i++) dealloc(get_heap_allocator(), floats[i]);
+		dealloc(get_heap_allocator(), b->kind);
+		dealloc(get_heap_allocator(), b->image_index);
+	}
+	*b = ZERO(Particle_Buffer);
+}
+
 Emission_Handle emit_particles(Emission_Config config, Vector2 pos) {
 
 	config.number_of_particles = max(config.number_of_particles, 1);
@@ -270,7 +431,10 @@ Emission_Handle emit_particles(Emission_Config config, Vector2 pos) {
 
 	for (u64 i = 0; i < growing_array_get_valid_count(emissions); i += 1) {
 		if (!emissions[i].allocated) {
+			particle_buffer_free(&emissions[i].particles);
+			u32 generation = emissions[i].generation;
 			emissions[i] = ZERO(Emission_Instance);
+			emissions[i].generation = generation;
 			emissions[i].config = config;
 			emissions[i].pos = pos;
 			emissions[i].start_time = os_get_elapsed_seconds();
@@ -298,6 +462,10 @@ void emission_reset(Emission_Handle h) {
 	
 	Emission_Instance *e = &emissions[h.index];
 	e->start_time = os_get_elapsed_seconds();
+	
+	e->particles.count = 0;
+	e->particles.emitted = 0;
+	e->particles.time = 0;
 }
 
 void emission_set_config(Emission_Handle h, Emission_Config config) {
@@ -321,132 +489,481 @@ void emission_release(Emission_Handle h) {
 	
 	Emission_Instance *e = &emissions[h.index];
 	
-	if (e->generation == h.generation) e->allocated = false;
+	if (e->generation == h.generation) {
+		e->allocated = false;
+		particle_buffer_free(&e->particles);
+	}
 }
 
 void particles_init() {
 	growing_array_init_reserve((void**)&emissions, sizeof(Emission_Instance), 16, get_heap_allocator());
+	growing_array_init((void**)&particle_jobs, sizeof(Particle_Job), get_heap_allocator());
+	growing_array_init((void**)&particle_job_frames, sizeof(Draw_Frame), get_heap_allocator());
 }
 
-void particles_update() {
-
-	// I ended up not needing this 
+// Samples everything about particle number j of a simulated emission and appends it.
+void particle_buffer_emit(Emission_Instance *e, u64 j, float32 age) {
+	Particle_Buffer *b = &e->particles;
+	Emission_Config *c = &e->config;
+	
+	u64 i = b->count;
+	
+	if (c->number_of_kinds <= 1) {
+		b->kind[i] = (u8)c->kind_pool[0];
+	} else {
+		b->kind[i] = (u8)c->kind_pool[get_random_int_in_range_at(particle_random_seed(e, j, PARTICLE_RANDOM_KIND), 0, 0, c->number_of_kinds-1)];
+	}
+	b->image_index[i] = 0;
+	if (b->kind[i] == PARTICLE_KIND_IMAGE && c->number_of_images > 1) {
+		b->image_index[i] = (u16)get_random_int_in_range_at(particle_random_seed(e, j, PARTICLE_RANDOM_IMAGE), 0, 0, c->number_of_images-1);
+	}
+	
+	float32 life_time = sample_emission_property_f32(c->life_time, particle_random_seed(e, j, PARTICLE_RANDOM_LIFE_TIME), 0.0);
+	Vector2 origin = v2_add(e->pos, sample_emission_property_v2(c->start_position, particle_random_seed(e, j, PARTICLE_RANDOM_START_POSITION), 0.0));
+	Vector2 velocity = sample_emission_property_v2(c->velocity, particle_random_seed(e, j, PARTICLE_RANDOM_VELOCITY), 0.0);
+	Vector2 acceleration = sample_emission_property_v2(c->acceleration, particle_random_seed(e, j, PARTICLE_RANDOM_ACCELERATION), 0.0);
+	Vector2 pivot = sample_emission_property_v2(c->pivot, particle_random_seed(e, j, PARTICLE_RANDOM_PIVOT), 0.0);
+	float32 rotation = sample_emission_property_f32(c->rotation, particle_random_seed(e, j, PARTICLE_RANDOM_ROTATION), 0.0);
+	float32 rotational_velocity = sample_emission_property_f32(c->rotational_acceleration, particle_random_seed(e, j, PARTICLE_RANDOM_ROTATIONAL_ACCELERATION), 0.0);
+	Vector4 color = sample_emission_property_v4(c->color, particle_random_seed(e, j, PARTICLE_RANDOM_COLOR), 0.0);
+	Vector2 size = sample_emission_property_v2(c->size, particle_random_seed(e, j, PARTICLE_RANDOM_SIZE), 0.0);
+	
+	// Catch up for the part of the frame since it was emitted
+	velocity = v2_add(velocity, v2_mulf(acceleration, age));
+	
+	b->position_x[i] = origin.x + velocity.x*age;
+	b->position_y[i] = origin.y + velocity.y*age;
+	b->velocity_x[i] = velocity.x;
+	b->velocity_y[i] = velocity.y;
+	b->acceleration_x[i] = acceleration.x;
+	b->acceleration_y[i] = acceleration.y;
+	b->rotation[i] = rotation + rotational_velocity*age;
+	b->rotational_velocity[i] = rotational_velocity;
+	b->age[i] = age;
+	b->life_time[i] = life_time;
+	b->color_r[i] = color.x;
+	b->color_g[i] = color.y;
+	b->color_b[i] = color.z;
+	b->color_a[i] = color.w;
+	b->size_x[i] = size.x;
+	b->size_y[i] = size.y;
+	b->pivot_x[i] = pivot.x;
+	b->pivot_y[i] = pivot.y;
+	
+	b->count += 1;
 }
 
-void particles_draw() {
-	// We compute each particle each frame depending on now vs then
+// Moves particles [first, last) and returns the index of the first one that died, or last if
+// none did.
+u64 particle_buffer_integrate(Particle_Buffer *b, u64 first, u64 last, float32 delta_time) {
+	u64 first_dead = last;
+	u64 i = first;
+	
+#if ENABLE_SIMD
+	// Arrays are padded to a multiple of 4 so we can do the last few too, but the padding has
+	// garbage in it so deaths there don't count.
+	__m128 dt = _mm_set1_ps(delta_time);
+	for (; i < last; i += 4) {
+		__m128 age = _mm_add_ps(_mm_load_ps(b->age + i), dt);
+		_mm_store_ps(b->age + i, age);
+		
+		__m128 vx = _mm_add_ps(_mm_load_ps(b->velocity_x + i), _mm_mul_ps(_mm_load_ps(b->acceleration_x + i), dt));
+		__m128 vy = _mm_add_ps(_mm_load_ps(b->velocity_y + i), _mm_mul_ps(_mm_load_ps(b->acceleration_y + i), dt));
+		_mm_store_ps(b->velocity_x + i, vx);
+		_mm_store_ps(b->velocity_y + i, vy);
+		
+		_mm_store_ps(b->position_x + i, _mm_add_ps(_mm_load_ps(b->position_x + i), _mm_mul_ps(vx, dt)));
+		_mm_store_ps(b->position_y + i, _mm_add_ps(_mm_load_ps(b->position_y + i), _mm_mul_ps(vy, dt)));
+		
+		_mm_store_ps(b->rotation + i, _mm_add_ps(_mm_load_ps(b->rotation + i), _mm_mul_ps(_mm_load_ps(b->rotational_velocity + i), dt)));
+		
+		int dead_mask = _mm_movemask_ps(_mm_cmpgt_ps(age, _mm_load_ps(b->life_time + i)));
+		if (dead_mask && first_dead == last) {
+			for (u64 lane = 0; lane < 4 && i+lane < last; lane++) {
+				if (dead_mask & (1 << lane)) {
+					first_dead = i+lane;
+					break;
+				}
+			}
+		}
+	}
+#else
+	for (; i < last; i++) {
+		b->age[i] += delta_time;
+		b->velocity_x[i] += b->acceleration_x[i]*delta_time;
+		b->velocity_y[i] += b->acceleration_y[i]*delta_time;
+		b->position_x[i] += b->velocity_x[i]*delta_time;
+		b->position_y[i] += b->velocity_y[i]*delta_time;
+		b->rotation[i] += b->rotational_velocity[i]*delta_time;
+		if (b->age[i] > b->life_time[i] && first_dead == last) first_dead = i;
+	}
+#endif
 	
-	float32 now = os_get_elapsed_seconds();
+	return first_dead;
+}
 
-	u64 backup_seed = seed_for_random;
+// Removes dead particles from first_dead on, keeping the rest in order
+void particle_buffer_compact(Particle_Buffer *b, u64 first_dead) {
+	float32 *floats[] = {
+		b->position_x, b->position_y, b->velocity_x, b->velocity_y, b->acceleration_x, b->acceleration_y,
+		b->rotation, b->rotational_velocity, b->age, b->life_time,
+		b->color_r, b->color_g, b->color_b, b->color_a, b->size_x, b->size_y, b->pivot_x, b->pivot_y,
+	};
 	
-	for (u64 i = 0; i < growing_array_get_valid_count(emissions); i += 1) {
-		Emission_Instance *e = &emissions[i];
-		if (!e->allocated) continue;
+	u64 write = first_dead;
+	for (u64 read = first_dead; read < b->count; read++) {
+		if (b->age[read] > b->life_time[read]) continue;
 		
-		float32 passed = now - e->start_time;
+		if (write != read) {
+			for (u64 j = 0; j < sizeof(floats)/sizeof(floats[0]); j++) floats[j][write] = floats[j][read];
+			b->kind[write] = b->kind[read];
+			b->image_index[write] = b->image_index[read];
+		}
+		write += 1;
+	}
+	b->count = write;
+}
+
+void particles_update_simulated_finish(Emission_Instance *e, u64 first_dead, float32 delta_time) {
+	Particle_Buffer *b = &e->particles;
+	Emission_Config *c = &e->config;
+	
+	if (first_dead < b->count) particle_buffer_compact(b, first_dead);
+	
+	b->time += delta_time;
+	
+	// Emit what should have been emitted by now
+	float32 emission_interval = 1.0/c->emissions_per_second;
+	u64 should_have_emitted = (u64)(b->time/emission_interval) + 1;
+	if (!c->loop) should_have_emitted = min(should_have_emitted, c->number_of_particles);
+	
+	if (should_have_emitted > b->emitted) {
+		particle_buffer_reserve(b, b->count + (should_have_emitted-b->emitted) + 4);
 		
-		float32 sample_life_time = sample_emission_property_f32(e->config.life_time, 69, 0.0);
+		for (u64 j = b->emitted; j < should_have_emitted; j++) {
+			float32 age = b->time - (float32)j*emission_interval;
+			particle_buffer_emit(e, j, max(age, 0));
+		}
 		
-		// Duration until last particle is emitted
-		float32 last_emit_duration  = (float32)e->config.number_of_particles/e->config.emissions_per_second;
-		// Duration until last particle dies
-		float32 last_death_duration = last_emit_duration + sample_life_time;
+		b->emitted = should_have_emitted;
+	}
+	
+	if (!c->persist && !c->loop && b->emitted >= c->number_of_particles && b->count == 0) {
+		e->allocated = false;
+		particle_buffer_free(b);
+	}
+}
+
+void particles_update_simulated(Emission_Instance *e, float32 delta_time) {
+	Particle_Buffer *b = &e->particles;
+	
+	particles_update_simulated_finish(e, particle_buffer_integrate(b, 0, b->count, delta_time), delta_time);
+}
+
+Draw_Quad *particle_draw_in_frame(Particle *p, Gfx_Image *image, Matrix4 world_to_clip, Draw_Frame *frame) {
+	Matrix3 xform = m3_identity();
+	xform = m3_translate(xform, p->position);
+	xform = m3_rotate(xform, p->rotation);
+	xform = m3_translate(xform, v2_mulf(p->pivot, -1));
+	
+	// Same quad as draw_rect_xform & co, but we already have world_to_clip so we skip the
+	// camera inverse they do for each quad.
+	Draw_Quad q = ZERO(Draw_Quad);
+	q.bottom_left  = v2(0,  0);
+	q.top_left     = v2(0,  p->size.y);
+	q.top_right    = v2(p->size.x, p->size.y);
+	q.bottom_right = v2(p->size.x, 0);
+	q.color = p->color;
+	q.type = p->kind == PARTICLE_KIND_CIRCLE ? QUAD_TYPE_CIRCLE : QUAD_TYPE_REGULAR;
+	if (p->kind == PARTICLE_KIND_IMAGE) {
+		q.image = image;
+		q.uv = v4(0, 0, 1, 1);
+	}
+	
+	return draw_quad_projected_in_frame(q, m4_mul(world_to_clip, m3_to_m4(xform)), frame);
+}
+
+// Fills out a simulated particle for drawing. Interpolated properties are interpolated here,
+// the rest was decided when it was emitted.
+void particle_buffer_get(Emission_Instance *e, u64 i, Particle *p) {
+	Particle_Buffer *b = &e->particles;
+	Emission_Config *c = &e->config;
+	
+	float32 t = b->age[i]/b->life_time[i];
+	
+	p->kind = (Particle_Kind)b->kind[i];
+	p->position = v2(b->position_x[i], b->position_y[i]);
+	p->rotation = b->rotation[i];
+	p->color = v4(b->color_r[i], b->color_g[i], b->color_b[i], b->color_a[i]);
+	p->size = v2(b->size_x[i], b->size_y[i]);
+	p->pivot = v2(b->pivot_x[i], b->pivot_y[i]);
+	p->index = (u32)i;
+	
+	if (c->rotation.mode == EMISSION_PROPERTY_MODE_INTERPOLATE) {
+		p->rotation = sample_emission_property_f32(c->rotation, c->seed, t) + b->rotational_velocity[i]*b->age[i];
+	}
+	if (c->color.mode == EMISSION_PROPERTY_MODE_INTERPOLATE) p->color = sample_emission_property_v4(c->color, c->seed, t);
+	if (c->size.mode  == EMISSION_PROPERTY_MODE_INTERPOLATE) p->size  = sample_emission_property_v2(c->size, c->seed, t);
+	if (c->pivot.mode == EMISSION_PROPERTY_MODE_INTERPOLATE) p->pivot = sample_emission_property_v2(c->pivot, c->seed, t);
+}
+
+// Draws particles [first, last) of a simulated emission
+void particles_draw_simulated_in_frame(Emission_Instance *e, u64 first, u64 last, Matrix4 world_to_clip, Draw_Frame *frame) {
+	Particle_Buffer *b = &e->particles;
+	
+	for (u64 i = first; i < last; i++) {
+		Particle p;
+		particle_buffer_get(e, i, &p);
+		particle_draw_in_frame(&p, p.kind == PARTICLE_KIND_IMAGE ? e->config.image_pool[b->image_index[i]] : 0, world_to_clip, frame);
+	}
+}
+
+// Computes particle number j of a recomputed (not simulated) emission at 'passed' seconds into
+// the emission. Returns false if it's dead.
+bool particle_compute(Emission_Instance *e, u64 j, float32 passed, float32 emission_interval, float32 last_emit_duration, Particle *result) {
+	Particle p = ZERO(Particle);
+	
+	if (e->config.number_of_kinds <= 1) {
+		p.kind = e->config.kind_pool[0];
+	} else {
+		p.kind = e->config.kind_pool[get_random_int_in_range_at(particle_random_seed(e, j, PARTICLE_RANDOM_KIND), 0, 0, e->config.number_of_kinds-1)];
+	}
+	
+	float32 emission_time = (float32)j*emission_interval;
+	
+	float32 life_time = sample_emission_property_f32(e->config.life_time, particle_random_seed(e, j, PARTICLE_RANDOM_LIFE_TIME), 0.0);
+	
+	float32 age = passed - emission_time;
+	
+	if (e->config.loop) age = fmodf(age, last_emit_duration);
+	
+	float32 t = age/life_time;
+	
+	Vector2 origin = e->pos;
+	origin = v2_add(origin, sample_emission_property_v2(e->config.start_position, particle_random_seed(e, j, PARTICLE_RANDOM_START_POSITION), t));
+	
+	p.pivot = sample_emission_property_v2(e->config.pivot, particle_random_seed(e, j, PARTICLE_RANDOM_PIVOT), t);
+	
+	Vector2 velocity = sample_emission_property_v2(e->config.velocity, particle_random_seed(e, j, PARTICLE_RANDOM_VELOCITY), t);
+	Vector2 acceleration = sample_emission_property_v2(e->config.acceleration, particle_random_seed(e, j, PARTICLE_RANDOM_ACCELERATION), t);
+	
+	velocity = v2_add(velocity, v2_mulf(acceleration, age));
+	p.position = v2_add(origin, v2_mulf(velocity, age));
+	
+	
+	p.rotation = sample_emission_property_f32(e->config.rotation, particle_random_seed(e, j, PARTICLE_RANDOM_ROTATION), t);
+	p.rotation += sample_emission_property_f32(e->config.rotational_acceleration, particle_random_seed(e, j, PARTICLE_RANDOM_ROTATIONAL_ACCELERATION), t) * age;
+	
+	p.color = sample_emission_property_v4(e->config.color, particle_random_seed(e, j, PARTICLE_RANDOM_COLOR), t);
+	
+	p.size = sample_emission_property_v2(e->config.size, particle_random_seed(e, j, PARTICLE_RANDOM_SIZE), t);
+
+	p.index = j;
+	
+	*result = p;
+	
+	// deth
+	// #Speed
+	return age <= life_time;
+}
+
+typedef struct Emission_Timing {
+	float32 last_emit_duration;  // Duration until last particle is emitted
+	float32 last_death_duration; // Duration until last particle dies
+	float32 emission_interval;
+} Emission_Timing;
+Emission_Timing get_emission_timing(Emission_Instance *e) {
+	Emission_Timing timing;
+	float32 sample_life_time = sample_emission_property_f32(e->config.life_time, 69, 0.0);
+	timing.last_emit_duration  = (float32)e->config.number_of_particles/e->config.emissions_per_second;
+	timing.last_death_duration = timing.last_emit_duration + sample_life_time;
+	timing.emission_interval   = timing.last_emit_duration / (float32)e->config.number_of_particles;
+	return timing;
+}
+
+u64 get_emission_max_emitted(Emission_Instance *e, float32 passed) {
+	Emission_Timing timing = get_emission_timing(e);
+	u64 max_emitted = (u64)(passed/timing.emission_interval);
+	return min(max_emitted, e->config.number_of_particles);
+}
+
+// Draws particles [first, last) of a recomputed emission at 'passed' seconds into it
+void particles_draw_recomputed_in_frame(Emission_Instance *e, u64 first, u64 last, float32 passed, Matrix4 world_to_clip, Draw_Frame *frame) {
+	Emission_Timing timing = get_emission_timing(e);
+	
+	for (u64 j = first; j < last; j += 1) {
 		
-		float32 emission_interval = last_emit_duration / (float32)e->config.number_of_particles;
+		float32 emission_time = (float32)j*timing.emission_interval;
 		
-		u64 max_emitted = (u64)(passed/emission_interval);
-		max_emitted = min(max_emitted, e->config.number_of_particles);
+		bool is_emitted = passed >= emission_time;
+		if (!is_emitted) continue;
 		
-		if (!e->config.persist && !e->config.loop && passed > last_death_duration) {
-			e->allocated = false;
-			continue;
-		}
+		Particle p;
+		if (!particle_compute(e, j, passed, timing.emission_interval, timing.last_emit_duration, &p)) continue;
 		
-		seed_for_random = e->config.seed;
-			
-		for (u64 j = 0; j < max_emitted; j += 1) {
-			Particle p = ZERO(Particle);
-			
-			float32 emission_time = (float32)j*emission_interval;
-			
-			bool is_emitted = passed >= emission_time;
-			if (!is_emitted) continue;
-			
-			if (e->config.number_of_kinds <= 1) {
-				p.kind = e->config.kind_pool[0];
+		Gfx_Image *image = 0;
+		if (p.kind == PARTICLE_KIND_IMAGE) {
+			assert(e->config.number_of_images > 0, "Particle is PARTICLE_KIND_IMAGE but config.number_of_images is <= 0");
+			if (e->config.number_of_images == 1) {
+				image = e->config.image_pool[0];
 			} else {
-				p.kind = e->config.kind_pool[get_random_int_in_range(0, e->config.number_of_kinds-1)];
+				image = e->config.image_pool[get_random_int_in_range_at(particle_random_seed(e, j, PARTICLE_RANDOM_IMAGE), 0, 0, e->config.number_of_images-1)];
 			}
-			
-			
-			float32 life_time = sample_emission_property_f32(e->config.life_time, e->config.seed, 0.0);
-			
-			float32 age = passed - emission_time;
-			
-			if (e->config.loop) age = fmodf(age, last_emit_duration);
-			
-			float32 t = age/life_time;
-			
-			Vector2 origin = e->pos;
-			origin = v2_add(origin, sample_emission_property_v2(e->config.start_position, e->config.seed, t));
-			
-			p.pivot = sample_emission_property_v2(e->config.pivot, e->config.seed, t);
-			
-			Vector2 velocity = sample_emission_property_v2(e->config.velocity, e->config.seed, t);
-			Vector2 acceleration = sample_emission_property_v2(e->config.acceleration, e->config.seed, t);
-			
-			velocity = v2_add(velocity, v2_mulf(acceleration, age));
-			p.position = v2_add(origin, v2_mulf(velocity, age));
-			
-			
-			p.rotation = sample_emission_property_f32(e->config.rotation, e->config.seed, t);
-			p.rotation += sample_emission_property_f32(e->config.rotational_acceleration, e->config.seed, t) * age;
-			
-			p.color = sample_emission_property_v4(e->config.color, e->config.seed, t);
-			
-			p.size = sample_emission_property_v2(e->config.size, e->config.seed, t);
+		}
+		particle_draw_in_frame(&p, image, world_to_clip, frame);
+	}
+}
 
-			p.index = j;
-			
-			// deth
-			// Must happen after computation for seed consistency
-			// #Speed
-			if (age > life_time) {
-				continue;
-			}
-			
-			
-			Matrix3 xform = m3_identity();
-			xform = m3_translate(xform, p.position);
-			xform = m3_rotate(xform, p.rotation);
-			xform = m3_translate(xform, v2_mulf(p.pivot, -1));
-			switch (p.kind) {
-				case PARTICLE_KIND_RECTANGLE: {
-					draw_rect_xform(m3_to_m4(xform), p.size, p.color);
-					break;
-				}
-				case PARTICLE_KIND_CIRCLE: {
-					draw_circle_xform(m3_to_m4(xform), p.size, p.color);
-					break;
-				}
-				case PARTICLE_KIND_IMAGE: {
-					Gfx_Image *image = 0;
-					assert(e->config.number_of_images > 0, "Particle is PARTICLE_KIND_IMAGE but config.number_of_images is <= 0");
-					if (e->config.number_of_images == 1) {
-						image = e->config.image_pool[0];
-					} else {
-						image = e->config.image_pool[get_random_int_in_range(0, e->config.number_of_images-1)];
-					}
-					draw_image_xform(image, m3_to_m4(xform), p.size, p.color);
-					break;
+void particle_update_job(void *data) {
+	Particle_Job *job = (Particle_Job*)data;
+	job->first_dead = particle_buffer_integrate(&job->e->particles, job->first, job->last, job->delta_time);
+}
+void particle_draw_job(void *data) {
+	Particle_Job *job = (Particle_Job*)data;
+	if (job->recompute) {
+		particles_draw_recomputed_in_frame(job->e, job->first, job->last, job->passed, job->world_to_clip, job->frame);
+	} else {
+		particles_draw_simulated_in_frame(job->e, job->first, job->last, job->world_to_clip, job->frame);
+	}
+}
+
+void particles_run_jobs(Job_Proc proc) {
+	u64 job_count = growing_array_get_valid_count(particle_jobs);
+	
+	if (!particles_multithreaded || job_count <= 1) {
+		for (u64 i = 0; i < job_count; i++) proc(&particle_jobs[i]);
+		return;
+	}
+	
+	if (!particle_workers_initted) {
+		if (particle_worker_count < 0) {
+			particle_worker_count = max((s64)os_get_number_of_logical_processors()-1, 1);
+		}
+		worker_pool_init(&particle_workers, (u64)particle_worker_count, get_heap_allocator());
+		particle_workers_initted = true;
+	}
+	
+	for (u64 i = 0; i < job_count; i++) worker_pool_push(&particle_workers, proc, &particle_jobs[i]);
+	
+	// We help out until everything is done
+	worker_pool_wait(&particle_workers);
+}
+
+void particles_push_jobs(Emission_Instance *e, u64 count, bool recompute, float32 passed) {
+	for (u64 first = 0; first < count; first += PARTICLES_PER_JOB) {
+		Particle_Job *job = growing_array_add_empty((void**)&particle_jobs);
+		*job = ZERO(Particle_Job);
+		job->e = e;
+		job->first = first;
+		job->last = min(first + PARTICLES_PER_JOB, count);
+		job->recompute = recompute;
+		job->passed = passed;
+	}
+}
+
+void particles_update(float32 delta_time) {
+	growing_array_clear((void**)&particle_jobs);
+	
+	for (u64 i = 0; i < growing_array_get_valid_count(emissions); i += 1) {
+		Emission_Instance *e = &emissions[i];
+		if (!e->allocated || !e->config.simulate) continue;
+		
+		particles_push_jobs(e, e->particles.count, false, 0);
+	}
+	
+	for (u64 i = 0; i < growing_array_get_valid_count(particle_jobs); i++) {
+		particle_jobs[i].delta_time = delta_time;
+	}
+	
+	particles_run_jobs(particle_update_job);
+	
+	// Jobs are in emission order, so we walk them alongside the emissions to find where each
+	// emission's first dead particle is. Removing and emitting particles stays on this thread
+	// so the random sequence doesn't depend on the threads.
+	u64 next_job = 0;
+	for (u64 i = 0; i < growing_array_get_valid_count(emissions); i += 1) {
+		Emission_Instance *e = &emissions[i];
+		if (!e->allocated || !e->config.simulate) continue;
+		
+		u64 first_dead = e->particles.count;
+		while (next_job < growing_array_get_valid_count(particle_jobs) && particle_jobs[next_job].e == e) {
+			first_dead = min(first_dead, particle_jobs[next_job].first_dead);
+			next_job += 1;
+		}
+		
+		particles_update_simulated_finish(e, first_dead, delta_time);
+	}
+}
+
+void particles_draw_in_frame(Draw_Frame *frame, float32 now) {
+	growing_array_clear((void**)&particle_jobs);
+	
+	Matrix4 world_to_clip = m4_mul(frame->projection, m4_inverse(frame->camera_xform));
+	
+	for (u64 i = 0; i < growing_array_get_valid_count(emissions); i += 1) {
+		Emission_Instance *e = &emissions[i];
+		if (!e->allocated) continue;
+		
+		if (e->config.simulate) {
+			if (e->particles.count) {
+				bool has_images = false;
+				for (u64 k = 0; k < e->config.number_of_kinds; k++) {
+					if (e->config.kind_pool[k] == PARTICLE_KIND_IMAGE) has_images = true;
 				}
+				assert(!has_images || e->config.number_of_images > 0, "Particle is PARTICLE_KIND_IMAGE but config.number_of_images is <= 0");
 			}
+			particles_push_jobs(e, e->particles.count, false, 0);
+			continue;
+		}
+		
+		// We compute each particle each frame depending on now vs then
+		float32 passed = now - e->start_time;
+		
+		Emission_Timing timing = get_emission_timing(e);
+		if (!e->config.persist && !e->config.loop && passed > timing.last_death_duration) {
+			e->allocated = false;
+			continue;
 		}
 		
+		particles_push_jobs(e, get_emission_max_emitted(e, passed), true, passed);
+	}
+	
+	u64 job_count = growing_array_get_valid_count(particle_jobs);
+	
+	while (growing_array_get_valid_count(particle_job_frames) < job_count) {
+		Draw_Frame *job_frame = growing_array_add_empty((void**)&particle_job_frames);
+		draw_frame_init(job_frame);
+	}
+	
+	for (u64 i = 0; i < job_count; i++) {
+		Draw_Frame *job_frame = &particle_job_frames[i];
 		
+		// Only the quad buffer and the current z & scissor matter for the jobs
+		growing_array_clear((void**)&job_frame->quad_buffer);
+		job_frame->z_count = 0;
+		job_frame->scissor_count = 0;
+		if (frame->z_count > 0) {
+			job_frame->z_stack[0] = frame->z_stack[frame->z_count-1];
+			job_frame->z_count = 1;
+		}
+		if (frame->scissor_count > 0) {
+			job_frame->scissor_stack[0] = frame->scissor_stack[frame->scissor_count-1];
+			job_frame->scissor_count = 1;
+		}
+		
+		particle_jobs[i].world_to_clip = world_to_clip;
+		particle_jobs[i].frame = job_frame;
 	}
 	
-	seed_for_random = backup_seed;
+	particles_run_jobs(particle_draw_job);
+	
+	for (u64 i = 0; i < job_count; i++) {
+		Draw_Quad *quads = particle_job_frames[i].quad_buffer;
+		u64 quad_count = growing_array_get_valid_count(quads);
+		if (quad_count) growing_array_add_multiple((void**)&frame->quad_buffer, quads, quad_count);
+	}
 }
 
+void particles_draw() {
+	particles_draw_in_frame(&draw_frame, os_get_elapsed_seconds());
+}
@@ -11,7 +11,7 @@ void ext_init() {
 
 void ext_update(float32 delta_time) {
 #if OOGABOOGA_EXTENSION_PARTICLES
-	particles_update();
+	particles_update(delta_time);
 #endif
 }
 
@@ -7,6 +7,8 @@
 	
 	Gfx_Font *font = load_font_from_disk(STR("C:/windows/fonts/arial.ttf"), get_heap_allocator());
 	assert(font, "Failed loading arial.ttf");
+	
+	// Or load_font_from_disk_sdf, for text that's drawn at many sizes (see FONT_SDF_BASE_HEIGHT)
 
 	while (...) {
 		...
@@ -18,13 +20,39 @@
 
 */
 
-// #Memory #Speed
-// This is terruble  and huge waste of video memory. We should have a constant codepoint range
-// with arbitrary atlas sizes instead.
-#define FONT_ATLAS_WIDTH  2048
-#define FONT_ATLAS_HEIGHT 2048
+// Glyphs are rasterized the first time they are used and packed into glyph cache pages, which
+// are shared by every height of a font. When all pages are full, the least recently used page
+// that wasn't touched this frame is cleared and reused, and glyphs that were in it get
+// rasterized again next time they are drawn.
+#ifndef FONT_ATLAS_WIDTH
+	#define FONT_ATLAS_WIDTH  1024
+#endif
+#ifndef FONT_ATLAS_HEIGHT
+	#define FONT_ATLAS_HEIGHT 1024
+#endif
+// Soft limit. If every page was used in the current frame we make another one rather than
+// evicting glyphs that are about to be drawn.
+#ifndef FONT_ATLAS_MAX_PAGES
+	#define FONT_ATLAS_MAX_PAGES 4
+#endif
+// Empty pixels between glyphs so linear filtering doesn't pick up neighbours
+#define FONT_ATLAS_GLYPH_PADDING 1
 #define MAX_FONT_HEIGHT 512
 
+// Fonts loaded with load_font_from_disk_sdf store signed distance fields instead of coverage.
+// Glyphs are only rasterized at FONT_SDF_BASE_HEIGHT, and that one variation is scaled to
+// whatever raster height you draw with, so every size shares the same glyphs.
+// The distance field extends FONT_SDF_PADDING pixels outside of the glyph, which is how far
+// it can be scaled down before edges get blurry.
+#ifndef FONT_SDF_BASE_HEIGHT
+	#define FONT_SDF_BASE_HEIGHT 64
+#endif
+#ifndef FONT_SDF_PADDING
+	#define FONT_SDF_PADDING 6
+#endif
+// #Volatile reflected in 2D batch shader (QUAD_TYPE_SDF)
+#define FONT_SDF_ON_EDGE 128
+
 typedef struct Gfx_Font Gfx_Font;
 typedef struct Gfx_Text_Metrics {
 	
@@ -93,28 +121,65 @@ typedef struct Gfx_Glyph {
 	float advance;
 	float width, height;
 	Vector4 uv;
+	
+	// Where the bitmap is in the glyph cache. Only valid while atlas_generation matches the
+	// page's generation, since pages get evicted.
+	u32 atlas_index;
+	u32 atlas_generation;
+	bool cached; // Metrics are computed
 } Gfx_Glyph;
+// A glyph cache page
 typedef struct Gfx_Font_Atlas {
 	Gfx_Image *image;
-	u32 first_codepoint;
-	Gfx_Glyph *glyphs; // first_codepoint + index == the codepoint
+	Rect_Packer packer;
+	u32 generation; // Bumped each time the page is evicted. Starts at 1.
+	u64 last_used_frame;
+	
+	// Glyphs are rasterized into this CPU copy, and the dirty rows are uploaded in one go by
+	// font_upload_dirty_glyphs before rendering.
+	u8 *pixels;
+	u32 dirty_y0, dirty_y1; // Nothing to upload if equal
 } Gfx_Font_Atlas;
 typedef struct Gfx_Font_Variation {
 	Gfx_Font *font;
 	u32 height;
 	Gfx_Font_Metrics metrics;
 	float scale;
-	u32 codepoint_range_per_atlas;
-	Hash_Table atlases; // u32 atlas_index, Gfx_Font_Atlas
+	Gfx_Glyph *latin1_glyphs; // 256 entries, indexed by codepoint
+	Hash_Table glyphs; // u32 codepoint, Gfx_Glyph. Only codepoints above latin1.
 	bool initted;
 } Gfx_Font_Variation;
+typedef struct Font_Kerning_Pair {
+	u64 key; // (first << 32) | second. 0 means empty slot.
+	s32 advance;
+} Font_Kerning_Pair;
 typedef struct Gfx_Font {
 	stbtt_fontinfo stbtt_handle;
 	string raw_font_data;
 	Gfx_Font_Variation variations[MAX_FONT_HEIGHT]; // Variation per font height
+	Gfx_Font_Atlas *atlases; // Growing array of glyph cache pages, shared by all variations
+	
+	// Kerning in font units, so it's shared by all variations. Built when the first variation is
+	// initted. See font_get_kerning.
+	bool has_kerning;
+	bool kerning_initted;
+	s16 *ascii_kerning; // 128*128, indexed [first*128 + second]
+	Font_Kerning_Pair *kerning_pairs; // Open addressing, filled as pairs outside ascii are seen
+	u64 kerning_pair_capacity;
+	u64 kerning_pair_count;
+	
+	bool sdf; // See FONT_SDF_BASE_HEIGHT
+	
 	Allocator allocator;
 } Gfx_Font;
 
+// Fonts that are loaded, so glyph uploads can be flushed before rendering.
+// #Global
+ogb_instance Gfx_Font **loaded_fonts;
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+Gfx_Font **loaded_fonts = 0;
+#endif
+
 Gfx_Font *load_font_from_disk(string path, Allocator allocator) {
 	
 	string font_data;
@@ -137,25 +202,43 @@ Gfx_Font *load_font_from_disk(string path, Allocator allocator) {
 	
 	third_party_allocator = ZERO(Allocator);
 	
+	if (!loaded_fonts) growing_array_init((void**)&loaded_fonts, sizeof(Gfx_Font*), get_heap_allocator());
+	growing_array_add((void**)&loaded_fonts, &font);
+	
+	return font;
+}
+Gfx_Font *load_font_from_disk_sdf(string path, Allocator allocator) {
+	Gfx_Font *font = load_font_from_disk(path, allocator);
+	if (font) font->sdf = true;
 	return font;
 }
+void text_layout_cache_remove_font(Gfx_Font *font);
 void destroy_font(Gfx_Font *font) {
 
+	growing_array_unordered_remove_one_by_value((void**)&loaded_fonts, &font);
+	text_layout_cache_remove_font(font);
+
 	third_party_allocator = font->allocator;
 
 	for (u64 i = 0; i < MAX_FONT_HEIGHT; i++) {
 		Gfx_Font_Variation *variation = &font->variations[i];
 		if (!variation->initted) continue;
 		
-		for (u64 j = 0; j < variation->atlases.count; j++) {
-			Gfx_Font_Atlas *atlas = (Gfx_Font_Atlas*)hash_table_get_nth_value(&variation->atlases, j);
-			delete_image(atlas->image);
-			dealloc(font->allocator, atlas->glyphs);
+		dealloc(font->allocator, variation->latin1_glyphs);
+		hash_table_destroy(&variation->glyphs);
+	}
+	
+	if (font->atlases) {
+		for (u64 i = 0; i < growing_array_get_valid_count(font->atlases); i++) {
+			delete_image(font->atlases[i].image);
+			rect_packer_deinit(&font->atlases[i].packer);
+			dealloc(font->allocator, font->atlases[i].pixels);
 		}
-		
-		hash_table_destroy(&variation->atlases);
-		
+		growing_array_deinit((void**)&font->atlases);
 	}
+	
+	if (font->ascii_kerning) dealloc(font->allocator, font->ascii_kerning);
+	if (font->kerning_pairs) dealloc(font->allocator, font->kerning_pairs);
 
 	dealloc_string(font->allocator, font->raw_font_data);
 	dealloc(font->allocator, font);
@@ -163,17 +246,103 @@ void destroy_font(Gfx_Font *font) {
 	third_party_allocator = ZERO(Allocator);
 }
 
+// SDF fonts only have the variation at FONT_SDF_BASE_HEIGHT, so other heights become a scale.
+// Returns the height to look glyphs up with. Does nothing for regular fonts, or if the height
+// was already resolved.
+u32 font_resolve_raster_height(Gfx_Font *font, u32 raster_height, Vector2 *scale) {
+	if (!font->sdf) return raster_height;
+	
+	float factor = (float)raster_height/(float)FONT_SDF_BASE_HEIGHT;
+	if (scale) {
+		scale->x *= factor;
+		scale->y *= factor;
+	}
+	return FONT_SDF_BASE_HEIGHT;
+}
+
+///
+// Kerning
+
+// stbtt_GetCodepointKernAdvance looks up both glyph indices and then walks the kern or GPOS
+// table, for every pair of glyphs we lay out. Instead we look up every ascii pair once, and
+// remember everything else the first time it's seen.
+void font_kerning_init(Gfx_Font *font) {
+	stbtt_fontinfo *info = &font->stbtt_handle;
+
+	font->kerning_initted = true;
+	font->has_kerning = info->kern || info->gpos;
+	
+	if (!font->has_kerning) return;
+	
+	int glyph_indices[128];
+	for (u32 c = 0; c < 128; c++) {
+		glyph_indices[c] = stbtt_FindGlyphIndex(info, (int)c);
+	}
+	
+	font->ascii_kerning = alloc(font->allocator, 128*128*sizeof(s16));
+	for (u32 a = 0; a < 128; a++) {
+		for (u32 b = 0; b < 128; b++) {
+			int advance = stbtt_GetGlyphKernAdvance(info, glyph_indices[a], glyph_indices[b]);
+			font->ascii_kerning[a*128+b] = (s16)advance;
+		}
+	}
+	
+	font->kerning_pair_capacity = 256;
+	font->kerning_pair_count = 0;
+	font->kerning_pairs = alloc(font->allocator, font->kerning_pair_capacity*sizeof(Font_Kerning_Pair));
+}
+
+void font_kerning_insert(Font_Kerning_Pair *pairs, u64 capacity, Font_Kerning_Pair pair) {
+	u64 mask = capacity-1;
+	u64 i = xx_hash(pair.key) & mask;
+	while (pairs[i].key) i = (i+1) & mask;
+	pairs[i] = pair;
+}
+
+// Unscaled, multiply by Gfx_Font_Variation.scale
+s32 font_get_kerning(Gfx_Font *font, u32 first, u32 second) {
+	if (!font->kerning_initted) font_kerning_init(font);
+	if (!font->has_kerning) return 0;
+	
+	if (first < 128 && second < 128) return font->ascii_kerning[first*128+second];
+	
+	u64 key = ((u64)first << 32) | (u64)second;
+	u64 mask = font->kerning_pair_capacity-1;
+	u64 i = xx_hash(key) & mask;
+	while (font->kerning_pairs[i].key) {
+		if (font->kerning_pairs[i].key == key) return font->kerning_pairs[i].advance;
+		i = (i+1) & mask;
+	}
+	
+	s32 advance = stbtt_GetCodepointKernAdvance(&font->stbtt_handle, (int)first, (int)second);
+	
+	// Keep load under 50%
+	if ((font->kerning_pair_count+1)*2 > font->kerning_pair_capacity) {
+		u64 new_capacity = font->kerning_pair_capacity*2;
+		Font_Kerning_Pair *new_pairs = alloc(font->allocator, new_capacity*sizeof(Font_Kerning_Pair));
+		for (u64 j = 0; j < font->kerning_pair_capacity; j++) {
+			if (font->kerning_pairs[j].key) font_kerning_insert(new_pairs, new_capacity, font->kerning_pairs[j]);
+		}
+		dealloc(font->allocator, font->kerning_pairs);
+		font->kerning_pairs = new_pairs;
+		font->kerning_pair_capacity = new_capacity;
+	}
+	
+	font_kerning_insert(font->kerning_pairs, font->kerning_pair_capacity, (Font_Kerning_Pair){key, advance});
+	font->kerning_pair_count += 1;
+	
+	return advance;
+}
+
 void font_variation_init(Gfx_Font_Variation *variation, Gfx_Font *font, u32 font_height) {
+	
+	if (!font->kerning_initted) font_kerning_init(font);
 
 	variation->font = font;
 	variation->height = font_height;
 	
-	u32 x_range = FONT_ATLAS_WIDTH / font_height;
-	u32 y_range = FONT_ATLAS_HEIGHT / font_height;
-	
-	variation->codepoint_range_per_atlas = x_range*y_range;
-	
-	variation->atlases = make_hash_table(u32, Gfx_Font_Atlas, font->allocator);
+	variation->latin1_glyphs = alloc(font->allocator, 256*sizeof(Gfx_Glyph));
+	variation->glyphs = make_hash_table(u32, Gfx_Glyph, font->allocator);
 	
 	variation->scale = stbtt_ScaleForPixelHeight(&font->stbtt_handle, (float)font_height);
 	
@@ -213,79 +382,414 @@ void font_variation_init(Gfx_Font_Variation *variation, Gfx_Font *font, u32 font
 	variation->initted = true;
 }
 
-void font_atlas_init(Gfx_Font_Atlas *atlas, Gfx_Font_Variation *variation, u32 first_codepoint) {
-	stbtt_fontinfo stbtt_handle = variation->font->stbtt_handle;
-	atlas->first_codepoint = first_codepoint;
+///
+// Glyph cache
+
+// Finds room for a w*h rect in the glyph cache, evicting the least recently used page if needed.
+// Returns the page index.
+u32 font_atlas_allocate(Gfx_Font *font, u32 w, u32 h, u32 *x, u32 *y) {
 	
-	atlas->image = make_image(FONT_ATLAS_WIDTH, FONT_ATLAS_HEIGHT, 1, 0, variation->font->allocator);
-	atlas->glyphs = alloc(variation->font->allocator, variation->codepoint_range_per_atlas*sizeof(Gfx_Glyph));
+	if (!font->atlases) {
+		growing_array_init((void**)&font->atlases, sizeof(Gfx_Font_Atlas), font->allocator);
+	}
 	
-	u32 cursor_x = 0;
-	u32 cursor_y = 0;
+	u64 page_count = growing_array_get_valid_count(font->atlases);
+	for (u64 i = 0; i < page_count; i++) {
+		if (rect_packer_pack(&font->atlases[i].packer, w, h, x, y)) return (u32)i;
+	}
 	
-	third_party_allocator = variation->font->allocator;
-	// Used for flipping bitmaps
-	u8 *temp_row = (u8 *)talloc(variation->height);
-	for (u32 c = first_codepoint; c < first_codepoint + variation->codepoint_range_per_atlas; c++) {
-		u32 i = c-first_codepoint;
-		Gfx_Glyph *glyph = &atlas->glyphs[i];
-		glyph->codepoint = c;
-		
-		int w, h, x, y;
-		void *bitmap = stbtt_GetCodepointBitmap(&stbtt_handle, variation->scale, variation->scale, (int)c, &w, &h, &x, &y);
-		
-		if (cursor_x+w > FONT_ATLAS_WIDTH) {
-			cursor_x = 0;
-			cursor_y += variation->height;
+	if (page_count >= FONT_ATLAS_MAX_PAGES) {
+		// Pages used this frame may have glyphs in queued quads, so those can't be evicted
+		s64 lru_index = -1;
+		for (u64 i = 0; i < page_count; i++) {
+			Gfx_Font_Atlas *page = &font->atlases[i];
+			if (page->last_used_frame >= gfx_frame_index) continue;
+			if (lru_index < 0 || page->last_used_frame < font->atlases[lru_index].last_used_frame) {
+				lru_index = (s64)i;
+			}
 		}
 		
-		if (bitmap) {
-			// #Speed #Loadtimes
-			for (int row = 0; row < h; ++row) {
-                gfx_set_image_data(atlas->image, cursor_x, cursor_y + (h - 1 - row), w, 1, bitmap + (row * w));
-            }
-			stbtt_FreeBitmap(bitmap, 0);
+		if (lru_index >= 0) {
+			Gfx_Font_Atlas *page = &font->atlases[lru_index];
+			rect_packer_reset(&page->packer);
+			page->generation += 1;
+			
+			// Clear so old glyphs don't show up in the padding of new ones
+			memset(page->pixels, 0, FONT_ATLAS_WIDTH*FONT_ATLAS_HEIGHT);
+			page->dirty_y0 = 0;
+			page->dirty_y1 = FONT_ATLAS_HEIGHT;
+			
+			if (rect_packer_pack(&page->packer, w, h, x, y)) return (u32)lru_index;
 		}
-		
-		glyph->xoffset = (float)x;
-		glyph->yoffset = variation->height - (float)y - (float)h - variation->metrics.max_ascent+variation->metrics.max_descent;  // Adjusted yoffset for bottom-up rendering
-		glyph->width   = (float)w;
-		glyph->height  = (float)h;
-		
-		int advance, left_side_bearing;
-		stbtt_GetCodepointHMetrics(&stbtt_handle, c, &advance, &left_side_bearing);
-		
-		glyph->advance = (float)advance*variation->scale;
-		//glyph->xoffset += (float)left_side_bearing*variation->scale;
-		
-		glyph->uv.x1 = ((float)cursor_x)/(float)FONT_ATLAS_WIDTH;
-		glyph->uv.y1 = ((float)cursor_y)/(float)FONT_ATLAS_HEIGHT;
-		glyph->uv.x2 = ((float)cursor_x+glyph->width)/(float)FONT_ATLAS_WIDTH;
-		glyph->uv.y2 = ((float)cursor_y+glyph->height)/(float)FONT_ATLAS_HEIGHT;
-		
-		cursor_x += w;
 	}
 	
+	Gfx_Font_Atlas *page = growing_array_add_empty((void**)&font->atlases);
+	page->image = make_image(FONT_ATLAS_WIDTH, FONT_ATLAS_HEIGHT, 1, 0, font->allocator);
+	page->pixels = alloc(font->allocator, FONT_ATLAS_WIDTH*FONT_ATLAS_HEIGHT);
+	rect_packer_init(&page->packer, FONT_ATLAS_WIDTH, FONT_ATLAS_HEIGHT, font->allocator);
+	page->generation = 1;
+	page->last_used_frame = gfx_frame_index;
+	
+	bool ok = rect_packer_pack(&page->packer, w, h, x, y);
+	assert(ok, "Glyph of size %ux%u does not fit in a %ux%u glyph cache page", w, h, FONT_ATLAS_WIDTH, FONT_ATLAS_HEIGHT);
+	
+	return (u32)(growing_array_get_valid_count(font->atlases)-1);
+}
+
+void font_glyph_compute_metrics(Gfx_Glyph *glyph, Gfx_Font_Variation *variation, u32 codepoint) {
+	stbtt_fontinfo *stbtt_handle = &variation->font->stbtt_handle;
+	
+	int x0, y0, x1, y1;
+	stbtt_GetCodepointBitmapBox(stbtt_handle, (int)codepoint, variation->scale, variation->scale, &x0, &y0, &x1, &y1);
+	int w = x1-x0;
+	int h = y1-y0;
+	
+	glyph->codepoint = codepoint;
+	glyph->xoffset = (float)x0;
+	glyph->yoffset = variation->height - (float)y0 - (float)h - variation->metrics.max_ascent+variation->metrics.max_descent;  // Adjusted yoffset for bottom-up rendering
+	glyph->width   = (float)w;
+	glyph->height  = (float)h;
+	
+	int advance, left_side_bearing;
+	stbtt_GetCodepointHMetrics(stbtt_handle, codepoint, &advance, &left_side_bearing);
+	
+	glyph->advance = (float)advance*variation->scale;
+	//glyph->xoffset += (float)left_side_bearing*variation->scale;
+	
+	glyph->cached = true;
+}
+
+// Size of the bitmap we rasterize for a glyph. For SDF fonts it includes the padding around the
+// glyph on all sides.
+void font_glyph_bitmap_size(Gfx_Font *font, Gfx_Glyph *glyph, u32 *w, u32 *h) {
+	u32 padding = font->sdf ? FONT_SDF_PADDING : 0;
+	*w = (u32)glyph->width  + padding*2;
+	*h = (u32)glyph->height + padding*2;
+}
+
+// Puts a top-down 8 bit bitmap of the glyph in the glyph cache
+void font_glyph_place(Gfx_Glyph *glyph, Gfx_Font *font, u8 *bitmap) {
+	u32 w, h;
+	font_glyph_bitmap_size(font, glyph, &w, &h);
+	
+	u32 x, y;
+	glyph->atlas_index = font_atlas_allocate(font, w+FONT_ATLAS_GLYPH_PADDING, h+FONT_ATLAS_GLYPH_PADDING, &x, &y);
+	Gfx_Font_Atlas *page = &font->atlases[glyph->atlas_index];
+	glyph->atlas_generation = page->generation;
+	
+	// Images are bottom-up
+	for (u32 row = 0; row < h; row++) {
+		memcpy(page->pixels + (y+h-1-row)*FONT_ATLAS_WIDTH + x, bitmap + row*w, w);
+	}
+	
+	if (page->dirty_y0 == page->dirty_y1) {
+		page->dirty_y0 = y;
+		page->dirty_y1 = y+h;
+	} else {
+		page->dirty_y0 = min(page->dirty_y0, y);
+		page->dirty_y1 = max(page->dirty_y1, y+h);
+	}
+	
+	// The uv covers the whole bitmap, SDF padding included. See font_glyph_quad.
+	glyph->uv.x1 = ((float)x)/(float)FONT_ATLAS_WIDTH;
+	glyph->uv.y1 = ((float)y)/(float)FONT_ATLAS_HEIGHT;
+	glyph->uv.x2 = ((float)(x+w))/(float)FONT_ATLAS_WIDTH;
+	glyph->uv.y2 = ((float)(y+h))/(float)FONT_ATLAS_HEIGHT;
+}
+
+// Where to draw a glyph's uv at glyph_x, glyph_y (as given to walk_glyphs callbacks). Glyph
+// metrics are the glyph box in both modes, but for SDF fonts the quad grows by the padding on
+// all sides so the edge falloff outside of the box isn't clipped.
+void font_glyph_quad(Gfx_Font *font, Gfx_Glyph glyph, float glyph_x, float glyph_y, Vector2 scale, Vector2 *position, Vector2 *size) {
+	float padding = font->sdf ? (float)FONT_SDF_PADDING : 0;
+	*position = v2(glyph_x-padding*scale.x, glyph_y-padding*scale.y);
+	*size = v2((glyph.width+padding*2)*scale.x, (glyph.height+padding*2)*scale.y);
+}
+
+// Top-down bitmap of w*h, as given by font_glyph_bitmap_size
+void font_glyph_make_bitmap(stbtt_fontinfo *stbtt_handle, bool sdf, float scale, u32 codepoint, u8 *bitmap, u32 w, u32 h) {
+	if (!sdf) {
+		stbtt_MakeCodepointBitmap(stbtt_handle, bitmap, (int)w, (int)h, (int)w, scale, scale, (int)codepoint);
+		return;
+	}
+	
+	int sdf_w, sdf_h, xoff, yoff;
+	u8 *sdf_bitmap = stbtt_GetCodepointSDF(stbtt_handle, scale, (int)codepoint, FONT_SDF_PADDING, FONT_SDF_ON_EDGE, (float)FONT_SDF_ON_EDGE/(float)FONT_SDF_PADDING, &sdf_w, &sdf_h, &xoff, &yoff);
+	assert(sdf_bitmap && (u32)sdf_w == w && (u32)sdf_h == h, "SDF for codepoint %u is %dx%d, expected %ux%u", codepoint, sdf_w, sdf_h, w, h);
+	
+	memcpy(bitmap, sdf_bitmap, w*h);
+	stbtt_FreeSDF(sdf_bitmap, 0);
+}
+
+void font_glyph_rasterize(Gfx_Glyph *glyph, Gfx_Font_Variation *variation) {
+	Gfx_Font *font = variation->font;
+	
+	u32 w, h;
+	font_glyph_bitmap_size(font, glyph, &w, &h);
+	
+	u8 *bitmap = (u8*)talloc(w*h);
+	third_party_allocator = font->allocator;
+	font_glyph_make_bitmap(&font->stbtt_handle, font->sdf, variation->scale, glyph->codepoint, bitmap, w, h);
 	third_party_allocator = ZERO(Allocator);
+	
+	font_glyph_place(glyph, font, bitmap);
 }
 
-void render_atlas_if_not_yet_rendered(Gfx_Font *font, u32 font_height, u32 codepoint) {
-	assert(font_height <= MAX_FONT_HEIGHT, "Font height too large; maximum of %d is allowed.", MAX_FONT_HEIGHT);
+// Returns the glyph entry with its metrics, it might not be in the glyph cache.
+// The pointer is valid until the next glyph is added to the variation.
+Gfx_Glyph *font_find_or_add_glyph(Gfx_Font_Variation *variation, u32 codepoint) {
+	Gfx_Glyph *glyph;
+	if (codepoint < 256) {
+		glyph = &variation->latin1_glyphs[codepoint];
+	} else {
+		glyph = (Gfx_Glyph*)hash_table_find(&variation->glyphs, codepoint);
+		if (!glyph) {
+			Gfx_Glyph new_glyph = ZERO(Gfx_Glyph);
+			hash_table_add(&variation->glyphs, codepoint, new_glyph);
+			glyph = (Gfx_Glyph*)hash_table_find(&variation->glyphs, codepoint);
+		}
+	}
+	
+	if (!glyph->cached) font_glyph_compute_metrics(glyph, variation, codepoint);
+	
+	return glyph;
+}
+
+// Glyph has pixels but they're not in the glyph cache (never rasterized, or its page was evicted)
+bool font_glyph_needs_rasterizing(Gfx_Font *font, Gfx_Glyph *glyph) {
+	if (glyph->width <= 0 || glyph->height <= 0) return false;
+	return glyph->atlas_generation == 0 || font->atlases[glyph->atlas_index].generation != glyph->atlas_generation;
+}
+
+// Returns the glyph with its bitmap in the glyph cache, rasterizing it if it isn't.
+// *atlas is set to the page it's in, or 0 if the glyph has no pixels (e.g. space).
+// The pointer is valid until the next glyph is added to the variation.
+Gfx_Glyph *font_get_glyph(Gfx_Font *font, u32 font_height, u32 codepoint, Gfx_Font_Atlas **atlas) {
+	assert(font_height < MAX_FONT_HEIGHT, "Font height too large; maximum of %d is allowed.", MAX_FONT_HEIGHT-1);
+	font_height = font_resolve_raster_height(font, font_height, 0);
 	Gfx_Font_Variation *variation = &font->variations[font_height];
 	
 	if (!variation->initted) {
 		font_variation_init(variation, font, font_height);
 	}
 	
-	u32 atlas_index = codepoint / variation->codepoint_range_per_atlas;
+	Gfx_Glyph *glyph = font_find_or_add_glyph(variation, codepoint);
+	
+	*atlas = 0;
+	if (glyph->width <= 0 || glyph->height <= 0) return glyph;
+	
+	if (font_glyph_needs_rasterizing(font, glyph)) {
+		font_glyph_rasterize(glyph, variation);
+	}
+	
+	*atlas = &font->atlases[glyph->atlas_index];
+	(*atlas)->last_used_frame = gfx_frame_index;
 	
-	if (!hash_table_contains(&variation->atlases, atlas_index)) {
-		Gfx_Font_Atlas atlas = ZERO(Gfx_Font_Atlas);
-		font_atlas_init(&atlas, variation, atlas_index*variation->codepoint_range_per_atlas);
-		hash_table_add(&variation->atlases, atlas_index, atlas);
+	return glyph;
+}
+
+// Uploads the rows of glyph cache pages that changed since last time.
+// Called by gfx_render_draw_frame, so you only need this if you read glyph pages yourself.
+void font_upload_dirty_glyphs() {
+	if (!loaded_fonts) return;
+	
+	for (u64 i = 0; i < growing_array_get_valid_count(loaded_fonts); i++) {
+		Gfx_Font *font = loaded_fonts[i];
+		if (!font->atlases) continue;
+		
+		for (u64 j = 0; j < growing_array_get_valid_count(font->atlases); j++) {
+			Gfx_Font_Atlas *page = &font->atlases[j];
+			if (page->dirty_y0 == page->dirty_y1) continue;
+			
+			// Whole rows so the source is contiguous in the staging copy
+			u32 h = page->dirty_y1-page->dirty_y0;
+			gfx_set_image_data(page->image, 0, page->dirty_y0, FONT_ATLAS_WIDTH, h, page->pixels + page->dirty_y0*FONT_ATLAS_WIDTH);
+			
+			page->dirty_y0 = page->dirty_y1 = 0;
+		}
 	}
 }
 
+void render_atlas_if_not_yet_rendered(Gfx_Font *font, u32 font_height, u32 codepoint) {
+	Gfx_Font_Atlas *atlas;
+	font_get_glyph(font, font_height, codepoint, &atlas);
+}
+
+///
+// Parallel glyph rasterization
+// font_prewarm_async rasterizes a range of codepoints on worker threads so you can do something
+// else meanwhile, like loading other assets. Once all of it is done, poll_font_prewarm (on the
+// rendering thread) puts the glyphs in the glyph cache. font_rasterize_range does the same thing
+// but blocks, with the calling thread helping out.
+//
+//     Font_Prewarm *prewarm = font_prewarm_async(font, 48, 32, 255);
+//     ... load other things ...
+//     wait_font_prewarm(prewarm);
+//
+// The font must not be destroyed while a prewarm is in flight.
+
+#define FONT_GLYPHS_PER_RASTER_JOB 16
+
+// Number of rasterization threads. -1 means one less than the number of logical processors.
+// Must be set before the first prewarm.
+// #Global
+ogb_instance s64 font_raster_worker_count;
+ogb_instance Worker_Pool font_raster_workers;
+ogb_instance bool font_raster_workers_initted;
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+s64 font_raster_worker_count = -1;
+Worker_Pool font_raster_workers;
+bool font_raster_workers_initted = false;
+#endif
+
+typedef struct Glyph_Raster_Item {
+	u32 codepoint;
+	u32 width, height;
+	u8 *bitmap; // Top-down, as stbtt makes it
+} Glyph_Raster_Item;
+
+typedef struct Glyph_Raster_Job {
+	stbtt_fontinfo *stbtt_handle;
+	float scale;
+	bool sdf;
+	Glyph_Raster_Item *items;
+	u64 count;
+	u8 *bitmaps; // One block for all the items
+	volatile bool done;
+} Glyph_Raster_Job;
+
+typedef struct Font_Prewarm {
+	Gfx_Font *font;
+	u32 font_height;
+	Glyph_Raster_Item *items;
+	u64 item_count;
+	Glyph_Raster_Job *jobs;
+	u64 job_count;
+} Font_Prewarm;
+
+void glyph_raster_job(void *data) {
+	Glyph_Raster_Job *job = (Glyph_Raster_Job*)data;
+	
+	u64 total_size = 0;
+	for (u64 i = 0; i < job->count; i++) total_size += job->items[i].width*job->items[i].height;
+	job->bitmaps = (u8*)alloc_uninitialized(get_heap_allocator(), total_size);
+	
+	// stbtt's edge and scanline buffers go in this thread's scratch
+	third_party_allocator = get_thread_scratch_allocator();
+	
+	u8 *next = job->bitmaps;
+	for (u64 i = 0; i < job->count; i++) {
+		Glyph_Raster_Item *item = &job->items[i];
+		item->bitmap = next;
+		font_glyph_make_bitmap(job->stbtt_handle, job->sdf, job->scale, item->codepoint, item->bitmap, item->width, item->height);
+		next += item->width*item->height;
+	}
+	
+	third_party_allocator = ZERO(Allocator);
+	reset_thread_scratch();
+	
+	MEMORY_BARRIER;
+	job->done = true;
+}
+
+// first_codepoint and last_codepoint are inclusive
+Font_Prewarm *font_prewarm_async(Gfx_Font *font, u32 font_height, u32 first_codepoint, u32 last_codepoint) {
+	assert(font_height < MAX_FONT_HEIGHT, "Font height too large; maximum of %d is allowed.", MAX_FONT_HEIGHT-1);
+	assert(last_codepoint >= first_codepoint, "Bad codepoint range");
+	font_height = font_resolve_raster_height(font, font_height, 0);
+	
+	if (!font_raster_workers_initted) {
+		if (font_raster_worker_count < 0) {
+			font_raster_worker_count = max((s64)os_get_number_of_logical_processors()-1, 1);
+		}
+		worker_pool_init(&font_raster_workers, (u64)font_raster_worker_count, get_heap_allocator());
+		font_raster_workers_initted = true;
+	}
+	
+	Gfx_Font_Variation *variation = &font->variations[font_height];
+	if (!variation->initted) {
+		font_variation_init(variation, font, font_height);
+	}
+	
+	Font_Prewarm *prewarm = alloc(get_heap_allocator(), sizeof(Font_Prewarm));
+	prewarm->font = font;
+	prewarm->font_height = font_height;
+	
+	// Metrics are cheap, so those are done here. Only the bitmaps are done on the workers.
+	u64 range = (u64)last_codepoint-(u64)first_codepoint+1;
+	prewarm->items = alloc(get_heap_allocator(), range*sizeof(Glyph_Raster_Item));
+	for (u64 c = first_codepoint; c <= last_codepoint; c++) {
+		Gfx_Glyph *glyph = font_find_or_add_glyph(variation, (u32)c);
+		if (!font_glyph_needs_rasterizing(font, glyph)) continue;
+		
+		Glyph_Raster_Item *item = &prewarm->items[prewarm->item_count];
+		item->codepoint = (u32)c;
+		font_glyph_bitmap_size(font, glyph, &item->width, &item->height);
+		prewarm->item_count += 1;
+	}
+	
+	prewarm->job_count = (prewarm->item_count+FONT_GLYPHS_PER_RASTER_JOB-1)/FONT_GLYPHS_PER_RASTER_JOB;
+	if (prewarm->job_count) {
+		prewarm->jobs = alloc(get_heap_allocator(), prewarm->job_count*sizeof(Glyph_Raster_Job));
+	}
+	for (u64 i = 0; i < prewarm->job_count; i++) {
+		Glyph_Raster_Job *job = &prewarm->jobs[i];
+		job->stbtt_handle = &font->stbtt_handle;
+		job->scale = variation->scale;
+		job->sdf = font->sdf;
+		job->items = prewarm->items + i*FONT_GLYPHS_PER_RASTER_JOB;
+		job->count = min(FONT_GLYPHS_PER_RASTER_JOB, prewarm->item_count-i*FONT_GLYPHS_PER_RASTER_JOB);
+		worker_pool_push(&font_raster_workers, glyph_raster_job, job);
+	}
+	
+	return prewarm;
+}
+
+// Must be called from the thread that owns the renderer.
+// Returns false while glyphs are still being rasterized. Once it returns true, the glyphs are in
+// the glyph cache and the prewarm is freed.
+bool poll_font_prewarm(Font_Prewarm *prewarm) {
+	for (u64 i = 0; i < prewarm->job_count; i++) {
+		if (!prewarm->jobs[i].done) return false;
+	}
+	MEMORY_BARRIER;
+	
+	Gfx_Font *font = prewarm->font;
+	Gfx_Font_Variation *variation = &font->variations[prewarm->font_height];
+	
+	for (u64 i = 0; i < prewarm->item_count; i++) {
+		Glyph_Raster_Item *item = &prewarm->items[i];
+		Gfx_Glyph *glyph = font_find_or_add_glyph(variation, item->codepoint);
+		
+		// Might have been drawn (and rasterized) in the meantime
+		if (!font_glyph_needs_rasterizing(font, glyph)) continue;
+		
+		font_glyph_place(glyph, font, item->bitmap);
+	}
+	
+	for (u64 i = 0; i < prewarm->job_count; i++) {
+		dealloc(get_heap_allocator(), prewarm->jobs[i].bitmaps);
+	}
+	if (prewarm->jobs) dealloc(get_heap_allocator(), prewarm->jobs);
+	dealloc(get_heap_allocator(), prewarm->items);
+	dealloc(get_heap_allocator(), prewarm);
+	
+	return true;
+}
+
+// Helps rasterizing while waiting
+void wait_font_prewarm(Font_Prewarm *prewarm) {
+	while (!poll_font_prewarm(prewarm)) {
+		if (!worker_pool_run_one(&font_raster_workers)) os_yield_thread();
+	}
+}
+
+// Rasterizes a range of codepoints into the glyph cache across all rasterization threads
+void font_rasterize_range(Gfx_Font *font, u32 font_height, u32 first_codepoint, u32 last_codepoint) {
+	wait_font_prewarm(font_prewarm_async(font, font_height, first_codepoint, last_codepoint));
+}
+
+// atlas is 0 for glyphs without any pixels
 typedef bool(*Walk_Glyphs_Callback_Proc)(Gfx_Glyph glyph, Gfx_Font_Atlas *atlas, float glyph_x, float glyph_y, void *ud);
 
 typedef struct {
@@ -300,6 +804,8 @@ void walk_glyphs(Walk_Glyphs_Spec spec, Walk_Glyphs_Callback_Proc proc) {
 	
 	if (spec.text.data == 0 || spec.text.count <= 0) return;
 	
+	spec.raster_height = font_resolve_raster_height(spec.font, spec.raster_height, &spec.scale);
+	
 	Gfx_Font_Variation *variation = &spec.font->variations[spec.raster_height];
 	
 	float x = 0;
@@ -309,7 +815,8 @@ void walk_glyphs(Walk_Glyphs_Spec spec, Walk_Glyphs_Callback_Proc proc) {
 	u32 c = next_utf8(&spec.text);
 	while (c != 0) {
 		
-		render_atlas_if_not_yet_rendered(spec.font, spec.raster_height, c);
+		Gfx_Font_Atlas *atlas;
+		Gfx_Glyph glyph = *font_get_glyph(spec.font, spec.raster_height, c, &atlas);
 		
 		if (c == '\n') {
 			x = 0;
@@ -322,10 +829,12 @@ void walk_glyphs(Walk_Glyphs_Spec spec, Walk_Glyphs_Callback_Proc proc) {
 			continue;
 		}
 		
-		u32 atlas_index = c/variation->codepoint_range_per_atlas;
-		
-		Gfx_Font_Atlas *atlas = (Gfx_Font_Atlas*)hash_table_find(&variation->atlases, atlas_index);
-		Gfx_Glyph glyph = atlas->glyphs[c-atlas->first_codepoint];
+		// Kerning is the space between the previous glyph and this one
+		if (last_c != 0) {
+			s32 kerning_unscaled = font_get_kerning(spec.font, last_c, c);
+			float kerning_scaled_to_font_height = kerning_unscaled * variation->scale;
+			x += kerning_scaled_to_font_height*spec.scale.x;
+		}
 		
 		float glyph_x = x+glyph.xoffset*spec.scale.x;
 		float glyph_y = y+(glyph.yoffset)*spec.scale.y;
@@ -333,31 +842,21 @@ void walk_glyphs(Walk_Glyphs_Spec spec, Walk_Glyphs_Callback_Proc proc) {
 		
 		if (!should_continue) break;
 		
-		// #Incomplete kerning
 		x += glyph.advance*spec.scale.x;
-		if (last_c != 0) {
-			int kerning_unscaled = stbtt_GetCodepointKernAdvance(&spec.font->stbtt_handle, last_c, c);
-			float kerning_scaled_to_font_height = kerning_unscaled * variation->scale;
-			x += kerning_scaled_to_font_height*spec.scale.x;
-		}
 		
 		last_c = c;
 		c = next_utf8(&spec.text);
 	}
 }
 
-Gfx_Font_Metrics get_font_metrics(Gfx_Font *font, u32 raster_height) {
-	Gfx_Font_Variation *variation = &font->variations[raster_height];
+Gfx_Font_Metrics get_font_metrics_scaled(Gfx_Font *font, u32 raster_height, Vector2 scale) {
+	raster_height = font_resolve_raster_height(font, raster_height, &scale);
 	
+	Gfx_Font_Variation *variation = &font->variations[raster_height];
 	if (!variation->initted) {
 		font_variation_init(variation, font, raster_height);
 	}
-	
-	return variation->metrics;
-}
-
-Gfx_Font_Metrics get_font_metrics_scaled(Gfx_Font *font, u32 raster_height, Vector2 scale) {
-	Gfx_Font_Metrics metrics = get_font_metrics(font, raster_height);
+	Gfx_Font_Metrics metrics = variation->metrics;
 	
 	metrics.latin_ascent *= scale.y;
 	metrics.latin_descent *= scale.y;
@@ -368,6 +867,9 @@ Gfx_Font_Metrics get_font_metrics_scaled(Gfx_Font *font, u32 raster_height, Vect
 	
 	return metrics;
 }
+Gfx_Font_Metrics get_font_metrics(Gfx_Font *font, u32 raster_height) {
+	return get_font_metrics_scaled(font, raster_height, v2(1, 1));
+}
 
 typedef struct {
 	Gfx_Text_Metrics m;
@@ -404,8 +906,223 @@ bool measure_text_glyph_callback(Gfx_Glyph glyph, Gfx_Font_Atlas *atlas, float g
 	
 	return true;
 }
+///
+// Text layout cache
+// Most games draw and measure the same strings every frame (labels, item counts), so laid out
+// text is cached by (font, raster height, scale, text). A repeated draw_text just emits quads
+// and a repeated measure_text is a lookup. Entries that haven't been used for
+// TEXT_LAYOUT_CACHE_MAX_AGE frames get evicted.
+
+#ifndef TEXT_LAYOUT_CACHE_MAX_AGE
+	#define TEXT_LAYOUT_CACHE_MAX_AGE 120
+#endif
+
+typedef struct Text_Layout_Glyph {
+	Vector2 position;
+	Vector2 size; // Scaled
+	Vector4 uv;
+	u32 atlas_index;
+	u32 atlas_generation;
+} Text_Layout_Glyph;
+
+typedef struct Text_Layout {
+	u64 hash;
+	Gfx_Font *font;
+	u32 raster_height;
+	Vector2 scale;
+	string text; // Copy, lives in the same allocation as the layout
+	
+	Gfx_Text_Metrics metrics;
+	Text_Layout_Glyph *glyphs; // Only glyphs with pixels, also in the same allocation
+	u64 glyph_count;
+	
+	u64 last_used_frame;
+} Text_Layout;
+
+typedef struct Text_Layout_Cache {
+	Text_Layout **slots; // Open addressing with linear probing, capacity is a power of two
+	u64 capacity;
+	u64 count;
+	u64 last_sweep_frame;
+	Text_Layout_Glyph *scratch_glyphs; // Growing array reused for building layouts
+} Text_Layout_Cache;
+
+// #Global
+ogb_instance bool enable_text_layout_cache;
+ogb_instance Text_Layout_Cache text_layout_cache;
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+bool enable_text_layout_cache = true;
+Text_Layout_Cache text_layout_cache = {0};
+#endif
+
+u64 text_layout_hash(Gfx_Font *font, string text, u32 raster_height, Vector2 scale) {
+	u64 h = string_get_hash(text);
+	h = xx_hash(h ^ (u64)font);
+	h = xx_hash(h ^ (u64)raster_height);
+	h = xx_hash(h ^ ((u64)*(u32*)&scale.x | ((u64)*(u32*)&scale.y << 32)));
+	return h;
+}
+
+void text_layout_cache_insert(Text_Layout *layout) {
+	u64 mask = text_layout_cache.capacity-1;
+	u64 i = layout->hash & mask;
+	while (text_layout_cache.slots[i]) i = (i+1) & mask;
+	text_layout_cache.slots[i] = layout;
+	text_layout_cache.count += 1;
+}
+
+// Reinserts everything into a new table of the given capacity. Layouts for font_to_remove, and
+// if evict_old is set layouts that are too old, are freed instead.
+// Also how we remove entries, since linear probing can't simply clear a slot.
+void text_layout_cache_rebuild(u64 capacity, Gfx_Font *font_to_remove, bool evict_old) {
+	Text_Layout **old_slots = text_layout_cache.slots;
+	u64 old_capacity = text_layout_cache.capacity;
+	
+	text_layout_cache.slots = alloc(get_heap_allocator(), capacity*sizeof(Text_Layout*));
+	text_layout_cache.capacity = capacity;
+	text_layout_cache.count = 0;
+	
+	for (u64 i = 0; i < old_capacity; i++) {
+		Text_Layout *layout = old_slots[i];
+		if (!layout) continue;
+		
+		bool remove = layout->font == font_to_remove;
+		if (evict_old && layout->last_used_frame+TEXT_LAYOUT_CACHE_MAX_AGE < gfx_frame_index) remove = true;
+		
+		if (remove) dealloc(get_heap_allocator(), layout);
+		else        text_layout_cache_insert(layout);
+	}
+	
+	if (old_slots) dealloc(get_heap_allocator(), old_slots);
+}
+
+void text_layout_cache_remove_font(Gfx_Font *font) {
+	if (!text_layout_cache.slots) return;
+	text_layout_cache_rebuild(text_layout_cache.capacity, font, false);
+}
+
+typedef struct {
+	Measure_Text_Walk_Glyphs_Context measure;
+	Text_Layout_Glyph **glyphs;
+} Text_Layout_Walk_Glyphs_Context;
+
+bool text_layout_glyph_callback(Gfx_Glyph glyph, Gfx_Font_Atlas *atlas, float glyph_x, float glyph_y, void *ud) {
+	Text_Layout_Walk_Glyphs_Context *c = (Text_Layout_Walk_Glyphs_Context*)ud;
+	
+	measure_text_glyph_callback(glyph, atlas, glyph_x, glyph_y, &c->measure);
+	
+	if (atlas) {
+		Text_Layout_Glyph *g = growing_array_add_empty((void**)c->glyphs);
+		font_glyph_quad(c->measure.font, glyph, glyph_x, glyph_y, c->measure.scale, &g->position, &g->size);
+		g->uv = glyph.uv;
+		g->atlas_index = (u32)(atlas - c->measure.font->atlases);
+		g->atlas_generation = atlas->generation;
+	}
+	
+	return true;
+}
+
+Text_Layout *text_layout_build(Gfx_Font *font, string text, u32 raster_height, Vector2 scale, u64 hash) {
+	if (!text_layout_cache.scratch_glyphs) {
+		growing_array_init((void**)&text_layout_cache.scratch_glyphs, sizeof(Text_Layout_Glyph), get_heap_allocator());
+	}
+	growing_array_clear((void**)&text_layout_cache.scratch_glyphs);
+	
+	Text_Layout_Walk_Glyphs_Context c = ZERO(Text_Layout_Walk_Glyphs_Context);
+	c.measure.scale = scale;
+	c.measure.font = font;
+	c.measure.raster_height = raster_height;
+	c.glyphs = &text_layout_cache.scratch_glyphs;
+	
+	walk_glyphs((Walk_Glyphs_Spec){font, text, raster_height, scale, true, &c}, text_layout_glyph_callback);
+	
+	c.measure.m.functional_size = v2_sub(c.measure.m.functional_pos_max, c.measure.m.functional_pos_min);
+	c.measure.m.visual_size = v2_sub(c.measure.m.visual_pos_max, c.measure.m.visual_pos_min);
+	
+	u64 glyph_count = growing_array_get_valid_count(text_layout_cache.scratch_glyphs);
+	u64 glyphs_size = glyph_count*sizeof(Text_Layout_Glyph);
+	
+	Text_Layout *layout = alloc_uninitialized(get_heap_allocator(), sizeof(Text_Layout) + glyphs_size + text.count);
+	layout->hash = hash;
+	layout->font = font;
+	layout->raster_height = raster_height;
+	layout->scale = scale;
+	layout->metrics = c.measure.m;
+	layout->glyphs = (Text_Layout_Glyph*)(layout+1);
+	layout->glyph_count = glyph_count;
+	layout->text.data = (u8*)layout->glyphs + glyphs_size;
+	layout->text.count = text.count;
+	layout->last_used_frame = gfx_frame_index;
+	
+	memcpy(layout->glyphs, text_layout_cache.scratch_glyphs, glyphs_size);
+	memcpy(layout->text.data, text.data, text.count);
+	
+	return layout;
+}
+
+// Returns the cached layout of the text, laying it out if it isn't cached or if any of its glyphs
+// were evicted from the glyph cache. Valid until the next call.
+Text_Layout *get_text_layout(Gfx_Font *font, string text, u32 raster_height, Vector2 scale) {
+	
+	raster_height = font_resolve_raster_height(font, raster_height, &scale);
+	
+	if (!text_layout_cache.slots) {
+		text_layout_cache_rebuild(1024, 0, false);
+		text_layout_cache.last_sweep_frame = gfx_frame_index;
+	}
+	if (text_layout_cache.last_sweep_frame+TEXT_LAYOUT_CACHE_MAX_AGE <= gfx_frame_index) {
+		text_layout_cache_rebuild(text_layout_cache.capacity, 0, true);
+		text_layout_cache.last_sweep_frame = gfx_frame_index;
+	}
+	
+	u64 hash = text_layout_hash(font, text, raster_height, scale);
+	
+	u64 mask = text_layout_cache.capacity-1;
+	for (u64 i = hash & mask; text_layout_cache.slots[i]; i = (i+1) & mask) {
+		Text_Layout *layout = text_layout_cache.slots[i];
+		if (layout->hash != hash || layout->font != font || layout->raster_height != raster_height) continue;
+		if (layout->scale.x != scale.x || layout->scale.y != scale.y) continue;
+		if (!strings_match(layout->text, text)) continue;
+		
+		bool stale = false;
+		for (u64 j = 0; j < layout->glyph_count; j++) {
+			Gfx_Font_Atlas *page = &font->atlases[layout->glyphs[j].atlas_index];
+			if (page->generation != layout->glyphs[j].atlas_generation) {
+				stale = true;
+				break;
+			}
+			page->last_used_frame = gfx_frame_index;
+		}
+		
+		if (stale) {
+			// Glyphs are back in the glyph cache after this, but probably somewhere else
+			dealloc(get_heap_allocator(), layout);
+			layout = text_layout_build(font, text, raster_height, scale, hash);
+			text_layout_cache.slots[i] = layout;
+		}
+		
+		layout->last_used_frame = gfx_frame_index;
+		return layout;
+	}
+	
+	if ((text_layout_cache.count+1)*2 > text_layout_cache.capacity) {
+		text_layout_cache_rebuild(text_layout_cache.capacity*2, 0, false);
+	}
+	
+	Text_Layout *layout = text_layout_build(font, text, raster_height, scale, hash);
+	text_layout_cache_insert(layout);
+	
+	return layout;
+}
+
 Gfx_Text_Metrics measure_text(Gfx_Font *font, string text, u32 raster_height, Vector2 scale) {
 
+	if (enable_text_layout_cache) {
+		return get_text_layout(font, text, raster_height, scale)->metrics;
+	}
+	
+	raster_height = font_resolve_raster_height(font, raster_height, &scale);
+
 	Measure_Text_Walk_Glyphs_Context c = ZERO(Measure_Text_Walk_Glyphs_Context);
 	
 	c.scale = scale;
@@ -420,105 +1137,250 @@ Gfx_Text_Metrics measure_text(Gfx_Font *font, string text, u32 raster_height, Ve
 	return c.m;
 }
 
-typedef struct State_For_Glyph_Line_Break_Search {
-	u64 *line_break_indices;
-	u64 *glyph_count_per_line;
-	float32 width;
-	u64 line_num;
-	u64 start_index;
-	u64 index;
-	u64 last_space_index;
-	float32 line_start_x;
-	float32 last_space_x; // -elon
-	u64 count;
-	Vector2 scale;
-} State_For_Glyph_Line_Break_Search;
-bool text_line_wrapping_callback(Gfx_Glyph g, Gfx_Font_Atlas *atlas, float x, float y, void *ud) {
-	State_For_Glyph_Line_Break_Search *state = (State_For_Glyph_Line_Break_Search*)ud;
-
-	bool is_newline = g.codepoint == '\n';
-	if (g.codepoint < 32 && !is_newline) {
-		state->index += 1;
-		state->count += 1;
-		return true;
-	}
+///
+// Text wrapping
+// Lays out lines into a buffer you own, as byte ranges of the text rather than strings. The
+// wrap remembers where it stopped, so when text is only appended to (chat logs, consoles) the
+// next text_wrap_append only lays out what's new instead of starting over.
+// Glyphs are only looked up for their metrics, nothing gets rasterized.
+//
+//     Text_Wrap_Line lines[256];
+//     Text_Wrap wrap = text_wrap_begin(font, 48, v2(1, 1), 600, lines, 256);
+//     text_wrap_append(&wrap, log); // Lays out all of log
+//     ... more is appended to log ...
+//     text_wrap_append(&wrap, log); // Only lays out the new part
+//     for (u64 i = 0; i < wrap.line_count; i++) {
+//         string line = text_wrap_line_string(log, wrap.lines[i], true);
+//         ...
+//     }
+//
+// Pass 0 for lines to only count and measure the lines.
 
+typedef struct Text_Wrap_Line {
+	u64 byte_start;
+	u64 byte_count;
+	float32 width; // From the start of the line to the right edge of its last glyph
+} Text_Wrap_Line;
 
-	float32 glyph_right = x + g.width*state->scale.x;
+typedef struct Text_Wrap {
+	Gfx_Font *font;
+	u32 raster_height;
+	Vector2 scale;
+	float32 width;
 	
-	if (state->last_space_index == state->index) state->last_space_x = x;
-
-	if ((g.codepoint != 32 && (glyph_right-state->line_start_x) > state->width) || is_newline) {
-
-		bool do_break_at_last_space = state->last_space_index > state->start_index && !is_newline;
-
-		u64 break_index;
-		if (do_break_at_last_space) break_index = state->last_space_index;
-		else break_index = state->index;
+	Text_Wrap_Line *lines; // Caller's buffer, or 0 to only measure
+	u64 line_capacity;
+	
+	// Results. The last line is the one still being laid out, so it can change if text is
+	// appended.
+	u64 line_count;
+	float32 max_line_width;
+	
+	// Where we're at, so we can continue from here
+	u64 bytes_done;
+	u64 closed_line_count;
+	float32 closed_max_line_width;
+	float32 pen_x;
+	u32 last_c;
+	u64 line_start;
+	u64 last_space; // Byte after the last space, or line_start if there is none on this line
+	float32 line_start_x;
+	float32 last_space_x; // Where the glyph after the last space starts
+	float32 line_right;
+	float32 right_at_space; // line_right when the last space was reached
+	float32 right_after_space;
+} Text_Wrap;
 
-		growing_array_add((void**)&state->line_break_indices, &state->start_index);
+Text_Wrap text_wrap_begin(Gfx_Font *font, u32 raster_height, Vector2 scale, float32 width, Text_Wrap_Line *lines, u64 line_capacity) {
+	Text_Wrap wrap = ZERO(Text_Wrap);
+	
+	wrap.raster_height = font_resolve_raster_height(font, raster_height, &scale);
+	wrap.font = font;
+	wrap.scale = scale;
+	wrap.width = width;
+	wrap.lines = lines;
+	wrap.line_capacity = line_capacity;
+	
+	Gfx_Font_Variation *variation = &font->variations[wrap.raster_height];
+	if (!variation->initted) {
+		font_variation_init(variation, font, wrap.raster_height);
+	}
+	
+	return wrap;
+}
 
-		u64 count_from_start_to_space = break_index-state->start_index;
-		growing_array_add((void**)&state->glyph_count_per_line, &count_from_start_to_space);
+// Like utf8_to_utf32, but a malformed sequence in the middle of the text comes out as a
+// U+FFFD for its first byte, and we carry on from the next byte.
+// Returns false only if the text ends in the middle of a codepoint, which a later append may complete.
+bool text_wrap_next_codepoint(string text, u64 b, u32 *c, u64 *size) {
+	u8 lead = text.data[b];
+	u64 remaining = (u64)text.count-b;
+	if (lead < 0x80) {
+		*c = lead;
+		*size = 1;
+		return true;
+	}
+	
+	u64 trailing = trailing_bytes_for_utf8[lead];
+	bool bad = (lead & 0xC0) == 0x80 || trailing > 3; // Stray continuation byte or too long
+	u64 available = min(trailing, remaining-1);
+	for (u64 i = 1; !bad && i <= available; i++) {
+		if ((text.data[b+i] & 0xC0) != 0x80) bad = true;
+	}
+	
+	if (bad) {
+		*c = UNI_REPLACEMENT_CHAR;
+		*size = 1;
+		return true;
+	}
+	if (trailing+1 > remaining) return false;
+	
+	Utf8_To_Utf32_Result next = utf8_to_utf32(text.data+b, (s64)remaining, false);
+	*c = next.utf32;
+	*size = (u64)next.continuation_bytes;
+	return true;
+}
 
-		u64 count_from_space_to_now = state->index - break_index;
-		state->count = count_from_space_to_now;
+// text must start with the text that was wrapped so far.
+// Returns false if the lines buffer ran out of room. Everything up to that point is kept, so you
+// can point wrap->lines to a bigger buffer (with the same lines in it) and call this again to
+// continue.
+bool text_wrap_append(Text_Wrap *wrap, string text) {
+	assert(text.count >= wrap->bytes_done, "Text to wrap is shorter than what was already wrapped. Use text_wrap_begin to start over.");
+	
+	Gfx_Font_Variation *variation = &wrap->font->variations[wrap->raster_height];
+	Vector2 scale = wrap->scale;
+	
+	u64 b = wrap->bytes_done;
+	while (b < (u64)text.count) {
+		u32 c;
+		u64 size;
+		if (!text_wrap_next_codepoint(text, b, &c, &size)) break; // The rest may be appended later
+		if (c == 0) break;
+		
+		Gfx_Glyph glyph = *font_find_or_add_glyph(variation, c);
 		
-		if (break_index == state->index && (is_newline || g.codepoint == ' ')) {
-			break_index += 1; // Skip \n and space if that's what we break on
+		// Same pen movement as walk_glyphs
+		float32 pen_x = wrap->pen_x;
+		u32 last_c = wrap->last_c;
+		if (c == '\n') {
+			pen_x = 0;
+			last_c = 0;
 		}
-		state->start_index = break_index;
-		state->line_num += 1;
-
-		if (do_break_at_last_space) state->line_start_x = state->last_space_x;
-		else state->line_start_x = x;
-	} else {
-		if (g.codepoint == ' ') {
-			state->last_space_index = state->index+1;
+		if (last_c != 0) {
+			s32 kerning_unscaled = font_get_kerning(wrap->font, last_c, c);
+			pen_x += kerning_unscaled*variation->scale*scale.x;
+		}
+		float32 x = pen_x + glyph.xoffset*scale.x;
+		
+		bool is_newline = c == '\n';
+		if (c >= 32 || is_newline) {
+			float32 glyph_right = x + glyph.width*scale.x;
+			
+			if (wrap->last_space == b) wrap->last_space_x = x;
+			
+			if ((c != ' ' && (glyph_right-wrap->line_start_x) > wrap->width) || is_newline) {
+				
+				// Leave the codepoint for next time if the line doesn't fit
+				if (wrap->lines && wrap->closed_line_count >= wrap->line_capacity) {
+					wrap->line_count = wrap->closed_line_count;
+					wrap->max_line_width = wrap->closed_max_line_width;
+					return false;
+				}
+				
+				bool do_break_at_last_space = wrap->last_space > wrap->line_start && !is_newline;
+				
+				u64 break_at = do_break_at_last_space ? wrap->last_space : b;
+				float32 line_right = do_break_at_last_space ? wrap->right_at_space : wrap->line_right;
+				
+				Text_Wrap_Line line;
+				line.byte_start = wrap->line_start;
+				line.byte_count = break_at-wrap->line_start;
+				line.width = max(line_right-wrap->line_start_x, 0);
+				if (wrap->lines) wrap->lines[wrap->closed_line_count] = line;
+				wrap->closed_line_count += 1;
+				wrap->closed_max_line_width = max(wrap->closed_max_line_width, line.width);
+				
+				if (is_newline) break_at += size; // Skip the \n
+				
+				if (do_break_at_last_space) {
+					wrap->line_start_x = wrap->last_space_x;
+					wrap->line_right = max(wrap->right_after_space, glyph_right);
+				} else {
+					wrap->line_start_x = x;
+					wrap->line_right = is_newline ? x : glyph_right;
+				}
+				wrap->line_start = break_at;
+				wrap->last_space = break_at;
+				wrap->right_at_space = wrap->line_start_x;
+				wrap->right_after_space = wrap->line_right;
+			} else if (c == ' ') {
+				wrap->last_space = b+1;
+				wrap->right_at_space = wrap->line_right;
+				wrap->right_after_space = wrap->line_start_x;
+			} else {
+				wrap->line_right = max(wrap->line_right, glyph_right);
+				wrap->right_after_space = max(wrap->right_after_space, glyph_right);
+			}
 		}
+		
+		pen_x += glyph.advance*scale.x;
+		wrap->pen_x = pen_x;
+		wrap->last_c = c;
+		
+		b += size;
+		wrap->bytes_done = b;
 	}
 	
-	state->index += 1;
-	state->count += 1;
+	wrap->line_count = wrap->closed_line_count;
+	wrap->max_line_width = wrap->closed_max_line_width;
+	
+	// The line we're still on
+	if (wrap->bytes_done > 0) {
+		if (wrap->lines && wrap->closed_line_count >= wrap->line_capacity) return false;
+		
+		Text_Wrap_Line line;
+		line.byte_start = wrap->line_start;
+		line.byte_count = wrap->bytes_done-wrap->line_start;
+		line.width = max(wrap->line_right-wrap->line_start_x, 0);
+		if (wrap->lines) wrap->lines[wrap->closed_line_count] = line;
+		wrap->line_count += 1;
+		wrap->max_line_width = max(wrap->max_line_width, line.width);
+	}
 	
 	return true;
-};
+}
+
+string text_wrap_line_string(string text, Text_Wrap_Line line, bool do_trim) {
+	string line_str = string_view(text, line.byte_start, line.byte_count);
+	if (do_trim) line_str = string_trim(line_str);
+	return line_str;
+}
 
 // Returns a Growing_Array of string, allocated with temp allocator
 string *split_text_to_lines_with_wrapping(string str, float32 width, Gfx_Font *font, u32 raster_height, Vector2 scale, bool do_trim_lines) {
 
-	Gfx_Font_Variation *variation = &font->variations[raster_height];
-
-	string text = str;
-	State_For_Glyph_Line_Break_Search result = ZERO(State_For_Glyph_Line_Break_Search);
-	result.width = width;
-	result.scale = scale;
-	growing_array_init((void**)&result.line_break_indices, sizeof(u64), get_temporary_allocator());
-	growing_array_init((void**)&result.glyph_count_per_line, sizeof(u64), get_temporary_allocator());
+	u64 capacity = 64;
+	Text_Wrap_Line *wrap_lines = talloc(capacity*sizeof(Text_Wrap_Line));
+	Text_Wrap wrap = text_wrap_begin(font, raster_height, scale, width, wrap_lines, capacity);
 	
-	walk_glyphs((Walk_Glyphs_Spec){font, text, raster_height, scale, false, &result}, text_line_wrapping_callback);
+	while (!text_wrap_append(&wrap, str)) {
+		u64 new_capacity = capacity*2;
+		Text_Wrap_Line *new_lines = talloc(new_capacity*sizeof(Text_Wrap_Line));
+		memcpy(new_lines, wrap_lines, wrap.closed_line_count*sizeof(Text_Wrap_Line));
+		wrap_lines = new_lines;
+		capacity = new_capacity;
+		wrap.lines = wrap_lines;
+		wrap.line_capacity = capacity;
+	}
 
 	string *lines;
-	growing_array_init((void**)&lines, sizeof(string), get_temporary_allocator());
-
-	for (u64 i = 0; i < growing_array_get_valid_count(result.line_break_indices); i += 1) {
-		u64 utf8_index = result.line_break_indices[i];
-		u64 byte_index = utf8_index_to_byte_index(text, utf8_index);
-		u64 utf8_count = result.glyph_count_per_line[i];
-		u64 byte_count = utf8_index_to_byte_index(text, utf8_index + utf8_count) - byte_index;
-		string line_str = string_view(text, byte_index, byte_count);
-		if (do_trim_lines)  line_str = string_trim(line_str);
-		growing_array_add((void**)&lines, &line_str);
-	}
-	if (result.count > 0) {
-		u64 utf8_index = result.start_index;
-		u64 byte_index = utf8_index_to_byte_index(text, utf8_index);
-		u64 utf8_count = result.count;
-		u64 byte_count = utf8_index_to_byte_index(text, utf8_index + utf8_count) - byte_index;
-		string line_str = string_view(text, byte_index, byte_count);
-		if (do_trim_lines)  line_str = string_trim(line_str);
+	growing_array_init_reserve((void**)&lines, sizeof(string), wrap.line_count, get_temporary_allocator());
+
+	for (u64 i = 0; i < wrap.line_count; i += 1) {
+		string line_str = text_wrap_line_string(str, wrap_lines[i], do_trim_lines);
 		growing_array_add((void**)&lines, &line_str);
 	}
 
 	return lines;
-}
\ No newline at end of file
+}
@@ -6,6 +6,7 @@
 const Gfx_Handle GFX_INVALID_HANDLE = 0;
 
 string temp_win32_null_terminated_wide_to_fixed_utf8(const u16 *utf16);
+void d3d11_vertex_pipeline_init();
 
 // We wanna pack this at some point
 // #Cleanup #Memory why am I doing alignat(16)?
@@ -56,7 +57,6 @@ ID3D11InputLayout  *d3d11_image_vertex_layout = 0;
 ID3D11Buffer *d3d11_quad_vbo = 0;
 ID3D11Buffer *d3d11_quad_ibo = 0;
 u32 d3d11_quad_vbo_size = 0;
-void *d3d11_staging_quad_buffer = 0;
 
 ID3D11Buffer *d3d11_cbuffer = 0;
 u64 d3d11_cbuffer_size = 0;
@@ -553,9 +553,11 @@ void gfx_init() {
 	log_info("D3D11 init done");
 	
 	draw_frame_init(&draw_frame);
+	
+	d3d11_vertex_pipeline_init();
 }
 
-void d3d11_draw_call(int number_of_rendered_quads, ID3D11ShaderResourceView **textures, u64 num_textures, Draw_Frame *frame, Gfx_Image *render_target) {
+void d3d11_draw_call(u64 first_quad, u64 number_of_rendered_quads, ID3D11ShaderResourceView **textures, u64 num_textures, Draw_Frame *frame, Gfx_Image *render_target) {
 
 	u32 view_width;
 	u32 view_height;
@@ -614,12 +616,421 @@ void d3d11_draw_call(int number_of_rendered_quads, ID3D11ShaderResourceView **te
     ID3D11DeviceContext_PSSetSamplers(d3d11_context, 3, 1, &d3d11_image_sampler_nl_fp);
     ID3D11DeviceContext_PSSetShaderResources(d3d11_context, 0, num_textures, textures);
 
-    ID3D11DeviceContext_DrawIndexed(d3d11_context, number_of_rendered_quads * 6, 0, 0);
+    ID3D11DeviceContext_DrawIndexed(d3d11_context, number_of_rendered_quads * 6, first_quad * 6, 0);
     
     ID3D11ShaderResourceView* null_srv[32] = {0};
     ID3D11DeviceContext_PSSetShaderResources(d3d11_context, 0, num_textures, null_srv);
 }
 
+u8 d3d11_get_sampler_index(Gfx_Filter_Mode min_filter, Gfx_Filter_Mode mag_filter) {
+	// #Volatile samplers are bound in this order in d3d11_draw_call
+	if (min_filter == GFX_FILTER_MODE_NEAREST && mag_filter == GFX_FILTER_MODE_NEAREST) return 0;
+	if (min_filter == GFX_FILTER_MODE_LINEAR  && mag_filter == GFX_FILTER_MODE_LINEAR)  return 1;
+	if (min_filter == GFX_FILTER_MODE_LINEAR  && mag_filter == GFX_FILTER_MODE_NEAREST) return 2;
+	if (min_filter == GFX_FILTER_MODE_NEAREST && mag_filter == GFX_FILTER_MODE_LINEAR)  return 3;
+	return 0;
+}
+
+// Writes 4 vertices per quad to out. All quads must share the same image & filters, which is why
+// texture_index, sampler and the uv transform are passed in rather than looked up per quad.
+// Quad uv's are mapped as uv*uv_scale+uv_offset, which is how atlased images get their page rect.
+// This only reads from the quads and only writes to out[0 .. number_of_quads*4], so it's safe to
+// call from multiple threads on disjoint ranges.
+void d3d11_emit_quad_vertices(Draw_Quad *quads, u64 number_of_quads, D3D11_Vertex *out, s8 texture_index, u8 sampler, Vector2 uv_offset, Vector2 uv_scale, float32 pixel_height) {
+	
+	// Everything but position, uv & self_uv is the same for all 4 vertices, so we build one vertex
+	// per quad and only patch the corner specific fields before each store.
+	D3D11_Vertex v;
+	memset(&v, 0, sizeof(D3D11_Vertex));
+	v.texture_index = texture_index;
+	v.sampler = sampler;
+	
+	for (u64 i = 0; i < number_of_quads; i++) {
+		Draw_Quad *q = &quads[i];
+		D3D11_Vertex *dst = out + i*4;
+		
+		v.color = q->color;
+		v.type = (u8)q->type;
+		v.has_scissor = q->has_scissor;
+		
+		// #Speed #Cleanup
+		// Many programs may not user userdata, which means a lot of redundant time spent on this.
+		memcpy(v.userdata, q->userdata, sizeof(q->userdata));
+		
+		// Flip scissor y to window pixel space
+		v.scissor = v4(q->scissor.x1, pixel_height - q->scissor.y2, q->scissor.x2, pixel_height - q->scissor.y1);
+		
+		Vector4 uv = v4(
+			q->uv.x1*uv_scale.x + uv_offset.x, q->uv.y1*uv_scale.y + uv_offset.y,
+			q->uv.x2*uv_scale.x + uv_offset.x, q->uv.y2*uv_scale.y + uv_offset.y
+		);
+		
+		v.position = v4(q->bottom_left.x, q->bottom_left.y, 0, 1);
+		v.uv = v2(uv.x1, uv.y1);
+		v.self_uv = v2(0, 0);
+		dst[0] = v;
+		
+		v.position = v4(q->top_left.x, q->top_left.y, 0, 1);
+		v.uv = v2(uv.x1, uv.y2);
+		v.self_uv = v2(0, 1);
+		dst[1] = v;
+		
+		v.position = v4(q->top_right.x, q->top_right.y, 0, 1);
+		v.uv = v2(uv.x2, uv.y2);
+		v.self_uv = v2(1, 1);
+		dst[2] = v;
+		
+		v.position = v4(q->bottom_right.x, q->bottom_right.y, 0, 1);
+		v.uv = v2(uv.x2, uv.y1);
+		v.self_uv = v2(1, 0);
+		dst[3] = v;
+	}
+}
+
+// The vbo is write-combined memory which we never read back, so we bypass the cache.
+// dst, src and size must be 16 byte aligned.
+void d3d11_stream_copy(void *dst, void *src, u64 size) {
+	assert((u64)dst % 16 == 0 && (u64)src % 16 == 0 && size % 16 == 0, "d3d11_stream_copy needs 16 byte alignment");
+#if ENABLE_SIMD
+	float32 *d = (float32*)dst;
+	float32 *s = (float32*)src;
+	for (u64 i = 0; i < size/sizeof(float32); i += 4) {
+		_mm_stream_ps(d + i, _mm_load_ps(s + i));
+	}
+	// Streaming stores are weakly ordered, make sure they land before we unmap
+	_mm_sfence();
+#else
+	memcpy(dst, src, size);
+#endif
+}
+
+///
+// Vertex pipeline
+//
+// Quads are walked in runs of consecutive quads with the same image & filters, so the texture slot,
+// sampler and uv bias is resolved once per run. Runs are grouped into batches of at most 32 textures,
+// one draw call each.
+// Vertices are then generated in chunks of D3D11_QUADS_PER_CHUNK quads by the vertex workers while
+// the calling thread hands finished chunks to the upload backend, in order. That way the upload of
+// one chunk overlaps with the generation of the next ones.
+//
+
+// Small enough for a chunk to stay in L2 until it's uploaded
+#define D3D11_QUADS_PER_CHUNK 512
+#define D3D11_MAX_CHUNKS_IN_FLIGHT 8
+
+typedef struct D3D11_Quad_Run {
+	u64 first_quad;
+	u64 number_of_quads;
+	s8 texture_index;
+	u8 sampler;
+	Vector2 uv_offset;
+	Vector2 uv_scale;
+} D3D11_Quad_Run;
+
+typedef struct D3D11_Quad_Batch {
+	u64 first_quad;
+	u64 number_of_quads;
+	Gfx_Handle textures[32];
+	u64 number_of_textures;
+} D3D11_Quad_Batch;
+
+typedef struct D3D11_Vertex_Pipeline {
+	Draw_Quad *quads;
+	u64 number_of_quads;
+	D3D11_Quad_Run *runs;
+	u64 number_of_runs;
+	float32 pixel_height;
+} D3D11_Vertex_Pipeline;
+
+typedef struct D3D11_Vertex_Chunk {
+	D3D11_Vertex *vertices;
+	u64 chunk_index;
+	volatile bool done;
+	D3D11_Vertex_Pipeline *pipeline;
+} D3D11_Vertex_Chunk;
+
+// #Global
+Worker_Pool d3d11_vertex_workers;
+D3D11_Vertex_Pipeline d3d11_vertex_pipeline;
+D3D11_Vertex_Chunk d3d11_vertex_chunks[D3D11_MAX_CHUNKS_IN_FLIGHT];
+D3D11_Quad_Run *d3d11_quad_runs = 0;
+D3D11_Quad_Batch *d3d11_quad_batches = 0;
+
+void d3d11_vertex_pipeline_init() {
+	if (gfx_vertex_worker_count < 0) {
+		gfx_vertex_worker_count = min(max((s64)os_get_number_of_logical_processors()-1, 0), 4);
+	}
+	worker_pool_init(&d3d11_vertex_workers, (u64)gfx_vertex_worker_count, get_heap_allocator());
+	
+	for (u64 i = 0; i < D3D11_MAX_CHUNKS_IN_FLIGHT; i++) {
+		// #Memory heap allocations are 16 byte aligned which is what d3d11_stream_copy needs
+		d3d11_vertex_chunks[i].vertices = (D3D11_Vertex*)alloc(get_heap_allocator(), D3D11_QUADS_PER_CHUNK*4*sizeof(D3D11_Vertex));
+		d3d11_vertex_chunks[i].pipeline = &d3d11_vertex_pipeline;
+	}
+	
+	growing_array_init((void**)&d3d11_quad_runs, sizeof(D3D11_Quad_Run), get_heap_allocator());
+	growing_array_init((void**)&d3d11_quad_batches, sizeof(D3D11_Quad_Batch), get_heap_allocator());
+}
+
+void d3d11_emit_chunk_job(void *data) {
+	D3D11_Vertex_Chunk *chunk = (D3D11_Vertex_Chunk*)data;
+	D3D11_Vertex_Pipeline *p = chunk->pipeline;
+	
+	u64 first = chunk->chunk_index*D3D11_QUADS_PER_CHUNK;
+	u64 end = min(first+D3D11_QUADS_PER_CHUNK, p->number_of_quads);
+	
+	// Find the run which contains the first quad in this chunk
+	u64 lo = 0;
+	u64 hi = p->number_of_runs;
+	while (hi-lo > 1) {
+		u64 mid = (lo+hi)/2;
+		if (p->runs[mid].first_quad <= first) lo = mid;
+		else                                  hi = mid;
+	}
+	
+	for (u64 r = lo; r < p->number_of_runs && p->runs[r].first_quad < end; r++) {
+		D3D11_Quad_Run *run = &p->runs[r];
+		u64 a = max(run->first_quad, first);
+		u64 b = min(run->first_quad+run->number_of_quads, end);
+		d3d11_emit_quad_vertices(p->quads+a, b-a, chunk->vertices+(a-first)*4, run->texture_index, run->sampler, run->uv_offset, run->uv_scale, p->pixel_height);
+	}
+	
+	MEMORY_BARRIER;
+	chunk->done = true;
+}
+
+// gfx_interface.c impl
+void gfx_process_draw_frame(Draw_Frame *frame, Gfx_Upload_Backend backend) {
+	if (!frame->quad_buffer) return;
+
+	u64 number_of_quads = growing_array_get_valid_count(frame->quad_buffer);
+	if (number_of_quads == 0) return;
+	
+	Draw_Quad *quads = frame->quad_buffer;
+	
+	///
+	// This is where we convert Draw_Quad's to vertices. It should be very fast as all it's doing is mostly
+	// copying and some minor computing.
+	// Most computation is done in draw_quad_projected in drawing.c.
+	// This way, we could easily build different draw frames on different threads and then render them
+	// here on the main thread.
+	//
+	tm_scope("Quad processing") {
+		if (frame->enable_z_sorting) tm_scope("Z sorting") {
+			if (!d3d11_sort_quad_buffer || (d3d11_sort_quad_buffer_size < number_of_quads*sizeof(Draw_Quad))) {
+				// #Memory #Heapalloc
+				if (d3d11_sort_quad_buffer) dealloc(get_heap_allocator(), d3d11_sort_quad_buffer);
+				d3d11_sort_quad_buffer = alloc(get_heap_allocator(), number_of_quads*sizeof(Draw_Quad));
+				d3d11_sort_quad_buffer_size = number_of_quads*sizeof(Draw_Quad);
+			}
+			radix_sort(frame->quad_buffer, d3d11_sort_quad_buffer, number_of_quads, sizeof(Draw_Quad), offsetof(Draw_Quad, z), MAX_Z_BITS);
+		}
+		
+		growing_array_clear((void**)&d3d11_quad_runs);
+		growing_array_clear((void**)&d3d11_quad_batches);
+		
+		tm_scope("Quad batching") {
+			D3D11_Quad_Batch *batch = growing_array_add_empty((void**)&d3d11_quad_batches);
+			batch->first_quad = 0;
+			batch->number_of_textures = 0;
+			
+			u64 i = 0;
+			while (i < number_of_quads) {
+				
+				Draw_Quad *first = &quads[i];
+				
+				u64 run_end = i;
+				for (; run_end < number_of_quads; run_end += 1) {
+					Draw_Quad *q = &quads[run_end];
+					if (q->image != first->image 
+					 || q->image_min_filter != first->image_min_filter 
+					 || q->image_mag_filter != first->image_mag_filter) break;
+					
+					assert(q->z <= MAX_Z, "Z is too high. Z is %d, Max is %d.", q->z, MAX_Z);
+					assert(q->z >= (-MAX_Z+1), "Z is too low. Z is %d, Min is %d.", q->z, -MAX_Z+1);
+				}
+				
+				D3D11_Quad_Run *run = growing_array_add_empty((void**)&d3d11_quad_runs);
+				run->first_quad = i;
+				run->number_of_quads = run_end-i;
+				run->texture_index = -1;
+				run->sampler = 0;
+				run->uv_offset = v2(0, 0);
+				run->uv_scale = v2(1, 1);
+				
+				if (first->image) {
+					
+					// First look if texture is already bound
+					for (u64 j = 0; j < batch->number_of_textures; j++) {
+						if (batch->textures[j] == first->image->gfx_handle) {
+							run->texture_index = (s8)j;
+							break;
+						}
+					}
+					// Otherwise use a new slot
+					if (run->texture_index <= -1) {
+						if (batch->number_of_textures >= 32) {
+							// If max textures reached, end this batch and start a new one
+							batch->number_of_quads = i-batch->first_quad;
+							batch = growing_array_add_empty((void**)&d3d11_quad_batches);
+							batch->first_quad = i;
+							batch->number_of_textures = 0;
+						}
+						run->texture_index = (s8)batch->number_of_textures;
+						batch->textures[batch->number_of_textures] = first->image->gfx_handle;
+						batch->number_of_textures += 1;
+					}
+					
+					run->sampler = d3d11_get_sampler_index(first->image_min_filter, first->image_mag_filter);
+					
+					// The texture we actually sample, which is the atlas page for atlased images
+					Gfx_Image *texture = first->image;
+					if (first->image->atlas_page) {
+						texture = first->image->atlas_page;
+						Vector4 rect = first->image->atlas_uv;
+						run->uv_offset = v2(rect.x1, rect.y1);
+						run->uv_scale  = v2(rect.x2-rect.x1, rect.y2-rect.y1);
+					}
+					
+					// #Hack #Bug #Cleanup
+					// When a window dimension is uneven it slightly under/oversamples on an axis by a
+					// seemingly arbitrary amount. The 0.25 is a magic value I got from trial and error.
+					// (It undersamples by a fourth of the atlas texture?)
+					// Anything > 0.25 < will slightly over/undersample on my machine.
+					// I have no idea about #Portability here.
+					// - Charlie M 26th July 2024
+					if (window.width % 2 != 0) {
+						run->uv_offset.x += (2.0/(float)texture->width)*0.25;
+					}
+					if (window.height % 2 != 0) {
+						run->uv_offset.y -= (2.0/(float)texture->height)*0.25;
+					}
+				}
+				
+				i = run_end;
+			}
+			batch->number_of_quads = number_of_quads-batch->first_quad;
+		}
+		
+		D3D11_Vertex_Pipeline *p = &d3d11_vertex_pipeline;
+		p->quads = quads;
+		p->number_of_quads = number_of_quads;
+		p->runs = d3d11_quad_runs;
+		p->number_of_runs = growing_array_get_valid_count(d3d11_quad_runs);
+		p->pixel_height = (float32)window.pixel_height;
+		
+		u64 number_of_batches = growing_array_get_valid_count(d3d11_quad_batches);
+		u64 number_of_chunks = (number_of_quads+D3D11_QUADS_PER_CHUNK-1)/D3D11_QUADS_PER_CHUNK;
+		
+		bool use_workers = gfx_vertex_worker_count > 0 && d3d11_vertex_workers.thread_count > 0;
+		u64 chunks_in_flight = use_workers ? min(number_of_chunks, D3D11_MAX_CHUNKS_IN_FLIGHT) : 1;
+		
+		if (use_workers) {
+			for (u64 c = 0; c < chunks_in_flight; c++) {
+				D3D11_Vertex_Chunk *chunk = &d3d11_vertex_chunks[c];
+				chunk->chunk_index = c;
+				chunk->done = false;
+				worker_pool_push(&d3d11_vertex_workers, d3d11_emit_chunk_job, chunk);
+			}
+		}
+		
+		backend.begin(backend.data, number_of_quads*4*sizeof(D3D11_Vertex));
+		
+		u64 next_batch = 0;
+		for (u64 c = 0; c < number_of_chunks; c++) {
+			D3D11_Vertex_Chunk *chunk = &d3d11_vertex_chunks[c % chunks_in_flight];
+			
+			if (use_workers) {
+				// Help out rather than just spinning if the chunk isn't done yet
+				while (!chunk->done) {
+					if (!worker_pool_run_one(&d3d11_vertex_workers)) os_yield_thread();
+				}
+			} else {
+				chunk->chunk_index = c;
+				d3d11_emit_chunk_job(chunk);
+			}
+			
+			u64 first_quad = c*D3D11_QUADS_PER_CHUNK;
+			u64 quads_in_chunk = min(D3D11_QUADS_PER_CHUNK, number_of_quads-first_quad);
+			
+			backend.upload(backend.data, chunk->vertices, first_quad*4*sizeof(D3D11_Vertex), quads_in_chunk*4*sizeof(D3D11_Vertex));
+			
+			// Slot is free again, start on the next chunk which goes there
+			if (use_workers && c+chunks_in_flight < number_of_chunks) {
+				chunk->chunk_index = c+chunks_in_flight;
+				chunk->done = false;
+				worker_pool_push(&d3d11_vertex_workers, d3d11_emit_chunk_job, chunk);
+			}
+			
+			u64 uploaded_quads = first_quad+quads_in_chunk;
+			while (next_batch < number_of_batches) {
+				D3D11_Quad_Batch *batch = &d3d11_quad_batches[next_batch];
+				if (batch->first_quad+batch->number_of_quads > uploaded_quads) break;
+				backend.draw(backend.data, batch->first_quad, batch->number_of_quads, batch->textures, batch->number_of_textures);
+				next_batch += 1;
+			}
+		}
+		
+		backend.end(backend.data);
+	}
+}
+
+///
+// D3D11 upload backend
+// Chunks are streamed straight into the mapped vbo. A draw has to unmap, so if there's more than
+// one batch we map again with NO_OVERWRITE since the gpu is still using what we already wrote.
+
+typedef struct D3D11_Upload_State {
+	Draw_Frame *frame;
+	Gfx_Image *render_target;
+	u8 *mapped;
+} D3D11_Upload_State;
+
+void d3d11_upload_begin(void *data, u64 total_bytes) {
+	D3D11_Upload_State *state = (D3D11_Upload_State*)data;
+	assert(total_bytes <= d3d11_quad_vbo_size, "Quad vbo was not grown before processing draw frame");
+	
+	tm_scope("The Map call") {
+	    D3D11_MAPPED_SUBRESOURCE buffer_mapping;
+		HRESULT hr = ID3D11DeviceContext_Map(d3d11_context, (ID3D11Resource*)d3d11_quad_vbo, 0, D3D11_MAP_WRITE_DISCARD, 0, &buffer_mapping);
+		d3d11_check_hr(hr);
+		state->mapped = (u8*)buffer_mapping.pData;
+	}
+}
+void d3d11_upload_upload(void *data, void *vertices, u64 offset_bytes, u64 size_bytes) {
+	D3D11_Upload_State *state = (D3D11_Upload_State*)data;
+	
+	if (!state->mapped) {
+	    D3D11_MAPPED_SUBRESOURCE buffer_mapping;
+		HRESULT hr = ID3D11DeviceContext_Map(d3d11_context, (ID3D11Resource*)d3d11_quad_vbo, 0, D3D11_MAP_WRITE_NO_OVERWRITE, 0, &buffer_mapping);
+		d3d11_check_hr(hr);
+		state->mapped = (u8*)buffer_mapping.pData;
+	}
+	
+	tm_scope("Write to gpu") {
+		d3d11_stream_copy(state->mapped+offset_bytes, vertices, size_bytes);
+	}
+}
+void d3d11_upload_draw(void *data, u64 first_quad, u64 number_of_quads, Gfx_Handle *textures, u64 number_of_textures) {
+	D3D11_Upload_State *state = (D3D11_Upload_State*)data;
+	
+	if (state->mapped) {
+		ID3D11DeviceContext_Unmap(d3d11_context, (ID3D11Resource*)d3d11_quad_vbo, 0);
+		state->mapped = 0;
+	}
+	
+	tm_scope("Draw call") d3d11_draw_call(first_quad, number_of_quads, textures, number_of_textures, state->frame, state->render_target);
+}
+void d3d11_upload_end(void *data) {
+	D3D11_Upload_State *state = (D3D11_Upload_State*)data;
+	
+	if (state->mapped) {
+		ID3D11DeviceContext_Unmap(d3d11_context, (ID3D11Resource*)d3d11_quad_vbo, 0);
+		state->mapped = 0;
+	}
+}
+
 void gfx_clear_render_target(Gfx_Image *render_target, Vector4 clear_color) {
 	assert(context.thread_id == d3d11_thread_id, "gfx_ functions must be called on the main thread");
 	assert(render_target->gfx_render_target, "Image was not created as a render target");
@@ -630,10 +1041,10 @@ void gfx_clear_render_target(Gfx_Image *render_target, Vector4 clear_color) {
 void gfx_render_draw_frame(Draw_Frame *frame, Gfx_Image *render_target) {
 	assert(context.thread_id == d3d11_thread_id, "gfx_ functions must be called on the main thread");
 	
-	HRESULT hr;
-	
-	
 	if (!frame->quad_buffer) return;
+	
+	// Glyphs rasterized since last frame
+	font_upload_dirty_glyphs();
 
 	u64 number_of_quads = growing_array_get_valid_count(frame->quad_buffer);
 	
@@ -645,14 +1056,12 @@ void gfx_render_draw_frame(Draw_Frame *frame, Gfx_Image *render_target) {
 	if (required_size > d3d11_quad_vbo_size) {
 		if (d3d11_quad_vbo) {
 			D3D11Release(d3d11_quad_vbo);
-			dealloc(get_heap_allocator(), d3d11_staging_quad_buffer);
 		}
 		u64 new_size = get_next_power_of_two(required_size);
 		u64 new_indices = ((new_size/sizeof(D3D11_Vertex))/4)*6;
 		
 		d3d11_quad_vbo_size = new_size;
 		
-		d3d11_staging_quad_buffer = alloc(get_heap_allocator(), d3d11_quad_vbo_size);
 		u32 *indices = (u32*)alloc(get_heap_allocator(), new_indices*sizeof(u32));
 		
 		for (u64 i = 0; i < new_indices; i += 6) {
@@ -687,197 +1096,19 @@ void gfx_render_draw_frame(Draw_Frame *frame, Gfx_Image *render_target) {
 		log_verbose("Grew quad vbo to %d bytes.", d3d11_quad_vbo_size);
 	}
 
-	if (number_of_quads > 0) {
-		///
-		// Render geometry from into vbo quad list
-	    
-		
-		ID3D11ShaderResourceView *textures[32];
-		ID3D11ShaderResourceView *last_texture = 0;
-		u64 num_textures = 0;
-		s8 last_texture_index = 0;
-		
-		D3D11_Vertex* head = (D3D11_Vertex*)d3d11_staging_quad_buffer;
-		D3D11_Vertex* pointer = head;
-		u64 number_of_rendered_quads = 0;
-		
-		
-		///
-		// This is where we convert Draw_Quad's to vertices. It should be very fast as all it's doing is mostly
-		// copying and some minor computing.
-		// Most computation is done in draw_quad_projected in drawing.c.
-		// This way, we could easily build different draw frames on different threads and then render them
-		// here on the main thread.
-		//
-		tm_scope("Quad processing") {
-			if (frame->enable_z_sorting) tm_scope("Z sorting") {
-				if (!d3d11_sort_quad_buffer || (d3d11_sort_quad_buffer_size < number_of_quads*sizeof(Draw_Quad))) {
-					// #Memory #Heapalloc
-					if (d3d11_sort_quad_buffer) dealloc(get_heap_allocator(), d3d11_sort_quad_buffer);
-					d3d11_sort_quad_buffer = alloc(get_heap_allocator(), number_of_quads*sizeof(Draw_Quad));
-					d3d11_sort_quad_buffer_size = number_of_quads*sizeof(Draw_Quad);
-				}
-				radix_sort(frame->quad_buffer, d3d11_sort_quad_buffer, number_of_quads, sizeof(Draw_Quad), offsetof(Draw_Quad, z), MAX_Z_BITS);
-			}
-		
-			for (u64 i = 0; i < number_of_quads; i++)  {
-				
-				Draw_Quad *q = &frame->quad_buffer[i];
-				
-				assert(q->z <= MAX_Z, "Z is too high. Z is %d, Max is %d.", q->z, MAX_Z);
-				assert(q->z >= (-MAX_Z+1), "Z is too low. Z is %d, Min is %d.", q->z, -MAX_Z+1);
-				
-				s8 texture_index = -1;
-				
-				if (q->image) {
-					
-					if (last_texture == q->image->gfx_handle) {
-						texture_index = last_texture_index;
-					} else {
-						// First look if texture is already bound
-						for (u64 j = 0; j < num_textures; j++) {
-							if (textures[j] == q->image->gfx_handle) {
-								texture_index = (s8)j;
-								break;
-							}
-						}
-						// Otherwise use a new slot
-						if (texture_index <= -1) {
-							if (num_textures >= 32) {
-								// If max textures reached, make a draw call and start over
-								D3D11_MAPPED_SUBRESOURCE buffer_mapping;
-								ID3D11DeviceContext_Map(d3d11_context, (ID3D11Resource*)d3d11_quad_vbo, 0, D3D11_MAP_WRITE_DISCARD, 0, &buffer_mapping);
-								memcpy(buffer_mapping.pData, d3d11_staging_quad_buffer, number_of_rendered_quads*sizeof(D3D11_Vertex)*4);
-								ID3D11DeviceContext_Unmap(d3d11_context, (ID3D11Resource*)d3d11_quad_vbo, 0);
-								d3d11_draw_call(number_of_rendered_quads, textures, num_textures, frame, render_target);
-								head = (D3D11_Vertex*)d3d11_staging_quad_buffer;
-								num_textures = 0;
-								texture_index = 0;
-								number_of_rendered_quads = 0;
-								pointer = head;
-							} else {
-								texture_index = (s8)num_textures;
-								num_textures += 1;
-							}
-						}
-					}
-					textures[texture_index] = q->image->gfx_handle;
-					last_texture = q->image->gfx_handle;
-					last_texture_index = texture_index;
-				}
-				
-				
-				
-				// We will write to 4 vertices for the one quad
-				 {
-				
-					D3D11_Vertex* BL  = pointer + 0;
-					D3D11_Vertex* TL  = pointer + 1;
-					D3D11_Vertex* TR  = pointer + 2;
-					D3D11_Vertex* BR  = pointer + 3;
-					pointer += 4;
-					
-					BL->position = v4(q->bottom_left.x,  q->bottom_left.y,  0, 1);
-					TL->position = v4(q->top_left.x,     q->top_left.y,     0, 1);
-					TR->position = v4(q->top_right.x,    q->top_right.y,    0, 1);
-					BR->position = v4(q->bottom_right.x, q->bottom_right.y, 0, 1);
-					
-					
-					if (q->image) {
-
-						BL->uv = v2(q->uv.x1, q->uv.y1);
-						TL->uv = v2(q->uv.x1, q->uv.y2);
-						TR->uv = v2(q->uv.x2, q->uv.y2);
-						BR->uv = v2(q->uv.x2, q->uv.y1);
-						// #Hack #Bug #Cleanup
-						// When a window dimension is uneven it slightly under/oversamples on an axis by a
-						// seemingly arbitrary amount. The 0.25 is a magic value I got from trial and error.
-						// (It undersamples by a fourth of the atlas texture?)
-						// Anything > 0.25 < will slightly over/undersample on my machine.
-						// I have no idea about #Portability here.
-						// - Charlie M 26th July 2024
-						if (window.width % 2 != 0) {
-							BL->uv.x += (2.0/(float)q->image->width)*0.25;
-							TL->uv.x += (2.0/(float)q->image->width)*0.25;
-							TR->uv.x += (2.0/(float)q->image->width)*0.25;
-							BR->uv.x += (2.0/(float)q->image->width)*0.25;
-						}
-						if (window.height % 2 != 0) {
-							BL->uv.y -= (2.0/(float)q->image->height)*0.25;
-							TL->uv.y -= (2.0/(float)q->image->height)*0.25;
-							TR->uv.y -= (2.0/(float)q->image->height)*0.25;
-							BR->uv.y -= (2.0/(float)q->image->height)*0.25;
-						}
+	D3D11_Upload_State state;
+	state.frame = frame;
+	state.render_target = render_target;
+	state.mapped = 0;
 
-						u8 sampler = -1;
-						if (q->image_min_filter == GFX_FILTER_MODE_NEAREST
-									&& q->image_mag_filter == GFX_FILTER_MODE_NEAREST)
-								sampler = 0;
-						if (q->image_min_filter == GFX_FILTER_MODE_LINEAR
-									&& q->image_mag_filter == GFX_FILTER_MODE_LINEAR)
-								sampler = 1;
-						if (q->image_min_filter == GFX_FILTER_MODE_LINEAR
-									&& q->image_mag_filter == GFX_FILTER_MODE_NEAREST)
-								sampler = 2;
-						if (q->image_min_filter == GFX_FILTER_MODE_NEAREST
-									&& q->image_mag_filter == GFX_FILTER_MODE_LINEAR)
-								sampler = 3;
-						BL->sampler=TL->sampler=TR->sampler=BR->sampler = (u8)sampler;
-								
-					}
-					BL->texture_index=TL->texture_index=TR->texture_index=BR->texture_index = texture_index;
-					
-					BL->self_uv = v2(0, 0);
-					TL->self_uv = v2(0, 1);
-					TR->self_uv = v2(1, 1);
-					BR->self_uv = v2(1, 0);
-					
-					// #Speed #Cleanup
-					// Many programs may not user userdata, which means a lot of redundant time spent on this.
-					memcpy(BL->userdata, q->userdata, sizeof(q->userdata));
-					memcpy(TL->userdata, q->userdata, sizeof(q->userdata));
-					memcpy(TR->userdata, q->userdata, sizeof(q->userdata));
-					memcpy(BR->userdata, q->userdata, sizeof(q->userdata));
-					
-					BL->color = TL->color = TR->color = BR->color = q->color;
-					
-					BL->type=TL->type=TR->type=BR->type = (u8)q->type;
-					
-					float t = q->scissor.y1;
-					q->scissor.y1 = q->scissor.y2;
-					q->scissor.y2 = t;
-					
-					q->scissor.y1 = window.pixel_height - q->scissor.y1;
-					q->scissor.y2 = window.pixel_height - q->scissor.y2;
-					
-					BL->has_scissor=TL->has_scissor=TR->has_scissor=BR->has_scissor = q->has_scissor;
-					BL->scissor=TL->scissor=TR->scissor=BR->scissor = q->scissor;
-					
-					number_of_rendered_quads += 1;
-				}
-			}
-		}
-		
-		tm_scope("Write to gpu") {
-		    D3D11_MAPPED_SUBRESOURCE buffer_mapping;
-			tm_scope("The Map call") {
-				hr = ID3D11DeviceContext_Map(d3d11_context, (ID3D11Resource*)d3d11_quad_vbo, 0, D3D11_MAP_WRITE_DISCARD, 0, &buffer_mapping);
-			d3d11_check_hr(hr);
-			}
-			tm_scope("The memcpy") {
-				memcpy(buffer_mapping.pData, d3d11_staging_quad_buffer, number_of_rendered_quads*sizeof(D3D11_Vertex)*4);
-			}
-			tm_scope("The Unmap call") {
-				ID3D11DeviceContext_Unmap(d3d11_context, (ID3D11Resource*)d3d11_quad_vbo, 0);
-			}
-		}
-		
-		///
-		// Draw call
-		tm_scope("Draw call") d3d11_draw_call(number_of_rendered_quads, textures, num_textures, frame, render_target);
-    }
-    
-    
+	Gfx_Upload_Backend backend;
+	backend.data = &state;
+	backend.begin = d3d11_upload_begin;
+	backend.upload = d3d11_upload_upload;
+	backend.draw = d3d11_upload_draw;
+	backend.end = d3d11_upload_end;
+
+	gfx_process_draw_frame(frame, backend);
 }
 void gfx_render_draw_frame_to_window(Draw_Frame *frame) {
 	gfx_render_draw_frame(frame, 0);
@@ -896,6 +1127,7 @@ void gfx_update() {
 	// Clear window & render global draw frame to window
 	gfx_render_draw_frame_to_window(&draw_frame);
 	draw_frame_reset(&draw_frame);
+	gfx_frame_index += 1;
 
 	tm_scope("Present") {
 		IDXGISwapChain1_Present(d3d11_swap_chain, window.enable_vsync, window.enable_vsync ? 0 : DXGI_PRESENT_ALLOW_TEARING);
@@ -915,14 +1147,12 @@ void gfx_reserve_vbo_bytes(u64 number_of_bytes) {
 	if (number_of_bytes > d3d11_quad_vbo_size) {
 		if (d3d11_quad_vbo) {
 			D3D11Release(d3d11_quad_vbo);
-			dealloc(get_heap_allocator(), d3d11_staging_quad_buffer);
 		}
 		u64 new_size = get_next_power_of_two(number_of_bytes);
 		u64 new_indices = ((new_size/sizeof(D3D11_Vertex))/4)*6;
 		
 		d3d11_quad_vbo_size = new_size;
 		
-		d3d11_staging_quad_buffer = alloc(get_heap_allocator(), d3d11_quad_vbo_size);
 		u32 *indices = (u32*)alloc(get_heap_allocator(), new_indices*sizeof(u32));
 		
 		for (u64 i = 0; i < new_indices; i += 6) {
@@ -1033,6 +1263,33 @@ void gfx_set_image_data(Gfx_Image *image, u32 x, u32 y, u32 w, u32 h, void *data
 	assert(context.thread_id == d3d11_thread_id, "gfx_ functions must be called on the main thread");
 	
     assert(image && data, "Bad parameters passed to gfx_set_image_data");
+    
+    // Where the region touches the edge of an atlased image, the extruded border next to it is
+    // rewritten in the same upload, or linear filtering at the edge keeps blending in old pixels.
+    u32 *extruded = 0;
+    if (image->atlas_page) {
+    	assert(x+w <= image->width && y+h <= image->height, "Specified subregion in image is out of bounds");
+    	u32 pad_x0 = x == 0               ? IMAGE_ATLAS_PADDING : 0;
+    	u32 pad_y0 = y == 0               ? IMAGE_ATLAS_PADDING : 0;
+    	u32 pad_x1 = x+w == image->width  ? IMAGE_ATLAS_PADDING : 0;
+    	u32 pad_y1 = y+h == image->height ? IMAGE_ATLAS_PADDING : 0;
+    	
+    	x += image->atlas_x;
+    	y += image->atlas_y;
+    	image = image->atlas_page;
+    	
+    	if (w > 0 && h > 0 && (pad_x0 || pad_y0 || pad_x1 || pad_y1)) {
+    		u32 extruded_w = pad_x0+w+pad_x1;
+    		u32 extruded_h = pad_y0+h+pad_y1;
+    		extruded = alloc_uninitialized(get_heap_allocator(), (u64)extruded_w*extruded_h*sizeof(u32));
+    		blit_rgba8_extruded_sides(extruded, extruded_w, 0, 0, (u32*)data, w, h, pad_x0, pad_y0, pad_x1, pad_y1);
+    		x -= pad_x0;
+    		y -= pad_y0;
+    		w = extruded_w;
+    		h = extruded_h;
+    		data = extruded;
+    	}
+    }
 
     ID3D11ShaderResourceView *view = image->gfx_handle;
     ID3D11Resource *resource = NULL;
@@ -1059,11 +1316,19 @@ void gfx_set_image_data(Gfx_Image *image, u32 x, u32 y, u32 w, u32 h, void *data
     ID3D11DeviceContext_UpdateSubresource(d3d11_context, (ID3D11Resource*)texture, 0, &region, data, w * image->channels, 0);
     
     ID3D11Resource_Release(resource);
+    if (extruded) dealloc(get_heap_allocator(), extruded);
 }
 void gfx_read_image_data(Gfx_Image *image, u32 x, u32 y, u32 w, u32 h, void *output) {
 	
 	assert(context.thread_id == d3d11_thread_id, "gfx_ functions must be called on the main thread");
 	
+    if (image->atlas_page) {
+    	assert(x+w <= image->width && y+h <= image->height, "Specified subregion in image is out of bounds");
+    	x += image->atlas_x;
+    	y += image->atlas_y;
+    	image = image->atlas_page;
+    }
+	
     D3D11_BOX region;
     region.left = x;
     region.right = x + w;
@@ -1104,11 +1369,13 @@ void gfx_read_image_data(Gfx_Image *image, u32 x, u32 y, u32 w, u32 h, void *out
     hr = ID3D11DeviceContext_Map(d3d11_context, (ID3D11Resource *)staging_texture, 0, D3D11_MAP_READ, 0, &mapped_texture);
 	d3d11_check_hr(hr);
 	
+	// The region was copied to the top left of the staging texture. Only copy out the region, the
+	// output is w*h and the image might be an atlas page much larger than that.
 	// #Hdr
-	assert(mapped_texture.RowPitch == image->width * image->channels, "Unexpected row pitch in d3d11 texture");
-	
-	// #Hdr
-	memcpy(output, mapped_texture.pData, image->width*image->height*image->channels);
+	u64 output_pitch = (u64)w*image->channels;
+	for (u32 row = 0; row < h; row++) {
+		memcpy((u8*)output + row*output_pitch, (u8*)mapped_texture.pData + row*mapped_texture.RowPitch, output_pitch);
+	}
 	
 	ID3D11DeviceContext_Unmap(d3d11_context, (ID3D11Resource *)staging_texture, 0);
 	
@@ -1118,6 +1385,9 @@ void gfx_read_image_data(Gfx_Image *image, u32 x, u32 y, u32 w, u32 h, void *out
 void gfx_deinit_image(Gfx_Image *image) {
 	assert(context.thread_id == d3d11_thread_id, "gfx_ functions must be called on the main thread");
 
+	// The page owns the texture
+	if (image->atlas_page) return;
+
 	ID3D11ShaderResourceView *view = image->gfx_handle;
 	ID3D11Resource *resource = 0;
 	ID3D11ShaderResourceView_GetResource(view, &resource);
@@ -1371,6 +1641,7 @@ $INJECT_PIXEL_POST_PROCESS
 \043define QUAD_TYPE_REGULAR 0\n
 \043define QUAD_TYPE_TEXT 1\n
 \043define QUAD_TYPE_CIRCLE 2\n
+\043define QUAD_TYPE_SDF 3\n
 float4 ps_main(PS_INPUT input) : SV_TARGET
 {
 
@@ -1394,6 +1665,16 @@ float4 ps_main(PS_INPUT input) : SV_TARGET
 		} else {
 			return pixel_shader_extension(input, input.color);
 		}
+	} else if (input.type == QUAD_TYPE_SDF) {
+		if (input.texture_index >= 0 && input.texture_index < 32 && input.sampler_index >= 0  && input.sampler_index <= 3) {
+			float dist = sample_texture(input.texture_index, input.sampler_index, input.uv).x;
+			float edge = 128.0/255.0;
+			float smoothing = max(fwidth(dist)*0.5, 0.0001);
+			float alpha = smoothstep(edge-smoothing, edge+smoothing, dist);
+			return pixel_shader_extension(input, float4(1.0, 1.0, 1.0, alpha)*input.color);
+		} else {
+			return pixel_shader_extension(input, input.color);
+		}
 	} else if (input.type == QUAD_TYPE_CIRCLE) {
 	
 		float dist = length(input.self_uv-float2(0.5, 0.5));
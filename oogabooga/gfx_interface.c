@@ -26,6 +26,7 @@ ogb_instance const Gfx_Handle GFX_INVALID_HANDLE;
 #define QUAD_TYPE_REGULAR 0
 #define QUAD_TYPE_TEXT 1
 #define QUAD_TYPE_CIRCLE 2
+#define QUAD_TYPE_SDF 3
 
 typedef enum Gfx_Filter_Mode {
 	GFX_FILTER_MODE_NEAREST,
@@ -37,6 +38,12 @@ typedef struct Gfx_Image {
 	Gfx_Handle gfx_handle;
 	Gfx_Render_Target_Handle gfx_render_target;
 	Allocator allocator;
+	
+	// Set if the image lives in a shared atlas page, see make_image_in_atlas.
+	// gfx_handle is then the page's handle.
+	struct Gfx_Image *atlas_page;
+	u32 atlas_x, atlas_y;
+	Vector4 atlas_uv;
 } Gfx_Image;
 
 typedef struct Draw_Frame Draw_Frame;
@@ -53,6 +60,94 @@ ogb_instance void gfx_update();
 ogb_instance void gfx_reserve_vbo_bytes(u64 number_of_bytes);
 ogb_instance bool gfx_shader_recompile_with_extension(string ext_source, u64 cbuffer_size);
 
+///
+// Vertex upload backend
+// gfx_render_draw_frame generates vertices in fixed size chunks on worker threads and hands each
+// chunk to an upload backend, in order, as soon as it's done. Draws are requested once every quad
+// in a batch has been uploaded.
+// The renderer uses its own gpu backend, but you can pass any backend to gfx_process_draw_frame,
+// for example the null backend below to time vertex generation without a gpu.
+typedef struct Gfx_Upload_Backend {
+	void *data;
+	// All calls happen on the thread calling gfx_process_draw_frame
+	void (*begin)(void *data, u64 total_bytes);
+	void (*upload)(void *data, void *vertices, u64 offset_bytes, u64 size_bytes);
+	void (*draw)(void *data, u64 first_quad, u64 number_of_quads, Gfx_Handle *textures, u64 number_of_textures);
+	void (*end)(void *data);
+} Gfx_Upload_Backend;
+
+// Number of worker threads used for vertex generation. -1 picks min(logical processors-1, 4) in
+// gfx_init. Must be set before gfx_init, but can be lowered after. 0 means vertices are generated
+// on the rendering thread, chunk by chunk in lockstep with uploading.
+// #Global
+ogb_instance s64 gfx_vertex_worker_count;
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+s64 gfx_vertex_worker_count = -1;
+#endif
+
+// Incremented at the end of every gfx_update. Used to tell what was used in the frame being built.
+// #Global
+ogb_instance u64 gfx_frame_index;
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+u64 gfx_frame_index = 0;
+#endif
+
+// Implemented per renderer
+ogb_instance void gfx_process_draw_frame(Draw_Frame *frame, Gfx_Upload_Backend backend);
+
+///
+// Null upload backend
+// Copies vertices to cpu memory and counts draws.
+typedef struct Gfx_Null_Upload_Backend {
+	u8 *memory;
+	u64 capacity;
+	u64 bytes_uploaded;
+	u64 number_of_draws;
+	u64 number_of_quads_drawn;
+	Allocator allocator;
+} Gfx_Null_Upload_Backend;
+
+void gfx_null_upload_begin(void *data, u64 total_bytes) {
+	Gfx_Null_Upload_Backend *b = (Gfx_Null_Upload_Backend*)data;
+	if (b->capacity < total_bytes) {
+		if (b->memory) dealloc(b->allocator, b->memory);
+		b->capacity = get_next_power_of_two(total_bytes);
+		b->memory = (u8*)alloc(b->allocator, b->capacity);
+	}
+	b->bytes_uploaded = 0;
+	b->number_of_draws = 0;
+	b->number_of_quads_drawn = 0;
+}
+void gfx_null_upload_upload(void *data, void *vertices, u64 offset_bytes, u64 size_bytes) {
+	Gfx_Null_Upload_Backend *b = (Gfx_Null_Upload_Backend*)data;
+	assert(offset_bytes+size_bytes <= b->capacity, "Null upload backend overflow");
+	memcpy(b->memory+offset_bytes, vertices, size_bytes);
+	b->bytes_uploaded += size_bytes;
+}
+void gfx_null_upload_draw(void *data, u64 first_quad, u64 number_of_quads, Gfx_Handle *textures, u64 number_of_textures) {
+	Gfx_Null_Upload_Backend *b = (Gfx_Null_Upload_Backend*)data;
+	b->number_of_draws += 1;
+	b->number_of_quads_drawn += number_of_quads;
+}
+void gfx_null_upload_end(void *data) {}
+
+Gfx_Upload_Backend make_null_upload_backend(Gfx_Null_Upload_Backend *state, Allocator allocator) {
+	memset(state, 0, sizeof(Gfx_Null_Upload_Backend));
+	state->allocator = allocator;
+	
+	Gfx_Upload_Backend b;
+	b.data = state;
+	b.begin = gfx_null_upload_begin;
+	b.upload = gfx_null_upload_upload;
+	b.draw = gfx_null_upload_draw;
+	b.end = gfx_null_upload_end;
+	return b;
+}
+void destroy_null_upload_backend(Gfx_Null_Upload_Backend *state) {
+	if (state->memory) dealloc(state->allocator, state->memory);
+	memset(state, 0, sizeof(Gfx_Null_Upload_Backend));
+}
+
 DEPRECATED(bool shader_recompile_with_extension(string ext_source, u64 cbuffer_size), "Use gfx_shader_recompile_with_extension");
 
 
@@ -89,34 +184,120 @@ Gfx_Image *make_image_render_target(u32 width, u32 height, u32 channels, void *i
     return image;
 }
 
+///
+// Image atlas
+// Images loaded with load_image_from_disk are packed into shared atlas pages, so drawing lots of
+// different small sprites doesn't use up a texture slot each (which forces a new draw call every
+// 32 distinct textures).
+// The renderer remaps the uv's of quads with atlased images to the image's rect in the page, so
+// this is transparent to drawing code. gfx_set_image_data & gfx_read_image_data also work as usual.
+// Except: uv's outside 0-1 don't clamp to the image's edge anymore, they read whatever is next to it
+// in the page (past the 1px border), and so does tiling with frac(uv) in a custom shader. Images
+// drawn like that need their own texture, see make_image_in_atlas.
+// Pages are never shrunk, deleting an atlased image does not give its space back. #Incomplete
+
+#ifndef IMAGE_ATLAS_PAGE_SIZE
+	#define IMAGE_ATLAS_PAGE_SIZE 2048
+#endif
+// Images larger than this in either dimension get their own texture
+#ifndef IMAGE_ATLAS_MAX_IMAGE_SIZE
+	#define IMAGE_ATLAS_MAX_IMAGE_SIZE 512
+#endif
+// Each image is extruded by this many pixels so linear filtering doesn't bleed in neighbours
+#define IMAGE_ATLAS_PADDING 1
+
+typedef struct Image_Atlas_Page {
+	Gfx_Image *image;
+	Rect_Packer packer;
+} Image_Atlas_Page;
+
+// #Global
+ogb_instance bool enable_image_atlas;
+ogb_instance Image_Atlas_Page *image_atlas_pages;
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+bool enable_image_atlas = true;
+Image_Atlas_Page *image_atlas_pages = 0;
+#endif
+
+// data is 4 channel, width*height, tightly packed.
+// Falls back to make_image if the image doesn't qualify for the atlas.
+// Only sample atlased images inside uv 0-1. For images drawn with uv's outside that (clamped edges,
+// tiling), use make_image, or set enable_image_atlas = false around load_image_from_disk.
+Gfx_Image *make_image_in_atlas(u32 width, u32 height, void *data, Allocator allocator) {
+	if (!enable_image_atlas || width > IMAGE_ATLAS_MAX_IMAGE_SIZE || height > IMAGE_ATLAS_MAX_IMAGE_SIZE) {
+		return make_image(width, height, 4, data, allocator);
+	}
+	
+	if (!image_atlas_pages) {
+		growing_array_init((void**)&image_atlas_pages, sizeof(Image_Atlas_Page), get_heap_allocator());
+	}
+	
+	u32 padded_width  = width  + IMAGE_ATLAS_PADDING*2;
+	u32 padded_height = height + IMAGE_ATLAS_PADDING*2;
+	
+	Image_Atlas_Page *page = 0;
+	u32 x = 0, y = 0;
+	u64 page_count = growing_array_get_valid_count(image_atlas_pages);
+	for (u64 i = 0; i < page_count; i++) {
+		if (rect_packer_pack(&image_atlas_pages[i].packer, padded_width, padded_height, &x, &y)) {
+			page = &image_atlas_pages[i];
+			break;
+		}
+	}
+	if (!page) {
+		page = growing_array_add_empty((void**)&image_atlas_pages);
+		page->image = make_image(IMAGE_ATLAS_PAGE_SIZE, IMAGE_ATLAS_PAGE_SIZE, 4, 0, get_heap_allocator());
+		rect_packer_init(&page->packer, IMAGE_ATLAS_PAGE_SIZE, IMAGE_ATLAS_PAGE_SIZE, get_heap_allocator());
+		bool ok = rect_packer_pack(&page->packer, padded_width, padded_height, &x, &y);
+		assert(ok, "Image did not fit in a fresh atlas page");
+		log_verbose("Allocated image atlas page #%d", page_count);
+	}
+	
+	u32 *padded = alloc_uninitialized(get_heap_allocator(), padded_width*padded_height*sizeof(u32));
+	blit_rgba8_extruded(padded, padded_width, 0, 0, (u32*)data, width, height, IMAGE_ATLAS_PADDING);
+	gfx_set_image_data(page->image, x, y, padded_width, padded_height, padded);
+	dealloc(get_heap_allocator(), padded);
+	
+	Gfx_Image *image = alloc(allocator, sizeof(Gfx_Image));
+	image->width = width;
+	image->height = height;
+	image->channels = 4;
+	image->allocator = allocator;
+	image->gfx_handle = page->image->gfx_handle;
+	image->atlas_page = page->image;
+	image->atlas_x = x + IMAGE_ATLAS_PADDING;
+	image->atlas_y = y + IMAGE_ATLAS_PADDING;
+	
+	const float32 page_size = (float32)IMAGE_ATLAS_PAGE_SIZE;
+	image->atlas_uv = v4(
+		(float32)image->atlas_x / page_size,
+		(float32)image->atlas_y / page_size,
+		(float32)(image->atlas_x+width)  / page_size,
+		(float32)(image->atlas_y+height) / page_size
+	);
+	
+	return image;
+}
+
 Gfx_Image *load_image_from_disk(string path, Allocator allocator) {
     string png;
     bool ok = os_read_entire_file(path, &png, allocator);
     if (!ok) return 0;
-
-    Gfx_Image *image = alloc(allocator, sizeof(Gfx_Image));
     
     int width, height, channels;
     stbi_set_flip_vertically_on_load(1);
     third_party_allocator = allocator;
     unsigned char* stb_data = stbi_load_from_memory(png.data, png.count, &width, &height, &channels, STBI_rgb_alpha);
     
+    dealloc_string(allocator, png);
     
     if (!stb_data) {
-        dealloc(allocator, image);
-        dealloc_string(allocator, png);
+        third_party_allocator = ZERO(Allocator);
         return 0;
     }
     
-    image->width = width;
-    image->height = height;
-    image->gfx_handle = GFX_INVALID_HANDLE;  // This is handled in gfx
-    image->allocator = allocator;
-    image->channels = 4;
-
-    dealloc_string(allocator, png);
-    
-    gfx_init_image(image, stb_data, false);
+    // Small images go in a shared atlas page, otherwise they get their own texture
+    Gfx_Image *image = make_image_in_atlas(width, height, stb_data, allocator);
     
     stbi_image_free(stb_data);
     
@@ -130,6 +311,139 @@ delete_image(Gfx_Image *image) {
       // Free the image data allocated by stb_image
     image->width = 0;
     image->height = 0;
-    gfx_deinit_image(image);
+    // Atlas pages outlive the images in them
+    if (!image->atlas_page) gfx_deinit_image(image);
     dealloc(image->allocator, image);
 }
+
+///
+// Async image loading
+// load_image_from_disk_async reads and decodes the file on a worker thread and hands back a request.
+// Creating the Gfx_Image has to happen on the thread that owns the renderer, so that's done when
+// you poll the request with poll_image_load (or block on it with wait_image_load).
+//
+//     Image_Load_Request *requests[N];
+//     for (int i = 0; i < N; i++) requests[i] = load_image_from_disk_async(paths[i], get_heap_allocator());
+//     for (int i = 0; i < N; i++) images[i] = wait_image_load(requests[i]);
+//
+// The allocator passed in is used from the worker threads, so it needs to be thread safe (the heap is).
+
+typedef enum Image_Load_State {
+	IMAGE_LOAD_PENDING,
+	IMAGE_LOAD_DECODED,
+	IMAGE_LOAD_FAILED,
+} Image_Load_State;
+
+typedef struct Image_Load_Request {
+	string path;
+	Allocator allocator;
+	
+	volatile Image_Load_State state;
+	u32 width, height;
+	void *pixels; // 4 channels, allocated with allocator. Freed when the image is made.
+} Image_Load_Request;
+
+// Number of decode threads. -1 means one less than the number of logical processors.
+// Must be set before the first async load.
+// #Global
+ogb_instance s64 image_load_worker_count;
+ogb_instance Worker_Pool image_load_workers;
+ogb_instance bool image_load_workers_initted;
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+s64 image_load_worker_count = -1;
+Worker_Pool image_load_workers;
+bool image_load_workers_initted = false;
+#endif
+
+void image_load_job(void *data) {
+	Image_Load_Request *request = (Image_Load_Request*)data;
+	
+	// stb_image makes a bunch of short lived allocations (zlib window, scanline buffers), those go
+	// in this thread's scratch so decoding threads don't serialize on the heap lock.
+	Allocator scratch_allocator = get_thread_scratch_allocator();
+	
+	string png;
+	if (!os_read_entire_file(request->path, &png, scratch_allocator)) {
+		reset_thread_scratch();
+		MEMORY_BARRIER;
+		request->state = IMAGE_LOAD_FAILED;
+		return;
+	}
+	
+	int width, height, channels;
+	stbi_set_flip_vertically_on_load_thread(1);
+	third_party_allocator = scratch_allocator;
+	unsigned char* stb_data = stbi_load_from_memory(png.data, png.count, &width, &height, &channels, STBI_rgb_alpha);
+	
+	Image_Load_State state = IMAGE_LOAD_FAILED;
+	if (stb_data) {
+		// Copy out of the scratch since it gets reset for the next image
+		u64 size = (u64)width*(u64)height*4;
+		request->pixels = alloc_uninitialized(request->allocator, size);
+		memcpy(request->pixels, stb_data, size);
+		request->width  = (u32)width;
+		request->height = (u32)height;
+		state = IMAGE_LOAD_DECODED;
+		
+		// Large images don't fit in the scratch and fall through to the heap, so these
+		// have to be freed explicitly. The reset only reclaims what did fit.
+		stbi_image_free(stb_data);
+	}
+	third_party_allocator = ZERO(Allocator);
+	dealloc_string(scratch_allocator, png);
+	
+	reset_thread_scratch();
+	
+	MEMORY_BARRIER;
+	request->state = state;
+}
+
+Image_Load_Request *load_image_from_disk_async(string path, Allocator allocator) {
+	if (!image_load_workers_initted) {
+		if (image_load_worker_count < 0) {
+			image_load_worker_count = max((s64)os_get_number_of_logical_processors()-1, 1);
+		}
+		worker_pool_init(&image_load_workers, (u64)image_load_worker_count, get_heap_allocator());
+		image_load_workers_initted = true;
+	}
+	
+	Image_Load_Request *request = alloc(allocator, sizeof(Image_Load_Request));
+	request->allocator = allocator;
+	request->path = string_copy(path, allocator);
+	request->state = IMAGE_LOAD_PENDING;
+	
+	worker_pool_push(&image_load_workers, image_load_job, request);
+	
+	return request;
+}
+
+// Must be called from the thread that owns the renderer.
+// Returns false while the image is still decoding. Once it returns true, the request is freed and
+// *result is the image, or 0 if the file couldn't be read or decoded.
+bool poll_image_load(Image_Load_Request *request, Gfx_Image **result) {
+	Image_Load_State state = request->state;
+	if (state == IMAGE_LOAD_PENDING) return false;
+	MEMORY_BARRIER;
+	
+	*result = 0;
+	if (state == IMAGE_LOAD_DECODED) {
+		*result = make_image_in_atlas(request->width, request->height, request->pixels, request->allocator);
+		dealloc(request->allocator, request->pixels);
+	} else {
+		log_error("Failed loading image '%s'", request->path);
+	}
+	
+	dealloc_string(request->allocator, request->path);
+	dealloc(request->allocator, request);
+	
+	return true;
+}
+
+// Helps decoding queued images while waiting
+Gfx_Image *wait_image_load(Image_Load_Request *request) {
+	Gfx_Image *image = 0;
+	while (!poll_image_load(request, &image)) {
+		if (!worker_pool_run_one(&image_load_workers)) os_yield_thread();
+	}
+	return image;
+}
@@ -749,3 +749,126 @@ Allocator make_arena_allocator_from_arena(Arena *arena) {
 	
 	return allocator;
 }
+
+///
+///
+// Thread scratch
+///
+// A growing per-thread arena for bursts of short lived allocations on worker threads, so they
+// don't serialize on the heap lock (e.g. the allocations stb makes while decoding an image).
+// Unlike temporary storage it supports reallocate and doesn't wrap around: allocations that don't
+// fit fall through to the heap, and the arena grows to the high water mark on the next reset.
+// Call reset_thread_scratch when you're done with everything you allocated from it.
+
+typedef struct Thread_Scratch {
+	u8 *base;
+	u64 size;
+	u64 used;
+	u64 high_water;
+	void *last;
+} Thread_Scratch;
+
+#ifndef THREAD_SCRATCH_INITIAL_SIZE
+	#define THREAD_SCRATCH_INITIAL_SIZE MB(4)
+#endif
+
+// Every scratch allocation is prefixed with its size so we can reallocate
+#define THREAD_SCRATCH_HEADER 16
+
+ogb_instance void*
+thread_scratch_allocator_proc(u64 size, void *p, Allocator_Message message, void *data);
+
+ogb_instance void
+thread_scratch_reset(Thread_Scratch *s);
+
+// Allocator for the calling thread's scratch
+ogb_instance Allocator
+get_thread_scratch_allocator();
+
+ogb_instance void
+reset_thread_scratch();
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+thread_local Thread_Scratch thread_scratch = {0};
+
+void *thread_scratch_allocator_proc(u64 size, void *p, Allocator_Message message, void *data) {
+	Thread_Scratch *s = (Thread_Scratch*)data;
+	
+	bool in_scratch = p && (u8*)p >= s->base && (u8*)p < s->base+s->size;
+	
+	switch (message) {
+		case ALLOCATOR_ALLOCATE: {
+			u64 needed = align_next(size, 16) + THREAD_SCRATCH_HEADER;
+			s->high_water = max(s->high_water, s->used+needed);
+			if (s->used+needed > s->size) {
+				return alloc(get_heap_allocator(), size);
+			}
+			u8 *result = s->base + s->used + THREAD_SCRATCH_HEADER;
+			*(u64*)(result-THREAD_SCRATCH_HEADER) = size;
+			s->used += needed;
+			s->last = result;
+			return result;
+		}
+		case ALLOCATOR_DEALLOCATE: {
+			if (!in_scratch) {
+				dealloc(get_heap_allocator(), p);
+			} else if (p == s->last) {
+				s->used = (u64)((u8*)p - s->base) - THREAD_SCRATCH_HEADER;
+				s->last = 0;
+			}
+			return 0;
+		}
+		case ALLOCATOR_REALLOCATE: {
+			if (!p) return thread_scratch_allocator_proc(size, 0, ALLOCATOR_ALLOCATE, data);
+			if (!in_scratch) {
+				return get_heap_allocator().proc(size, p, ALLOCATOR_REALLOCATE, 0);
+			}
+			
+			u64 old_size = *(u64*)((u8*)p-THREAD_SCRATCH_HEADER);
+			
+			// Growing the last allocation (e.g. zlib doubling its output buffer) happens in place
+			if (p == s->last) {
+				u64 start = (u64)((u8*)p - s->base);
+				u64 end = start + align_next(size, 16);
+				s->high_water = max(s->high_water, end);
+				if (end <= s->size) {
+					*(u64*)((u8*)p-THREAD_SCRATCH_HEADER) = size;
+					s->used = end;
+					return p;
+				}
+			}
+			
+			void *new_p = thread_scratch_allocator_proc(size, 0, ALLOCATOR_ALLOCATE, data);
+			if (new_p) memcpy(new_p, p, min(old_size, size));
+			return new_p;
+		}
+	}
+	return 0;
+}
+
+void thread_scratch_reset(Thread_Scratch *s) {
+	if (s->high_water > s->size) {
+		if (s->base) dealloc(get_heap_allocator(), s->base);
+		s->size = align_next(s->high_water, KB(64));
+		s->base = (u8*)alloc_uninitialized(get_heap_allocator(), s->size);
+	}
+	s->used = 0;
+	s->high_water = 0;
+	s->last = 0;
+}
+
+Allocator get_thread_scratch_allocator() {
+	if (!thread_scratch.base) {
+		thread_scratch.high_water = THREAD_SCRATCH_INITIAL_SIZE;
+		thread_scratch_reset(&thread_scratch);
+	}
+	Allocator allocator;
+	allocator.proc = thread_scratch_allocator_proc;
+	allocator.data = &thread_scratch;
+	return allocator;
+}
+
+void reset_thread_scratch() {
+	thread_scratch_reset(&thread_scratch);
+}
+#endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
@@ -127,8 +127,10 @@
 					tm_scope_accum
 					
 		- OOGABOOGA_HEADLESS
-            Run oogabooga in headless mode, i.e. no window, no graphics, no audio.
+            Run oogabooga in headless mode, i.e. no window, no graphics, no audio device.
             Useful if you only need the oogabooga standard library for something like a game server.
+            Audio sources, players and the mixer are still available, and can be driven with
+            audio_null_device_run() (see audio.c).
             
             0: Disable
             1: Enable
@@ -341,10 +343,12 @@ typedef u8 bool;
     #include "font.c"
 
     #include "drawing.c"
-
-    #include "audio.c"
 #endif
 
+#include "audio.c"
+
+#include "sprite_pack.c"
+
 #if OOGABOOGA_ENABLE_EXTENSIONS
 
 	#include "extensions.c"
@@ -419,6 +423,12 @@ void oogabooga_init(u64 program_memory_size) {
 	gfx_init();
 #else
     log_info("Headless mode on");
+    
+    // There's no audio device, but sources still need a format to load into
+    mutex_init(&audio_init_mutex);
+    audio_output_format.sample_rate = 48000;
+    audio_output_format.channels = 2;
+    audio_output_format.bit_width = AUDIO_BITS_32;
 #endif
 
 #if OOGABOOGA_ENABLE_EXTENSIONS
@@ -1084,6 +1084,68 @@ bool os_is_directory_s(string path) {
     return (attributes & FILE_ATTRIBUTE_DIRECTORY);
 }
 
+bool os_read_directory_file_names_s(string path, string **result, Allocator allocator) {
+    u16 *search_path = temp_win32_fixed_utf8_to_null_terminated_wide(string_concat(path, STR("\\*"), get_temporary_allocator()));
+    assert(search_path, "Invalid path string");
+    
+    WIN32_FIND_DATAW find_data;
+    HANDLE find = FindFirstFileW(search_path, &find_data);
+    if (find == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    
+    do {
+        if (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+        
+        string name = win32_null_terminated_wide_to_fixed_utf8(find_data.cFileName, allocator);
+        growing_array_add((void**)result, &name);
+    } while (FindNextFileW(find, &find_data) != 0);
+    
+    FindClose(find);
+    
+    return true;
+}
+
+bool os_file_map_s(string path, File_Mapping *result) {
+    *result = (File_Mapping){0};
+    
+    File file = os_file_open_s(path, O_READ);
+    if (file == OS_INVALID_FILE) return false;
+    
+    s64 size = os_file_get_size(file);
+    if (size <= 0) {
+        os_file_close(file);
+        return false;
+    }
+    
+    HANDLE mapping = CreateFileMappingW(file, 0, PAGE_READONLY, 0, 0, 0);
+    if (!mapping) {
+        os_file_close(file);
+        return false;
+    }
+    
+    void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!data) {
+        CloseHandle(mapping);
+        os_file_close(file);
+        return false;
+    }
+    
+    result->data = data;
+    result->size = (u64)size;
+    result->file = file;
+    result->os_handle = mapping;
+    
+    return true;
+}
+
+void os_file_unmap(File_Mapping *mapping) {
+    if (mapping->data) UnmapViewOfFile(mapping->data);
+    if (mapping->os_handle) CloseHandle(mapping->os_handle);
+    if (mapping->file != OS_INVALID_FILE && mapping->file) os_file_close(mapping->file);
+    *mapping = (File_Mapping){0};
+}
+
 bool os_is_path_absolute(string path) {
 	// #Incomplete #Portability not sure this is very robust.
 	
@@ -1785,11 +1847,13 @@ win32_audio_thread(Thread *t) {
     
 	while (!window.should_close) tm_scope("Audio update") {
 		if (win32_audio_deactivated) tm_scope("Retry audio device") {
+			// Game threads apply audio commands themselves until we're back
+			if (started) audio_mixer_thread_end();
+			started = false;
 			os_sleep(100);
 			mutex_acquire_or_wait(&audio_init_mutex);
 			win32_audio_init();
 			mutex_release(&audio_init_mutex);
-			started = false;
 			if (win32_audio_deactivated) {
 				hr = IAudioClient_GetBufferSize(win32_audio_client, &buffer_frame_count);
 	    		if (FAILED(hr)) win32_audio_deactivated = true;
@@ -1813,12 +1877,15 @@ win32_audio_thread(Thread *t) {
 	    	hr = IAudioClient_Start(win32_audio_client);
 	    	win32_check_hr(hr);
 	    	started = true;
+	    	audio_mixer_thread_begin();
     	}
     	
     	while (num_frames_to_write == 0) tm_scope("Chill") {
     		// We yield & sleep until we have any work to do
     		os_yield_thread();
     		os_sleep(1);
+    		
+    		audio_mixer_thread_apply_commands();
 			
 	    	hr = IAudioClient_GetCurrentPadding(win32_audio_client, &num_frames_available);
 			if (FAILED(hr)) {
@@ -1876,6 +1943,8 @@ win32_audio_thread(Thread *t) {
 		}
         
 	}
+	
+	if (started) audio_mixer_thread_end();
 }
 #endif /* OOGABOOGA_HEADLESS */
 
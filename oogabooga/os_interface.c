@@ -326,6 +326,27 @@ os_get_relative_path(string from, string to, string *result, Allocator allocator
 bool ogb_instance
 os_do_paths_match(string a, string b);
 
+// Appends the names (not full paths) of all files directly in the directory to result, which
+// must be an initialized growing array of string. Names are allocated with allocator.
+bool ogb_instance
+os_read_directory_file_names_s(string path, string **result, Allocator allocator);
+
+///
+// Memory mapped files
+typedef struct File_Mapping {
+	void *data;
+	u64 size;
+	File file;
+	void *os_handle;
+} File_Mapping;
+
+// Maps the entire file read-only. Returns false on fail.
+bool ogb_instance
+os_file_map_s(string path, File_Mapping *result);
+
+void ogb_instance
+os_file_unmap(File_Mapping *mapping);
+
 
 // It's a little unfortunate that we need to do this but I can't think of a better solution
 
@@ -382,6 +403,18 @@ inline bool os_is_directory_f(const char *path) {return os_is_directory_s(STR(pa
                            default: os_is_directory_f \
                           )(__VA_ARGS__)
                           
+inline bool os_read_directory_file_names_f(const char *path, string **result, Allocator allocator) {return os_read_directory_file_names_s(STR(path), result, allocator);}
+#define os_read_directory_file_names(...) _Generic((FIRST_ARG(__VA_ARGS__)), \
+                           string:  os_read_directory_file_names_s, \
+                           default: os_read_directory_file_names_f \
+                          )(__VA_ARGS__)
+                          
+inline bool os_file_map_f(const char *path, File_Mapping *result) {return os_file_map_s(STR(path), result);}
+#define os_file_map(...) _Generic((FIRST_ARG(__VA_ARGS__)), \
+                           string:  os_file_map_s, \
+                           default: os_file_map_f \
+                          )(__VA_ARGS__)
+                          
                           
 
 void ogb_instance
@@ -40,4 +40,130 @@ f64 get_random_float64_in_range(f64 min, f64 max) {
 
 s64 get_random_int_in_range(s64 min, s64 max) {
     return min + (s64)(get_random() % (max - min + 1));
-}
\ No newline at end of file
+}
+
+// Counter based
+// These don't have any state, the result only depends on seed and index. So you can get random
+// number n without getting all the ones before it, and from any thread without touching
+// seed_for_random. For example, use the index of a particle or an entity to give each
+// its own random numbers that stay the same no matter what order they're made in.
+//
+// get_random_at is SplitMix64 on the seed and index. The 32 bit and float versions use a cheaper
+// 32 bit hash (lowbias32 by Chris Wellons) so they can be done 4 at a time with SSE2,
+// and the batch versions give exactly the same numbers as calling the scalar versions one by one.
+// Only the low 32 bits of the index go into the 32 bit versions.
+
+#define RANDOM_GOLDEN_GAMMA_64 0x9E3779B97F4A7C15ull
+#define RANDOM_GOLDEN_GAMMA_32 0x9E3779B9u
+
+u64 random_mix64(u64 x) {
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+	return x ^ (x >> 31);
+}
+u32 random_mix32(u32 x) {
+	x ^= x >> 16;
+	x *= 0x7FEB352Du;
+	x ^= x >> 15;
+	x *= 0x846CA68Bu;
+	x ^= x >> 16;
+	return x;
+}
+
+u64 get_random_at(u64 seed, u64 index) {
+	// Seed is mixed first, otherwise seed+1 would give the same numbers as seed shifted by one index
+	return random_mix64(random_mix64(seed) + (index+1)*RANDOM_GOLDEN_GAMMA_64);
+}
+
+u32 random_key32(u64 seed) {
+	return (u32)(random_mix64(seed) >> 32);
+}
+u32 get_random_u32_at(u64 seed, u64 index) {
+	return random_mix32(((u32)index + 1)*RANDOM_GOLDEN_GAMMA_32 ^ random_key32(seed));
+}
+
+f32 get_random_float32_at(u64 seed, u64 index) {
+	// Top 24 bits so every result is exactly representable, [0, 1)
+	return (f32)(get_random_u32_at(seed, index) >> 8)*(1.0f/16777216.0f);
+}
+f32 get_random_float32_in_range_at(u64 seed, u64 index, f32 min, f32 max) {
+	return (max-min)*get_random_float32_at(seed, index)+min;
+}
+f64 get_random_float64_at(u64 seed, u64 index) {
+	return (f64)(get_random_at(seed, index) >> 11)*(1.0/9007199254740992.0);
+}
+f64 get_random_float64_in_range_at(u64 seed, u64 index, f64 min, f64 max) {
+	return (max-min)*get_random_float64_at(seed, index)+min;
+}
+s64 get_random_int_in_range_at(u64 seed, u64 index, s64 min, s64 max) {
+	return min + (s64)(get_random_at(seed, index) % (u64)(max - min + 1));
+}
+
+#if ENABLE_SIMD
+inline __m128i _random_mullo_epi32(__m128i a, __m128i b) {
+#if SIMD_ENABLE_SSE41
+	return _mm_mullo_epi32(a, b);
+#else
+	// SSE2 only multiplies the even lanes, so we do the odd ones shifted down and put them back
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd  = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+#endif
+}
+inline __m128i _random_mix32_4(__m128i x) {
+	x = _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+	x = _random_mullo_epi32(x, _mm_set1_epi32((int)0x7FEB352Du));
+	x = _mm_xor_si128(x, _mm_srli_epi32(x, 15));
+	x = _random_mullo_epi32(x, _mm_set1_epi32((int)0x846CA68Bu));
+	x = _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+	return x;
+}
+#endif
+
+// results[i] = get_random_u32_at(seed, first_index+i)
+void get_random_u32_batch(u64 seed, u64 first_index, u32 *results, u64 count) {
+	u32 key = random_key32(seed);
+	u64 i = 0;
+#if ENABLE_SIMD
+	__m128i keys  = _mm_set1_epi32((int)key);
+	__m128i gamma = _mm_set1_epi32((int)RANDOM_GOLDEN_GAMMA_32);
+	__m128i counter = _mm_add_epi32(_mm_set1_epi32((int)((u32)first_index+1)), _mm_set_epi32(3, 2, 1, 0));
+	__m128i four = _mm_set1_epi32(4);
+	for (; i+4 <= count; i += 4) {
+		__m128i x = _mm_xor_si128(_random_mullo_epi32(counter, gamma), keys);
+		_mm_storeu_si128((__m128i*)(results+i), _random_mix32_4(x));
+		counter = _mm_add_epi32(counter, four);
+	}
+#endif
+	for (; i < count; i++) {
+		results[i] = random_mix32(((u32)(first_index+i) + 1)*RANDOM_GOLDEN_GAMMA_32 ^ key);
+	}
+}
+
+// results[i] = get_random_float32_in_range_at(seed, first_index+i, min, max)
+void get_random_float32_in_range_batch(u64 seed, u64 first_index, f32 min, f32 max, f32 *results, u64 count) {
+	u32 key = random_key32(seed);
+	u64 i = 0;
+#if ENABLE_SIMD
+	__m128i keys  = _mm_set1_epi32((int)key);
+	__m128i gamma = _mm_set1_epi32((int)RANDOM_GOLDEN_GAMMA_32);
+	__m128i counter = _mm_add_epi32(_mm_set1_epi32((int)((u32)first_index+1)), _mm_set_epi32(3, 2, 1, 0));
+	__m128i four = _mm_set1_epi32(4);
+	__m128 range = _mm_set1_ps(max-min);
+	__m128 offset = _mm_set1_ps(min);
+	__m128 unit = _mm_set1_ps(1.0f/16777216.0f);
+	for (; i+4 <= count; i += 4) {
+		__m128i x = _random_mix32_4(_mm_xor_si128(_random_mullo_epi32(counter, gamma), keys));
+		// Top 24 bits fit in a positive int32, so the signed conversion is exact
+		__m128 f = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(x, 8)), unit);
+		_mm_storeu_ps(results+i, _mm_add_ps(_mm_mul_ps(range, f), offset));
+		counter = _mm_add_epi32(counter, four);
+	}
+#endif
+	for (; i < count; i++) {
+		results[i] = get_random_float32_in_range_at(seed, first_index+i, min, max);
+	}
+}
+void get_random_float32_batch(u64 seed, u64 first_index, f32 *results, u64 count) {
+	get_random_float32_in_range_batch(seed, first_index, 0.0, 1.0, results, count);
+}
@@ -0,0 +1,337 @@
+
+///
+// Sprite pack
+//
+// A sprite pack is a set of images which are decoded, flipped and packed into atlas pages ahead of
+// time. Loading one is a memory map and a texture upload per page, no png decoding at all.
+//
+//	Baking (usually done by bake.c in the project root):
+//
+//		sprite_pack_bake(png_paths, number_of_pngs, STR("assets/sprites.pack"));
+//
+//	Loading:
+//
+//		Sprite_Pack *pack = load_sprite_pack(STR("assets/sprites.pack"), get_heap_allocator());
+//		Gfx_Image *player = sprite_pack_get(pack, STR("player"));
+//
+//	Sprites are named by their file name without extension. The images you get are atlased images
+//	(see make_image_in_atlas) so you draw them like any other image.
+//
+// File layout (little endian):
+//	Sprite_Pack_Header
+//	Sprite_Pack_Entry * sprite_count                   at header.directory_offset
+//	RGBA8 pixels, page_size*page_size * page_count     at header.page_data_offset
+// Pixels are stored bottom-up, which is what load_image_from_disk gives you after flipping.
+//
+
+#define SPRITE_PACK_MAGIC 0x4B505053 // "SPPK"
+#define SPRITE_PACK_VERSION 1
+#define SPRITE_PACK_MAX_NAME_LENGTH 63
+#define SPRITE_PACK_MIN_PAGE_SIZE 128
+#define SPRITE_PACK_MAX_PAGE_SIZE 4096
+#define SPRITE_PACK_PADDING 1
+
+typedef struct Sprite_Pack_Header {
+	u32 magic;
+	u32 version;
+	u32 page_size;
+	u32 page_count;
+	u32 sprite_count;
+	u32 reserved;
+	u64 directory_offset;
+	u64 page_data_offset;
+} Sprite_Pack_Header;
+
+typedef struct Sprite_Pack_Entry {
+	char name[SPRITE_PACK_MAX_NAME_LENGTH+1]; // Null terminated
+	u32 page;
+	u32 x, y; // Position in the page, excluding padding
+	u32 width, height;
+	u32 reserved;
+	Vector4 uv; // x1, y1, x2, y2 in the page
+} Sprite_Pack_Entry;
+
+typedef struct Sprite_Pack_Bake_Image {
+	string name;
+	u32 *pixels;
+	u32 width, height;
+	u32 page, x, y;
+} Sprite_Pack_Bake_Image;
+
+// Tries to place all images, in order, into pages of page_size. Returns number of pages used or 0
+// if max_pages wasn't enough.
+u32 sprite_pack_place_images(Sprite_Pack_Bake_Image **sorted, u64 count, u32 page_size, u32 max_pages) {
+	Rect_Packer *packers = alloc(get_heap_allocator(), max_pages*sizeof(Rect_Packer));
+	u32 page_count = 0;
+	bool ok = true;
+
+	for (u64 i = 0; i < count && ok; i++) {
+		Sprite_Pack_Bake_Image *image = sorted[i];
+		u32 w = image->width  + SPRITE_PACK_PADDING*2;
+		u32 h = image->height + SPRITE_PACK_PADDING*2;
+
+		bool placed = false;
+		for (u32 p = 0; p < page_count && !placed; p++) {
+			if (rect_packer_pack(&packers[p], w, h, &image->x, &image->y)) {
+				image->page = p;
+				placed = true;
+			}
+		}
+		if (!placed) {
+			if (page_count >= max_pages) {
+				ok = false;
+				break;
+			}
+			rect_packer_init(&packers[page_count], page_size, page_size, get_heap_allocator());
+			if (!rect_packer_pack(&packers[page_count], w, h, &image->x, &image->y)) {
+				ok = false;
+			}
+			image->page = page_count;
+			page_count += 1;
+		}
+	}
+
+	for (u32 p = 0; p < page_count; p++) rect_packer_deinit(&packers[p]);
+	dealloc(get_heap_allocator(), packers);
+
+	return ok ? page_count : 0;
+}
+
+bool sprite_pack_bake(string *image_paths, u64 image_count, string output_path) {
+	if (image_count == 0) {
+		log_error("No images to bake into '%s'", output_path);
+		return false;
+	}
+
+	Allocator heap = get_heap_allocator();
+	Sprite_Pack_Bake_Image *images = alloc(heap, image_count*sizeof(Sprite_Pack_Bake_Image));
+	Sprite_Pack_Bake_Image **sorted = alloc(heap, image_count*sizeof(Sprite_Pack_Bake_Image*));
+	bool ok = true;
+
+	///
+	// Decode
+	for (u64 i = 0; i < image_count; i++) {
+		Sprite_Pack_Bake_Image *image = &images[i];
+		sorted[i] = image;
+
+		image->name = get_file_name_excluding_extension(image_paths[i]);
+		if (image->name.count > SPRITE_PACK_MAX_NAME_LENGTH) {
+			log_error("Sprite name '%s' is longer than %d characters", image->name, SPRITE_PACK_MAX_NAME_LENGTH);
+			ok = false;
+			break;
+		}
+
+		string png;
+		if (!os_read_entire_file(image_paths[i], &png, heap)) {
+			log_error("Could not read '%s'", image_paths[i]);
+			ok = false;
+			break;
+		}
+
+		int width, height, channels;
+		stbi_set_flip_vertically_on_load(1);
+		third_party_allocator = heap;
+		image->pixels = (u32*)stbi_load_from_memory(png.data, png.count, &width, &height, &channels, STBI_rgb_alpha);
+		third_party_allocator = ZERO(Allocator);
+		dealloc_string(heap, png);
+
+		if (!image->pixels) {
+			log_error("Could not decode '%s'", image_paths[i]);
+			ok = false;
+			break;
+		}
+		image->width = (u32)width;
+		image->height = (u32)height;
+
+		if (image->width+SPRITE_PACK_PADDING*2 > SPRITE_PACK_MAX_PAGE_SIZE || image->height+SPRITE_PACK_PADDING*2 > SPRITE_PACK_MAX_PAGE_SIZE) {
+			log_error("'%s' is too large for a sprite pack page (%dx%d)", image_paths[i], width, height);
+			ok = false;
+			break;
+		}
+	}
+
+	///
+	// Place
+	// Tallest first packs better with a skyline packer. Find the smallest single page that fits
+	// everything, otherwise use as many max size pages as needed.
+	u32 page_size = 0;
+	u32 page_count = 0;
+	if (ok) {
+		for (u64 i = 1; i < image_count; i++) {
+			for (u64 j = i; j > 0 && sorted[j]->height > sorted[j-1]->height; j--) {
+				swap(sorted[j], sorted[j-1], Sprite_Pack_Bake_Image*);
+			}
+		}
+
+		for (u32 size = SPRITE_PACK_MIN_PAGE_SIZE; size <= SPRITE_PACK_MAX_PAGE_SIZE && !page_count; size *= 2) {
+			page_size = size;
+			page_count = sprite_pack_place_images(sorted, image_count, size, 1);
+		}
+		if (!page_count) {
+			page_size = SPRITE_PACK_MAX_PAGE_SIZE;
+			page_count = sprite_pack_place_images(sorted, image_count, page_size, (u32)image_count);
+		}
+		assert(page_count, "Failed placing sprites even with one page per sprite");
+	}
+
+	///
+	// Write
+	if (ok) {
+		u64 directory_offset = sizeof(Sprite_Pack_Header);
+		u64 page_data_offset = align_next(directory_offset + image_count*sizeof(Sprite_Pack_Entry), 64);
+		u64 page_bytes = (u64)page_size*(u64)page_size*4;
+		u64 total_size = page_data_offset + page_bytes*page_count;
+
+		u8 *file = alloc(heap, total_size);
+
+		Sprite_Pack_Header *header = (Sprite_Pack_Header*)file;
+		header->magic = SPRITE_PACK_MAGIC;
+		header->version = SPRITE_PACK_VERSION;
+		header->page_size = page_size;
+		header->page_count = page_count;
+		header->sprite_count = (u32)image_count;
+		header->directory_offset = directory_offset;
+		header->page_data_offset = page_data_offset;
+
+		Sprite_Pack_Entry *entries = (Sprite_Pack_Entry*)(file + directory_offset);
+		for (u64 i = 0; i < image_count; i++) {
+			Sprite_Pack_Bake_Image *image = &images[i];
+			Sprite_Pack_Entry *entry = &entries[i];
+
+			memcpy(entry->name, image->name.data, image->name.count);
+			entry->name[image->name.count] = 0;
+			entry->page = image->page;
+			entry->x = image->x + SPRITE_PACK_PADDING;
+			entry->y = image->y + SPRITE_PACK_PADDING;
+			entry->width = image->width;
+			entry->height = image->height;
+			entry->uv = v4(
+				(float32)entry->x / (float32)page_size,
+				(float32)entry->y / (float32)page_size,
+				(float32)(entry->x+entry->width)  / (float32)page_size,
+				(float32)(entry->y+entry->height) / (float32)page_size
+			);
+
+			u32 *page_pixels = (u32*)(file + page_data_offset + page_bytes*image->page);
+			blit_rgba8_extruded(page_pixels, page_size, image->x, image->y, image->pixels, image->width, image->height, SPRITE_PACK_PADDING);
+		}
+
+		ok = os_write_entire_file_s(output_path, (string){total_size, file});
+		if (!ok) log_error("Could not write sprite pack to '%s'", output_path);
+		else log_info("Baked %d sprites into %d %dx%d page(s) in '%s'", image_count, page_count, page_size, page_size, output_path);
+
+		dealloc(heap, file);
+	}
+
+	for (u64 i = 0; i < image_count; i++) {
+		if (images[i].pixels) {
+			third_party_allocator = heap;
+			stbi_image_free(images[i].pixels);
+			third_party_allocator = ZERO(Allocator);
+		}
+	}
+	dealloc(heap, images);
+	dealloc(heap, sorted);
+
+	return ok;
+}
+
+#ifndef OOGABOOGA_HEADLESS
+
+typedef struct Sprite_Pack {
+	Gfx_Image **pages;
+	u32 page_count;
+	Gfx_Image **sprites;
+	string *names;
+	u32 sprite_count;
+	Allocator allocator;
+} Sprite_Pack;
+
+// Returns 0 on fail
+Sprite_Pack *load_sprite_pack(string path, Allocator allocator) {
+	File_Mapping mapping;
+	if (!os_file_map(path, &mapping)) {
+		log_error("Could not map sprite pack '%s'", path);
+		return 0;
+	}
+
+	Sprite_Pack_Header *header = (Sprite_Pack_Header*)mapping.data;
+	u64 page_bytes = 0;
+	bool valid = mapping.size >= sizeof(Sprite_Pack_Header)
+	          && header->magic == SPRITE_PACK_MAGIC
+	          && header->version == SPRITE_PACK_VERSION
+	          && header->page_size <= SPRITE_PACK_MAX_PAGE_SIZE;
+	if (valid) {
+		page_bytes = (u64)header->page_size*(u64)header->page_size*4;
+		valid = header->directory_offset + header->sprite_count*sizeof(Sprite_Pack_Entry) <= mapping.size
+		     && header->page_data_offset + page_bytes*header->page_count <= mapping.size;
+	}
+	if (!valid) {
+		log_error("'%s' is not a valid sprite pack (or was baked with an incompatible version)", path);
+		os_file_unmap(&mapping);
+		return 0;
+	}
+
+	Sprite_Pack *pack = alloc(allocator, sizeof(Sprite_Pack));
+	pack->allocator = allocator;
+	pack->page_count = header->page_count;
+	pack->sprite_count = header->sprite_count;
+	pack->pages   = alloc(allocator, pack->page_count*sizeof(Gfx_Image*));
+	pack->sprites = alloc(allocator, pack->sprite_count*sizeof(Gfx_Image*));
+	pack->names   = alloc(allocator, pack->sprite_count*sizeof(string));
+
+	// Straight from the mapped file to the gpu
+	u8 *page_data = (u8*)mapping.data + header->page_data_offset;
+	for (u32 i = 0; i < pack->page_count; i++) {
+		pack->pages[i] = make_image(header->page_size, header->page_size, 4, page_data + page_bytes*i, allocator);
+	}
+
+	Sprite_Pack_Entry *entries = (Sprite_Pack_Entry*)((u8*)mapping.data + header->directory_offset);
+	for (u32 i = 0; i < pack->sprite_count; i++) {
+		Sprite_Pack_Entry *entry = &entries[i];
+		assert(entry->page < pack->page_count, "Sprite pack entry has a bad page index");
+
+		Gfx_Image *page = pack->pages[entry->page];
+		Gfx_Image *image = alloc(allocator, sizeof(Gfx_Image));
+		image->width = entry->width;
+		image->height = entry->height;
+		image->channels = 4;
+		image->allocator = allocator;
+		image->gfx_handle = page->gfx_handle;
+		image->atlas_page = page;
+		image->atlas_x = entry->x;
+		image->atlas_y = entry->y;
+		image->atlas_uv = entry->uv;
+
+		pack->sprites[i] = image;
+		pack->names[i] = string_copy(STR(entry->name), allocator);
+	}
+
+	os_file_unmap(&mapping);
+
+	return pack;
+}
+
+// Returns 0 if there's no sprite with that name
+Gfx_Image *sprite_pack_get(Sprite_Pack *pack, string name) {
+	for (u32 i = 0; i < pack->sprite_count; i++) {
+		if (strings_match(pack->names[i], name)) return pack->sprites[i];
+	}
+	return 0;
+}
+
+void destroy_sprite_pack(Sprite_Pack *pack) {
+	for (u32 i = 0; i < pack->sprite_count; i++) {
+		delete_image(pack->sprites[i]);
+		dealloc_string(pack->allocator, pack->names[i]);
+	}
+	for (u32 i = 0; i < pack->page_count; i++) {
+		delete_image(pack->pages[i]);
+	}
+	dealloc(pack->allocator, pack->pages);
+	dealloc(pack->allocator, pack->sprites);
+	dealloc(pack->allocator, pack->names);
+	dealloc(pack->allocator, pack);
+}
+
+#endif // OOGABOOGA_HEADLESS
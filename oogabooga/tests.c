@@ -1368,6 +1368,114 @@ void test_random_distribution() {
     print("Min: %d, max: %d\n", min_bin, max_bin);
 }
 
+void test_random_counter_based() {
+    
+    // Same seed and index is the same number, nothing else is
+    assert(get_random_at(1234, 5) == get_random_at(1234, 5), "Failed: get_random_at is not deterministic");
+    assert(get_random_at(1234, 5) != get_random_at(1234, 6), "Failed: Neighbouring indices gave the same number");
+    assert(get_random_at(1234, 5) != get_random_at(1235, 5), "Failed: Neighbouring seeds gave the same number");
+    assert(get_random_at(1235, 5) != get_random_at(1234, 6), "Failed: Seed+1 is the same stream as index+1");
+    
+    // Doesn't touch the thread's seed
+    u64 seed_before = seed_for_random;
+    seed_for_random = 69;
+    get_random_at(1, 2);
+    get_random_float32_at(1, 2);
+    assert(seed_for_random == 69, "Failed: Counter based random changed seed_for_random");
+    seed_for_random = seed_before;
+    
+    // Batches are exactly the same as one by one, including the scalar tail and odd start
+    const u64 batch_count = 1003;
+    u32 *batch_u32 = alloc(get_heap_allocator(), batch_count*sizeof(u32));
+    f32 *batch_f32 = alloc(get_heap_allocator(), batch_count*sizeof(f32));
+    get_random_u32_batch(42, 77, batch_u32, batch_count);
+    for (u64 i = 0; i < batch_count; i++) {
+        assert(batch_u32[i] == get_random_u32_at(42, 77+i), "Failed: u32 batch differs from scalar at %llu", i);
+    }
+    get_random_float32_batch(42, 77, batch_f32, batch_count);
+    for (u64 i = 0; i < batch_count; i++) {
+        assert(batch_f32[i] == get_random_float32_at(42, 77+i), "Failed: f32 batch differs from scalar at %llu", i);
+        assert(batch_f32[i] >= 0.0 && batch_f32[i] < 1.0, "Failed: %f is out of [0, 1)", batch_f32[i]);
+    }
+    get_random_float32_in_range_batch(42, 77, -3.0, 5.0, batch_f32, batch_count);
+    for (u64 i = 0; i < batch_count; i++) {
+        f32 expected = get_random_float32_in_range_at(42, 77+i, -3.0, 5.0);
+        assert(fabsf(batch_f32[i]-expected) < 0.00001, "Failed: f32 range batch differs from scalar at %llu", i);
+        assert(batch_f32[i] >= -3.0 && batch_f32[i] <= 5.0, "Failed: %f is out of [-3, 5]", batch_f32[i]);
+    }
+    
+    // Distribution: chi-squared over 100 bins (99 degrees of freedom, so ~99 +- 14),
+    // mean, each bit set half the time, and no correlation between neighbouring indices or seeds
+    const u64 sample_count = 1000000;
+    u64 bins_32[100] = {0};
+    u64 bins_64[100] = {0};
+    u64 bit_counts[32] = {0};
+    f64 sum = 0;
+    f64 sum_index_products = 0;
+    f64 sum_seed_products = 0;
+    f32 previous = get_random_float32_at(7, 0);
+    for (u64 i = 0; i < sample_count; i++) {
+        f32 v = get_random_float32_at(7, i);
+        bins_32[(u64)(v*100.0)] += 1;
+        bins_64[(u64)(get_random_float64_at(7, i)*100.0)] += 1;
+        u32 bits = get_random_u32_at(7, i);
+        for (u64 b = 0; b < 32; b++) bit_counts[b] += (bits >> b) & 1;
+        sum += v;
+        sum_index_products += (f64)(v-0.5)*(f64)(previous-0.5);
+        sum_seed_products += (f64)(v-0.5)*(f64)(get_random_float32_at(8, i)-0.5);
+        previous = v;
+    }
+    f64 expected_per_bin = (f64)sample_count/100.0;
+    f64 chi_squared_32 = 0;
+    f64 chi_squared_64 = 0;
+    for (u64 i = 0; i < 100; i++) {
+        chi_squared_32 += ((f64)bins_32[i]-expected_per_bin)*((f64)bins_32[i]-expected_per_bin)/expected_per_bin;
+        chi_squared_64 += ((f64)bins_64[i]-expected_per_bin)*((f64)bins_64[i]-expected_per_bin)/expected_per_bin;
+    }
+    assert(chi_squared_32 < 200.0, "Failed: 32 bit chi-squared is %f", chi_squared_32);
+    assert(chi_squared_64 < 200.0, "Failed: 64 bit chi-squared is %f", chi_squared_64);
+    f64 mean = sum/(f64)sample_count;
+    assert(fabs(mean-0.5) < 0.002, "Failed: Mean is %f", mean);
+    for (u64 b = 0; b < 32; b++) {
+        f64 ratio = (f64)bit_counts[b]/(f64)sample_count;
+        assert(fabs(ratio-0.5) < 0.005, "Failed: Bit %llu is set %f of the time", b, ratio);
+    }
+    // Correlation coefficient, variance of uniform [0, 1) is 1/12
+    f64 index_correlation = (sum_index_products/(f64)sample_count)*12.0;
+    f64 seed_correlation  = (sum_seed_products/(f64)sample_count)*12.0;
+    assert(fabs(index_correlation) < 0.01, "Failed: Neighbouring indices correlate by %f", index_correlation);
+    assert(fabs(seed_correlation) < 0.01, "Failed: Neighbouring seeds correlate by %f", seed_correlation);
+    
+    // Ints in range hit every value
+    u64 int_bins[6] = {0};
+    for (u64 i = 0; i < 60000; i++) {
+        s64 v = get_random_int_in_range_at(99, i, -2, 3);
+        assert(v >= -2 && v <= 3, "Failed: %lld is out of [-2, 3]", v);
+        int_bins[v+2] += 1;
+    }
+    for (u64 i = 0; i < 6; i++) assert(int_bins[i] > 9000 && int_bins[i] < 11000, "Failed: Bad int distribution, %llu of 60000 for %lld", int_bins[i], (s64)i-2);
+    
+    // Speed, LCG vs counter based one by one vs batched
+    const u64 speed_count = 10000000;
+    f32 *speed_results = alloc(get_heap_allocator(), speed_count*sizeof(f32));
+    f64 start = os_get_elapsed_seconds();
+    for (u64 i = 0; i < speed_count; i++) speed_results[i] = get_random_float32();
+    f64 lcg_seconds = os_get_elapsed_seconds()-start;
+    start = os_get_elapsed_seconds();
+    for (u64 i = 0; i < speed_count; i++) speed_results[i] = get_random_float32_at(1, i);
+    f64 scalar_seconds = os_get_elapsed_seconds()-start;
+    start = os_get_elapsed_seconds();
+    get_random_float32_batch(1, 0, speed_results, speed_count);
+    f64 batch_seconds = os_get_elapsed_seconds()-start;
+    
+    print("%llu floats: %.2f ms lcg, %.2f ms counter based, %.2f ms batched. chi-squared %.1f ",
+        speed_count, lcg_seconds*1000.0, scalar_seconds*1000.0, batch_seconds*1000.0, chi_squared_32);
+    
+    dealloc(get_heap_allocator(), speed_results);
+    dealloc(get_heap_allocator(), batch_u32);
+    dealloc(get_heap_allocator(), batch_f32);
+}
+
 #define MUTEX_TEST_TASK_COUNT 1000
 typedef struct Mutex_Test_Shared_Data {
     int counter;
@@ -1388,118 +1496,2769 @@ void mutex_test_increment_counter(Thread* t) {
 void test_mutex() {
     Mutex m;
     
-    // Test initialization
-    mutex_init(&m);
-    assert(m.spin_time_microseconds == MUTEX_DEFAULT_SPIN_TIME_MICROSECONDS, "Failed: Default spin time incorrect");
-    assert(!m.spinlock_acquired, "Failed: Spinlock should not be acquired after initialization");
+    // Test initialization
+    mutex_init(&m);
+    assert(m.spin_time_microseconds == MUTEX_DEFAULT_SPIN_TIME_MICROSECONDS, "Failed: Default spin time incorrect");
+    assert(!m.spinlock_acquired, "Failed: Spinlock should not be acquired after initialization");
+
+    // Test acquire and release without contention
+    mutex_acquire_or_wait(&m);
+    assert(m.spinlock_acquired, "Failed: Mutex should be acquired after mutex_acquire_or_wait");
+    
+    mutex_release(&m);
+    assert(!m.spinlock_acquired, "Failed: Spinlock should not be acquired after mutex_release");
+
+    // Clean up
+    mutex_destroy(&m);
+    
+    Mutex_Test_Shared_Data data;
+    data.counter = 0;
+    data.any_active_thread = false;
+    mutex_init(&data.mutex);
+
+    Allocator allocator = get_heap_allocator();
+
+	const int num_threads = 100;
+
+	Thread *threads = alloc(allocator, sizeof(Thread)*num_threads);
+	for (u64 i = 0; i < num_threads; i++) {
+		os_thread_init(&threads[i], mutex_test_increment_counter);
+		threads[i].data = &data;
+	}
+	for (u64 i = 0; i < num_threads; i++) {
+    	os_thread_start(&threads[i]);
+	}
+	for (u64 i = 0; i < num_threads; i++) {
+    	os_thread_join(&threads[i]);
+	}
+
+    assert(data.counter == num_threads * MUTEX_TEST_TASK_COUNT, "Failed: Counter does not match expected value after threading tasks");
+
+    mutex_destroy(&data.mutex);
+}
+
+void test_thread_scratch() {
+    
+    // In place growth, falling through to the heap, growing on reset
+    Thread_Scratch scratch = {0};
+    scratch.high_water = KB(4);
+    thread_scratch_reset(&scratch);
+    Allocator a = {.proc = thread_scratch_allocator_proc, .data = &scratch};
+    
+    u8 *p0 = alloc(a, 100);
+    u8 *p1 = alloc(a, 100);
+    memset(p1, 7, 100);
+    u8 *p1_grown = a.proc(1000, p1, ALLOCATOR_REALLOCATE, a.data);
+    assert(p1_grown == p1, "Failed: Expected last scratch allocation to grow in place");
+    assert(p1_grown[99] == 7, "Failed: Scratch reallocate lost data");
+    u8 *p0_grown = a.proc(200, p0, ALLOCATOR_REALLOCATE, a.data);
+    assert(p0_grown != p0 && p0_grown[0] == p0[0], "Failed: Scratch reallocate of non-last allocation");
+    u8 *big = alloc(a, KB(8));
+    assert(big < scratch.base || big >= scratch.base+scratch.size, "Failed: Expected overflow to go to the heap");
+    dealloc(a, big);
+    u64 high_water = scratch.high_water;
+    thread_scratch_reset(&scratch);
+    assert(scratch.size >= high_water, "Failed: Scratch should grow to the high water mark on reset");
+    assert(scratch.used == 0, "Failed: Scratch reset");
+    dealloc(get_heap_allocator(), scratch.base);
+}
+
+void test_worker_pool_job(void *data) {
+    u64 *slot = (u64*)data;
+    // Make sure temporary storage works on workers
+    u64 *tmp = talloc(sizeof(u64));
+    *tmp = *slot;
+    *slot = *tmp + 1;
+}
+void test_worker_pool() {
+    const u64 number_of_jobs = 5000;
+    
+    Worker_Pool pool;
+    worker_pool_init(&pool, 4, get_heap_allocator());
+    
+    u64 *slots = alloc(get_heap_allocator(), number_of_jobs*sizeof(u64));
+    for (u64 i = 0; i < number_of_jobs; i++) {
+        slots[i] = i;
+        worker_pool_push(&pool, test_worker_pool_job, &slots[i]);
+    }
+    worker_pool_wait(&pool);
+    
+    assert(pool.jobs_unfinished == 0, "Failed: Jobs left after worker_pool_wait");
+    for (u64 i = 0; i < number_of_jobs; i++) {
+        assert(slots[i] == i+1, "Failed: Job %llu did not run exactly once", i);
+    }
+    
+    // Pool without threads, everything runs in worker_pool_wait
+    Worker_Pool inline_pool;
+    worker_pool_init(&inline_pool, 0, get_heap_allocator());
+    for (u64 i = 0; i < number_of_jobs; i++) {
+        worker_pool_push(&inline_pool, test_worker_pool_job, &slots[i]);
+    }
+    worker_pool_wait(&inline_pool);
+    for (u64 i = 0; i < number_of_jobs; i++) {
+        assert(slots[i] == i+2, "Failed: Job %llu did not run exactly once on inline pool", i);
+    }
+    
+    worker_pool_destroy(&pool);
+    worker_pool_destroy(&inline_pool);
+    
+    // Workers run jobs on their own without anyone helping in worker_pool_wait, and
+    // destroying right after pushing doesn't hang on a worker that missed the exit signal
+    for (u64 round = 0; round < 200; round++) {
+        Worker_Pool short_pool;
+        worker_pool_init(&short_pool, 8, get_heap_allocator());
+        for (u64 i = 0; i < 16; i++) {
+            slots[i] = i;
+            worker_pool_push(&short_pool, test_worker_pool_job, &slots[i]);
+        }
+        f64 start = os_get_elapsed_seconds();
+        while (short_pool.jobs_unfinished > 0) {
+            assert(os_get_elapsed_seconds()-start < 5.0, "Failed: Workers left jobs unrun in round %llu", round);
+            os_yield_thread();
+        }
+        worker_pool_destroy(&short_pool);
+    }
+    
+    dealloc(get_heap_allocator(), slots);
+}
+
+#ifndef OOGABOOGA_HEADLESS
+int compare_draw_quads(const void *a, const void *b) {
+    return ((Draw_Quad*)a)->z-((Draw_Quad*)b)->z;
+}
+void test_sort() {
+    
+    int num_samples = 500;
+    u64 id_bits = 21;
+    u64 item_count = 50000;
+    
+    f64 seconds = 0;
+    u64 cycles = 0;
+    
+    Draw_Quad *items = alloc(get_heap_allocator(), (item_count * 2) * sizeof(Draw_Quad));
+    Draw_Quad *buffer = items + item_count;
+
+    for (int a = 0; a < num_samples; a++) {
+        
+        for (u64 i = 0; i < item_count; i++) {
+            if (i % 2 == 0) items[i].z = get_random_int_in_range(0, pow(2, id_bits) / 2);
+            else items[i].z = i;
+        }
+    
+        u64 item_size = sizeof(Draw_Quad);
+        u64 sort_value_offset_in_item = offsetof(Draw_Quad, z);
+    
+        float64 start_seconds = os_get_elapsed_seconds();
+        u64 start_cycles = rdtsc();
+        radix_sort(items, buffer, item_count, item_size, sort_value_offset_in_item, id_bits);
+        u64 end_cycles = rdtsc();
+        float64 end_seconds = os_get_elapsed_seconds();
+    
+        for (u64 i = 1; i < item_count; i++) {
+            assert(items[i].z >= items[i-1].z, "Failed: not correctly sorted");
+        }
+        
+        seconds += end_seconds - start_seconds;
+        cycles += end_cycles - start_cycles;
+    }
+    
+    print("Radix sort took on average %llu cycles and %.2f ms\n", cycles / num_samples, (seconds * 1000.0) / (float64)num_samples);
+
+	seconds = 0;
+    cycles = 0;
+	for (int a = 0; a < num_samples; a++) {
+        
+        for (u64 i = 0; i < item_count; i++) {
+            if (i % 2 == 0) items[i].z = get_random_int_in_range(0, pow(2, id_bits) / 2);
+            else items[i].z = i;
+        }
+    
+        u64 item_size = sizeof(Draw_Quad);
+        u64 sort_value_offset_in_item = offsetof(Draw_Quad, z);
+    
+        float64 start_seconds = os_get_elapsed_seconds();
+        u64 start_cycles = rdtsc();
+        merge_sort(items, buffer, item_count, item_size, compare_draw_quads);
+        u64 end_cycles = rdtsc();
+        float64 end_seconds = os_get_elapsed_seconds();
+    
+        for (u64 i = 1; i < item_count; i++) {
+            assert(items[i].z >= items[i-1].z, "Failed: not correctly sorted");
+        }
+        
+        seconds += end_seconds - start_seconds;
+        cycles += end_cycles - start_cycles;
+    }
+    
+    print("Merge sort took on average %llu cycles and %.2f ms\n", cycles / num_samples, (seconds * 1000.0) / (float64)num_samples);
+}
+
+void test_vertex_pipeline() {
+    
+    const u64 number_of_quads = 200000;
+    const u64 number_of_images = 40; // More than 32 so we get several batches
+    const int num_samples = 50;
+    
+    Gfx_Image *images = alloc(get_heap_allocator(), number_of_images*sizeof(Gfx_Image));
+    for (u64 i = 0; i < number_of_images; i++) {
+        images[i].width = 64;
+        images[i].height = 64;
+        images[i].gfx_handle = (Gfx_Handle)(i+1); // Never dereferenced by the null backend
+    }
+    
+    Draw_Frame frame;
+    draw_frame_init_reserve(&frame, number_of_quads);
+    for (u64 i = 0; i < number_of_quads; i++) {
+        Draw_Quad *q = growing_array_add_empty((void**)&frame.quad_buffer);
+        q->bottom_left  = v2(get_random_float32_in_range(-1, 1), get_random_float32_in_range(-1, 1));
+        q->top_left     = v2(q->bottom_left.x, q->bottom_left.y+0.01);
+        q->top_right    = v2(q->bottom_left.x+0.01, q->bottom_left.y+0.01);
+        q->bottom_right = v2(q->bottom_left.x+0.01, q->bottom_left.y);
+        q->color = v4(1, 1, 1, 1);
+        q->uv = v4(0, 0, 1, 1);
+        // Runs of 64 quads per image
+        q->image = (i/64) % 5 == 0 ? 0 : &images[(i/64) % number_of_images];
+    }
+    
+    Gfx_Null_Upload_Backend serial_state;
+    Gfx_Null_Upload_Backend pipelined_state;
+    Gfx_Upload_Backend serial = make_null_upload_backend(&serial_state, get_heap_allocator());
+    Gfx_Upload_Backend pipelined = make_null_upload_backend(&pipelined_state, get_heap_allocator());
+    
+    s64 worker_count = gfx_vertex_worker_count;
+    
+    f64 serial_seconds = 0;
+    f64 pipelined_seconds = 0;
+    for (int a = 0; a < num_samples; a++) {
+        gfx_vertex_worker_count = 0;
+        f64 start = os_get_elapsed_seconds();
+        gfx_process_draw_frame(&frame, serial);
+        serial_seconds += os_get_elapsed_seconds()-start;
+        
+        gfx_vertex_worker_count = worker_count;
+        start = os_get_elapsed_seconds();
+        gfx_process_draw_frame(&frame, pipelined);
+        pipelined_seconds += os_get_elapsed_seconds()-start;
+    }
+    gfx_vertex_worker_count = worker_count;
+    
+    assert(serial_state.number_of_quads_drawn == number_of_quads, "Failed: Not all quads were drawn");
+    assert(pipelined_state.number_of_quads_drawn == number_of_quads, "Failed: Not all quads were drawn");
+    assert(serial_state.number_of_draws > 1, "Failed: Expected more than one batch with %d textures", number_of_images);
+    assert(serial_state.number_of_draws == pipelined_state.number_of_draws, "Failed: Batching differs between serial and pipelined");
+    assert(serial_state.bytes_uploaded == pipelined_state.bytes_uploaded, "Failed: Upload size differs between serial and pipelined");
+    assert(memcmp(serial_state.memory, pipelined_state.memory, serial_state.bytes_uploaded) == 0, "Failed: Vertices differ between serial and pipelined");
+    
+    print("Vertex pipeline (%llu quads, null backend) took on average %.2f ms serial and %.2f ms with %lld workers\n", number_of_quads, (serial_seconds*1000.0)/(f64)num_samples, (pipelined_seconds*1000.0)/(f64)num_samples, worker_count);
+    
+    destroy_null_upload_backend(&serial_state);
+    destroy_null_upload_backend(&pipelined_state);
+    growing_array_deinit((void**)&frame.quad_buffer);
+    dealloc(get_heap_allocator(), images);
+}
+
+void test_image_atlas() {
+    
+    const u64 number_of_images = 64;
+    const u64 number_of_quads = 100000;
+    const u32 size = 32;
+    const int num_samples = 50;
+    
+    u32 *pixels = alloc(get_heap_allocator(), size*size*sizeof(u32));
+    u32 *readback = alloc(get_heap_allocator(), size*size*sizeof(u32));
+    
+    Gfx_Image **separate = alloc(get_heap_allocator(), number_of_images*sizeof(Gfx_Image*));
+    Gfx_Image **atlased  = alloc(get_heap_allocator(), number_of_images*sizeof(Gfx_Image*));
+    for (u64 i = 0; i < number_of_images; i++) {
+        for (u32 p = 0; p < size*size; p++) pixels[p] = (u32)get_random();
+        
+        separate[i] = make_image(size, size, 4, pixels, get_heap_allocator());
+        atlased[i]  = make_image_in_atlas(size, size, pixels, get_heap_allocator());
+        
+        assert(atlased[i]->atlas_page, "Failed: Small image was not put in atlas");
+        assert(atlased[i]->gfx_handle == atlased[0]->gfx_handle, "Failed: Expected all images in the same page");
+        
+        gfx_read_image_data(atlased[i], 0, 0, size, size, readback);
+        assert(memcmp(readback, pixels, size*size*sizeof(u32)) == 0, "Failed: Atlased image data does not match");
+    }
+    
+    // Setting the right half of an atlased image also rewrites the border around that half, and
+    // leaves the border around the left half alone
+    Gfx_Image *edited = atlased[0];
+    u32 half = size/2;
+    u32 left_color;
+    gfx_read_image_data(edited, 0, 0, 1, 1, &left_color);
+    for (u32 p = 0; p < half*size; p++) pixels[p] = 0xff00ff00;
+    gfx_set_image_data(edited, half, 0, half, size, pixels);
+    u32 border_width = size+IMAGE_ATLAS_PADDING*2;
+    u32 *border = alloc(get_heap_allocator(), border_width*border_width*sizeof(u32));
+    gfx_read_image_data(edited->atlas_page, edited->atlas_x-IMAGE_ATLAS_PADDING, edited->atlas_y-IMAGE_ATLAS_PADDING, border_width, border_width, border);
+    assert(border[border_width-1] == 0xff00ff00, "Failed: Top right border corner was not rewritten");
+    assert(border[(border_width/2)*border_width + border_width-1] == 0xff00ff00, "Failed: Right border was not rewritten");
+    assert(border[(border_width-1)*border_width + border_width-1] == 0xff00ff00, "Failed: Bottom right border corner was not rewritten");
+    assert(border[border_width-2] == 0xff00ff00 && border[(border_width-1)*border_width + half+IMAGE_ATLAS_PADDING] == 0xff00ff00, "Failed: Top/bottom border over the set half was not rewritten");
+    assert(border[0] == left_color, "Failed: Border outside the set region was rewritten");
+    dealloc(get_heap_allocator(), border);
+    
+    Draw_Frame frames[2];
+    Gfx_Image **image_sets[2] = { separate, atlased };
+    for (u64 f = 0; f < 2; f++) {
+        draw_frame_init_reserve(&frames[f], number_of_quads);
+        for (u64 i = 0; i < number_of_quads; i++) {
+            Draw_Quad *q = growing_array_add_empty((void**)&frames[f].quad_buffer);
+            q->bottom_left  = v2(get_random_float32_in_range(-1, 1), get_random_float32_in_range(-1, 1));
+            q->top_left     = v2(q->bottom_left.x, q->bottom_left.y+0.02);
+            q->top_right    = v2(q->bottom_left.x+0.02, q->bottom_left.y+0.02);
+            q->bottom_right = v2(q->bottom_left.x+0.02, q->bottom_left.y);
+            q->color = v4(1, 1, 1, 1);
+            q->uv = v4(0, 0, 1, 1);
+            q->image = image_sets[f][i % number_of_images];
+        }
+    }
+    
+    Gfx_Null_Upload_Backend null_state;
+    Gfx_Upload_Backend null_backend = make_null_upload_backend(&null_state, get_heap_allocator());
+    
+    const char *names[2] = { "separate textures", "atlas" };
+    u64 draws[2];
+    for (u64 f = 0; f < 2; f++) {
+        gfx_process_draw_frame(&frames[f], null_backend);
+        draws[f] = null_state.number_of_draws;
+        
+        f64 seconds = 0;
+        for (int a = 0; a < num_samples; a++) {
+            f64 start = os_get_elapsed_seconds();
+            gfx_render_draw_frame_to_window(&frames[f]);
+            seconds += os_get_elapsed_seconds()-start;
+        }
+        print("%llu quads with %llu images in %cs: %llu draw calls, %.2f ms per frame\n", number_of_quads, number_of_images, names[f], draws[f], (seconds*1000.0)/(f64)num_samples);
+    }
+    
+    assert(draws[1] == 1, "Failed: Expected a single draw call with atlased images, got %llu", draws[1]);
+    assert(draws[0] > draws[1], "Failed: Expected atlas to reduce draw calls");
+    
+    destroy_null_upload_backend(&null_state);
+    for (u64 f = 0; f < 2; f++) growing_array_deinit((void**)&frames[f].quad_buffer);
+    for (u64 i = 0; i < number_of_images; i++) {
+        delete_image(separate[i]);
+        delete_image(atlased[i]);
+    }
+    dealloc(get_heap_allocator(), separate);
+    dealloc(get_heap_allocator(), atlased);
+    dealloc(get_heap_allocator(), pixels);
+    dealloc(get_heap_allocator(), readback);
+}
+
+void test_async_image_load() {
+    
+    // Missing files fail gracefully
+    Image_Load_Request *missing = load_image_from_disk_async(STR("this_file_does_not_exist.png"), get_heap_allocator());
+    assert(wait_image_load(missing) == 0, "Failed: Expected 0 for missing file");
+    
+    string path = STR("assets/rock0.png");
+    if (!os_is_file(path)) {
+        print("(skipping decode comparison, no '%s') ", path);
+        return;
+    }
+    
+    // Async decode should give the same pixels as load_image_from_disk
+    Gfx_Image *sync_image = load_image_from_disk(path, get_heap_allocator());
+    Gfx_Image *async_image = wait_image_load(load_image_from_disk_async(path, get_heap_allocator()));
+    assert(sync_image && async_image, "Failed: Could not load '%s'", path);
+    assert(sync_image->width == async_image->width && sync_image->height == async_image->height, "Failed: Async image size mismatch");
+    
+    u64 size = sync_image->width*sync_image->height*4;
+    u8 *a_pixels = alloc(get_heap_allocator(), size);
+    u8 *b_pixels = alloc(get_heap_allocator(), size);
+    gfx_read_image_data(sync_image,  0, 0, sync_image->width,  sync_image->height,  a_pixels);
+    gfx_read_image_data(async_image, 0, 0, async_image->width, async_image->height, b_pixels);
+    assert(memcmp(a_pixels, b_pixels, size) == 0, "Failed: Async image pixels mismatch");
+    
+    delete_image(sync_image);
+    delete_image(async_image);
+    dealloc(get_heap_allocator(), a_pixels);
+    dealloc(get_heap_allocator(), b_pixels);
+    
+    // Serial vs async throughput
+    const u64 number_of_loads = 64;
+    Gfx_Image **images = alloc(get_heap_allocator(), number_of_loads*sizeof(Gfx_Image*));
+    Image_Load_Request **requests = alloc(get_heap_allocator(), number_of_loads*sizeof(Image_Load_Request*));
+    
+    f64 start = os_get_elapsed_seconds();
+    for (u64 i = 0; i < number_of_loads; i++) images[i] = load_image_from_disk(path, get_heap_allocator());
+    f64 serial_seconds = os_get_elapsed_seconds()-start;
+    for (u64 i = 0; i < number_of_loads; i++) delete_image(images[i]);
+    
+    start = os_get_elapsed_seconds();
+    for (u64 i = 0; i < number_of_loads; i++) requests[i] = load_image_from_disk_async(path, get_heap_allocator());
+    for (u64 i = 0; i < number_of_loads; i++) images[i] = wait_image_load(requests[i]);
+    f64 async_seconds = os_get_elapsed_seconds()-start;
+    for (u64 i = 0; i < number_of_loads; i++) delete_image(images[i]);
+    
+    print("%llu loads: serial %.2f ms, async on %lld threads %.2f ms ", number_of_loads, serial_seconds*1000.0, image_load_worker_count, async_seconds*1000.0);
+    
+    dealloc(get_heap_allocator(), images);
+    dealloc(get_heap_allocator(), requests);
+}
+
+// The font tests rasterize a system font, and are skipped where it's not there
+#define TEST_FONT_PATH "C:/windows/fonts/arial.ttf"
+bool test_font_is_available() {
+    string path = STR(TEST_FONT_PATH);
+    if (!os_is_file(path)) {
+        print("(skipping, no '%s') ", path);
+        return false;
+    }
+    return true;
+}
+Gfx_Font *test_load_font(bool sdf) {
+    string path = STR(TEST_FONT_PATH);
+    Gfx_Font *font = sdf ? load_font_from_disk_sdf(path, get_heap_allocator()) : load_font_from_disk(path, get_heap_allocator());
+    assert(font, "Failed: Could not load '%s'", path);
+    return font;
+}
+
+void test_font_glyph_cache() {
+    
+    if (!test_font_is_available()) return;
+    Gfx_Font *font = test_load_font(false);
+    
+    u64 frame_index_before = gfx_frame_index;
+    
+    Draw_Frame frame;
+    draw_frame_init(&frame);
+    
+    // First use only rasterizes the glyphs in the string
+    f64 start = os_get_elapsed_seconds();
+    draw_text_in_frame(font, STR("Wood x12"), 48, v2(0, 0), v2(1, 1), COLOR_WHITE, &frame);
+    f64 first_draw_seconds = os_get_elapsed_seconds()-start;
+    
+    assert(growing_array_get_valid_count(font->atlases) == 1, "Failed: Expected a single glyph cache page");
+    assert(growing_array_get_valid_count(frame.quad_buffer) == 7, "Failed: Expected one quad per visible glyph, got %llu", growing_array_get_valid_count(frame.quad_buffer));
+    u64 glyphs_cached = 0;
+    for (u32 c = 0; c < 256; c++) {
+        if (font->variations[48].latin1_glyphs[c].atlas_generation != 0) glyphs_cached += 1;
+    }
+    assert(glyphs_cached == 6, "Failed: Expected only the used glyphs to be rasterized, got %llu", glyphs_cached);
+    
+    // Glyph pixels end up in the page
+    Gfx_Font_Atlas *atlas;
+    Gfx_Glyph *w_glyph = font_get_glyph(font, 48, 'W', &atlas);
+    u32 gx = (u32)(w_glyph->uv.x1*FONT_ATLAS_WIDTH);
+    u32 gy = (u32)(w_glyph->uv.y1*FONT_ATLAS_HEIGHT);
+    u8 *page_pixels = alloc(get_heap_allocator(), FONT_ATLAS_WIDTH*FONT_ATLAS_HEIGHT);
+    font_upload_dirty_glyphs();
+    gfx_read_image_data(atlas->image, 0, 0, FONT_ATLAS_WIDTH, FONT_ATLAS_HEIGHT, page_pixels);
+    u64 coverage = 0;
+    for (u32 y = gy; y < gy+(u32)w_glyph->height; y++) {
+        for (u32 x = gx; x < gx+(u32)w_glyph->width; x++) coverage += page_pixels[y*FONT_ATLAS_WIDTH+x];
+    }
+    assert(coverage > 0, "Failed: Glyph was not written to the glyph cache page");
+    
+    print("first draw %.3f ms, %llu KB of glyph pages ", first_draw_seconds*1000.0, (growing_array_get_valid_count(font->atlases)*FONT_ATLAS_WIDTH*FONT_ATLAS_HEIGHT)/1024);
+    
+    // Fill the cache with big glyphs over multiple frames so pages get evicted
+    string alphabet = STR("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789");
+    for (u32 height = 64; height <= 256; height += 16) {
+        gfx_frame_index += 1;
+        draw_frame_reset(&frame);
+        draw_text_in_frame(font, alphabet, height, v2(0, 0), v2(1, 1), COLOR_WHITE, &frame);
+        
+        assert(growing_array_get_valid_count(font->atlases) <= FONT_ATLAS_MAX_PAGES, "Failed: Glyph cache grew past FONT_ATLAS_MAX_PAGES");
+    }
+    bool any_evicted = false;
+    for (u64 i = 0; i < growing_array_get_valid_count(font->atlases); i++) {
+        if (font->atlases[i].generation > 1) any_evicted = true;
+    }
+    assert(any_evicted, "Failed: Expected pages to be evicted");
+    
+    // Evicted glyphs come back when used again
+    gfx_frame_index += 1;
+    w_glyph = font_get_glyph(font, 48, 'W', &atlas);
+    assert(atlas && w_glyph->atlas_generation == atlas->generation, "Failed: Evicted glyph was not rasterized again");
+    
+    gfx_frame_index = frame_index_before;
+    growing_array_deinit((void**)&frame.quad_buffer);
+    dealloc(get_heap_allocator(), page_pixels);
+    destroy_font(font);
+}
+
+void test_font_glyph_upload() {
+    
+    if (!test_font_is_available()) return;
+    
+    // Rasterize all of latin-1, uploading once vs once per glyph
+    u32 heights[] = { 16, 48, 128 };
+    for (u64 i = 0; i < sizeof(heights)/sizeof(u32); i++) {
+        f64 seconds[2];
+        for (u64 per_glyph = 0; per_glyph < 2; per_glyph++) {
+            Gfx_Font *font = test_load_font(false);
+            
+            f64 start = os_get_elapsed_seconds();
+            for (u32 c = 32; c < 256; c++) {
+                render_atlas_if_not_yet_rendered(font, heights[i], c);
+                if (per_glyph) font_upload_dirty_glyphs();
+            }
+            font_upload_dirty_glyphs();
+            seconds[per_glyph] = os_get_elapsed_seconds()-start;
+            
+            for (u64 j = 0; j < growing_array_get_valid_count(font->atlases); j++) {
+                Gfx_Font_Atlas *page = &font->atlases[j];
+                assert(page->dirty_y0 == page->dirty_y1, "Failed: Glyph page still dirty after upload");
+            }
+            
+            destroy_font(font);
+        }
+        
+        print("\n    latin-1 at %u: %.2f ms batched, %.2f ms uploading per glyph", heights[i], seconds[0]*1000.0, seconds[1]*1000.0);
+    }
+    print("\n");
+}
+
+void test_font_parallel_rasterization() {
+    
+    if (!test_font_is_available()) return;
+    
+    Gfx_Font *serial   = test_load_font(false);
+    Gfx_Font *parallel = test_load_font(false);
+    
+    const u32 height = 128;
+    
+    f64 start = os_get_elapsed_seconds();
+    for (u32 c = 32; c < 256; c++) render_atlas_if_not_yet_rendered(serial, height, c);
+    f64 serial_seconds = os_get_elapsed_seconds()-start;
+    
+    start = os_get_elapsed_seconds();
+    font_rasterize_range(parallel, height, 32, 255);
+    f64 parallel_seconds = os_get_elapsed_seconds()-start;
+    
+    // Same pixels for every glyph
+    for (u32 c = 32; c < 256; c++) {
+        Gfx_Glyph *a = &serial->variations[height].latin1_glyphs[c];
+        Gfx_Glyph *b = &parallel->variations[height].latin1_glyphs[c];
+        assert(a->width == b->width && a->height == b->height, "Failed: Glyph metrics mismatch");
+        if (a->width <= 0 || a->height <= 0) continue;
+        
+        assert(b->atlas_generation != 0, "Failed: Glyph %u was not rasterized", c);
+        
+        u8 *a_pixels = serial->atlases[a->atlas_index].pixels;
+        u8 *b_pixels = parallel->atlases[b->atlas_index].pixels;
+        u32 ax = (u32)(a->uv.x1*FONT_ATLAS_WIDTH), ay = (u32)(a->uv.y1*FONT_ATLAS_HEIGHT);
+        u32 bx = (u32)(b->uv.x1*FONT_ATLAS_WIDTH), by = (u32)(b->uv.y1*FONT_ATLAS_HEIGHT);
+        for (u32 row = 0; row < (u32)a->height; row++) {
+            assert(memcmp(a_pixels+(ay+row)*FONT_ATLAS_WIDTH+ax, b_pixels+(by+row)*FONT_ATLAS_WIDTH+bx, (u64)a->width) == 0, "Failed: Glyph %u pixels mismatch", c);
+        }
+    }
+    
+    // Async prewarm doesn't clobber glyphs that were drawn while it was running
+    Font_Prewarm *prewarm = font_prewarm_async(parallel, 48, 'A', 'Z');
+    Gfx_Font_Atlas *atlas;
+    Gfx_Glyph q = *font_get_glyph(parallel, 48, 'Q', &atlas);
+    wait_font_prewarm(prewarm);
+    Gfx_Glyph *q_after = &parallel->variations[48].latin1_glyphs['Q'];
+    assert(q_after->atlas_index == q.atlas_index && q_after->uv.x1 == q.uv.x1 && q_after->uv.y1 == q.uv.y1, "Failed: Prewarm re-placed a glyph that was already cached");
+    
+    print("latin-1 at %u: %.2f ms serial, %.2f ms on %lld threads ", height, serial_seconds*1000.0, parallel_seconds*1000.0, font_raster_worker_count);
+    
+    destroy_font(serial);
+    destroy_font(parallel);
+}
+
+void test_text_layout_cache() {
+    
+    if (!test_font_is_available()) return;
+    Gfx_Font *font = test_load_font(false);
+    
+    bool enable_before = enable_text_layout_cache;
+    u64 frame_index_before = gfx_frame_index;
+    
+    const u64 number_of_labels = 5000;
+    const u64 number_of_frames = 20;
+    
+    // Cached and uncached should give the same quads and metrics
+    Draw_Frame frames[2];
+    Gfx_Text_Metrics metrics[2];
+    for (u64 cached = 0; cached < 2; cached++) {
+        enable_text_layout_cache = cached;
+        draw_frame_init(&frames[cached]);
+        string label = STR("Pine wood x12\nAVAVA");
+        draw_text_in_frame(font, label, 48, v2(10, 20), v2(.5, .5), COLOR_WHITE, &frames[cached]);
+        draw_text_in_frame(font, label, 48, v2(10, 20), v2(.5, .5), COLOR_WHITE, &frames[cached]);
+        metrics[cached] = measure_text(font, label, 48, v2(.5, .5));
+    }
+    u64 quad_count = growing_array_get_valid_count(frames[0].quad_buffer);
+    assert(quad_count == growing_array_get_valid_count(frames[1].quad_buffer), "Failed: Cached text has a different number of quads");
+    for (u64 i = 0; i < quad_count; i++) {
+        Draw_Quad *a = &frames[0].quad_buffer[i];
+        Draw_Quad *b = &frames[1].quad_buffer[i];
+        assert(memcmp(&a->bottom_left, &b->bottom_left, sizeof(Vector2)*4) == 0, "Failed: Cached text quad %llu is in a different place", i);
+        assert(memcmp(&a->uv, &b->uv, sizeof(Vector4)) == 0 && a->image == b->image, "Failed: Cached text quad %llu has a different glyph", i);
+    }
+    assert(memcmp(&metrics[0], &metrics[1], sizeof(Gfx_Text_Metrics)) == 0, "Failed: Cached text metrics differ");
+    
+    // 5000 labels per frame, like item labels & amounts in a big inventory
+    f64 seconds[2];
+    for (u64 cached = 0; cached < 2; cached++) {
+        enable_text_layout_cache = cached;
+        draw_frame_reset(&frames[cached]);
+        
+        f64 start = os_get_elapsed_seconds();
+        for (u64 f = 0; f < number_of_frames; f++) {
+            draw_frame_reset(&frames[cached]);
+            for (u64 i = 0; i < number_of_labels; i++) {
+                string label = tprint("Item %llu x%llu", i%500, i%7);
+                Gfx_Text_Metrics m = measure_text(font, label, 48, v2(.1, .1));
+                draw_text_in_frame(font, label, 48, v2(-m.functional_size.x/2, (f32)i), v2(.1, .1), COLOR_WHITE, &frames[cached]);
+            }
+            reset_temporary_storage();
+            gfx_frame_index += 1;
+        }
+        seconds[cached] = (os_get_elapsed_seconds()-start)/(f64)number_of_frames;
+    }
+    
+    // Entries that aren't used get evicted
+    u64 count_before = text_layout_cache.count;
+    gfx_frame_index += TEXT_LAYOUT_CACHE_MAX_AGE*2;
+    get_text_layout(font, STR("Still here"), 48, v2(1, 1));
+    assert(text_layout_cache.count < count_before, "Failed: Old text layouts were not evicted");
+    
+    print("%llu labels: %.2f ms per frame uncached, %.2f ms cached ", number_of_labels, seconds[0]*1000.0, seconds[1]*1000.0);
+    
+    enable_text_layout_cache = enable_before;
+    gfx_frame_index = frame_index_before;
+    for (u64 i = 0; i < 2; i++) growing_array_deinit((void**)&frames[i].quad_buffer);
+    destroy_font(font);
+}
+
+bool test_record_glyph_x(Gfx_Glyph glyph, Gfx_Font_Atlas *atlas, float glyph_x, float glyph_y, void *ud) {
+    float *xs = (float*)ud;
+    u64 i = (u64)xs[0];
+    xs[1+i] = glyph_x-glyph.xoffset;
+    xs[0] += 1;
+    return i < 7;
+}
+
+void test_font_kerning() {
+    
+    if (!test_font_is_available()) return;
+    Gfx_Font *font = test_load_font(false);
+    
+    // Table lookups should match what stbtt gives for the same pair
+    for (u32 a = 0; a < 128; a++) {
+        for (u32 b = 0; b < 128; b++) {
+            s32 expected = stbtt_GetCodepointKernAdvance(&font->stbtt_handle, (int)a, (int)b);
+            assert(font_get_kerning(font, a, b) == expected, "Failed: Kerning for ascii pair %u, %u", a, b);
+        }
+    }
+    u32 others[] = { 'A', 'V', 'T', 'o', 0xC5, 0xE9, 0x3A9, 0x416, 0x2014, 0x20AC };
+    for (u32 i = 0; i < sizeof(others)/sizeof(u32); i++) {
+        for (u32 j = 0; j < sizeof(others)/sizeof(u32); j++) {
+            s32 expected = stbtt_GetCodepointKernAdvance(&font->stbtt_handle, (int)others[i], (int)others[j]);
+            // Twice, so the second one comes from the hash
+            assert(font_get_kerning(font, others[i], others[j]) == expected, "Failed: Kerning for pair %u, %u", others[i], others[j]);
+            assert(font_get_kerning(font, others[i], others[j]) == expected, "Failed: Remembered kerning for pair %u, %u", others[i], others[j]);
+        }
+    }
+    assert(font_get_kerning(font, 'A', 'V') != 0, "Failed: Expected 'AV' to be kerned in '%cs'", TEST_FONT_PATH);
+    
+    // The pair's kerning goes between the two glyphs, not after the second one
+    float xs[1+8] = {0};
+    walk_glyphs((Walk_Glyphs_Spec){font, STR("AVo"), 48, v2(1, 1), true, xs}, test_record_glyph_x);
+    Gfx_Font_Variation *variation = &font->variations[48];
+    Gfx_Font_Atlas *atlas;
+    float a_advance = font_get_glyph(font, 48, 'A', &atlas)->advance;
+    float v_advance = font_get_glyph(font, 48, 'V', &atlas)->advance;
+    float av = a_advance + font_get_kerning(font, 'A', 'V')*variation->scale;
+    float vo = v_advance + font_get_kerning(font, 'V', 'o')*variation->scale;
+    assert(xs[0] == 3, "Failed: Expected 3 glyphs, got %f", xs[0]);
+    assert(floats_roughly_match(xs[2]-xs[1], av), "Failed: 'V' is %f after 'A', expected %f", xs[2]-xs[1], av);
+    assert(floats_roughly_match(xs[3]-xs[2], vo), "Failed: 'o' is %f after 'V', expected %f", xs[3]-xs[2], vo);
+    
+    // Long paragraphs, like dialogue or item descriptions
+    string words[] = { STR("The "), STR("AVATAR "), STR("sailed "), STR("toward "), STR("Yavin, "), STR("where "), STR("Tawny "), STR("pirates "), STR("wait. "), STR("Café "), STR("Ωmega "), STR("\n") };
+    u64 word_count = sizeof(words)/sizeof(string);
+    String_Builder sb;
+    string_builder_init(&sb, get_heap_allocator());
+    u64 seed = 1234;
+    while (sb.count < KB(16)) {
+        seed = seed*6364136223846793005ULL + 1442695040888963407ULL;
+        string word = words[(seed >> 33) % word_count];
+        string_builder_append(&sb, word);
+    }
+    string paragraph = string_builder_get_string(sb);
+    
+    // Raw pair lookups, table vs stbtt
+    const u64 lookup_rounds = 10;
+    u32 *codepoints = alloc(get_heap_allocator(), paragraph.count*sizeof(u32));
+    u64 codepoint_count = 0;
+    string it = paragraph;
+    for (u32 c = next_utf8(&it); c != 0; c = next_utf8(&it)) codepoints[codepoint_count++] = c;
+    
+    s64 sums[2] = {0};
+    f64 lookup_seconds[2];
+    f64 start = os_get_elapsed_seconds();
+    for (u64 r = 0; r < lookup_rounds; r++) {
+        for (u64 i = 1; i < codepoint_count; i++) sums[0] += stbtt_GetCodepointKernAdvance(&font->stbtt_handle, codepoints[i-1], codepoints[i]);
+    }
+    lookup_seconds[0] = os_get_elapsed_seconds()-start;
+    start = os_get_elapsed_seconds();
+    for (u64 r = 0; r < lookup_rounds; r++) {
+        for (u64 i = 1; i < codepoint_count; i++) sums[1] += font_get_kerning(font, codepoints[i-1], codepoints[i]);
+    }
+    lookup_seconds[1] = os_get_elapsed_seconds()-start;
+    assert(sums[0] == sums[1], "Failed: Kerning table gave a different sum over the paragraph");
+    
+    // Line wrapping the whole paragraph
+    const u64 wrap_rounds = 20;
+    u64 line_count = 0;
+    start = os_get_elapsed_seconds();
+    for (u64 r = 0; r < wrap_rounds; r++) {
+        string *lines = split_text_to_lines_with_wrapping(paragraph, 600, font, 32, v2(1, 1), true);
+        line_count = growing_array_get_valid_count(lines);
+        reset_temporary_storage();
+    }
+    f64 wrap_seconds = (os_get_elapsed_seconds()-start)/(f64)wrap_rounds;
+    assert(line_count > 1, "Failed: Expected paragraph to wrap");
+    
+    f64 pair_count = (f64)((codepoint_count-1)*lookup_rounds);
+    print("%.1f ns per pair with stbtt, %.1f ns with table. Wrapping %llu bytes into %llu lines: %.2f ms (%.1f MB/s) ",
+        lookup_seconds[0]*1e9/pair_count, lookup_seconds[1]*1e9/pair_count,
+        paragraph.count, line_count, wrap_seconds*1000.0, ((f64)paragraph.count/wrap_seconds)/(1024.0*1024.0));
+    
+    dealloc(get_heap_allocator(), codepoints);
+    string_builder_deinit(&sb);
+    destroy_font(font);
+}
+
+// Bytes of glyph bitmaps in the glyph cache, over all variations
+u64 test_font_glyph_bytes(Gfx_Font *font) {
+    u64 bytes = 0;
+    for (u32 h = 0; h < MAX_FONT_HEIGHT; h++) {
+        Gfx_Font_Variation *variation = &font->variations[h];
+        if (!variation->initted) continue;
+        for (u32 c = 0; c < 256; c++) {
+            Gfx_Glyph *glyph = &variation->latin1_glyphs[c];
+            if (!glyph->atlas_generation) continue;
+            u32 w, ht;
+            font_glyph_bitmap_size(font, glyph, &w, &ht);
+            bytes += (w+FONT_ATLAS_GLYPH_PADDING)*(ht+FONT_ATLAS_GLYPH_PADDING);
+        }
+    }
+    return bytes;
+}
+void test_font_sdf() {
+    
+    if (!test_font_is_available()) return;
+    Gfx_Font *fonts[2];
+    fonts[0] = test_load_font(false);
+    fonts[1] = test_load_font(true);
+    
+    Draw_Frame frame;
+    draw_frame_init(&frame);
+    
+    // The sizes a UI might use
+    u32 heights[] = { 12, 16, 24, 32, 48, 64, 96, 128 };
+    u64 height_count = sizeof(heights)/sizeof(u32);
+    string text = STR("The quick brown fox jumps over the lazy dog. 0123456789 ()[]{}!?");
+    
+    f64 seconds[2];
+    for (u64 i = 0; i < 2; i++) {
+        f64 start = os_get_elapsed_seconds();
+        for (u64 j = 0; j < height_count; j++) {
+            draw_text_in_frame(fonts[i], text, heights[j], v2(0, (f32)j*130), v2(1, 1), COLOR_WHITE, &frame);
+        }
+        seconds[i] = os_get_elapsed_seconds()-start;
+    }
+    
+    // Only the base height is ever rasterized for SDF fonts
+    for (u32 h = 0; h < MAX_FONT_HEIGHT; h++) {
+        assert(fonts[1]->variations[h].initted == (h == FONT_SDF_BASE_HEIGHT), "Failed: SDF font has a variation at height %u", h);
+    }
+    
+    // SDF glyphs are scaled to the same place and size as regular ones, give or take the rounding
+    // of glyph boxes
+    for (u64 j = 0; j < height_count; j++) {
+        Gfx_Text_Metrics a = measure_text(fonts[0], text, heights[j], v2(1, 1));
+        Gfx_Text_Metrics b = measure_text(fonts[1], text, heights[j], v2(1, 1));
+        float tolerance = 2.0 + (float)heights[j]*0.05;
+        assert(fabsf(a.functional_size.x-b.functional_size.x) < tolerance && fabsf(a.functional_size.y-b.functional_size.y) < tolerance,
+            "Failed: SDF text at height %u measures %.2fx%.2f, regular text %.2fx%.2f", heights[j], b.functional_size.x, b.functional_size.y, a.functional_size.x, a.functional_size.y);
+        
+        Gfx_Font_Metrics ma = get_font_metrics(fonts[0], heights[j]);
+        Gfx_Font_Metrics mb = get_font_metrics(fonts[1], heights[j]);
+        assert(fabsf(ma.max_ascent-mb.max_ascent) < 0.01*(float)heights[j], "Failed: SDF font metrics at height %u are off", heights[j]);
+    }
+    
+    // Quads are SDF quads
+    Draw_Frame sdf_frame;
+    draw_frame_init(&sdf_frame);
+    draw_text_in_frame(fonts[1], STR("l"), 200, v2(0, 0), v2(1, 1), COLOR_WHITE, &sdf_frame);
+    assert(growing_array_get_valid_count(sdf_frame.quad_buffer) == 1 && sdf_frame.quad_buffer[0].type == QUAD_TYPE_SDF, "Failed: Expected one SDF quad");
+    
+    // The quad and uv include the padding around the glyph box, so the edge falloff isn't clipped
+    Gfx_Font_Atlas *atlas;
+    Gfx_Glyph *l_glyph = font_get_glyph(fonts[1], FONT_SDF_BASE_HEIGHT, 'l', &atlas);
+    Draw_Quad *l_quad = &sdf_frame.quad_buffer[0];
+    float l_scale = 200.0/(float)FONT_SDF_BASE_HEIGHT;
+    float l_width = (l_glyph->width+FONT_SDF_PADDING*2)*l_scale;
+    float l_height = (l_glyph->height+FONT_SDF_PADDING*2)*l_scale;
+    assert(fabsf((l_quad->top_right.x-l_quad->bottom_left.x)-l_width) < 0.01 && fabsf((l_quad->top_right.y-l_quad->bottom_left.y)-l_height) < 0.01,
+        "Failed: SDF quad is %.2fx%.2f, expected %.2fx%.2f", l_quad->top_right.x-l_quad->bottom_left.x, l_quad->top_right.y-l_quad->bottom_left.y, l_width, l_height);
+    assert(fabsf((l_quad->uv.z-l_quad->uv.x)*FONT_ATLAS_WIDTH-(l_glyph->width+FONT_SDF_PADDING*2)) < 0.01, "Failed: SDF uv does not cover the padding");
+    
+    // Inside of the glyph is above the edge value, the padding around it is below
+    u32 gx = (u32)(l_glyph->uv.x1*FONT_ATLAS_WIDTH)+FONT_SDF_PADDING;
+    u32 gy = (u32)(l_glyph->uv.y1*FONT_ATLAS_HEIGHT)+FONT_SDF_PADDING;
+    u8 inside = atlas->pixels[(gy+(u32)l_glyph->height/2)*FONT_ATLAS_WIDTH + gx+(u32)l_glyph->width/2];
+    u8 outside = atlas->pixels[(gy+(u32)l_glyph->height/2)*FONT_ATLAS_WIDTH + gx-FONT_SDF_PADDING/2];
+    assert(inside > FONT_SDF_ON_EDGE && outside < FONT_SDF_ON_EDGE, "Failed: Unexpected distance field, %u inside and %u outside", inside, outside);
+    
+    u64 bytes[2];
+    u64 pages[2];
+    for (u64 i = 0; i < 2; i++) {
+        bytes[i] = test_font_glyph_bytes(fonts[i]);
+        pages[i] = growing_array_get_valid_count(fonts[i]->atlases);
+    }
+    assert(bytes[1] < bytes[0], "Failed: SDF glyphs should take less room than %llu heights of regular glyphs", height_count);
+    
+    print("%llu heights: %llu KB of glyphs in %llu pages, %.2f ms regular. %llu KB in %llu pages, %.2f ms SDF ",
+        height_count, bytes[0]/1024, pages[0], seconds[0]*1000.0, bytes[1]/1024, pages[1], seconds[1]*1000.0);
+    
+    growing_array_deinit((void**)&frame.quad_buffer);
+    growing_array_deinit((void**)&sdf_frame.quad_buffer);
+    destroy_font(fonts[0]);
+    destroy_font(fonts[1]);
+}
+
+void test_text_wrap() {
+    
+    if (!test_font_is_available()) return;
+    Gfx_Font *font = test_load_font(false);
+    
+    Text_Wrap_Line small[16];
+    Text_Wrap wrap;
+    
+    wrap = text_wrap_begin(font, 32, v2(1, 1), 1000, small, 16);
+    text_wrap_append(&wrap, STR(""));
+    assert(wrap.line_count == 0, "Failed: Empty text should have no lines");
+    
+    string text = STR("a\nb");
+    wrap = text_wrap_begin(font, 32, v2(1, 1), 1000, small, 16);
+    text_wrap_append(&wrap, text);
+    assert(wrap.line_count == 2, "Failed: Expected 2 lines, got %llu", wrap.line_count);
+    assert(strings_match(text_wrap_line_string(text, small[0], false), STR("a")) && strings_match(text_wrap_line_string(text, small[1], false), STR("b")), "Failed: Wrong lines for newline");
+    
+    text = STR("a\n");
+    wrap = text_wrap_begin(font, 32, v2(1, 1), 1000, small, 16);
+    text_wrap_append(&wrap, text);
+    assert(wrap.line_count == 2 && small[1].byte_count == 0, "Failed: Trailing newline should give an empty last line");
+    
+    // A malformed sequence in the middle doesn't stop the wrap, a codepoint cut off at the end
+    // waits for the rest
+    text = STR("a\xC3" "b\nc");
+    wrap = text_wrap_begin(font, 32, v2(1, 1), 1000, small, 16);
+    text_wrap_append(&wrap, text);
+    assert(wrap.line_count == 2, "Failed: Expected 2 lines after a malformed byte, got %llu", wrap.line_count);
+    assert(strings_match(text_wrap_line_string(text, small[1], false), STR("c")), "Failed: Text after a malformed byte was dropped");
+    text = STR("a\xC3\x86");
+    wrap = text_wrap_begin(font, 32, v2(1, 1), 1000, small, 16);
+    text_wrap_append(&wrap, string_view(text, 0, 2));
+    assert(wrap.bytes_done == 1, "Failed: Cut off codepoint should wait for the rest");
+    text_wrap_append(&wrap, text);
+    assert(wrap.bytes_done == 3 && small[0].byte_count == 3, "Failed: Cut off codepoint wasn't completed");
+    
+    // Breaks at the last space that fits
+    wrap = text_wrap_begin(font, 32, v2(1, 1), 1000, small, 16);
+    text_wrap_append(&wrap, STR("aaaa bbbb"));
+    float32 two_words = small[0].width;
+    text = STR("aaaa bbbb cccc");
+    wrap = text_wrap_begin(font, 32, v2(1, 1), two_words+1, small, 16);
+    text_wrap_append(&wrap, text);
+    assert(wrap.line_count == 2, "Failed: Expected 2 wrapped lines, got %llu", wrap.line_count);
+    assert(strings_match(text_wrap_line_string(text, small[0], true), STR("aaaa bbbb")), "Failed: Wrong first wrapped line");
+    assert(strings_match(text_wrap_line_string(text, small[1], true), STR("cccc")), "Failed: Wrong second wrapped line");
+    assert(small[0].width <= two_words+1 && floats_roughly_match(small[0].width, two_words), "Failed: Wrong wrapped line width");
+    
+    // 100KB, like a long chat log
+    string words[] = { STR("Ahoy "), STR("matey, "), STR("the "), STR("treasure "), STR("is "), STR("buried "), STR("under "), STR("the "), STR("palm. "), STR("Ærø "), STR("Ωmega "), STR("\n"), STR("Supercalifragilisticexpialidocious ") };
+    u64 word_count = sizeof(words)/sizeof(string);
+    String_Builder sb;
+    string_builder_init(&sb, get_heap_allocator());
+    u64 seed = 4321;
+    while (sb.count < KB(100)) {
+        seed = seed*6364136223846793005ULL + 1442695040888963407ULL;
+        string_builder_append(&sb, words[(seed >> 33) % word_count]);
+    }
+    string log = string_builder_get_string(sb);
+    const float32 width = 600;
+    
+    // Measure only
+    f64 start = os_get_elapsed_seconds();
+    Text_Wrap measured = text_wrap_begin(font, 32, v2(1, 1), width, 0, 0);
+    text_wrap_append(&measured, log);
+    f64 measure_seconds = os_get_elapsed_seconds()-start;
+    
+    u64 capacity = measured.line_count;
+    Text_Wrap_Line *full_lines = alloc(get_heap_allocator(), capacity*sizeof(Text_Wrap_Line));
+    Text_Wrap_Line *incremental_lines = alloc(get_heap_allocator(), capacity*sizeof(Text_Wrap_Line));
+    
+    start = os_get_elapsed_seconds();
+    Text_Wrap full = text_wrap_begin(font, 32, v2(1, 1), width, full_lines, capacity);
+    bool ok = text_wrap_append(&full, log);
+    f64 full_seconds = os_get_elapsed_seconds()-start;
+    assert(ok, "Failed: Lines should fit in the measured line count");
+    assert(full.line_count == measured.line_count && full.max_line_width == measured.max_line_width, "Failed: Measuring gave different results than wrapping");
+    assert(full.max_line_width <= width, "Failed: Line is wider than the wrap width");
+    
+    // Appending in chunks (also splitting codepoints) gives the same lines as all at once
+    Text_Wrap incremental = text_wrap_begin(font, 32, v2(1, 1), width, incremental_lines, capacity);
+    u64 appended = 0;
+    while (appended < log.count) {
+        seed = seed*6364136223846793005ULL + 1442695040888963407ULL;
+        appended = min(appended + 1 + (seed >> 33) % 2000, log.count);
+        text_wrap_append(&incremental, string_view(log, 0, appended));
+    }
+    assert(incremental.line_count == full.line_count, "Failed: Incremental wrap has %llu lines, expected %llu", incremental.line_count, full.line_count);
+    assert(memcmp(incremental_lines, full_lines, full.line_count*sizeof(Text_Wrap_Line)) == 0, "Failed: Incremental wrap gave different lines");
+    
+    // Running out of room and continuing with a bigger buffer
+    Text_Wrap_Line *grown = alloc(get_heap_allocator(), capacity*sizeof(Text_Wrap_Line));
+    Text_Wrap partial = text_wrap_begin(font, 32, v2(1, 1), width, grown, 16);
+    assert(!text_wrap_append(&partial, log), "Failed: Expected to run out of lines");
+    assert(partial.line_count == 16, "Failed: Expected a full buffer");
+    partial.line_capacity = capacity;
+    assert(text_wrap_append(&partial, log), "Failed: Expected lines to fit after growing");
+    assert(memcmp(grown, full_lines, full.line_count*sizeof(Text_Wrap_Line)) == 0, "Failed: Continued wrap gave different lines");
+    
+    // split_text_to_lines_with_wrapping is built on the same thing
+    string *split = split_text_to_lines_with_wrapping(log, width, font, 32, v2(1, 1), true);
+    assert(growing_array_get_valid_count(split) == full.line_count, "Failed: split_text_to_lines_with_wrapping gave a different number of lines");
+    for (u64 i = 0; i < full.line_count; i++) {
+        assert(strings_match(split[i], text_wrap_line_string(log, full_lines[i], true)), "Failed: split_text_to_lines_with_wrapping line %llu differs", i);
+    }
+    reset_temporary_storage();
+    
+    // A log that grows by 1KB per frame, rewrapped from scratch vs appended to
+    const u64 frames = 100;
+    const u64 bytes_per_frame = log.count/frames;
+    start = os_get_elapsed_seconds();
+    for (u64 f = 1; f <= frames; f++) {
+        Text_Wrap w = text_wrap_begin(font, 32, v2(1, 1), width, full_lines, capacity);
+        text_wrap_append(&w, string_view(log, 0, f*bytes_per_frame));
+    }
+    f64 rewrap_seconds = os_get_elapsed_seconds()-start;
+    start = os_get_elapsed_seconds();
+    incremental = text_wrap_begin(font, 32, v2(1, 1), width, incremental_lines, capacity);
+    for (u64 f = 1; f <= frames; f++) {
+        text_wrap_append(&incremental, string_view(log, 0, f*bytes_per_frame));
+    }
+    f64 append_seconds = os_get_elapsed_seconds()-start;
+    
+    print("%llu KB into %llu lines: %.2f ms wrapping, %.2f ms measuring. Growing over %llu frames: %.2f ms rewrapping, %.2f ms appending ",
+        log.count/1024, full.line_count, full_seconds*1000.0, measure_seconds*1000.0, frames, rewrap_seconds*1000.0, append_seconds*1000.0);
+    
+    dealloc(get_heap_allocator(), full_lines);
+    dealloc(get_heap_allocator(), incremental_lines);
+    dealloc(get_heap_allocator(), grown);
+    string_builder_deinit(&sb);
+    destroy_font(font);
+}
+
+#if OOGABOOGA_ENABLE_EXTENSIONS && OOGABOOGA_EXTENSION_PARTICLES
+void test_particles_simulation() {
+    
+    // Particles move like they should and die when they should
+    Emission_Config config = ZERO(Emission_Config);
+    config.simulate = true;
+    config.seed = 1234;
+    config.number_of_particles = 1000;
+    config.emissions_per_second = 1000;
+    config.life_time.mode = EMISSION_PROPERTY_MODE_RANDOM;
+    config.life_time.min_f32 = 0.5;
+    config.life_time.max_f32 = 1.0;
+    config.velocity.mode = EMISSION_PROPERTY_MODE_RANDOM;
+    config.velocity.min_v2 = v2(-100, -100);
+    config.velocity.max_v2 = v2(100, 100);
+    config.size.flat_v2 = v2(4, 4);
+    config.color.flat_v4 = COLOR_WHITE;
+    
+    Emission_Handle h = emit_particles(config, v2(10, 20));
+    Emission_Instance *e = &emissions[h.index];
+    
+    const float32 dt = 1.0/60.0;
+    u64 max_count = 0;
+    for (u64 frame = 0; frame < 30; frame++) {
+        particles_update_simulated(e, dt);
+        max_count = max(max_count, e->particles.count);
+    }
+    Particle_Buffer *b = &e->particles;
+    assert(b->emitted >= 499 && b->emitted <= 502, "Failed: Emitted %llu particles in half a second at 1000 per second", b->emitted);
+    for (u64 i = 0; i < b->count; i++) {
+        float32 expected_x = 10 + b->velocity_x[i]*b->age[i];
+        float32 expected_y = 20 + b->velocity_y[i]*b->age[i];
+        assert(fabsf(b->position_x[i]-expected_x) < 0.01 && fabsf(b->position_y[i]-expected_y) < 0.01, "Failed: Particle %llu is in the wrong place", i);
+    }
+    
+    // Ages go down since particles are kept in emission order
+    u64 emitted_in_first_half_second = b->emitted;
+    for (u64 frame = 0; frame < 60; frame++) {
+        particles_update_simulated(e, dt);
+        for (u64 i = 0; i < b->count; i++) {
+            assert(b->age[i] <= b->life_time[i], "Failed: Dead particle %llu was not removed", i);
+            assert(i == 0 || b->age[i] <= b->age[i-1]+0.0001, "Failed: Particles were reordered");
+        }
+    }
+    // A frame after 1.5s, everything emitted in the first half second is past its max life time of 1s
+    particles_update_simulated(e, dt);
+    assert(b->count < max_count, "Failed: Expected particles to die");
+    assert(b->count <= b->emitted-emitted_in_first_half_second, "Failed: %llu particles alive, but only %llu were emitted in the last second", b->count, b->emitted-emitted_in_first_half_second);
+    
+    // Non-persisting emissions are released when everything died
+    for (u64 frame = 0; frame < 120 && e->allocated; frame++) particles_update_simulated(e, dt);
+    assert(!e->allocated && b->capacity == 0, "Failed: Finished emission was not released");
+    
+    // 1M live particles, simulated vs recomputed every frame
+    const u64 particle_count = 1000000;
+    const u64 frames = 10;
+    config.number_of_particles = particle_count;
+    config.emissions_per_second = particle_count;
+    config.life_time.mode = EMISSION_PROPERTY_MODE_FLAT;
+    config.life_time.flat_f32 = 100;
+    config.acceleration.flat_v2 = v2(0, -10);
+    config.persist = true;
+    
+    h = emit_particles(config, v2(0, 0));
+    e = &emissions[h.index];
+    particles_update_simulated(e, 1.0);
+    assert(e->particles.count == particle_count, "Failed: Expected %llu live particles, got %llu", particle_count, e->particles.count);
+    
+    f64 start = os_get_elapsed_seconds();
+    for (u64 frame = 0; frame < frames; frame++) particles_update_simulated(e, dt);
+    f64 simulated_seconds = (os_get_elapsed_seconds()-start)/(f64)frames;
+    assert(e->particles.count == particle_count, "Failed: Particles died early");
+    
+    float32 emission_interval = 1.0/(float32)particle_count;
+    float32 last_emit_duration = (float32)particle_count*emission_interval;
+    start = os_get_elapsed_seconds();
+    for (u64 frame = 0; frame < frames; frame++) {
+        for (u64 j = 0; j < particle_count; j++) {
+            Particle p;
+            particle_compute(e, j, 1.5, emission_interval, last_emit_duration, &p);
+        }
+    }
+    f64 recomputed_seconds = (os_get_elapsed_seconds()-start)/(f64)frames;
+    
+    print("%llu particles: %.2f ms per frame recomputed, %.2f ms simulated ", particle_count, recomputed_seconds*1000.0, simulated_seconds*1000.0);
+    
+    emission_release(h);
+}
+
+void test_particles_threading() {
+    
+    // Two big simulated emissions and one recomputed, so there are plenty of jobs of both kinds
+    Emission_Config config = ZERO(Emission_Config);
+    config.simulate = true;
+    config.persist = true;
+    config.seed = 4321;
+    config.number_of_particles = 200000;
+    config.emissions_per_second = 200000;
+    config.life_time.flat_f32 = 100;
+    config.velocity.mode = EMISSION_PROPERTY_MODE_RANDOM;
+    config.velocity.min_v2 = v2(-100, -100);
+    config.velocity.max_v2 = v2(100, 100);
+    config.acceleration.flat_v2 = v2(0, -10);
+    config.size.flat_v2 = v2(4, 4);
+    config.color.mode = EMISSION_PROPERTY_MODE_INTERPOLATE;
+    config.color.min_v4 = COLOR_WHITE;
+    config.color.max_v4 = COLOR_RED;
+    config.kind_pool[0] = PARTICLE_KIND_RECTANGLE;
+    config.kind_pool[1] = PARTICLE_KIND_CIRCLE;
+    config.number_of_kinds = 2;
+    
+    Emission_Handle a = emit_particles(config, v2(0, 0));
+    config.seed = 8765;
+    Emission_Handle b = emit_particles(config, v2(50, 50));
+    config.simulate = false;
+    config.number_of_particles = 5000;
+    config.emissions_per_second = 5000;
+    Emission_Handle c = emit_particles(config, v2(-50, 0));
+    float32 now = emissions[c.index].start_time + 0.5;
+    
+    Draw_Frame frames[2];
+    f64 update_seconds[2];
+    f64 draw_seconds[2];
+    for (u64 threaded = 0; threaded < 2; threaded++) {
+        particles_multithreaded = threaded;
+        emission_reset(a);
+        emission_reset(b);
+        
+        // Big first step to emit everything
+        particles_update(1.0);
+        
+        f64 start = os_get_elapsed_seconds();
+        for (u64 frame = 0; frame < 10; frame++) particles_update(1.0/60.0);
+        update_seconds[threaded] = (os_get_elapsed_seconds()-start)/10.0;
+        
+        draw_frame_init(&frames[threaded]);
+        draw_frame_reset(&frames[threaded]);
+        frames[threaded].projection = m4_make_orthographic_projection(-1000, 1000, -1000, 1000, -1, 10);
+        start = os_get_elapsed_seconds();
+        particles_draw_in_frame(&frames[threaded], now);
+        draw_seconds[threaded] = os_get_elapsed_seconds()-start;
+    }
+    particles_multithreaded = true;
+    
+    assert(emissions[a.index].particles.count == 200000 && emissions[b.index].particles.count == 200000, "Failed: Expected all simulated particles to be alive");
+    
+    u64 count = growing_array_get_valid_count(frames[0].quad_buffer);
+    assert(count > 400000, "Failed: Expected all particles to be drawn, got %llu quads", count);
+    assert(count == growing_array_get_valid_count(frames[1].quad_buffer), "Failed: Threaded draw made %llu quads, single threaded made %llu", growing_array_get_valid_count(frames[1].quad_buffer), count);
+    assert(memcmp(frames[0].quad_buffer, frames[1].quad_buffer, count*sizeof(Draw_Quad)) == 0, "Failed: Threaded draw came out different from single threaded");
+    
+    print("%llu quads: update %.2f ms single threaded, %.2f ms threaded. Draw %.2f ms single threaded, %.2f ms threaded ",
+        count, update_seconds[0]*1000.0, update_seconds[1]*1000.0, draw_seconds[0]*1000.0, draw_seconds[1]*1000.0);
+    
+    growing_array_deinit((void**)&frames[0].quad_buffer);
+    growing_array_deinit((void**)&frames[1].quad_buffer);
+    emission_release(a);
+    emission_release(b);
+    emission_release(c);
+}
+#endif
+#endif /* OOGABOOGA_HEADLESS */
+
+// Memory source with a sine wave of 'amplitude', or a constant if frequency is 0
+Audio_Source test_make_audio_source(Audio_Format format, u64 number_of_frames, float32 frequency, float32 amplitude) {
+    Audio_Source src = ZERO(Audio_Source);
+    src.kind = AUDIO_SOURCE_MEMORY;
+    src.format = format;
+    src.number_of_frames = number_of_frames;
+    src.uid = next_audio_source_uid++;
+    src.allocator = get_heap_allocator();
+    
+    u64 comp_size = get_audio_bit_width_byte_size(format.bit_width);
+    src.pcm_frames = alloc(get_heap_allocator(), number_of_frames*format.channels*comp_size);
+    for (u64 f = 0; f < number_of_frames; f++) {
+        float32 s = amplitude;
+        if (frequency > 0) s = amplitude*sinf(2.0f*PI32*frequency*(float32)f/(float32)format.sample_rate);
+        for (u64 c = 0; c < format.channels; c++) {
+            if (format.bit_width == AUDIO_BITS_32) ((float32*)src.pcm_frames)[f*format.channels+c] = s;
+            else ((s16*)src.pcm_frames)[f*format.channels+c] = (s16)(s*32767.0f);
+        }
+    }
+    return src;
+}
+
+// Mixes players the same way do_program_audio_sample does, but without touching the global players
+void test_mix_audio_players(Audio_Player *players, u64 count, Audio_Format out_format, u64 frames, void *output) {
+    local_persist Audio_Planar_Buffer bus = {0};
+    audio_planar_buffer_reserve(&bus, out_format.channels, frames);
+    audio_planar_buffer_clear(&bus);
+    for (u64 i = 0; i < count; i++) {
+        if (players[i].voice.state != AUDIO_PLAYER_STATE_PLAYING && players[i].voice.fade_frames == 0) continue;
+        audio_player_mix(&players[i], out_format, &bus);
+    }
+    audio_planar_to_frames(output, out_format, &bus);
+}
+
+void test_audio_player_init(Audio_Player *p, Audio_Source src) {
+    *p = ZERO(Audio_Player);
+    p->allocated = true;
+    p->config.volume = 1.0;
+    p->config.playback_speed = 1.0;
+    // Not in the player pool, so the voice is set up directly instead of through commands
+    p->source = src;
+    p->has_source = true;
+    p->state = AUDIO_PLAYER_STATE_PLAYING;
+    p->looping = true;
+    audio_voice_set_source(&p->voice, src, 0);
+    p->voice.state = AUDIO_PLAYER_STATE_PLAYING;
+    p->voice.looping = true;
+}
+
+void test_audio_mixer() {
+    Audio_Format f32_stereo = { AUDIO_BITS_32, 2, 48000 };
+    Audio_Format s16_stereo = { AUDIO_BITS_16, 2, 48000 };
+    Audio_Format s16_mono   = { AUDIO_BITS_16, 1, 48000 };
+    const u64 frames = 480; // 10ms
+    
+    float32 *out_f32 = alloc(get_heap_allocator(), frames*2*sizeof(float32));
+    s16 *out_s16 = alloc(get_heap_allocator(), frames*2*sizeof(s16));
+    
+    Audio_Source sine_f32 = test_make_audio_source(f32_stereo, 48000, 440, 0.8);
+    Audio_Source sine_s16 = test_make_audio_source(s16_stereo, 48000, 440, 0.8);
+    Audio_Source sine_mono = test_make_audio_source(s16_mono, 48000, 440, 0.8);
+    Audio_Source dc = test_make_audio_source(f32_stereo, 48000, 0, 0.9);
+    
+    Audio_Player p;
+    
+    // Volume is applied, frames advance
+    test_audio_player_init(&p, sine_f32);
+    p.config.volume = 0.5;
+    test_mix_audio_players(&p, 1, f32_stereo, frames, out_f32);
+    assert(p.voice.frame_index == frames, "Failed: Expected frame index %llu, got %llu", frames, p.voice.frame_index);
+    for (u64 i = 0; i < frames*2; i++) {
+        float32 expected = 0.5f*((float32*)sine_f32.pcm_frames)[i];
+        assert(fabsf(out_f32[i]-expected) < 0.00001, "Failed: Sample %llu is %f, expected %f", i, out_f32[i], expected);
+    }
+    
+    // s16 source into f32 output, and mono to both channels
+    test_audio_player_init(&p, sine_s16);
+    test_mix_audio_players(&p, 1, f32_stereo, frames, out_f32);
+    for (u64 i = 0; i < frames*2; i++) {
+        float32 expected = (float32)((s16*)sine_s16.pcm_frames)[i]/32768.0f;
+        assert(fabsf(out_f32[i]-expected) < 0.0001, "Failed: s16 sample %llu is %f, expected %f", i, out_f32[i], expected);
+    }
+    test_audio_player_init(&p, sine_mono);
+    test_mix_audio_players(&p, 1, f32_stereo, frames, out_f32);
+    for (u64 f = 0; f < frames; f++) {
+        float32 expected = (float32)((s16*)sine_mono.pcm_frames)[f]/32768.0f;
+        assert(out_f32[f*2] == out_f32[f*2+1] && fabsf(out_f32[f*2]-expected) < 0.0001, "Failed: Mono frame %llu was not spread to both channels", f);
+    }
+    
+    // Two loud voices saturate instead of wrapping around in s16
+    Audio_Player loud[2];
+    test_audio_player_init(&loud[0], dc);
+    test_audio_player_init(&loud[1], dc);
+    test_mix_audio_players(loud, 2, s16_stereo, frames, out_s16);
+    for (u64 i = 0; i < frames*2; i++) assert(out_s16[i] == S16_MAX, "Failed: Expected saturated sample, got %d", out_s16[i]);
+    
+    // Faded in from silence, and continues at full volume when the fade is done
+    test_audio_player_init(&p, dc);
+    p.voice.state = AUDIO_PLAYER_STATE_PAUSED;
+    audio_voice_set_state(&p.voice, AUDIO_PLAYER_STATE_PLAYING);
+    assert(p.voice.fade_frames > frames, "Failed: Expected a fade longer than one buffer");
+    test_mix_audio_players(&p, 1, f32_stereo, frames, out_f32);
+    assert(out_f32[0] < 0.01 && out_f32[0] < out_f32[(frames-1)*2], "Failed: Expected fade in");
+    while (p.voice.fade_frames > 0) test_mix_audio_players(&p, 1, f32_stereo, frames, out_f32);
+    test_mix_audio_players(&p, 1, f32_stereo, frames, out_f32);
+    assert(fabsf(out_f32[0]-0.9f) < 0.0001, "Failed: Expected full volume after fade in, got %f", out_f32[0]);
+    
+    // 256 voices: stereo f32 and s16, some mono, some spacialized and some pitched so they need resampling
+    const u64 voice_count = 256;
+    const u64 buffers = 200;
+    Audio_Player *voices = alloc(get_heap_allocator(), voice_count*sizeof(Audio_Player));
+    for (u64 i = 0; i < voice_count; i++) {
+        Audio_Source src = (i % 4 == 0) ? sine_mono : ((i % 2) ? sine_f32 : sine_s16);
+        test_audio_player_init(&voices[i], src);
+        voices[i].voice.frame_index = (i*97) % src.number_of_frames;
+        voices[i].config.volume = 1.0/(float32)voice_count;
+        if (i % 3 == 0) {
+            voices[i].config.enable_spacialization = true;
+            voices[i].config.position_ndc = v3((float32)(i % 7)/3.0f-1.0f, 0, 0);
+        }
+        if (i % 8 == 0) voices[i].config.playback_speed = 1.25;
+    }
+    
+    f64 start = os_get_elapsed_seconds();
+    for (u64 b = 0; b < buffers; b++) test_mix_audio_players(voices, voice_count, f32_stereo, frames, out_f32);
+    f64 fused_seconds = (os_get_elapsed_seconds()-start)/(f64)buffers;
+    
+    // Same voices through the separate passes the mixer used to do
+    float32 *voice_buffer = alloc(get_heap_allocator(), frames*2*sizeof(float32)*4);
+    start = os_get_elapsed_seconds();
+    for (u64 b = 0; b < buffers; b++) {
+        memset(out_f32, 0, frames*2*sizeof(float32));
+        for (u64 i = 0; i < voice_count; i++) {
+            Audio_Player *v = &voices[i];
+            Audio_Format sample_format = v->voice.source.format;
+            sample_format.sample_rate = (int)(sample_format.sample_rate*v->config.playback_speed);
+            u64 sample_frames = (u64)round((f64)frames*(f64)sample_format.sample_rate/(f64)f32_stereo.sample_rate);
+            void *raw = talloc(sample_frames*4*2);
+            v->voice.frame_index = audio_source_sample_next_frames(&v->voice.source, v->voice.frame_index, sample_frames, raw, true);
+            convert_frames(voice_buffer, f32_stereo, raw, sample_format, frames);
+            if (v->config.enable_spacialization) apply_audio_spacialization(voice_buffer, f32_stereo, frames, v->config.position_ndc);
+            apply_audio_volume(voice_buffer, f32_stereo, frames, v->config.volume);
+            mix_frames(out_f32, voice_buffer, frames, f32_stereo);
+        }
+        reset_temporary_storage();
+    }
+    f64 separate_seconds = (os_get_elapsed_seconds()-start)/(f64)buffers;
+    
+    f64 budget = (f64)frames/(f64)f32_stereo.sample_rate;
+    print("%llu voices, %llu frame buffers: %.3f ms fused (%.1f%% of real time), %.3f ms in separate passes ",
+        voice_count, frames, fused_seconds*1000.0, fused_seconds/budget*100.0, separate_seconds*1000.0);
+    
+    dealloc(get_heap_allocator(), voices);
+    dealloc(get_heap_allocator(), voice_buffer);
+    dealloc(get_heap_allocator(), out_f32);
+    dealloc(get_heap_allocator(), out_s16);
+    audio_source_destroy(&sine_f32);
+    audio_source_destroy(&sine_s16);
+    audio_source_destroy(&sine_mono);
+    audio_source_destroy(&dc);
+}
+
+// Streams a sine at in_rate through a resampler, with pitch moving between pitch_min and
+// pitch_max from block to block. Returns the SNR in dB against the exact signal at the
+// positions the resampler was asked for. Output of the first channel goes to 'output' if set.
+f64 test_resampler_snr(Audio_Resample_Quality quality, f64 frequency, f64 in_rate, f64 out_rate, 
+                       f64 pitch_min, f64 pitch_max, u64 block, u64 blocks, float32 *output) {
+    Audio_Resampler r;
+    audio_resampler_reset(&r, 2);
+    Audio_Planar_Buffer in = ZERO(Audio_Planar_Buffer);
+    Audio_Planar_Buffer out = ZERO(Audio_Planar_Buffer);
+    
+    u64 next_input_frame = 0;
+    f64 position = 0;
+    f64 signal = 0;
+    f64 noise = 0;
+    for (u64 b = 0; b < blocks; b++) {
+        f64 pitch = pitch_min + (pitch_max-pitch_min)*(0.5+0.5*sin((f64)b*0.1));
+        f64 ratio = in_rate*pitch/out_rate;
+        
+        u64 needed = audio_resampler_frames_needed(&r, quality, ratio, block);
+        audio_planar_buffer_reserve(&in, 2, max(needed, 1));
+        in.frame_count = needed;
+        for (u64 i = 0; i < needed; i++) {
+            float32 s = (float32)sin(2.0*PI64*frequency*(f64)(next_input_frame+i)/in_rate);
+            audio_planar_channel(&in, 0)[i] = s;
+            audio_planar_channel(&in, 1)[i] = -s;
+        }
+        next_input_frame += needed;
+        
+        audio_planar_buffer_reserve(&out, 2, block);
+        audio_resampler_process(&r, quality, ratio, &in, &out);
+        
+        f64 step = (f64)audio_resampler_step(ratio)/4294967296.0;
+        for (u64 f = 0; f < block; f++) {
+            f64 expected = sin(2.0*PI64*frequency*position/in_rate);
+            f64 left = audio_planar_channel(&out, 0)[f];
+            assert(audio_planar_channel(&out, 1)[f] == -left, "Resampled channels differ");
+            if (output) output[b*block+f] = (float32)left;
+            // Skip the start where the kernel reads the zeroed history
+            if (b > 2) {
+                signal += expected*expected;
+                noise += (left-expected)*(left-expected);
+            }
+            position += step;
+        }
+    }
+    
+    audio_planar_buffer_destroy(&in);
+    audio_planar_buffer_destroy(&out);
+    
+    return 10.0*log10(signal/max(noise, 1e-30));
+}
+
+void test_audio_resampler() {
+    const char *names[] = { "linear", "sinc" };
+    
+    // 44.1k to 48k
+    f64 linear_1k  = test_resampler_snr(AUDIO_RESAMPLE_LINEAR, 1000,  44100, 48000, 1, 1, 480, 100, 0);
+    f64 linear_10k = test_resampler_snr(AUDIO_RESAMPLE_LINEAR, 10000, 44100, 48000, 1, 1, 480, 100, 0);
+    f64 sinc_1k    = test_resampler_snr(AUDIO_RESAMPLE_SINC,   1000,  44100, 48000, 1, 1, 480, 100, 0);
+    f64 sinc_10k   = test_resampler_snr(AUDIO_RESAMPLE_SINC,   10000, 44100, 48000, 1, 1, 480, 100, 0);
+    assert(linear_1k > 50, "Linear 44.1k->48k SNR at 1kHz is %.1f dB", linear_1k);
+    assert(sinc_1k > 80,   "Sinc 44.1k->48k SNR at 1kHz is %.1f dB", sinc_1k);
+    assert(sinc_10k > 80,  "Sinc 44.1k->48k SNR at 10kHz is %.1f dB", sinc_10k);
+    assert(sinc_10k > linear_10k+40, "Sinc should be far better than linear at 10kHz (%.1f vs %.1f dB)", sinc_10k, linear_10k);
+    
+    // Pitch changing every block, between half and double speed
+    f64 linear_pitch = test_resampler_snr(AUDIO_RESAMPLE_LINEAR, 500, 48000, 48000, 0.5, 2.0, 480, 100, 0);
+    f64 sinc_pitch   = test_resampler_snr(AUDIO_RESAMPLE_SINC,   500, 48000, 48000, 0.5, 2.0, 480, 100, 0);
+    assert(linear_pitch > 60, "Linear varying pitch SNR is %.1f dB", linear_pitch);
+    assert(sinc_pitch > 80,   "Sinc varying pitch SNR is %.1f dB", sinc_pitch);
+    
+    // Streaming: the output doesn't depend on how it's split into blocks
+    const u64 total_frames = 480*60;
+    float32 *one_block = alloc(get_heap_allocator(), total_frames*sizeof(float32));
+    float32 *blocks    = alloc(get_heap_allocator(), total_frames*sizeof(float32));
+    for (int q = 0; q < 2; q++) {
+        test_resampler_snr((Audio_Resample_Quality)q, 1000, 44100, 48000, 1, 1, total_frames, 1, one_block);
+        test_resampler_snr((Audio_Resample_Quality)q, 1000, 44100, 48000, 1, 1, 480, 60, blocks);
+        assert(memcmp(one_block, blocks, total_frames*sizeof(float32)) == 0, "%cs resampler output depends on block size", names[q]);
+        test_resampler_snr((Audio_Resample_Quality)q, 1000, 44100, 48000, 1, 1, 37, total_frames/37, blocks);
+        assert(memcmp(one_block, blocks, (total_frames/37)*37*sizeof(float32)) == 0, "%cs resampler output depends on block size", names[q]);
+    }
+    dealloc(get_heap_allocator(), one_block);
+    dealloc(get_heap_allocator(), blocks);
+    
+    // Players keep a constant signal constant while playback_speed changes between buffers
+    Audio_Format f32_stereo = { AUDIO_BITS_32, 2, 48000 };
+    Audio_Source dc = test_make_audio_source(f32_stereo, 48000, 0, 0.5);
+    float32 *out = alloc(get_heap_allocator(), 480*2*sizeof(float32));
+    for (int q = 0; q < 2; q++) {
+        Audio_Player p;
+        test_audio_player_init(&p, dc);
+        p.voice.state = AUDIO_PLAYER_STATE_PLAYING;
+        p.config.resample_quality = (Audio_Resample_Quality)q;
+        const float32 speeds[] = { 1.0f, 1.3f, 0.7f, 1.0f, 2.5f, 0.45f };
+        for (u64 b = 0; b < 24; b++) {
+            p.config.playback_speed = speeds[b%6];
+            test_mix_audio_players(&p, 1, f32_stereo, 480, out);
+            if (b < 2) continue;
+            for (u64 i = 0; i < 480*2; i++) {
+                assert(fabsf(out[i]-0.5f) < 0.0001f, "%cs resampler discontinuity at buffer %llu frame %llu: %f", names[q], b, i/2, out[i]);
+            }
+        }
+    }
+    dealloc(get_heap_allocator(), out);
+    audio_source_destroy(&dc);
+    
+    // Cost per voice for 10ms stereo buffers, 44.1k to 48k
+    const u64 buffers = 2000;
+    Audio_Planar_Buffer in = ZERO(Audio_Planar_Buffer);
+    Audio_Planar_Buffer resampled = ZERO(Audio_Planar_Buffer);
+    f64 seconds[2];
+    for (int q = 0; q < 2; q++) {
+        Audio_Resampler r;
+        audio_resampler_reset(&r, 2);
+        f64 ratio = 44100.0/48000.0;
+        f64 start = os_get_elapsed_seconds();
+        for (u64 b = 0; b < buffers; b++) {
+            u64 needed = audio_resampler_frames_needed(&r, (Audio_Resample_Quality)q, ratio, 480);
+            audio_planar_buffer_reserve(&in, 2, max(needed, 1));
+            audio_planar_buffer_clear(&in);
+            in.frame_count = needed;
+            audio_planar_buffer_reserve(&resampled, 2, 480);
+            audio_resampler_process(&r, (Audio_Resample_Quality)q, ratio, &in, &resampled);
+        }
+        seconds[q] = (os_get_elapsed_seconds()-start)/(f64)buffers;
+    }
+    audio_planar_buffer_destroy(&in);
+    audio_planar_buffer_destroy(&resampled);
+    
+    print("44.1k->48k SNR at 1k/10kHz: linear %.1f/%.1f dB, sinc %.1f/%.1f dB. Varying pitch: linear %.1f dB, sinc %.1f dB. Per voice per 10ms: linear %.2f us, sinc %.2f us ",
+        linear_1k, linear_10k, sinc_1k, sinc_10k, linear_pitch, sinc_pitch, seconds[0]*1000000.0, seconds[1]*1000000.0);
+}
+
+// Reads through a streamed source until all frames are there, waiting for the decode thread
+u64 test_stream_read_all(Audio_Source *src, u64 first_frame, u64 number_of_frames, void *output, bool looping) {
+    u64 frame_size = get_audio_bit_width_byte_size(src->format.bit_width)*src->format.channels;
+    u64 position = first_frame;
+    u64 got = 0;
+    f64 start = os_get_elapsed_seconds();
+    while (got < number_of_frames) {
+        u64 new_position = audio_source_sample_next_frames(src, position, number_of_frames-got, (u8*)output + got*frame_size, looping);
+        u64 advanced = (new_position + src->number_of_frames - position) % src->number_of_frames;
+        if (new_position == src->number_of_frames) advanced = src->number_of_frames - position;
+        if (advanced == 0) {
+            assert(os_get_elapsed_seconds()-start < 5.0, "Timed out waiting for stream decode");
+            os_sleep(1);
+        }
+        got += advanced;
+        position = new_position;
+    }
+    return position;
+}
+
+// Writes a short s16 sine clip, in another format than the output so the bank has to convert it
+void test_write_sound_bank_clip(string path, u64 sample_rate, u64 frames, float32 hz) {
+    u64 data_size = frames*sizeof(s16);
+    string wav = alloc_string(get_heap_allocator(), AUDIO_WAV_HEADER_SIZE+data_size);
+    Audio_Format mono_s16 = { AUDIO_BITS_16, 1, (int)sample_rate };
+    audio_write_wav_header(wav.data, mono_s16, data_size);
+    s16 *samples = (s16*)(wav.data+AUDIO_WAV_HEADER_SIZE);
+    for (u64 i = 0; i < frames; i++) {
+        samples[i] = (s16)(sin(2.0*PI64*hz*(f64)i/(f64)sample_rate)*16000.0);
+    }
+    bool ok = os_write_entire_file_s(path, wav);
+    assert(ok, "Could not write %s", path);
+    dealloc_string(get_heap_allocator(), wav);
+}
+
+// An empty stream must not keep the decode thread busy
+void test_audio_stream_empty() {
+    string path = STR("oogabooga_test_empty_stream.wav");
+    test_write_sound_bank_clip(path, 48000, 0, 0);
+    Audio_Source src;
+    bool ok = audio_open_source_stream(&src, path, get_heap_allocator());
+    assert(ok, "Could not open empty stream");
+    assert(src.stream && src.number_of_frames == 0, "Expected an empty decode-ahead stream");
+    
+    mutex_acquire_or_wait(&audio_streams_mutex);
+    src.stream->cursors[0].seek_frame = 0;
+    MEMORY_BARRIER;
+    src.stream->cursors[0].seek_generation = 1;
+    audio_stream_decode_some(src.stream); // Getting the cursor ready is work
+    bool did_work = audio_stream_decode_some(src.stream);
+    mutex_release(&audio_streams_mutex);
+    assert(!did_work, "Decoding an empty stream counted as work, the decode thread would never sleep");
+    
+    audio_source_destroy(&src);
+    os_file_delete(path);
+}
+
+void test_audio_stream() {
+    test_audio_stream_empty();
+    
+    string path = STR("oogabooga/examples/song.ogg");
+    File probe = os_file_open(path, O_READ);
+    if (probe == OS_INVALID_FILE) {
+        print("(skipped, no %s) ", path);
+        return;
+    }
+    os_file_close(probe);
+    
+    // Native format, so there's no conversion and decoded frames can be compared exactly
+    Audio_Source src;
+    bool ok = audio_open_source_stream(&src, path, get_heap_allocator());
+    assert(ok, "Could not open stream");
+    Audio_Format native = { AUDIO_BITS_32, src.ogg->channels, src.ogg->sample_rate };
+    audio_source_destroy(&src);
+    ok = audio_open_source_stream_format(&src, path, native, get_heap_allocator());
+    assert(ok, "Could not open stream");
+    assert(src.stream, "File stream has no decode-ahead stream");
+    
+    Audio_Stream_Cursor reference = ZERO(Audio_Stream_Cursor);
+    ok = audio_stream_open_decoder(src.stream, &reference);
+    assert(ok, "Could not open reference decoder");
+    reference.decoder_open = true;
+    
+    u64 frame_size = sizeof(float32)*native.channels;
+    const u64 n = 4800;
+    float32 *streamed = alloc(get_heap_allocator(), n*frame_size);
+    float32 *expected = alloc(get_heap_allocator(), n*frame_size);
+    
+    // Sequential reads in mixer sized pieces
+    u64 position = 0;
+    for (u64 i = 0; i < 10; i++) {
+        position = test_stream_read_all(&src, position, 480, (u8*)streamed + i*480*frame_size, false);
+    }
+    assert(position == n, "Stream position is %llu, expected %llu", position, n);
+    audio_source_get_frames(&reference.decoder, 0, n, expected);
+    assert(memcmp(streamed, expected, n*frame_size) == 0, "Streamed frames differ from decoding directly");
+    
+    // Seek
+    test_stream_read_all(&src, 100000, n, streamed, false);
+    audio_source_get_frames(&reference.decoder, 100000, n, expected);
+    assert(memcmp(streamed, expected, n*frame_size) == 0, "Streamed frames differ after seeking");
+    
+    // Two readers on one source get their own cursors
+    u64 a = 200000, b = 20000;
+    float32 *streamed_b = alloc(get_heap_allocator(), n*frame_size);
+    for (u64 i = 0; i < 10; i++) {
+        a = test_stream_read_all(&src, a, 480, (u8*)streamed + i*480*frame_size, false);
+        b = test_stream_read_all(&src, b, 480, (u8*)streamed_b + i*480*frame_size, false);
+    }
+    audio_source_get_frames(&reference.decoder, 200000, n, expected);
+    assert(memcmp(streamed, expected, n*frame_size) == 0, "Streamed frames differ with two readers");
+    audio_source_get_frames(&reference.decoder, 20000, n, expected);
+    assert(memcmp(streamed_b, expected, n*frame_size) == 0, "Streamed frames differ with two readers");
+    dealloc(get_heap_allocator(), streamed_b);
+    
+    // Looping over the end doesn't lose or repeat anything
+    u64 end = src.number_of_frames;
+    position = test_stream_read_all(&src, end-n/2, n, streamed, true);
+    assert(position == n/2, "Looped stream position is %llu, expected %llu", position, n/2);
+    audio_source_get_frames(&reference.decoder, end-n/2, n/2, expected);
+    audio_source_get_frames(&reference.decoder, 0, n/2, (u8*)expected + (n/2)*frame_size);
+    assert(memcmp(streamed, expected, n*frame_size) == 0, "Streamed frames differ when looping");
+    
+    audio_stream_close_decoder(&reference);
+    audio_source_destroy(&src);
+    dealloc(get_heap_allocator(), streamed);
+    dealloc(get_heap_allocator(), expected);
+    
+    // 16 streams playing at once. Worst time in the audio callback, compared to decoding
+    // in the callback like we used to.
+    const u64 stream_count = 16;
+    const u64 buffers = 200;
+    Audio_Source sources[16];
+    Audio_Player *players[16];
+    for (u64 i = 0; i < stream_count; i++) {
+        ok = audio_open_source_stream(&sources[i], path, get_heap_allocator());
+        assert(ok, "Could not open stream %llu", i);
+    }
+    // Let the decode thread fill the rings before we start
+    for (u64 i = 0; i < stream_count; i++) {
+        Audio_Stream_Cursor *c = &sources[i].stream->cursors[0];
+        f64 start = os_get_elapsed_seconds();
+        while (c->ready_generation != c->seek_generation || c->write_count-c->read_count < sources[i].stream->capacity/2) {
+            assert(os_get_elapsed_seconds()-start < 5.0, "Timed out waiting for stream decode");
+            os_sleep(1);
+        }
+    }
+    for (u64 i = 0; i < stream_count; i++) {
+        players[i] = audio_player_get_one();
+        audio_player_set_source(players[i], sources[i]);
+        audio_player_set_looping(players[i], true);
+        audio_player_set_state(players[i], AUDIO_PLAYER_STATE_PLAYING);
+    }
+    
+    Audio_Null_Device_Config config = ZERO(Audio_Null_Device_Config);
+    config.format = audio_output_format;
+    config.frames_per_buffer = 480;
+    config.number_of_buffers = buffers;
+    config.real_time = true;
+    Audio_Null_Device_Stats stats;
+    ok = audio_null_device_run(config, &stats);
+    assert(ok, "Null device run failed");
+    assert(stats.max_voices_mixed == stream_count, "Expected %llu voices, got %llu", stream_count, stats.max_voices_mixed);
+    
+    u64 underrun_frames = 0;
+    for (u64 i = 0; i < stream_count; i++) {
+        underrun_frames += sources[i].stream->underrun_frames;
+        audio_player_release(players[i]);
+    }
+    
+    // Decoding in the callback, seeking every time
+    Audio_Format format = sources[0].format;
+    void *frames = alloc(get_heap_allocator(), 480*frame_size*4);
+    Audio_Source legacy[16];
+    for (u64 i = 0; i < stream_count; i++) {
+        legacy[i] = sources[i];
+        legacy[i].stream = 0;
+    }
+    f64 worst_legacy = 0;
+    u64 legacy_position = 0;
+    for (u64 b = 0; b < buffers; b++) {
+        f64 start = os_get_elapsed_seconds();
+        for (u64 i = 0; i < stream_count; i++) {
+            legacy[i].ogg_next_frame = UINT64_MAX;
+            audio_source_get_frames(&legacy[i], legacy_position, 480, frames);
+        }
+        f64 seconds = os_get_elapsed_seconds()-start;
+        worst_legacy = max(worst_legacy, seconds);
+        legacy_position += 480;
+    }
+    dealloc(get_heap_allocator(), frames);
+    
+    print("%llu OGG streams: worst callback %.3f ms decoded ahead (%llu frames underrun), %.3f ms decoding in the callback ", 
+        stream_count, stats.worst_mix_seconds*1000.0, underrun_frames, worst_legacy*1000.0);
+    
+    assert(stats.worst_mix_seconds < worst_legacy, "Decoding ahead should make the worst callback faster");
+    
+    // Let the mixer see the released players before the sources go away
+    config.frames_per_buffer = 16;
+    config.number_of_buffers = 1;
+    config.real_time = false;
+    audio_null_device_run(config, 0);
+    for (u64 i = 0; i < stream_count; i++) {
+        audio_source_destroy(&sources[i]);
+    }
+}
+
+// Forwards to the heap and keeps track of how much is allocated through it
+typedef struct Test_Counting_Allocator {
+    Spinlock lock;
+    s64 live_bytes;
+    s64 peak_bytes;
+} Test_Counting_Allocator;
+void* test_counting_allocator_proc(u64 size, void *p, Allocator_Message message, void* data) {
+    Test_Counting_Allocator *counter = (Test_Counting_Allocator*)data;
+    switch (message) {
+        case ALLOCATOR_ALLOCATE: {
+            u64 *block = (u64*)heap_alloc(size + 16);
+            block[0] = size;
+            spinlock_acquire_or_wait(&counter->lock);
+            counter->live_bytes += size;
+            counter->peak_bytes = max(counter->peak_bytes, counter->live_bytes);
+            spinlock_release(&counter->lock);
+            return block + 2;
+        }
+        case ALLOCATOR_DEALLOCATE: {
+            if (!p) return 0;
+            u64 *block = (u64*)p - 2;
+            spinlock_acquire_or_wait(&counter->lock);
+            counter->live_bytes -= block[0];
+            spinlock_release(&counter->lock);
+            heap_dealloc(block);
+            return 0;
+        }
+        case ALLOCATOR_REALLOCATE: {
+            void *new = test_counting_allocator_proc(size, 0, ALLOCATOR_ALLOCATE, data);
+            if (p) {
+                memcpy(new, p, min(size, ((u64*)p)[-2]));
+                test_counting_allocator_proc(0, p, ALLOCATOR_DEALLOCATE, data);
+            }
+            return new;
+        }
+    }
+    return 0;
+}
+
+void test_ogg_stream_modes() {
+    string path = STR("oogabooga/examples/song.ogg");
+    File probe = os_file_open(path, O_READ);
+    if (probe == OS_INVALID_FILE) {
+        print("(skipped, no %s) ", path);
+        return;
+    }
+    s64 file_size = os_file_get_size(probe);
+    os_file_close(probe);
+    
+    Audio_Ogg_Stream_Mode old_mode = audio_ogg_stream_mode;
+    
+    Audio_Source src;
+    audio_ogg_stream_mode = AUDIO_OGG_STREAM_FILE;
+    bool ok = audio_open_source_stream(&src, path, get_heap_allocator());
+    assert(ok, "Could not open stream");
+    Audio_Format native = { AUDIO_BITS_32, src.ogg->channels, src.ogg->sample_rate };
+    f64 duration = (f64)src.number_of_frames/(f64)native.sample_rate;
+    audio_source_destroy(&src);
+    
+    u64 frame_size = sizeof(float32)*native.channels;
+    const u64 n = 4800;
+    const u64 seek_frame = 300000;
+    float32 *decoded[3];
+    s64 live_bytes[3];
+    
+    for (int mode = 0; mode < 3; mode++) {
+        audio_ogg_stream_mode = (Audio_Ogg_Stream_Mode)mode;
+        
+        Test_Counting_Allocator counter = ZERO(Test_Counting_Allocator);
+        Allocator allocator = { test_counting_allocator_proc, &counter };
+        
+        ok = audio_open_source_stream_format(&src, path, native, allocator);
+        assert(ok, "Could not open stream with ogg mode %d", mode);
+        assert(src.ogg_mode == (Audio_Ogg_Stream_Mode)mode, "Ogg mode was not applied");
+        
+        // Through the decode thread, then straight from the source's own decoder with a seek
+        decoded[mode] = alloc(get_heap_allocator(), n*2*frame_size);
+        test_stream_read_all(&src, 0, n, decoded[mode], false);
+        audio_source_get_frames(&src, seek_frame, n, (u8*)decoded[mode] + n*frame_size);
+        
+        spinlock_acquire_or_wait(&counter.lock);
+        live_bytes[mode] = counter.live_bytes;
+        spinlock_release(&counter.lock);
+        
+        audio_source_destroy(&src);
+        assert(counter.live_bytes == 0, "Ogg mode %d leaked %lld bytes", mode, counter.live_bytes);
+        
+        if (mode > 0) {
+            assert(memcmp(decoded[mode], decoded[0], n*2*frame_size) == 0, "Ogg mode %d decodes differently from file streaming", mode);
+        }
+    }
+    
+    audio_ogg_stream_mode = old_mode;
+    for (int mode = 0; mode < 3; mode++) dealloc(get_heap_allocator(), decoded[mode]);
+    
+    // Reading the whole file grows with length, the others don't (mapped pages can be dropped
+    // by the OS, so they're not counted)
+    f64 bytes_per_second = (f64)file_size/duration;
+    f64 ten_minutes = bytes_per_second*600.0;
+    f64 memory_ten_minutes = (f64)(live_bytes[AUDIO_OGG_STREAM_MEMORY] - file_size) + ten_minutes;
+    
+    print("%.0f s, %lld KB file. Heap per stream: file %lld KB, mapped %lld KB (+%lld KB mapped), memory %lld KB. For a 10 minute track: file %lld KB, memory %.0f KB ",
+        duration, file_size/1024,
+        live_bytes[AUDIO_OGG_STREAM_FILE]/1024,
+        live_bytes[AUDIO_OGG_STREAM_MAPPED]/1024, file_size/1024,
+        live_bytes[AUDIO_OGG_STREAM_MEMORY]/1024,
+        live_bytes[AUDIO_OGG_STREAM_FILE]/1024, memory_ten_minutes/1024.0);
+    
+    assert(live_bytes[AUDIO_OGG_STREAM_FILE] + file_size/2 < live_bytes[AUDIO_OGG_STREAM_MEMORY], "File streaming should not hold the compressed file");
+    assert(live_bytes[AUDIO_OGG_STREAM_MAPPED] + file_size/2 < live_bytes[AUDIO_OGG_STREAM_MEMORY], "Mapped streaming should not hold the compressed file on the heap");
+}
+
+Audio_Sound_Bank_Clip *test_find_sound_bank_clip(string path) {
+    Audio_Sound_Bank_Clip **clip = hash_table_find(&audio_sound_bank.clips, path);
+    assert(clip, "%s is not in the sound bank", path);
+    return *clip;
+}
+
+// Runs the mixer until every one-shot player is done
+void test_sound_bank_drain() {
+    Audio_Null_Device_Config config = ZERO(Audio_Null_Device_Config);
+    config.format = audio_output_format;
+    config.frames_per_buffer = 480;
+    config.number_of_buffers = 50;
+    bool ok = audio_null_device_run(config, 0);
+    assert(ok, "Null device run failed");
+}
+
+typedef struct Test_Sound_Bank_Triggers {
+    string *paths;
+    u64 path_count;
+    u64 triggers_per_buffer;
+    u64 triggers;
+    f64 total_seconds;
+    f64 worst_seconds;
+} Test_Sound_Bank_Triggers;
+void test_sound_bank_trigger(Audio_Null_Device *device, u64 buffer_index) {
+    Test_Sound_Bank_Triggers *t = (Test_Sound_Bank_Triggers*)device->config.userdata;
+    for (u64 i = 0; i < t->triggers_per_buffer; i++) {
+        f64 start = os_get_elapsed_seconds();
+        play_one_audio_clip(t->paths[t->triggers % t->path_count]);
+        f64 seconds = os_get_elapsed_seconds()-start;
+        t->total_seconds += seconds;
+        t->worst_seconds = max(t->worst_seconds, seconds);
+        t->triggers += 1;
+    }
+}
+
+typedef struct Test_Sound_Bank_Get {
+    string path;
+    Audio_Sound_Bank_Clip *clip;
+} Test_Sound_Bank_Get;
+
+void test_sound_bank_get_thread(Thread *t) {
+    Test_Sound_Bank_Get *get = (Test_Sound_Bank_Get*)t->data;
+    get->clip = audio_sound_bank_get(get->path);
+}
+
+void test_audio_sound_bank() {
+    const u64 clip_count = 4;
+    const u64 clip_frames = 1103; // 50ms at 22050
+    string paths[4];
+    for (u64 i = 0; i < clip_count; i++) {
+        paths[i] = sprint(get_heap_allocator(), STR("oogabooga_test_clip_%llu.wav"), i);
+        test_write_sound_bank_clip(paths[i], 22050, clip_frames, 440.0f*(f32)(i+1));
+    }
+    
+    u64 old_budget = audio_sound_bank_budget_bytes;
+    audio_sound_bank_trim(0);
+    
+    // Decoded once, in the output format, and shared
+    u64 loads = audio_sound_bank.loads;
+    u64 hits = audio_sound_bank.hits;
+    play_one_audio_clip(paths[0]);
+    play_one_audio_clip(paths[0]);
+    assert(audio_sound_bank.loads == loads+1, "Clip was loaded %llu times", audio_sound_bank.loads-loads);
+    assert(audio_sound_bank.hits == hits+1, "Second play missed the bank");
+    
+    Audio_Sound_Bank_Clip *clip = test_find_sound_bank_clip(paths[0]);
+    assert(clip->loaded, "Clip is not loaded");
+    assert(clip->ref_count == 2, "Clip has %llu references, expected 2", clip->ref_count);
+    assert(clip->source.kind == AUDIO_SOURCE_MEMORY, "Clip is not decoded into memory");
+    assert(clip->source.planar, "Clip was not prepared for the mixer");
+    assert(clip->source.format.sample_rate == audio_output_format.sample_rate 
+        && clip->source.format.channels == audio_output_format.channels, "Clip is not in the output format");
+    u64 expected_frames = (u64)round((f64)clip_frames*(f64)audio_output_format.sample_rate/22050.0);
+    assert(clip->source.number_of_frames == expected_frames, "Clip has %llu frames, expected %llu", clip->source.number_of_frames, expected_frames);
+    u64 clip_size = clip->size;
+    
+    test_sound_bank_drain();
+    assert(clip->ref_count == 0, "Finished players still hold %llu references", clip->ref_count);
+    
+    // Clips that aren't playing are evicted least recently used first
+    audio_sound_bank_budget_bytes = clip_size*2 + clip_size/2;
+    u64 evictions = audio_sound_bank.evictions;
+    play_one_audio_clip(paths[1]);
+    play_one_audio_clip(paths[2]);
+    assert(audio_sound_bank.evictions == evictions+1, "Expected one eviction, got %llu", audio_sound_bank.evictions-evictions);
+    assert(!test_find_sound_bank_clip(paths[0])->loaded, "Least recently used clip was not evicted");
+    assert(test_find_sound_bank_clip(paths[1])->loaded && test_find_sound_bank_clip(paths[2])->loaded, "Playing clip was evicted");
+    assert(audio_sound_bank.loaded_bytes <= audio_sound_bank_budget_bytes, "Bank is over budget");
+    
+    // Playing clips are never evicted, even when over budget
+    audio_sound_bank_trim(0);
+    assert(test_find_sound_bank_clip(paths[1])->loaded && test_find_sound_bank_clip(paths[2])->loaded, "Playing clip was evicted");
+    test_sound_bank_drain();
+    audio_sound_bank_trim(0);
+    assert(audio_sound_bank.loaded_bytes == 0, "Bank still has %llu bytes after trimming everything", audio_sound_bank.loaded_bytes);
+    
+    // Evicted clips are loaded again
+    loads = audio_sound_bank.loads;
+    play_one_audio_clip(paths[0]);
+    assert(audio_sound_bank.loads == loads+1, "Evicted clip was not loaded again");
+    test_sound_bank_drain();
+    
+    audio_sound_bank_budget_bytes = old_budget;
+    
+    // 1000 triggers per second, 10 per 10ms buffer
+    Test_Sound_Bank_Triggers triggers = ZERO(Test_Sound_Bank_Triggers);
+    triggers.paths = paths;
+    triggers.path_count = clip_count;
+    triggers.triggers_per_buffer = 10;
+    
+    Audio_Null_Device_Config config = ZERO(Audio_Null_Device_Config);
+    config.format = audio_output_format;
+    config.frames_per_buffer = audio_output_format.sample_rate/100;
+    config.number_of_buffers = 300;
+    config.before_buffer = test_sound_bank_trigger;
+    config.userdata = &triggers;
+    Audio_Null_Device_Stats stats;
+    bool ok = audio_null_device_run(config, &stats);
+    assert(ok, "Null device run failed");
+    assert(triggers.triggers == 3000, "Triggered %llu clips", triggers.triggers);
+    test_sound_bank_drain();
+    for (u64 i = 0; i < clip_count; i++) {
+        assert(test_find_sound_bank_clip(paths[i])->ref_count == 0, "Clip %llu is still referenced", i);
+    }
+    
+    // What every trigger cost when it opened the clip from disk
+    const u64 fresh_opens = 100;
+    f64 start = os_get_elapsed_seconds();
+    for (u64 i = 0; i < fresh_opens; i++) {
+        Audio_Source src;
+        ok = audio_open_source_load(&src, paths[i % clip_count], get_heap_allocator());
+        assert(ok, "Could not load clip");
+        audio_source_destroy(&src);
+    }
+    f64 fresh_seconds = (os_get_elapsed_seconds()-start)/(f64)fresh_opens;
+    f64 bank_seconds = triggers.total_seconds/(f64)triggers.triggers;
+    
+    print("1000 triggers/s: %.2f us per trigger (worst %.2f us), mixing %.3f ms per 10ms (max %llu voices). Opening from disk: %.2f us per trigger ",
+        bank_seconds*1000000.0, triggers.worst_seconds*1000000.0, stats.average_mix_seconds*1000.0, stats.max_voices_mixed, fresh_seconds*1000000.0);
+    
+    assert(bank_seconds < fresh_seconds, "Playing from the sound bank should be cheaper than opening the clip");
+    
+    // Threads asking for a clip that's being loaded wait for that load instead of loading it again
+    string shared_path = STR("oogabooga_test_bank_shared.wav");
+    test_write_sound_bank_clip(shared_path, 48000, 48000*4, 440.0f);
+    u64 loads_before = audio_sound_bank.loads;
+    Thread getters[4];
+    Test_Sound_Bank_Get gets[4];
+    for (u64 i = 0; i < 4; i++) {
+        gets[i] = ZERO(Test_Sound_Bank_Get);
+        gets[i].path = shared_path;
+        os_thread_init(&getters[i], test_sound_bank_get_thread);
+        getters[i].data = &gets[i];
+        os_thread_start(&getters[i]);
+    }
+    for (u64 i = 0; i < 4; i++) {
+        os_thread_join(&getters[i]);
+        os_thread_destroy(&getters[i]);
+    }
+    assert(audio_sound_bank.loads == loads_before+1, "Clip was loaded %llu times", audio_sound_bank.loads-loads_before);
+    for (u64 i = 0; i < 4; i++) {
+        assert(gets[i].clip && gets[i].clip == gets[0].clip, "Threads got different clips");
+        audio_sound_bank_clip_release(gets[i].clip);
+    }
+    os_file_delete(shared_path);
+    
+    audio_sound_bank_trim(0);
+    for (u64 i = 0; i < clip_count; i++) {
+        os_file_delete(paths[i]);
+        dealloc_string(get_heap_allocator(), paths[i]);
+    }
+}
+
+// Average time to mix every source looping voices_per_source times, with no two voices in step
+f64 test_mix_seconds_for_sources(Audio_Source *sources, u64 source_count, u64 voices_per_source) {
+    u64 voice_count = source_count*voices_per_source;
+    Audio_Player **players = alloc(get_heap_allocator(), voice_count*sizeof(Audio_Player*));
+    for (u64 i = 0; i < voice_count; i++) {
+        players[i] = audio_player_get_one();
+        audio_player_set_source(players[i], sources[i%source_count]);
+        audio_player_set_looping(players[i], true);
+        audio_player_set_progression_factor(players[i], (f64)(i+1)/(f64)(voice_count+1));
+        audio_player_set_state(players[i], AUDIO_PLAYER_STATE_PLAYING);
+    }
+    
+    Audio_Null_Device_Config config = ZERO(Audio_Null_Device_Config);
+    config.format = audio_output_format;
+    config.frames_per_buffer = audio_output_format.sample_rate/100;
+    config.number_of_buffers = 500;
+    Audio_Null_Device_Stats stats;
+    bool ok = audio_null_device_run(config, &stats);
+    assert(ok, "Null device run failed");
+    assert(stats.max_voices_mixed == voice_count, "Expected %llu voices, got %llu", voice_count, stats.max_voices_mixed);
+    
+    for (u64 i = 0; i < voice_count; i++) {
+        audio_player_release(players[i]);
+    }
+    dealloc(get_heap_allocator(), players);
+    
+    return stats.average_mix_seconds;
+}
 
-    // Test acquire and release without contention
-    mutex_acquire_or_wait(&m);
-    assert(m.spinlock_acquired, "Failed: Mutex should be acquired after mutex_acquire_or_wait");
+// Signal to noise of channel 0 against the sine test_write_sound_bank_clip wrote, away from the ends
+f64 test_prepared_snr(Audio_Source *src, f64 hz) {
+    const u64 edge = 256;
+    u64 frames = src->number_of_frames-edge*2;
+    u64 frame_size = get_audio_bit_width_byte_size(src->format.bit_width)*src->format.channels;
+    void *raw = alloc(get_heap_allocator(), frames*frame_size);
+    audio_source_sample_next_frames(src, edge, frames, raw, false);
+    Audio_Planar_Buffer out = ZERO(Audio_Planar_Buffer);
+    audio_planar_buffer_reserve(&out, src->format.channels, frames);
+    audio_frames_to_planar(&out, raw, src->format, frames);
     
-    mutex_release(&m);
-    assert(!m.spinlock_acquired, "Failed: Spinlock should not be acquired after mutex_release");
+    f64 signal = 0, noise = 0;
+    for (u64 i = 0; i < frames; i++) {
+        f64 expected = sin(2.0*PI64*hz*(f64)(i+edge)/(f64)src->format.sample_rate)*16000.0/32768.0;
+        f64 d = (f64)audio_planar_channel(&out, 0)[i]-expected;
+        signal += expected*expected;
+        noise += d*d;
+    }
+    audio_planar_buffer_destroy(&out);
+    dealloc(get_heap_allocator(), raw);
+    return 10.0*log10(signal/max(noise, 1e-30));
+}
 
-    // Clean up
-    mutex_destroy(&m);
+void test_audio_prepare() {
+    const int rates[3] = { 22050, 44100, 48000 };
+    string paths[3];
+    for (u64 i = 0; i < 3; i++) {
+        paths[i] = sprint(get_heap_allocator(), STR("oogabooga_test_prepare_%d.wav"), rates[i]);
+        test_write_sound_bank_clip(paths[i], rates[i], rates[i]*2, 1000.0f);
+    }
+    Audio_Format out_format = audio_output_format;
+    f64 old_max_seconds = audio_prepare_max_seconds;
+    audio_prepare_max_seconds = 30.0;
     
-    Mutex_Test_Shared_Data data;
-    data.counter = 0;
-    data.any_active_thread = false;
-    mutex_init(&data.mutex);
+    // Probing reads the format without decoding
+    Audio_Format native;
+    u64 native_frames;
+    bool ok = audio_probe_file(paths[1], &native, &native_frames);
+    assert(ok, "Could not probe %s", paths[1]);
+    assert(native.sample_rate == 44100 && native.channels == 1 && native_frames == 88200, "Probed %dhz %d channels %llu frames", native.sample_rate, native.channels, native_frames);
+    
+    Audio_Source prepared[3];
+    Audio_Source converted[3];
+    Audio_Source as_is[3];
+    for (u64 i = 0; i < 3; i++) {
+        ok = audio_open_source_load(&prepared[i], paths[i], get_heap_allocator());
+        assert(ok, "Could not load %s", paths[i]);
+        assert(prepared[i].planar, "Short clip was not prepared");
+        assert(prepared[i].format.bit_width == AUDIO_BITS_32 && prepared[i].format.channels == out_format.channels 
+            && prepared[i].format.sample_rate == out_format.sample_rate, "Prepared clip is not in the output format");
+        u64 expected_frames = (u64)round((f64)rates[i]*2.0*(f64)out_format.sample_rate/(f64)rates[i]);
+        assert(prepared[i].number_of_frames == expected_frames, "Prepared clip has %llu frames, expected %llu", prepared[i].number_of_frames, expected_frames);
+        
+        ok = audio_open_source_load_format(&converted[i], paths[i], out_format, get_heap_allocator());
+        assert(ok, "Could not load %s", paths[i]);
+        assert(!converted[i].planar, "Explicit format was prepared anyway");
+        
+        ok = audio_probe_file(paths[i], &native, &native_frames);
+        assert(ok, "Could not probe %s", paths[i]);
+        ok = audio_open_source_load_format(&as_is[i], paths[i], native, get_heap_allocator());
+        assert(ok, "Could not load %s", paths[i]);
+    }
+    
+    // Reading a prepared source interleaved, across the loop point
+    u64 channels = out_format.channels;
+    float32 *frames = alloc(get_heap_allocator(), 64*channels*sizeof(float32));
+    u64 start_frame = prepared[0].number_of_frames-32;
+    u64 next = audio_source_sample_next_frames(&prepared[0], start_frame, 64, frames, true);
+    assert(next == 32, "Expected to wrap to frame 32, got %llu", next);
+    float32 *planar = (float32*)prepared[0].pcm_frames;
+    for (u64 f = 0; f < 64; f++) {
+        u64 index = (start_frame+f) % prepared[0].number_of_frames;
+        for (u64 c = 0; c < channels; c++) {
+            assert(frames[f*channels+c] == planar[c*prepared[0].number_of_frames+index], "Interleaved read of a prepared source is wrong at frame %llu", f);
+        }
+    }
+    dealloc(get_heap_allocator(), frames);
+    
+    f64 prepared_snr = test_prepared_snr(&prepared[1], 1000.0);
+    f64 converted_snr = test_prepared_snr(&converted[1], 1000.0);
+    assert(prepared_snr > 60.0, "Prepared 44.1k clip has SNR %.1f dB", prepared_snr);
+    
+    // Long sources and a disabled limit load straight into the output format like before
+    audio_prepare_max_seconds = 1.0;
+    Audio_Source long_clip;
+    ok = audio_open_source_load(&long_clip, paths[2], get_heap_allocator());
+    assert(ok && !long_clip.planar, "Clip longer than audio_prepare_max_seconds was prepared");
+    assert(bytes_match(&long_clip.format, &out_format, sizeof(Audio_Format)), "Long clip is not in the output format");
+    audio_source_destroy(&long_clip);
+    audio_prepare_max_seconds = 30.0;
+    
+    // Mixer cost with 22k, 44.1k and 48k assets playing at once
+    const u64 voices_per_source = 16;
+    f64 as_is_seconds     = test_mix_seconds_for_sources(as_is, 3, voices_per_source);
+    f64 converted_seconds = test_mix_seconds_for_sources(converted, 3, voices_per_source);
+    f64 prepared_seconds  = test_mix_seconds_for_sources(prepared, 3, voices_per_source);
+    
+    print("%llu voices of 22k/44.1k/48k clips, avg mix: as in the file %.3f ms, converted at load %.3f ms, prepared %.3f ms (%.0f%% less than as in the file). 44.1k clip SNR %.1f dB prepared, %.1f dB converted ",
+        voices_per_source*3, as_is_seconds*1000.0, converted_seconds*1000.0, prepared_seconds*1000.0,
+        (1.0-prepared_seconds/as_is_seconds)*100.0, prepared_snr, converted_snr);
+    
+    assert(prepared_seconds < as_is_seconds, "Prepared clips should be cheaper to mix than clips in their file format");
+    
+    audio_prepare_max_seconds = old_max_seconds;
+    for (u64 i = 0; i < 3; i++) {
+        audio_source_destroy(&prepared[i]);
+        audio_source_destroy(&converted[i]);
+        audio_source_destroy(&as_is[i]);
+        os_file_delete(paths[i]);
+        dealloc_string(get_heap_allocator(), paths[i]);
+    }
+}
 
-    Allocator allocator = get_heap_allocator();
+void test_null_device_count_buffers(Audio_Null_Device *device, u64 buffer_index) {
+    u64 *count = (u64*)device->config.userdata;
+    assert(buffer_index == *count, "Buffers called out of order");
+    *count += 1;
+}
 
-	const int num_threads = 100;
+typedef struct Test_Null_Device_Owner {
+    Audio_Player *player;
+    u64 first_frame;
+    u64 last_frame;
+    volatile bool stop;
+    u64 os_buffers;
+} Test_Null_Device_Owner;
+void test_null_device_track_frame(Audio_Null_Device *device, u64 buffer_index) {
+    Test_Null_Device_Owner *owner = (Test_Null_Device_Owner*)device->config.userdata;
+    if (buffer_index == 0) owner->first_frame = owner->player->voice.frame_index;
+    owner->last_frame = owner->player->voice.frame_index;
+}
+// Pulls buffers like the OS audio thread does
+void test_fake_os_audio_thread(Thread *t) {
+    Test_Null_Device_Owner *owner = (Test_Null_Device_Owner*)t->data;
+    Audio_Format f32_stereo = { AUDIO_BITS_32, 2, 48000 };
+    float32 out[480*2];
+    audio_mixer_thread_begin();
+    while (!owner->stop) {
+        do_program_audio_sample(480, f32_stereo, out);
+        owner->os_buffers += 1;
+        os_yield_thread();
+    }
+    audio_mixer_thread_end();
+}
 
-	Thread *threads = alloc(allocator, sizeof(Thread)*num_threads);
-	for (u64 i = 0; i < num_threads; i++) {
-		os_thread_init(&threads[i], mutex_test_increment_counter);
-		threads[i].data = &data;
-	}
-	for (u64 i = 0; i < num_threads; i++) {
-    	os_thread_start(&threads[i]);
-	}
-	for (u64 i = 0; i < num_threads; i++) {
-    	os_thread_join(&threads[i]);
-	}
+void test_audio_null_device() {
+    Audio_Format f32_stereo = { AUDIO_BITS_32, 2, 48000 };
+    const u64 frames = 480;
+    const u64 buffers = 20;
+    
+    Audio_Source sources[4];
+    Audio_Player *players[4];
+    for (u64 i = 0; i < 4; i++) {
+        sources[i] = test_make_audio_source(f32_stereo, 48000, 220.0f*(i+1), 0.2f);
+        players[i] = audio_player_get_one();
+        audio_player_set_source(players[i], sources[i]);
+        audio_player_set_looping(players[i], true);
+        audio_player_set_state(players[i], AUDIO_PLAYER_STATE_PLAYING);
+    }
+    
+    // Write to WAV
+    string wav_path = STR("oogabooga_test_null_device.wav");
+    Audio_Null_Device_Config config = ZERO(Audio_Null_Device_Config);
+    config.format = f32_stereo;
+    config.frames_per_buffer = frames;
+    config.number_of_buffers = buffers;
+    config.wav_path = wav_path;
+    
+    u64 buffer_callbacks = 0;
+    config.before_buffer = test_null_device_count_buffers;
+    config.userdata = &buffer_callbacks;
+    
+    Audio_Null_Device_Stats stats;
+    bool ok = audio_null_device_run(config, &stats);
+    assert(ok, "Null device run failed");
+    assert(buffer_callbacks == buffers, "before_buffer called %d times, expected %d", buffer_callbacks, buffers);
+    config.before_buffer = 0;
+    assert(stats.buffers_mixed == buffers, "Expected %d buffers, got %d", buffers, stats.buffers_mixed);
+    assert(stats.frames_mixed == buffers*frames, "Frames mixed mismatch");
+    assert(stats.max_voices_mixed == 4, "Expected 4 voices, got %d", stats.max_voices_mixed);
+    assert(fabs(stats.buffer_seconds-0.01) < 0.000001, "Buffer duration is %f", stats.buffer_seconds);
+    assert(stats.worst_mix_seconds >= stats.average_mix_seconds, "Worst mix time below average");
+    
+    string wav;
+    ok = os_read_entire_file(wav_path, &wav, get_heap_allocator());
+    assert(ok, "Could not read back null device WAV");
+    u64 data_size = buffers*frames*2*sizeof(float32);
+    assert(wav.count == AUDIO_WAV_HEADER_SIZE+data_size, "WAV is %d bytes, expected %d", wav.count, AUDIO_WAV_HEADER_SIZE+data_size);
+    assert(memcmp(wav.data, "RIFF", 4) == 0 && memcmp(wav.data+8, "WAVE", 4) == 0, "Bad WAV header");
+    assert(*(u32*)(wav.data+4) == 36+data_size, "Bad RIFF size");
+    assert(*(u16*)(wav.data+20) == 3, "Expected IEEE float WAV");
+    assert(*(u16*)(wav.data+22) == 2, "Bad WAV channel count");
+    assert(*(u32*)(wav.data+24) == 48000, "Bad WAV sample rate");
+    assert(*(u32*)(wav.data+40) == data_size, "Bad WAV data size");
+    
+    float32 *samples = (float32*)(wav.data+AUDIO_WAV_HEADER_SIZE);
+    float32 peak = 0;
+    for (u64 i = 0; i < frames*2*buffers; i++) {
+        assert(samples[i] >= -1.0f && samples[i] <= 1.0f, "Sample %d out of range: %f", i, samples[i]);
+        peak = max(peak, fabsf(samples[i]));
+    }
+    assert(peak > 0.05f, "WAV output is silent");
+    dealloc(get_heap_allocator(), wav.data);
+    os_file_delete(wav_path);
+    
+    // The OS device doesn't advance the players while the null device runs
+    Test_Null_Device_Owner owner = ZERO(Test_Null_Device_Owner);
+    owner.player = players[0];
+    Thread os_thread;
+    os_thread_init(&os_thread, test_fake_os_audio_thread);
+    os_thread.data = &owner;
+    os_thread_start(&os_thread);
+    while (owner.os_buffers == 0) os_yield_thread();
+    config.wav_path = ZERO(string);
+    config.real_time = true; // Gives the OS thread time to mix in between
+    config.before_buffer = test_null_device_track_frame;
+    config.userdata = &owner;
+    ok = audio_null_device_run(config, &stats);
+    owner.stop = true;
+    os_thread_join(&os_thread);
+    os_thread_destroy(&os_thread);
+    assert(ok, "Null device run failed");
+    config.before_buffer = 0;
+    u64 advanced = (owner.last_frame + 48000 - owner.first_frame) % 48000;
+    assert(advanced == (buffers-1)*frames, "Player advanced %llu frames while the null device mixed %llu", advanced, (buffers-1)*frames);
+    
+    // Discarding in real time takes roughly as long as the audio lasts
+    config.wav_path = ZERO(string);
+    config.real_time = true;
+    config.number_of_buffers = 5;
+    f64 start = os_get_elapsed_seconds();
+    ok = audio_null_device_run(config, &stats);
+    f64 elapsed = os_get_elapsed_seconds()-start;
+    assert(ok, "Null device run failed");
+    // The first buffer is due immediately, then one every 10ms
+    assert(elapsed >= 0.035, "Real time run took %f seconds, expected about 0.04", elapsed);
+    
+    for (u64 i = 0; i < 4; i++) {
+        audio_player_release(players[i]);
+    }
+    
+    // Invalid config is rejected
+    config.frames_per_buffer = 0;
+    assert(!audio_null_device_run(config, 0), "Null device accepted 0 frames per buffer");
+    
+    // Benchmark: many voices, small buffers
+    const u64 voice_count = 64;
+    Audio_Player **voices = alloc(get_heap_allocator(), voice_count*sizeof(Audio_Player*));
+    for (u64 i = 0; i < voice_count; i++) {
+        voices[i] = audio_player_get_one();
+        audio_player_set_source(voices[i], sources[i%4]);
+        audio_player_set_looping(voices[i], true);
+        voices[i]->config.playback_speed = 0.75+0.5*((f64)i/(f64)voice_count);
+        audio_player_set_state(voices[i], AUDIO_PLAYER_STATE_PLAYING);
+    }
+    
+    config.frames_per_buffer = 256;
+    config.number_of_buffers = 1000;
+    config.real_time = false;
+    ok = audio_null_device_run(config, &stats);
+    assert(ok, "Null device run failed");
+    assert(stats.underruns <= stats.buffers_mixed, "Underruns exceed buffers");
+    
+    print("%llu voices, %llu frame buffers: avg %.3f ms, worst %.3f ms, avg %.1f voices, min headroom %.3f ms, %llu underruns ",
+        voice_count, config.frames_per_buffer, stats.average_mix_seconds*1000.0, stats.worst_mix_seconds*1000.0,
+        stats.average_voices_mixed, stats.min_headroom_seconds*1000.0, stats.underruns);
+    
+    for (u64 i = 0; i < voice_count; i++) {
+        audio_player_release(voices[i]);
+    }
+    dealloc(get_heap_allocator(), voices);
+    
+    // Let the mixer see the released players before the sources go away
+    config.frames_per_buffer = 16;
+    config.number_of_buffers = 1;
+    audio_null_device_run(config, 0);
+    
+    for (u64 i = 0; i < 4; i++) {
+        audio_source_destroy(&sources[i]);
+    }
+}
 
-    assert(data.counter == num_threads * MUTEX_TEST_TASK_COUNT, "Failed: Counter does not match expected value after threading tasks");
 
-    mutex_destroy(&data.mutex);
+// Pushes player changes from another thread as fast as it can, like a busy game thread
+typedef struct Test_Audio_Command_Flood {
+    Audio_Player **players;
+    u64 player_count;
+    volatile bool stop;
+    u64 commands_pushed;
+} Test_Audio_Command_Flood;
+void test_audio_command_flood_thread(Thread *t) {
+    Test_Audio_Command_Flood *flood = (Test_Audio_Command_Flood*)t->data;
+    u64 n = 0;
+    while (!flood->stop) {
+        Audio_Player *p = flood->players[n%flood->player_count];
+        bool pause = (n/flood->player_count)%2 == 1;
+        audio_player_set_state(p, pause ? AUDIO_PLAYER_STATE_PAUSED : AUDIO_PLAYER_STATE_PLAYING);
+        audio_player_set_progression_factor(p, (f64)(n%100)/100.0);
+        audio_player_set_looping(p, true);
+        flood->commands_pushed += 3;
+        n += 1;
+    }
 }
 
-#ifndef OOGABOOGA_HEADLESS
-int compare_draw_quads(const void *a, const void *b) {
-    return ((Draw_Quad*)a)->z-((Draw_Quad*)b)->z;
-}
-void test_sort() {
+void test_audio_commands() {
+    Audio_Format f32_stereo = { AUDIO_BITS_32, 2, 48000 };
     
-    int num_samples = 500;
-    u64 id_bits = 21;
-    u64 item_count = 50000;
+    // Commands are applied by the OS audio thread if it's running, otherwise by the thread
+    // waiting for them. The player stays paused so the OS device doesn't move it while we
+    // check exact positions.
+    Audio_Source src = test_make_audio_source(f32_stereo, 48000, 440, 0.2f);
+    Audio_Player *p = audio_player_get_one();
+    audio_player_set_source(p, src);
+    audio_player_set_state(p, AUDIO_PLAYER_STATE_PLAYING);
+    audio_player_set_state(p, AUDIO_PLAYER_STATE_PAUSED);
+    audio_player_set_progression_factor(p, 0.5);
+    audio_commands_sync();
+    assert(p->voice.has_source && p->voice.source.uid == src.uid, "Source command was not applied");
+    assert(p->voice.state == AUDIO_PLAYER_STATE_PAUSED, "State command was not applied");
+    assert(p->voice.frame_index == 24000, "Expected frame index 24000, got %llu", p->voice.frame_index);
+    assert(fabs(audio_player_get_current_progression_factor(p)-0.5) < 0.0001, "Progression getter does not follow the voice");
     
-    f64 seconds = 0;
-    u64 cycles = 0;
+    // More commands than the queue holds don't block forever
+    for (u64 i = 0; i < AUDIO_COMMAND_QUEUE_SIZE*3; i++) {
+        audio_player_set_progression_factor(p, (f64)(i%10)/10.0);
+    }
+    audio_commands_sync();
+    assert(audio_command_queue.read_count == audio_command_queue.write_count, "Command queue was not drained");
+    assert(p->voice.frame_index == 4800*((AUDIO_COMMAND_QUEUE_SIZE*3-1)%10), "Commands were applied out of order");
     
-    Draw_Quad *items = alloc(get_heap_allocator(), (item_count * 2) * sizeof(Draw_Quad));
-    Draw_Quad *buffer = items + item_count;
+    // While a device runs, game threads leave the commands to the audio thread
+    audio_mixer_thread_begin();
+    audio_player_set_progression_factor(p, 0.25);
+    u64 read_count = audio_command_queue.read_count;
+    assert(!audio_commands_apply_if_no_mixer(), "Game thread applied commands while a device runs");
+    // (unless the OS audio thread is running too and got to them)
+    u64 other_mixers = audio_mixer_thread_count-1;
+    assert(other_mixers > 0 || audio_command_queue.read_count == read_count, "Commands were applied off the audio thread");
+    u64 target = audio_command_queue.write_count;
+    while (audio_command_queue.read_count < target) audio_mixer_thread_apply_commands();
+    assert(p->voice.frame_index == 12000, "Expected frame index 12000, got %llu", p->voice.frame_index);
+    audio_mixer_thread_end();
+    
+    // The OS callback never waits on the mixer lock, it outputs silence instead
+    float32 out[64*2];
+    for (u64 i = 0; i < 64*2; i++) out[i] = 1.0f;
+    spinlock_acquire_or_wait(&audio_mixer_lock);
+    u64 voices = do_program_audio_sample(64, f32_stereo, out);
+    spinlock_release(&audio_mixer_lock);
+    assert(voices == 0, "Mixed %llu voices without the mixer lock", voices);
+    for (u64 i = 0; i < 64*2; i++) assert(out[i] == 0.0f, "Expected silence while the mixer lock is held");
+    
+    // Destroying a source stops voices playing it before the memory goes away
+    audio_source_destroy(&src);
+    assert(!p->voice.has_source, "Voice still plays a destroyed source");
+    
+    // Released players go back to the pool once the release is applied
+    audio_player_release(p);
+    audio_commands_sync();
+    assert(!p->allocated, "Released player is still allocated");
+    
+    // Mix time while a game thread floods the queue, compared to when it's quiet
+    const u64 player_count = 32;
+    Audio_Source sources[4];
+    Audio_Player *players[32];
+    for (u64 i = 0; i < 4; i++) {
+        sources[i] = test_make_audio_source(f32_stereo, 48000, 220.0f*(i+1), 0.1f);
+    }
+    for (u64 i = 0; i < player_count; i++) {
+        players[i] = audio_player_get_one();
+        audio_player_set_source(players[i], sources[i%4]);
+        audio_player_set_looping(players[i], true);
+        audio_player_set_progression_factor(players[i], (f64)i/(f64)player_count);
+        audio_player_set_state(players[i], AUDIO_PLAYER_STATE_PLAYING);
+    }
+    
+    Audio_Null_Device_Config config = ZERO(Audio_Null_Device_Config);
+    config.format = f32_stereo;
+    config.frames_per_buffer = 480;
+    config.number_of_buffers = 100;
+    config.real_time = true;
+    
+    Audio_Null_Device_Stats quiet;
+    bool ok = audio_null_device_run(config, &quiet);
+    assert(ok, "Null device run failed");
+    
+    Test_Audio_Command_Flood flood = ZERO(Test_Audio_Command_Flood);
+    flood.players = players;
+    flood.player_count = player_count;
+    Thread thread;
+    os_thread_init(&thread, test_audio_command_flood_thread);
+    thread.data = &flood;
+    os_thread_start(&thread);
+    
+    Audio_Null_Device_Stats flooded;
+    ok = audio_null_device_run(config, &flooded);
+    flood.stop = true;
+    os_thread_join(&thread);
+    os_thread_destroy(&thread);
+    assert(ok, "Null device run failed");
+    assert(flooded.buffers_mixed == config.number_of_buffers, "Buffers were skipped while flooded");
+    assert(flood.commands_pushed > 0, "Flood thread pushed no commands");
+    
+    print("%llu voices, mix avg/worst/jitter: quiet %.3f/%.3f/%.3f ms, %llu commands pushed during %.3f/%.3f/%.3f ms ",
+        player_count, 
+        quiet.average_mix_seconds*1000.0, quiet.worst_mix_seconds*1000.0, quiet.mix_jitter_seconds*1000.0,
+        flood.commands_pushed,
+        flooded.average_mix_seconds*1000.0, flooded.worst_mix_seconds*1000.0, flooded.mix_jitter_seconds*1000.0);
+    
+    for (u64 i = 0; i < player_count; i++) {
+        audio_player_release(players[i]);
+    }
+    for (u64 i = 0; i < 4; i++) {
+        audio_source_destroy(&sources[i]);
+    }
+}
 
-    for (int a = 0; a < num_samples; a++) {
-        
-        for (u64 i = 0; i < item_count; i++) {
-            if (i % 2 == 0) items[i].z = get_random_int_in_range(0, pow(2, id_bits) / 2);
-            else items[i].z = i;
-        }
+// Default bus configs, and no limiter still pulling down after an earlier loud test
+void test_reset_buses() {
+    for (u64 i = 0; i < AUDIO_BUS_BUILTIN_COUNT; i++) {
+        audio_bus_get((Audio_Bus_Id)i)->config = audio_bus_default_config();
+    }
+    audio_bus_get(AUDIO_BUS_MASTER)->config.enable_limiter = true;
+    spinlock_acquire_or_wait(&audio_mixer_lock);
+    for (u64 i = 0; i < AUDIO_MAX_BUSES; i++) audio_buses[i].mix.limiter.gain = 1.0;
+    spinlock_release(&audio_mixer_lock);
+}
+
+void test_audio_player_pool() {
+    Audio_Format f32_stereo = { AUDIO_BITS_32, 2, 48000 };
+    const u64 frames = 256;
     
-        u64 item_size = sizeof(Draw_Quad);
-        u64 sort_value_offset_in_item = offsetof(Draw_Quad, z);
+    // Voice cap: the 8 high priority voices are mixed, the 8 low priority ones are skipped.
+    // Each has its own source so none are dropped for phase cancellation.
+    Audio_Source dc[16];
+    Audio_Player *capped[16];
+    for (u64 i = 0; i < 16; i++) {
+        bool high = i%2 == 1;
+        dc[i] = test_make_audio_source(f32_stereo, 48000, 0, high ? 0.01f : 0.1f);
+        capped[i] = audio_player_get_one();
+        capped[i]->config.priority = high ? 1 : 0;
+        audio_player_set_source(capped[i], dc[i]);
+        audio_player_set_looping(capped[i], true);
+        audio_player_set_state(capped[i], AUDIO_PLAYER_STATE_PLAYING);
+    }
     
-        float64 start_seconds = os_get_elapsed_seconds();
-        u64 start_cycles = rdtsc();
-        radix_sort(items, buffer, item_count, item_size, sort_value_offset_in_item, id_bits);
-        u64 end_cycles = rdtsc();
-        float64 end_seconds = os_get_elapsed_seconds();
+    test_reset_buses();
+    u64 old_max_voices = audio_max_voices;
+    audio_max_voices = 8;
+    u64 stolen_before = audio_player_pool.voices_stolen;
+    float32 *out = alloc(get_heap_allocator(), frames*2*sizeof(float32));
     
-        for (u64 i = 1; i < item_count; i++) {
-            assert(items[i].z >= items[i-1].z, "Failed: not correctly sorted");
+    // Past the fade in
+    const u64 buffers = 10;
+    u64 voices = 0;
+    for (u64 b = 0; b < buffers; b++) {
+        spinlock_acquire_or_wait(&audio_mixer_lock);
+        reset_temporary_storage();
+        voices = audio_mix_voices(frames, f32_stereo, out);
+        spinlock_release(&audio_mixer_lock);
+        assert(voices == 8, "Expected 8 voices under the cap, got %llu", voices);
+    }
+    assert(audio_player_pool.voices_stolen-stolen_before == 8*buffers, "Expected 8 voices skipped per buffer");
+    assert(fabsf(out[0]-0.08f) < 0.0001f, "Expected only high priority voices, got %f", out[0]);
+    for (u64 i = 0; i < 16; i++) {
+        assert(capped[i]->voice.frame_index == frames*buffers, "Voice %llu is at frame %llu, expected %llu", i, capped[i]->voice.frame_index, frames*buffers);
+    }
+    
+    // Room again, so the skipped voices come back
+    audio_max_voices = 0;
+    spinlock_acquire_or_wait(&audio_mixer_lock);
+    reset_temporary_storage();
+    voices = audio_mix_voices(frames, f32_stereo, out);
+    spinlock_release(&audio_mixer_lock);
+    assert(voices == 16, "Expected 16 voices without a cap, got %llu", voices);
+    assert(fabsf(out[frames*2-2]-0.88f) < 0.0001f, "Expected every voice, got %f", out[frames*2-2]);
+    audio_max_voices = old_max_voices;
+    dealloc(get_heap_allocator(), out);
+    
+    for (u64 i = 0; i < 16; i++) {
+        audio_player_release(capped[i]);
+        audio_source_destroy(&dc[i]);
+    }
+    
+    // 10,000 players with a source, 32 of them playing
+    const u64 player_count = 10000;
+    const u64 playing_count = 32;
+    Audio_Source sources[4];
+    for (u64 i = 0; i < 4; i++) {
+        sources[i] = test_make_audio_source(f32_stereo, 48000, 220.0f*(i+1), 0.1f);
+    }
+    Audio_Player **players = alloc(get_heap_allocator(), player_count*sizeof(Audio_Player*));
+    
+    f64 start = os_get_elapsed_seconds();
+    for (u64 i = 0; i < player_count; i++) {
+        players[i] = audio_player_get_one();
+    }
+    f64 get_seconds = os_get_elapsed_seconds()-start;
+    
+    for (u64 i = 0; i < player_count; i++) {
+        audio_player_set_source(players[i], sources[i%4]);
+        audio_player_set_looping(players[i], true);
+        // Not 0, so no two start together and get dropped for phase cancellation
+        audio_player_set_progression_factor(players[i], (f64)(i%100+1)/101.0);
+    }
+    for (u64 i = 0; i < playing_count; i++) {
+        audio_player_set_state(players[i*(player_count/playing_count)], AUDIO_PLAYER_STATE_PLAYING);
+    }
+    u64 pool_size = audio_player_pool.player_count;
+    
+    // What audio_player_get_one used to do: look from the start for the first free player,
+    // which was the n'th one when allocating the n'th player
+    start = os_get_elapsed_seconds();
+    u64 legacy_checked = 0;
+    for (u64 n = 0; n < player_count; n++) {
+        u64 index = 0;
+        for (Audio_Player_Block *block = &audio_player_block; block; block = block->next) {
+            u64 i = 0;
+            for (; i < AUDIO_PLAYERS_PER_BLOCK; i++, index++) {
+                volatile Audio_Player *p = &block->players[i];
+                legacy_checked += 1;
+                if (index == n || !p->allocated) break;
+            }
+            if (i < AUDIO_PLAYERS_PER_BLOCK) break;
         }
-        
-        seconds += end_seconds - start_seconds;
-        cycles += end_cycles - start_cycles;
     }
+    f64 legacy_get_seconds = os_get_elapsed_seconds()-start;
+    assert(legacy_checked >= player_count, "Legacy scan did not run");
     
-    print("Radix sort took on average %llu cycles and %.2f ms\n", cycles / num_samples, (seconds * 1000.0) / (float64)num_samples);
+    Audio_Null_Device_Config config = ZERO(Audio_Null_Device_Config);
+    config.format = f32_stereo;
+    config.frames_per_buffer = frames;
+    config.number_of_buffers = 1000;
+    Audio_Null_Device_Stats stats;
+    bool ok = audio_null_device_run(config, &stats);
+    assert(ok, "Null device run failed");
+    assert(stats.max_voices_mixed == playing_count, "Expected %llu voices, got %llu", playing_count, stats.max_voices_mixed);
+    u64 active_count = growing_array_get_valid_count(audio_player_pool.active);
+    assert(active_count == playing_count, "Expected only the %llu playing players to stay active, got %llu", playing_count, active_count);
+    
+    // What mixing used to cost before getting to any voice: looking at every player
+    start = os_get_elapsed_seconds();
+    u64 legacy_seen = 0;
+    for (u64 b = 0; b < config.number_of_buffers; b++) {
+        for (Audio_Player_Block *block = &audio_player_block; block; block = block->next) {
+            for (u64 i = 0; i < AUDIO_PLAYERS_PER_BLOCK; i++) {
+                volatile Audio_Player *p = &block->players[i];
+                if (!p->allocated) continue;
+                if (p->voice.state != AUDIO_PLAYER_STATE_PLAYING && p->voice.fade_frames == 0) continue;
+                legacy_seen += 1;
+            }
+        }
+    }
+    f64 legacy_scan_seconds = (os_get_elapsed_seconds()-start)/(f64)config.number_of_buffers;
+    assert(legacy_seen == playing_count*config.number_of_buffers, "Legacy scan found %llu voices", legacy_seen);
+    
+    print("%llu players: get_one %.3f us each (scanning: %.3f us), mixing %llu voices avg %.3f ms (scanning every player added %.3f ms) ",
+        player_count, get_seconds*1000000.0/(f64)player_count, legacy_get_seconds*1000000.0/(f64)player_count,
+        playing_count, stats.average_mix_seconds*1000.0, legacy_scan_seconds*1000.0);
+    
+    // Released players are reused instead of growing the pool
+    for (u64 i = 0; i < player_count; i++) {
+        audio_player_release(players[i]);
+    }
+    audio_commands_sync();
+    for (u64 i = 0; i < player_count; i++) {
+        players[i] = audio_player_get_one();
+    }
+    assert(audio_player_pool.player_count == pool_size, "Pool grew from %llu to %llu players", pool_size, audio_player_pool.player_count);
+    for (u64 i = 0; i < player_count; i++) {
+        audio_player_release(players[i]);
+    }
+    dealloc(get_heap_allocator(), players);
+    
+    for (u64 i = 0; i < 4; i++) {
+        audio_source_destroy(&sources[i]);
+    }
+}
 
-	seconds = 0;
-    cycles = 0;
-	for (int a = 0; a < num_samples; a++) {
-        
-        for (u64 i = 0; i < item_count; i++) {
-            if (i % 2 == 0) items[i].z = get_random_int_in_range(0, pow(2, id_bits) / 2);
-            else items[i].z = i;
+// Mixes one buffer of the global players through the buses, like the audio thread does
+void test_mix_buses(u64 frames, Audio_Format format, float32 *out) {
+    spinlock_acquire_or_wait(&audio_mixer_lock);
+    reset_temporary_storage();
+    audio_mix_voices(frames, format, out);
+    spinlock_release(&audio_mixer_lock);
+}
+
+f64 test_rms(float32 *frames, u64 count, u64 stride) {
+    f64 sum = 0;
+    for (u64 i = 0; i < count; i++) sum += (f64)frames[i*stride]*(f64)frames[i*stride];
+    return sqrt(sum/(f64)max(count, 1));
+}
+
+// RMS of channel 0 after a bus with a low-pass at 1khz, relative to the input
+f64 test_lowpass_gain(Audio_Source *sine, Audio_Format format, u64 frames, float32 *out) {
+    Audio_Player *p = audio_player_get_one();
+    p->config.bus = AUDIO_BUS_MUSIC;
+    audio_player_set_source(p, *sine);
+    audio_player_set_looping(p, true);
+    audio_player_set_state(p, AUDIO_PLAYER_STATE_PLAYING);
+    // Past the fade in
+    for (u64 b = 0; b < 20; b++) test_mix_buses(frames, format, out);
+    f64 rms = test_rms(out, frames, 2);
+    audio_player_release(p);
+    audio_commands_sync();
+    return rms/(0.5/sqrt(2.0));
+}
+
+void test_audio_buses() {
+    Audio_Format f32_stereo = { AUDIO_BITS_32, 2, 48000 };
+    const u64 frames = 480;
+    float32 *out = alloc(get_heap_allocator(), frames*2*sizeof(float32));
+    audio_commands_sync();
+    test_reset_buses();
+    
+    // Routing: bus volumes multiply on the way to the master bus
+    Audio_Source dc[3];
+    Audio_Player *routed[3];
+    Audio_Bus_Id custom = audio_bus_create(AUDIO_BUS_MUSIC);
+    assert(custom != AUDIO_BUS_INVALID, "Could not create a bus");
+    Audio_Bus_Id targets[3] = { AUDIO_BUS_SFX, AUDIO_BUS_MUSIC, custom };
+    for (u64 i = 0; i < 3; i++) {
+        dc[i] = test_make_audio_source(f32_stereo, 48000, 0, 0.1f);
+        routed[i] = audio_player_get_one();
+        routed[i]->config.bus = targets[i];
+        audio_player_set_source(routed[i], dc[i]);
+        audio_player_set_looping(routed[i], true);
+        audio_player_set_state(routed[i], AUDIO_PLAYER_STATE_PLAYING);
+    }
+    audio_bus_get(AUDIO_BUS_MUSIC)->config.volume = 0.5;
+    audio_bus_get(custom)->config.volume = 0.5;
+    for (u64 b = 0; b < 10; b++) test_mix_buses(frames, f32_stereo, out);
+    assert(fabsf(out[0]-0.175f) < 0.0001f, "Expected 0.1 + 0.1*0.5 + 0.1*0.5*0.5, got %f", out[0]);
+    
+    bool ok = audio_bus_set_output(AUDIO_BUS_MUSIC, custom);
+    assert(!ok, "Routing music into a bus that goes to music should fail");
+    ok = audio_bus_set_output(custom, AUDIO_BUS_SFX);
+    assert(ok, "Could not route a bus to the SFX bus");
+    test_mix_buses(frames, f32_stereo, out);
+    assert(fabsf(out[0]-0.2f) < 0.0001f, "Expected 0.1 + 0.1*0.5 + 0.1*0.5, got %f", out[0]);
+    
+    // Players on a destroyed bus play through the master bus
+    audio_bus_destroy(custom);
+    test_mix_buses(frames, f32_stereo, out);
+    assert(fabsf(out[0]-0.25f) < 0.0001f, "Expected 0.1 + 0.1*0.5 + 0.1, got %f", out[0]);
+    for (u64 i = 0; i < 3; i++) {
+        audio_player_release(routed[i]);
+        audio_source_destroy(&dc[i]);
+    }
+    test_reset_buses();
+    
+    // Limiter: 30 voices of 0.1 are held at the threshold instead of clipping
+    const u64 loud_count = 30;
+    Audio_Source loud_dc = test_make_audio_source(f32_stereo, 48000, 0, 0.1f);
+    Audio_Player *loud[30];
+    for (u64 i = 0; i < loud_count; i++) {
+        loud[i] = audio_player_get_one();
+        audio_player_set_source(loud[i], loud_dc);
+        audio_player_set_looping(loud[i], true);
+        // Not 0, so none are dropped for phase cancellation
+        audio_player_set_progression_factor(loud[i], (f64)(i+1)/64.0);
+        audio_player_set_state(loud[i], AUDIO_PLAYER_STATE_PLAYING);
+    }
+    float32 threshold = audio_bus_get(AUDIO_BUS_MASTER)->config.limiter_threshold;
+    float32 peak = 0;
+    for (u64 b = 0; b < 10; b++) {
+        test_mix_buses(frames, f32_stereo, out);
+        for (u64 i = 0; i < frames*2; i++) peak = max(peak, fabsf(out[i]));
+    }
+    assert(peak <= threshold+0.0001f, "Limiter let %f through, threshold is %f", peak, threshold);
+    assert(fabsf(out[0]-threshold) < 0.0001f, "Expected the limiter to hold at %f, got %f", threshold, out[0]);
+    
+    audio_bus_get(AUDIO_BUS_MASTER)->config.enable_limiter = false;
+    test_mix_buses(frames, f32_stereo, out);
+    assert(out[0] == 1.0f, "Expected a hard clip without the limiter, got %f", out[0]);
+    audio_bus_get(AUDIO_BUS_MASTER)->config.enable_limiter = true;
+    
+    // And it lets go once it's quiet again
+    for (u64 i = 1; i < loud_count; i++) audio_player_release(loud[i]);
+    for (u64 b = 0; b < 50; b++) test_mix_buses(frames, f32_stereo, out);
+    assert(fabsf(out[0]-0.1f) < 0.001f, "Limiter did not release, got %f", out[0]);
+    audio_player_release(loud[0]);
+    audio_commands_sync();
+    audio_source_destroy(&loud_dc);
+    
+    // Low-pass at 1khz on the music bus
+    audio_bus_get(AUDIO_BUS_MUSIC)->config.lowpass_cutoff_hz = 1000.0f;
+    Audio_Source low = test_make_audio_source(f32_stereo, 48000, 200.0f, 0.5f);
+    Audio_Source high = test_make_audio_source(f32_stereo, 48000, 10000.0f, 0.5f);
+    f64 low_gain = test_lowpass_gain(&low, f32_stereo, frames, out);
+    f64 high_gain = test_lowpass_gain(&high, f32_stereo, frames, out);
+    assert(low_gain > 0.95 && low_gain < 1.05, "200hz through a 1khz low-pass came out at %f", low_gain);
+    assert(20.0*log10(high_gain) < -35.0, "10khz through a 1khz low-pass came out at %.1f dB", 20.0*log10(high_gain));
+    audio_source_destroy(&low);
+    audio_source_destroy(&high);
+    test_reset_buses();
+    
+    // The 4 frames at a time biquad matches the plain filter, also across odd buffer sizes
+    Audio_Biquad biquad = ZERO(Audio_Biquad);
+    audio_biquad_update_lowpass(&biquad, 2500.0f, 2.0f, 48000);
+    Audio_Planar_Buffer noise = ZERO(Audio_Planar_Buffer);
+    f64 x1 = 0, x2 = 0, y1 = 0, y2 = 0;
+    u64 seed = 1;
+    float32 biquad_error = 0;
+    for (u64 b = 0; b < 64; b++) {
+        u64 count = 1 + (b*37)%200;
+        audio_planar_buffer_reserve(&noise, 1, count);
+        float32 *data = audio_planar_channel(&noise, 0);
+        for (u64 i = 0; i < count; i++) {
+            seed = seed*6364136223846793005ull + 1442695040888963407ull;
+            data[i] = (float32)((f64)(seed >> 40)/(f64)(1ull << 24))*2.0f-1.0f;
+        }
+        float32 input[256];
+        memcpy(input, data, count*sizeof(float32));
+        audio_biquad_process(&biquad, &noise);
+        for (u64 i = 0; i < count; i++) {
+            f64 y = biquad.b0*input[i] + biquad.b1*x1 + biquad.b2*x2 - biquad.a1*y1 - biquad.a2*y2;
+            x2 = x1;
+            x1 = input[i];
+            y2 = y1;
+            y1 = y;
+            biquad_error = max(biquad_error, fabsf(data[i]-(float32)y));
         }
+    }
+    assert(biquad_error < 0.0001f, "Biquad differs from the reference by %f", biquad_error);
+    audio_planar_buffer_destroy(&noise);
     
-        u64 item_size = sizeof(Draw_Quad);
-        u64 sort_value_offset_in_item = offsetof(Draw_Quad, z);
+    // Reverb: an impulse rings on and dies out, and the longest decay doesn't blow up
+    Audio_Reverb reverb = ZERO(Audio_Reverb);
+    Audio_Planar_Buffer block = ZERO(Audio_Planar_Buffer);
+    f64 energy[6] = {0}; // Per half second
+    for (u64 b = 0; b < 300; b++) {
+        audio_planar_buffer_reserve(&block, 2, frames);
+        audio_planar_buffer_clear(&block);
+        if (b == 0) {
+            audio_planar_channel(&block, 0)[0] = 1.0f;
+            audio_planar_channel(&block, 1)[0] = 1.0f;
+        }
+        audio_reverb_process(&reverb, &block, 48000, 1.0f, 0.5f, 0.5f);
+        for (u64 i = 0; i < frames; i++) {
+            f64 s = audio_planar_channel(&block, 0)[i];
+            energy[b/50] += s*s;
+        }
+    }
+    assert(energy[0] > 0.001, "Reverb made no tail");
+    assert(energy[1] < energy[0] && energy[5] < energy[1]*0.01, "Reverb tail doesn't decay: %f %f %f", energy[0], energy[1], energy[5]);
     
-        float64 start_seconds = os_get_elapsed_seconds();
-        u64 start_cycles = rdtsc();
-        merge_sort(items, buffer, item_count, item_size, compare_draw_quads);
-        u64 end_cycles = rdtsc();
-        float64 end_seconds = os_get_elapsed_seconds();
+    f64 longest = 0;
+    for (u64 b = 0; b < 1000; b++) {
+        audio_planar_buffer_reserve(&block, 2, frames);
+        for (u64 i = 0; i < frames; i++) {
+            seed = seed*6364136223846793005ull + 1442695040888963407ull;
+            float32 s = b < 500 ? (float32)((f64)(seed >> 40)/(f64)(1ull << 24))-0.5f : 0.0f;
+            audio_planar_channel(&block, 0)[i] = s;
+            audio_planar_channel(&block, 1)[i] = s;
+        }
+        audio_reverb_process(&reverb, &block, 48000, 1.0f, 1.0f, 0.0f);
+        for (u64 i = 0; i < frames; i++) {
+            float32 s = audio_planar_channel(&block, 0)[i];
+            assert(s == s && fabsf(s) < 100.0f, "Reverb blew up at buffer %llu", b);
+            if (b == 999) longest = max(longest, fabsf(s));
+        }
+    }
+    assert(longest < 0.5, "Longest reverb tail is still at %f 5 seconds later", longest);
+    if (reverb.lines) dealloc(get_heap_allocator(), reverb.lines);
+    audio_planar_buffer_destroy(&block);
     
-        for (u64 i = 1; i < item_count; i++) {
-            assert(items[i].z >= items[i-1].z, "Failed: not correctly sorted");
+    // Cost: 48 voices over three buses, with and without effects on every bus
+    const u64 voices_per_bus = 16;
+    Audio_Source tones[3];
+    Audio_Player *players[48];
+    for (u64 bus = 0; bus < 3; bus++) {
+        tones[bus] = test_make_audio_source(f32_stereo, 48000, 220.0f*(bus+1), 0.02f);
+        for (u64 i = 0; i < voices_per_bus; i++) {
+            Audio_Player *p = audio_player_get_one();
+            p->config.bus = (Audio_Bus_Id)bus;
+            audio_player_set_source(p, tones[bus]);
+            audio_player_set_looping(p, true);
+            audio_player_set_progression_factor(p, (f64)(i+1)/(f64)(voices_per_bus+1));
+            audio_player_set_state(p, AUDIO_PLAYER_STATE_PLAYING);
+            players[bus*voices_per_bus+i] = p;
         }
-        
-        seconds += end_seconds - start_seconds;
-        cycles += end_cycles - start_cycles;
     }
     
-    print("Merge sort took on average %llu cycles and %.2f ms\n", cycles / num_samples, (seconds * 1000.0) / (float64)num_samples);
+    Audio_Null_Device_Config config = ZERO(Audio_Null_Device_Config);
+    config.format = f32_stereo;
+    config.frames_per_buffer = frames;
+    config.number_of_buffers = 1000;
+    Audio_Null_Device_Stats dry_stats;
+    ok = audio_null_device_run(config, &dry_stats);
+    assert(ok, "Null device run failed");
+    assert(dry_stats.max_voices_mixed == voices_per_bus*3, "Expected %llu voices, got %llu", voices_per_bus*3, dry_stats.max_voices_mixed);
+    
+    for (u64 bus = 0; bus < 3; bus++) {
+        Audio_Bus_Config *c = &audio_bus_get((Audio_Bus_Id)bus)->config;
+        c->lowpass_cutoff_hz = 4000.0f;
+        c->reverb_mix = 0.3f;
+        c->enable_limiter = true;
+    }
+    Audio_Null_Device_Stats wet_stats;
+    ok = audio_null_device_run(config, &wet_stats);
+    assert(ok, "Null device run failed");
+    
+    f64 per_bus_seconds = (wet_stats.average_mix_seconds-dry_stats.average_mix_seconds)/3.0;
+    print("%llu voices on 3 buses, avg mix per %.0fms: %.3f ms without effects, %.3f ms with low-pass, reverb and limiter on every bus (%.1f us per bus) ",
+        voices_per_bus*3, dry_stats.buffer_seconds*1000.0, dry_stats.average_mix_seconds*1000.0, wet_stats.average_mix_seconds*1000.0, per_bus_seconds*1000000.0);
+    assert(per_bus_seconds < dry_stats.buffer_seconds*0.05, "Bus effects take %.3f ms per bus", per_bus_seconds*1000.0);
+    
+    for (u64 i = 0; i < voices_per_bus*3; i++) audio_player_release(players[i]);
+    audio_commands_sync();
+    for (u64 bus = 0; bus < 3; bus++) audio_source_destroy(&tones[bus]);
+    test_reset_buses();
+    dealloc(get_heap_allocator(), out);
 }
-#endif /* OOGABOOGA_HEADLESS */
 
 typedef struct Test_Thing {
     int foo;
@@ -1740,6 +4499,10 @@ void oogabooga_run_tests() {
 	test_random_distribution();
 	print("OK!\n");
 	
+	print("Testing counter based random... ");
+	test_random_counter_based();
+	print("OK!\n");
+	
 	print("Testing mutex... ");
 	test_mutex();
 	print("OK!\n");
@@ -1747,11 +4510,109 @@ void oogabooga_run_tests() {
 	print("Testing binary semaphore... ");
 	test_os_binary_semaphore();
 	print("OK!\n");
+	
+	print("Testing worker pool... ");
+	test_worker_pool();
+	print("OK!\n");
+	
+	print("Testing thread scratch... ");
+	test_thread_scratch();
+	print("OK!\n");
+	
+	print("Testing audio mixer... ");
+	test_audio_mixer();
+	print("OK!\n");
+	
+	print("Testing audio resampler... ");
+	test_audio_resampler();
+	print("OK!\n");
+	
+	print("Testing null audio device... ");
+	test_audio_null_device();
+	print("OK!\n");
+	
+	print("Testing audio commands... ");
+	test_audio_commands();
+	print("OK!\n");
+	
+	print("Testing audio player pool... ");
+	test_audio_player_pool();
+	print("OK!\n");
+	
+	print("Testing audio buses... ");
+	test_audio_buses();
+	print("OK!\n");
+	
+	print("Testing prepared audio sources... ");
+	test_audio_prepare();
+	print("OK!\n");
+	
+	print("Testing audio streams... ");
+	test_audio_stream();
+	print("OK!\n");
+	
+	print("Testing OGG stream modes... ");
+	test_ogg_stream_modes();
+	print("OK!\n");
+	
+	print("Testing sound bank... ");
+	test_audio_sound_bank();
+	print("OK!\n");
 
 #ifndef OOGABOOGA_HEADLESS
 	print("Testing radix sort... ");
 	test_sort();
 	print("OK!\n");
+	
+	print("Testing vertex pipeline... ");
+	test_vertex_pipeline();
+	print("OK!\n");
+	
+	print("Testing image atlas... ");
+	test_image_atlas();
+	print("OK!\n");
+	
+	print("Testing async image load... ");
+	test_async_image_load();
+	print("OK!\n");
+	
+	print("Testing font glyph cache... ");
+	test_font_glyph_cache();
+	print("OK!\n");
+	
+	print("Testing font glyph upload... ");
+	test_font_glyph_upload();
+	print("OK!\n");
+	
+	print("Testing font parallel rasterization... ");
+	test_font_parallel_rasterization();
+	print("OK!\n");
+	
+	print("Testing text layout cache... ");
+	test_text_layout_cache();
+	print("OK!\n");
+	
+	print("Testing font kerning... ");
+	test_font_kerning();
+	print("OK!\n");
+	
+	print("Testing SDF fonts... ");
+	test_font_sdf();
+	print("OK!\n");
+	
+	print("Testing text wrapping... ");
+	test_text_wrap();
+	print("OK!\n");
+	
+#if OOGABOOGA_ENABLE_EXTENSIONS && OOGABOOGA_EXTENSION_PARTICLES
+	print("Testing particle simulation... ");
+	test_particles_simulation();
+	print("OK!\n");
+	
+	print("Testing particle threading... ");
+	test_particles_threading();
+	print("OK!\n");
+#endif
 #endif
 
 	
@@ -22,51 +22,118 @@
 
 #define EOF -1
 
-int fgetc(File f) {
-    u8 ch;
-    u64 bytes_read;
-    if (os_file_read(f, &ch, 1, &bytes_read) && bytes_read == 1) {
-        return (int)ch;
-    } else {
+// #Modified Buffered reader, so the File port works like a FILE* does. Reading straight from
+// the File was one os_file_read per byte, which is what made streaming from files unusable.
+// stb_vorbis only ever reads forward through pages and seeks to page boundaries, so one
+// buffer is enough and memory use is bounded by its size no matter how long the file is.
+#ifndef STB_VORBIS_FILE_BUFFER_SIZE
+#define STB_VORBIS_FILE_BUFFER_SIZE (32*1024)
+#endif
+
+typedef struct Stb_Vorbis_File_Reader {
+    File file;
+    s64 file_size;
+    s64 file_pos;     // Where the os file pointer is
+    s64 buffer_pos;   // File position of buffer[0]
+    s64 buffer_count; // Valid bytes in buffer
+    s64 cursor;       // Read position in buffer
+    u8 buffer[STB_VORBIS_FILE_BUFFER_SIZE];
+} Stb_Vorbis_File_Reader;
+
+void stb_vorbis_reader_init(Stb_Vorbis_File_Reader *r, File f) {
+    r->file = f;
+    r->file_size = os_file_get_size(f);
+    r->file_pos = os_file_get_pos(f);
+    r->buffer_pos = r->file_pos;
+    r->buffer_count = 0;
+    r->cursor = 0;
+}
+
+// Reads directly from the file at the reader position, without going through the buffer
+u64 stb_vorbis_reader_read_at(Stb_Vorbis_File_Reader *r, s64 pos, void *dst, u64 size) {
+    if (pos != r->file_pos) {
+        if (!os_file_set_pos(r->file, pos)) return 0;
+        r->file_pos = pos;
+    }
+    u64 bytes_read = 0;
+    if (!os_file_read(r->file, dst, size, &bytes_read)) bytes_read = 0;
+    r->file_pos += bytes_read;
+    return bytes_read;
+}
+
+bool stb_vorbis_reader_refill(Stb_Vorbis_File_Reader *r) {
+    r->buffer_pos += r->cursor;
+    r->cursor = 0;
+    r->buffer_count = stb_vorbis_reader_read_at(r, r->buffer_pos, r->buffer, STB_VORBIS_FILE_BUFFER_SIZE);
+    return r->buffer_count > 0;
+}
+
+int fgetc(Stb_Vorbis_File_Reader *r) {
+    if (r->cursor >= r->buffer_count && !stb_vorbis_reader_refill(r)) {
         return EOF;
     }
+    return (int)r->buffer[r->cursor++];
 }
 
-size_t fread(void *buffer, size_t size, size_t count, File f) {
+size_t fread(void *buffer, size_t size, size_t count, Stb_Vorbis_File_Reader *r) {
     u64 bytes_to_read = size * count;
-    u64 actual_read_bytes;
-    if (os_file_read(f, buffer, bytes_to_read, &actual_read_bytes)) {
-        return actual_read_bytes / size;
-    } else {
-        return 0;
+    u64 bytes_read = 0;
+    u8 *dst = (u8*)buffer;
+    
+    while (bytes_read < bytes_to_read) {
+        if (r->cursor >= r->buffer_count) {
+            u64 left = bytes_to_read - bytes_read;
+            if (left >= STB_VORBIS_FILE_BUFFER_SIZE) {
+                // Big reads skip the buffer
+                s64 pos = r->buffer_pos + r->cursor;
+                u64 n = stb_vorbis_reader_read_at(r, pos, dst + bytes_read, left);
+                bytes_read += n;
+                r->buffer_pos = pos + n;
+                r->buffer_count = 0;
+                r->cursor = 0;
+                break;
+            }
+            if (!stb_vorbis_reader_refill(r)) break;
+        }
+        u64 n = min(bytes_to_read - bytes_read, (u64)(r->buffer_count - r->cursor));
+        memcpy(dst + bytes_read, r->buffer + r->cursor, n);
+        r->cursor += n;
+        bytes_read += n;
     }
+    
+    return size ? bytes_read / size : 0;
 }
 
-long ftell(File f) {
-    s64 pos = os_file_get_pos(f);
-    if (pos >= 0) {
-        return (long)pos;
-    } else {
-        return -1;
-    }
+long ftell(Stb_Vorbis_File_Reader *r) {
+    return (long)(r->buffer_pos + r->cursor);
 }
 
-int fseek(File f, s64 offset, s64 origin) {
+int fseek(Stb_Vorbis_File_Reader *r, s64 offset, s64 origin) {
     s64 new_pos;
     switch (origin) {
         case SEEK_SET:
             new_pos = offset;
             break;
         case SEEK_CUR:
-            new_pos = os_file_get_pos(f) + offset;
+            new_pos = r->buffer_pos + r->cursor + offset;
             break;
         case SEEK_END:
-            new_pos = os_file_get_size(f) + offset;
+            new_pos = r->file_size + offset;
             break;
         default:
             return -1;
     }
-    return os_file_set_pos(f, new_pos) ? 0 : -1;
+    if (new_pos < 0) return -1;
+    
+    if (new_pos >= r->buffer_pos && new_pos <= r->buffer_pos + r->buffer_count) {
+        r->cursor = new_pos - r->buffer_pos;
+    } else {
+        // Next read refills from here
+        r->buffer_pos = new_pos;
+        r->buffer_count = 0;
+        r->cursor = 0;
+    }
+    return 0;
 }
 
 File fopen(const char *filename, const char *mode) {
@@ -919,7 +986,7 @@ struct stb_vorbis
 
   // input config
 #ifndef STB_VORBIS_NO_STDIO
-   File f;
+   Stb_Vorbis_File_Reader *f; // #Modified File -> Stb_Vorbis_File_Reader
    uint32 f_start;
    int close_on_free;
 #endif
@@ -4387,7 +4454,12 @@ static void vorbis_deinit(stb_vorbis *p)
       setup_free(p, p->bit_reverse[i]);
    }
    #ifndef STB_VORBIS_NO_STDIO
-   if (p->close_on_free) fclose(p->f);
+   // #Modified free the reader
+   if (p->f) {
+      if (p->close_on_free) fclose(p->f->file);
+      setup_free(p, p->f);
+      p->f = NULL;
+   }
    #endif
 }
 
@@ -5176,8 +5248,15 @@ stb_vorbis * stb_vorbis_open_file_section(File file, int close_on_free, int *err
 {
    stb_vorbis *f, p;
    vorbis_init(&p, alloc);
-   p.f = file;
-   p.f_start = (uint32) ftell(file);
+   // #Modified read through a Stb_Vorbis_File_Reader
+   p.f = (Stb_Vorbis_File_Reader *) setup_malloc(&p, sizeof(Stb_Vorbis_File_Reader));
+   if (!p.f) {
+      if (close_on_free) fclose(file);
+      if (error) *error = VORBIS_outofmem;
+      return NULL;
+   }
+   stb_vorbis_reader_init(p.f, file);
+   p.f_start = (uint32) ftell(p.f);
    p.stream_len   = length;
    p.close_on_free = close_on_free;
    if (start_decoder(&p)) {
@@ -5196,10 +5275,9 @@ stb_vorbis * stb_vorbis_open_file_section(File file, int close_on_free, int *err
 stb_vorbis * stb_vorbis_open_file(File file, int close_on_free, int *error, const stb_vorbis_alloc *alloc)
 {
    unsigned int len, start;
-   start = (unsigned int) ftell(file);
-   fseek(file, 0, SEEK_END);
-   len = (unsigned int) (ftell(file) - start);
-   fseek(file, start, SEEK_SET);
+   // #Modified no fseek/ftell on a File
+   start = (unsigned int) os_file_get_pos(file);
+   len = (unsigned int) (os_file_get_size(file) - start);
    return stb_vorbis_open_file_section(file, close_on_free, error, alloc, len);
 }
 
@@ -109,6 +109,125 @@ void merge_sort(void *collection, void *help_buffer, u64 item_count, u64 item_si
     }
 }
 
+///
+// Skyline rect packer
+// Packs rects into a width*height area, picking the lowest position that fits (bottom-left).
+// Rects can't be removed individually, but you can rect_packer_reset to start over.
+typedef struct Rect_Packer_Node {
+	u32 x, y, width;
+} Rect_Packer_Node;
+
+typedef struct Rect_Packer {
+	u32 width, height;
+	Rect_Packer_Node *nodes;
+	u32 node_count;
+	u32 node_capacity;
+	u64 used_area;
+	Allocator allocator;
+} Rect_Packer;
+
+void rect_packer_reset(Rect_Packer *p) {
+	p->node_count = 1;
+	p->nodes[0].x = 0;
+	p->nodes[0].y = 0;
+	p->nodes[0].width = p->width;
+	p->used_area = 0;
+}
+void rect_packer_init(Rect_Packer *p, u32 width, u32 height, Allocator allocator) {
+	memset(p, 0, sizeof(Rect_Packer));
+	p->width = width;
+	p->height = height;
+	p->allocator = allocator;
+	// The skyline can never have more segments than there are columns
+	p->node_capacity = width+1;
+	p->nodes = (Rect_Packer_Node*)alloc(allocator, p->node_capacity*sizeof(Rect_Packer_Node));
+	rect_packer_reset(p);
+}
+void rect_packer_deinit(Rect_Packer *p) {
+	dealloc(p->allocator, p->nodes);
+	memset(p, 0, sizeof(Rect_Packer));
+}
+
+// Returns the y a w*h rect would land at if placed at node index, or -1 if it doesn't fit there
+s64 rect_packer_fit(Rect_Packer *p, u32 index, u32 w, u32 h) {
+	Rect_Packer_Node *node = &p->nodes[index];
+	if (node->x + w > p->width) return -1;
+	
+	s64 y = 0;
+	s64 width_left = w;
+	for (u32 i = index; width_left > 0; i++) {
+		if (i >= p->node_count) return -1;
+		y = max(y, (s64)p->nodes[i].y);
+		if (y + h > p->height) return -1;
+		width_left -= p->nodes[i].width;
+	}
+	return y;
+}
+
+// Returns false if there's no room left
+bool rect_packer_pack(Rect_Packer *p, u32 w, u32 h, u32 *x_out, u32 *y_out) {
+	if (w == 0 || h == 0 || w > p->width || h > p->height) return false;
+	
+	s64 best_index = -1;
+	s64 best_y = 0;
+	u32 best_width = 0;
+	for (u32 i = 0; i < p->node_count; i++) {
+		s64 y = rect_packer_fit(p, i, w, h);
+		if (y < 0) continue;
+		if (best_index < 0 || y < best_y || (y == best_y && p->nodes[i].width < best_width)) {
+			best_index = i;
+			best_y = y;
+			best_width = p->nodes[i].width;
+		}
+	}
+	if (best_index < 0) return false;
+	
+	u32 x = p->nodes[best_index].x;
+	
+	// Insert the new top segment
+	assert(p->node_count < p->node_capacity, "Rect packer skyline overflow");
+	memmove(&p->nodes[best_index+1], &p->nodes[best_index], (p->node_count-best_index)*sizeof(Rect_Packer_Node));
+	p->nodes[best_index].x = x;
+	p->nodes[best_index].y = (u32)best_y + h;
+	p->nodes[best_index].width = w;
+	p->node_count += 1;
+	
+	// Cut away what's now covered by the new segment
+	for (u32 i = best_index+1; i < p->node_count; ) {
+		Rect_Packer_Node *prev = &p->nodes[i-1];
+		Rect_Packer_Node *node = &p->nodes[i];
+		u32 prev_end = prev->x + prev->width;
+		if (node->x >= prev_end) break;
+		
+		u32 shrink = prev_end - node->x;
+		if (shrink >= node->width) {
+			memmove(&p->nodes[i], &p->nodes[i+1], (p->node_count-i-1)*sizeof(Rect_Packer_Node));
+			p->node_count -= 1;
+		} else {
+			node->x += shrink;
+			node->width -= shrink;
+			break;
+		}
+	}
+	
+	// Merge neighbours at the same height
+	for (u32 i = 0; i+1 < p->node_count; ) {
+		if (p->nodes[i].y == p->nodes[i+1].y) {
+			p->nodes[i].width += p->nodes[i+1].width;
+			memmove(&p->nodes[i+1], &p->nodes[i+2], (p->node_count-i-2)*sizeof(Rect_Packer_Node));
+			p->node_count -= 1;
+		} else {
+			i += 1;
+		}
+	}
+	
+	p->used_area += (u64)w*(u64)h;
+	
+	*x_out = x;
+	*y_out = (u32)best_y;
+	return true;
+}
+
 inline bool bytes_match(void *a, void *b, u64 count) { return memcmp(a, b, count) == 0; }
 
 #define swap(a, b, type) { type t = a; a = b; b = t;  }
@@ -145,4 +264,28 @@ s64 smerpi(s64 from, s64 to, f64 t) {
 // https://www.desmos.com/calculator/r2etlhi2ej
 float32 sine_oscillate_n_waves_normalized(float32 v, float32 n) {
 	return (sin((n*2*PI32*((v)-(1/(n*4))))+1))/2;
-}
\ No newline at end of file
+}
+
+// Copies a 4 channel src image into dst at (dst_x, dst_y), with the edge pixels repeated
+// pad_x0/pad_y0 times on the left/top and pad_x1/pad_y1 times on the right/bottom.
+// dst needs room for (pad_x0+src_width+pad_x1) x (pad_y0+src_height+pad_y1) pixels at (dst_x, dst_y).
+void blit_rgba8_extruded_sides(u32 *dst, u32 dst_width, u32 dst_x, u32 dst_y, u32 *src, u32 src_width, u32 src_height, u32 pad_x0, u32 pad_y0, u32 pad_x1, u32 pad_y1) {
+	u32 padded_width  = src_width  + pad_x0 + pad_x1;
+	u32 padded_height = src_height + pad_y0 + pad_y1;
+	for (u32 py = 0; py < padded_height; py++) {
+		u32 sy = (u32)clamp((s64)py-(s64)pad_y0, 0, (s64)src_height-1);
+		u32 *dst_row = dst + (u64)(dst_y+py)*dst_width + dst_x;
+		u32 *src_row = src + (u64)sy*src_width;
+		for (u32 px = 0; px < padded_width; px++) {
+			u32 sx = (u32)clamp((s64)px-(s64)pad_x0, 0, (s64)src_width-1);
+			dst_row[px] = src_row[sx];
+		}
+	}
+}
+
+// Copies a 4 channel src image into dst at (dst_x, dst_y), with the edge pixels repeated padding
+// times on each side. Used for atlases so linear filtering doesn't bleed in neighbouring images.
+// dst needs room for (src_width+padding*2) x (src_height+padding*2) pixels at (dst_x, dst_y).
+void blit_rgba8_extruded(u32 *dst, u32 dst_width, u32 dst_x, u32 dst_y, u32 *src, u32 src_width, u32 src_height, u32 padding) {
+	blit_rgba8_extruded_sides(dst, dst_width, dst_x, dst_y, src, src_width, src_height, padding, padding, padding, padding);
+}